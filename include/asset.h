@@ -41,7 +41,9 @@
  * (so that the user code will be ready for adding compression at any time).
  * 
  * If you know that the file will never be compressed and you absolutely need
- * to freely seek, simply use the standard fopen() function.
+ * to freely seek, simply use the standard fopen() function. Alternatively,
+ * mkasset can compress a file in independent chunks (`--chunk-size`): these
+ * files can be seeked when opened with #asset_fopen.
  * 
  * ## Asset compression
  * 
@@ -142,6 +144,12 @@ void *asset_load(const char *fn, int *sz);
  * required. If you need random access to an uncompressed file, simply use
  * the standard fopen() function.
  * 
+ * The only exception are files compressed by mkasset in independent
+ * chunks (using `--chunk-size`): they can be freely seeked, as only the
+ * chunk containing the new position needs to be decompressed (up to the
+ * requested position). Smaller chunks make seeking faster at the expense
+ * of compression ratio.
+ * 
  * @param fn        Filename to load (including filesystem prefix, eg: "rom:/foo.dat")
  * @param sz        If not NULL, this will be filed with the uncompressed size of the loaded file
  * @return FILE*    FILE pointer to use with standard C functions (fread, fclose)
@@ -85,6 +85,21 @@ typedef struct {
 	uint32_t out;              ///< Current output value
 } AYNoise;
 
+/**
+ * @brief A run of identical output samples of AY-3-8910
+ * 
+ * The emulator first converts the internal state changes of the chip into
+ * runs of identical samples, and then expands them into the output buffer.
+ * The expansion is the most expensive part, so it can be offloaded to the
+ * RSP (see #ay8910_gen_rsp).
+ */
+typedef struct {
+	int16_t l, r;              ///< Output sample (left / right)
+	uint16_t fnl, fnr;         ///< Amplitude of the fast-noise modulation (left / right)
+	uint16_t count;            ///< Number of output samples
+	uint16_t __padding;        ///< Padding
+} AYRun;
+
 /**
  * @brief A AY-3-8910 emulator
  * 
@@ -105,6 +120,7 @@ typedef struct {
 	AYChannel ch[3];                          ///< Configuration and state of the channels
 	AYNoise ns;                               ///< Configuration and state of the noise
 	AYEnvelope env;                           ///< Configuration and state of the envelope
+	uint16_t fastnoise_state;                 ///< State of the fast-noise generator (never zero)
 } AY8910;
 
 /** @brief Reset the AY8910 emulator. */
@@ -132,6 +148,30 @@ bool ay8910_is_mute(AY8910 *ay);
  */
 int ay8910_gen(AY8910 *ay, int16_t *out, int nsamples);
 
+/**
+ * @brief Generate audio for the specified number of samples, using the RSP.
+ * 
+ * This is like #ay8910_gen, but only the state changes of the chip are
+ * computed by the CPU, as a list of runs of identical samples (#AYRun). The
+ * runs are then expanded into the output buffer by the RSP, via a command
+ * of the mixer ucode, so the function requires the mixer to be initialized.
+ * The output is bit-exact with #ay8910_gen.
+ * 
+ * The RSP command is enqueued in the current rspq queue, so the output
+ * buffer is ready only once the RSP has processed it. The caller must
+ * also keep the runs buffer alive until then.
+ * 
+ * This function is only available in stereo mode (#AY8910_OUTPUT_STEREO).
+ * 
+ * @param ay            AY8910 emulator
+ * @param runs          Buffer for the runs. It must have room for at least
+ *                      nsamples runs, and be 8-byte aligned.
+ * @param out           Output buffer (4-byte aligned)
+ * @param nsamples      Number of samples to generate (after decimation)
+ * @return              Number of runs used in the buffer
+ */
+int ay8910_gen_rsp(AY8910 *ay, AYRun *runs, int16_t *out, int nsamples);
+
 #ifdef __cplusplus
 }
 #endif
@@ -41,6 +41,67 @@ _Static_assert(sizeof(struct directory_entry) == SECTOR_SIZE, "invalid directory
 /** @brief Type definition */
 typedef struct directory_entry directory_entry_t;
 
+/** @brief Magic value at the start of the path index ("DFSI") */
+#define DFS_INDEX_MAGIC     0x44465349
+/** @brief Size of the buffer used to verify paths looked up in the index (longer paths walk the tree) */
+#define DFS_INDEX_MAX_PATH  256
+
+/**
+ * @brief Header of the path index
+ *
+ * The path index is an optional blob emitted by mkdfs. When present, its
+ * offset is stored in the #directory_entry::file_pointer field of the root
+ * sector (which is always zero in images without index, so that old images
+ * keep working and old runtimes simply ignore the index).
+ *
+ * The header is followed by `num_buckets+1` 32-bit entries, where
+ * bucket `i` spans the entries `[buckets[i], buckets[i+1])`. The buckets
+ * are followed by `num_entries` #dfs_index_entry_t, sorted by hash, and
+ * then by the (NUL-terminated) paths of the indexed files.
+ */
+typedef struct dfs_index_header_s
+{
+    /** @brief Magic value (#DFS_INDEX_MAGIC) */
+    uint32_t magic;
+    /** @brief Number of hash buckets (always a power of two) */
+    uint32_t num_buckets;
+    /** @brief Number of indexed files */
+    uint32_t num_entries;
+    /** @brief Reserved for future use (must be zero) */
+    uint32_t reserved;
+} dfs_index_header_t;
+
+/** @brief Entry of the path index */
+typedef struct dfs_index_entry_s
+{
+    /** @brief Hash of the absolute path of the file (see #dfs_path_hash) */
+    uint32_t hash;
+    /** @brief Offset of the #directory_entry of the file */
+    uint32_t dirent;
+    /** @brief Offset of the path of the file, from the start of the index */
+    uint32_t path;
+} dfs_index_entry_t;
+
+/**
+ * @brief Hash function used by the path index (32-bit FNV-1a)
+ *
+ * The hashed string is the absolute path of the file without the leading
+ * slash, using '/' as separator (eg: "levels/level1.dat").
+ *
+ * @param[in] path   Path to hash
+ * @param[in] len    Length of the path in bytes
+ * @return The path hash
+ */
+static inline uint32_t dfs_path_hash(const char *path, int len)
+{
+    uint32_t hash = 0x811C9DC5;
+    for (int i = 0; i < len; i++) {
+        hash ^= (uint8_t)path[i];
+        hash *= 0x01000193;
+    }
+    return hash;
+}
+
 /** @brief Open file handle structure */
 typedef struct dfs_open_file_s
 {
@@ -40,6 +40,33 @@ extern "C" {
 #define PI_WR_LEN       ((volatile uint32_t*)0xA460000C)  ///< PI DMA: write length register
 #define PI_STATUS       ((volatile uint32_t*)0xA4600010)  ///< PI: status register
 
+/**
+ * @brief Callback invoked when a queued DMA transfer is finished
+ * 
+ * @note The callback is invoked under interrupt, so it must be short
+ *       and must not perform blocking operations.
+ * 
+ * @param ctx           Opaque context pointer specified at enqueue time
+ */
+typedef void (*dma_callback_t)(void *ctx);
+
+/**
+ * @brief A queued PI DMA transfer
+ * 
+ * This structure is allocated by the caller and filled by #dma_read_enqueue.
+ * It must stay valid (and must not be modified) until the transfer is finished.
+ * Use #dma_request_done to poll for completion.
+ */
+typedef struct dma_request_s {
+    void *ram_address;                  ///< RDRAM destination buffer
+    uint32_t pi_address;                ///< PI source address
+    uint32_t len;                       ///< Length of the transfer in bytes
+    dma_callback_t cb;                  ///< Completion callback (or NULL)
+    void *ctx;                          ///< Context for the completion callback
+    volatile bool done;                 ///< True when the transfer is finished
+    struct dma_request_s *next;         ///< Next request in the queue
+} dma_request_t;
+
 /**
  * @brief Start writing data to a peripheral through PI DMA (low-level)
  *
@@ -158,6 +185,55 @@ void dma_read(void * ram_address, unsigned long pi_address, unsigned long len);
  */
 void dma_wait(void);
 
+/**
+ * @brief Enqueue a PI DMA read, serviced in background via the PI interrupt
+ * 
+ * Differently from #dma_read_async, which starts the transfer immediately
+ * (waiting for any pending transfer to finish first), this function adds
+ * the transfer to a FIFO queue and returns immediately. Transfers in the
+ * queue are chained one after the other by the PI interrupt handler, so
+ * the CPU is free to do other work while data is being loaded.
+ * 
+ * Once the transfer is finished, the request is marked as done (see
+ * #dma_request_done) and the optional callback is invoked under interrupt.
+ * 
+ * The same alignment constraints of #dma_read_async apply: the RAM and PI
+ * addresses must have the same 1-bit misalignment. The RAM buffer must have
+ * been already invalidated from the data cache, and must not be accessed
+ * by the CPU until the transfer is done.
+ * 
+ * It is safe to mix queued transfers with the blocking ones (#dma_read):
+ * a blocking transfer will simply wait for the current queued transfer to
+ * finish before starting.
+ * 
+ * @param[out] req          Request structure (allocated by the caller)
+ * @param[out] ram_address  Pointer to a buffer in RDRAM to place read data
+ * @param[in]  pi_address   Memory address of the peripheral to read from
+ * @param[in]  len          Length in bytes to read
+ * @param[in]  cb           Callback to invoke when the transfer is finished (or NULL)
+ * @param[in]  ctx          Opaque context pointer passed to the callback
+ */
+void dma_read_enqueue(dma_request_t *req, void *ram_address, unsigned long pi_address,
+    unsigned long len, dma_callback_t cb, void *ctx);
+
+/**
+ * @brief Check whether a queued DMA transfer is finished
+ * 
+ * @param req       Request as passed to #dma_read_enqueue
+ * @return true if the transfer is finished, false otherwise
+ */
+inline bool dma_request_done(dma_request_t *req)
+{
+    return req->done;
+}
+
+/**
+ * @brief Wait until a queued DMA transfer is finished
+ * 
+ * @param req       Request as passed to #dma_read_enqueue
+ */
+void dma_request_wait(dma_request_t *req);
+
 
 /**
  * @brief Read a 32 bit integer from a peripheral using the CPU.
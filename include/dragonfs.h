@@ -6,6 +6,8 @@
 #ifndef __LIBDRAGON_DRAGONFS_H
 #define __LIBDRAGON_DRAGONFS_H
 
+#include "dma.h"
+
 /**
  * @defgroup dfs DragonFS
  * @ingroup asset
@@ -39,6 +41,14 @@
  * Files can be opened using both sets of API calls simultaneously as long as no more than
  * four files are open at any one time.
  * 
+ * By default, mkdfs also stores a hashed index of all the file paths in the
+ * image. When the index is present, opening a file via an absolute path
+ * (as done by the standard C API with the 'rom:/' prefix) requires a fixed,
+ * small number of PI DMA transfers irrespective of the number of files in the
+ * filesystem, instead of one DMA per directory entry walked. Images without
+ * the index (eg: built by older versions of mkdfs, or with `--no-index`) are
+ * still supported and fall back to walking the directory tree.
+ * 
  * DragonFS does not support file compression; if you want to compress your assets,
  * use the asset API (#asset_load / #asset_fopen).
  * 
@@ -217,6 +227,44 @@ int dfs_open(const char * const path);
  */
 int dfs_read(void * const buf, int size, int count, uint32_t handle);
 
+/**
+ * @brief Read data from a file asynchronously
+ * 
+ * This function schedules a read from the file into the PI DMA queue
+ * (see #dma_read_enqueue) and returns immediately, so that the CPU can
+ * keep running while the data is being loaded. The file position is advanced
+ * immediately, so that multiple reads can be scheduled back to back.
+ * 
+ * Completion can be either polled with #dma_request_done / #dma_request_wait
+ * on the request structure, or notified through the callback, which is
+ * invoked under interrupt.
+ * 
+ * Differently from #dfs_read, no intermediate buffer is used, so the buffer
+ * must have the same 2-byte phase of the current file position (that is,
+ * both must be either even or odd). The buffer must not be accessed by the
+ * CPU until the read is finished.
+ * 
+ * @param[out] buf
+ *             Buffer to read into
+ * @param[in]  size
+ *             Size of each element to read
+ * @param[in]  count
+ *             Number of elements to read
+ * @param[in]  handle
+ *             A valid file handle as returned from #dfs_open.
+ * @param[out] req
+ *             Request structure to track the read (allocated by the caller,
+ *             must stay valid until the read is finished)
+ * @param[in]  cb
+ *             Callback to invoke when the read is finished (or NULL)
+ * @param[in]  ctx
+ *             Opaque context pointer passed to the callback
+ *
+ * @return The number of bytes that will be read or a negative value on failure.
+ */
+int dfs_read_async(void * const buf, int size, int count, uint32_t handle,
+    dma_request_t *req, dma_callback_t cb, void *ctx);
+
 /**
  * @brief Seek to an offset in the file
  *
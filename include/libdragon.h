@@ -30,6 +30,7 @@
 #include "audio.h"
 #include "console.h"
 #include "debug.h"
+#include "timeline.h"
 #include "joybus.h"
 #include "controller.h"
 #include "rtc.h"
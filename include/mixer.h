@@ -235,6 +235,50 @@ float mixer_ch_get_pos(int ch);
 /** @brief Stop playing samples on the specified channel. */
 void mixer_ch_stop(int ch);
 
+/**
+ * @brief Set a low-pass filter on the specified channel.
+ *
+ * The filter is a one-pole low-pass filter, applied by the RSP to the
+ * samples of the channel before they are mixed. It is useful for instance
+ * to muffle sounds that are far away or behind a wall.
+ *
+ * If the channel is playing a stereo waveform, the filter is applied to
+ * both channels. The filter setting is retained across #mixer_ch_play.
+ *
+ * @param[in]   ch              Channel index
+ * @param[in]   cutoff          Cutoff frequency (in Hz), or 0 to disable the filter
+ */
+void mixer_ch_set_filter(int ch, float cutoff);
+
+/**
+ * @brief Set how much of the specified channel is sent to the reverb.
+ *
+ * The reverb must be configured with #mixer_set_reverb, otherwise the send
+ * level has no effect. The send level is applied on top of the channel
+ * volume.
+ *
+ * @param[in]   ch              Channel index
+ * @param[in]   send            Send level (0..1)
+ */
+void mixer_ch_set_reverb_send(int ch, float send);
+
+/**
+ * @brief Configure the reverb applied to the mixer output.
+ *
+ * The reverb is a stereo feedback delay line: the channels are mixed into it
+ * (as configured with #mixer_ch_set_reverb_send), and its output is added
+ * back to the mixer output, scaled by the specified level. The delay line
+ * is allocated in RDRAM (4 bytes per sample).
+ *
+ * When no channel has a filter and the reverb is disabled, the mixer uses
+ * the standard mixing path, so the effects do not cost anything.
+ *
+ * @param[in]   delay           Delay of the echo (in seconds), or 0 to disable the reverb
+ * @param[in]   feedback        Amount of the echo fed back into the delay line (0..1, excluded)
+ * @param[in]   level           Level of the echo in the mixer output (0..1)
+ */
+void mixer_set_reverb(float delay, float feedback, float level);
+
 /** @brief  Return true if the channel is currently playing samples. */
 bool mixer_ch_playing(int ch);
 
@@ -318,7 +362,8 @@ void mixer_poll(int16_t *out, int nsamples);
  *
  * If the callback has finished its task, it can return 0 to deregister itself
  * from the mixer. Otherwise, it can return a positive number of samples to
- * wait before calling it again.
+ * wait before calling it again. If the callback deregisters itself via
+ * #mixer_remove_event, it is not called again whatever the return value.
  * 
  * @param[in]   ctx             Opaque pointer to provide context (specified
  *                              in #mixer_add_event)
@@ -335,6 +380,14 @@ typedef int (*MixerEvent)(void* ctx);
  * wait before calling the event callback. "cb" is the event callback. "ctx"
  * is an opaque pointer that will be passed to the callback when invoked.
  * 
+ * Events are sample-accurate: #mixer_poll splits the mixing at the sample
+ * each event is due, so the callback can change the channel settings exactly
+ * at that point of the output stream, irrespective of how many samples are
+ * requested by each #mixer_poll call. There is no limit on the number of
+ * registered events. Events due at the same sample are invoked in the order
+ * they were registered; events whose time is already past (delay <= 0) are
+ * invoked at the beginning of the next #mixer_poll call.
+ * 
  * @param[in]   delay           Number of samples to wait before invoking
  *                              the event.
  * @param[in]   cb              Event callback to invoke
@@ -347,7 +400,8 @@ void mixer_add_event(int64_t delay, MixerEvent cb, void *ctx);
  * 
  * Deregister an event from the mixer. "cb" is the event callback, and "ctx"
  * is the opaque context pointer. Notice that an event can also deregister
- * itself by returning 0 when called.
+ * itself by returning 0 when called. Deregistering an event that is not
+ * registered is a no-op.
  * 
  * @param[in]    cb             Callback that was registered via #mixer_add_event
  * @param[in]    ctx            Opaque pointer that was registered with the callback.
@@ -355,6 +409,114 @@ void mixer_add_event(int64_t delay, MixerEvent cb, void *ctx);
 void mixer_remove_event(MixerEvent cb, void *ctx);
 
 
+/*********************************************************************
+ *
+ * VOICES
+ *
+ *********************************************************************/
+
+/**
+ * @brief Handle to a voice started with #mixer_voice_play.
+ *
+ * A value of 0 is never returned by #mixer_voice_play, so it can be used
+ * as "no voice".
+ */
+typedef uint32_t mixer_voice_t;
+
+/**
+ * @brief Reserve a range of mixer channels for the voice allocator.
+ *
+ * The voice allocator allows to play any number of waveforms at the same
+ * time ("voices"), without having to pick a mixer channel for each of them.
+ * Each voice has a priority and a volume: every time the mixer runs, the
+ * most audible voices (higher priority first, and then higher volume) are
+ * mapped to the reserved channels and mixed by the RSP. The other voices
+ * are "virtual": their playback position keeps advancing, but they are
+ * not mixed (and their waveform is not read), so they cost almost nothing.
+ * When a virtual voice becomes audible enough again, it resumes playing
+ * from the correct position.
+ *
+ * This allows SFX-heavy scenes to trigger many sounds without exceeding
+ * the RSP mixing budget, and without cutting the most important sounds.
+ *
+ * The reserved channels must not be used directly with the mixer_ch_*
+ * functions. Other channels can still be used as usual, for instance
+ * to play music.
+ *
+ * @param[in]   first_ch        First channel reserved for voices
+ * @param[in]   num_ch          Number of channels reserved for voices
+ */
+void mixer_voices_init(int first_ch, int num_ch);
+
+/**
+ * @brief Start playing a waveform as a new voice.
+ *
+ * Stereo waveforms require two consecutive free channels to be mapped, so
+ * they are more likely to be virtualized when the reserved channels are
+ * busy.
+ *
+ * @param[in]   wave            Waveform to play back
+ * @param[in]   priority        Priority of the voice. Voices with higher
+ *                              priority are always preferred to voices
+ *                              with lower priority, irrespective of volume.
+ * @param[in]   vol             Volume of the voice (range [0..1])
+ * @param[in]   pan             Panning (range [0..1], center is 0.5)
+ * @return                      Handle to the voice
+ *
+ * @see #mixer_ch_set_vol_pan
+ */
+mixer_voice_t mixer_voice_play(waveform_t *wave, int priority, float vol, float pan);
+
+/**
+ * @brief Change the volume and panning of a voice.
+ *
+ * Changing the volume also affects which voices are mapped to mixer
+ * channels. If the voice has already finished playing, this function
+ * does nothing.
+ *
+ * @param[in]   voice           Voice handle
+ * @param[in]   vol             Volume of the voice (range [0..1])
+ * @param[in]   pan             Panning (range [0..1], center is 0.5)
+ */
+void mixer_voice_set_vol_pan(mixer_voice_t voice, float vol, float pan);
+
+/**
+ * @brief Change the playback frequency of a voice.
+ *
+ * If the voice has already finished playing, this function does nothing.
+ *
+ * @param[in]   voice           Voice handle
+ * @param[in]   frequency       Playback frequency (in Hz / samples per second)
+ */
+void mixer_voice_set_freq(mixer_voice_t voice, float frequency);
+
+/**
+ * @brief Stop a voice.
+ *
+ * If the voice has already finished playing, this function does nothing.
+ *
+ * @param[in]   voice           Voice handle
+ */
+void mixer_voice_stop(mixer_voice_t voice);
+
+/**
+ * @brief Return true if the voice is still playing (mixed or virtual).
+ *
+ * @param[in]   voice           Voice handle
+ */
+bool mixer_voice_playing(mixer_voice_t voice);
+
+/**
+ * @brief Return true if the voice is currently mapped to a mixer channel.
+ *
+ * This is mainly useful for debugging: it returns false both for virtual
+ * voices and for voices that have finished playing.
+ *
+ * @param[in]   voice           Voice handle
+ */
+bool mixer_voice_audible(mixer_voice_t voice);
+
+
 /*********************************************************************
  *
  * WAVEFORMS
@@ -163,6 +163,7 @@ enum {
     RDPQ_CMD_NOOP                       = 0x00,
     RDPQ_CMD_SET_LOOKUP_ADDRESS         = 0x01,
     RDPQ_CMD_FILL_RECTANGLE_EX          = 0x02,
+    RDPQ_CMD_TRIANGLE_INDEXED           = 0x03,
     RDPQ_CMD_RESET_RENDER_MODE          = 0x04,
     RDPQ_CMD_SET_COMBINE_MODE_2PASS     = 0x05,
     RDPQ_CMD_PUSH_RENDER_MODE           = 0x06,
@@ -1537,15 +1538,19 @@ void rdpq_exec(void *buffer, int size);
  *       a single RDP TEXTURE_RECTANGLE command, pass 2 as @p num_rdp_commands.
  */
 #define rdpq_write(num_rdp_commands, ovl_id, cmd_id, ...) ({ \
+    extern rspq_block_t *rspq_block; \
     int __num_rdp_commands = (num_rdp_commands); \
     if (!__builtin_constant_p(__num_rdp_commands) || __num_rdp_commands != 0) { \
-        extern rspq_block_t *rspq_block; \
         if (__builtin_expect(rspq_block != NULL, 0)) { \
-            extern void __rdpq_block_reserve(int); \
-            __rdpq_block_reserve(__num_rdp_commands); \
+            extern void __rdpq_block_reserve(int, uint32_t, uint32_t); \
+            __rdpq_block_reserve(__num_rdp_commands, ovl_id, cmd_id); \
         } \
     } \
     rspq_write(ovl_id, cmd_id, ##__VA_ARGS__); \
+    if (__builtin_expect(rspq_block != NULL, 0)) { \
+        extern void __rdpq_block_written(void); \
+        __rdpq_block_written(); \
+    } \
 })
 
 
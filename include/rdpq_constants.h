@@ -27,6 +27,9 @@
 #define RDPQ_BLOCK_MIN_SIZE   64    ///< RDPQ block minimum size (in 32-bit words)
 #define RDPQ_BLOCK_MAX_SIZE   4192  ///< RDPQ block minimum size (in 32-bit words)
 
+/** @brief Number of vertices in the RSP vertex cache used by indexed triangles */
+#define RDPQ_VTXCACHE_SIZE    32
+
 /** @brief Set to 1 for the reference implementation of RDPQ_TRIANGLE (on CPU) */
 #define RDPQ_TRIANGLE_REFERENCE    0
 
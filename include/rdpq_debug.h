@@ -154,6 +154,69 @@ surface_t rdpq_debug_get_tmem(void);
  */
 void rdpq_debug_install_hook(void (*hook)(void *ctx, uint64_t* cmd, int cmd_size), void* ctx);
 
+/** @brief Magic number at the start of a frame capture ("RDPC") */
+#define RDPQ_CAPTURE_MAGIC          0x52445043
+/** @brief Version of the frame capture format */
+#define RDPQ_CAPTURE_VERSION        1
+/** @brief Capture chunk: a sequence of RDP commands */
+#define RDPQ_CAPTURE_CHUNK_CMDS     1
+/** @brief Capture chunk: a block of RDRAM */
+#define RDPQ_CAPTURE_CHUNK_MEM      2
+/** @brief Capture flag: the capture buffer was full, so the frame is incomplete */
+#define RDPQ_CAPTURE_FLAG_TRUNCATED     (1<<0)
+/** @brief Capture flag: some memory blocks did not fit in the capture buffer */
+#define RDPQ_CAPTURE_FLAG_MEM_MISSING   (1<<1)
+
+/**
+ * @brief Capture all the RDP commands of the next frame
+ * 
+ * This function records all RDP commands that follow it in the rspq queue,
+ * until the next SYNC_FULL (which normally terminates a frame, see
+ * #rdpq_detach), together with the memory they reference: textures and
+ * palettes being loaded, and the color and Z buffers. The capture begins
+ * with the RDP state that was set before it (render targets, render mode,
+ * combiner and tiles), so that it can be replayed standalone.
+ * 
+ * The capture is written out by the first rspq flush or wait after the
+ * frame is complete (it is never written from within an interrupt).
+ * If @p fn is NULL, it is sent via USB as a binary packet; otherwise,
+ * it is written to the specified file. Use #debug_init_sdfs to write
+ * to the SD card:
+ * 
+ * @code{.c}
+ *      debug_init_sdfs("sd:/", -1);
+ *      rdpq_debug_start();
+ * 
+ *      // [...]
+ *      if (capture_requested)
+ *          rdpq_debug_capture_frame("sd:/frame.rdpc");
+ *      rdpq_attach(display_get(), NULL);
+ *      // [...] render the frame
+ *      rdpq_detach_show();
+ * @endcode
+ * 
+ * The capture is a sequence of big-endian 32-bit words. It starts with a
+ * 16-byte header: magic (#RDPQ_CAPTURE_MAGIC), version (#RDPQ_CAPTURE_VERSION),
+ * flags (RDPQ_CAPTURE_FLAG_*), and a reserved word. Then, a sequence of chunks
+ * follows, each one made by a type, the size of the payload in bytes (always
+ * a multiple of 8), and the payload itself:
+ * 
+ *  * #RDPQ_CAPTURE_CHUNK_CMDS: a sequence of 64-bit RDP commands.
+ *  * #RDPQ_CAPTURE_CHUNK_MEM: the physical address and length in bytes of a
+ *    block of RDRAM, followed by its contents (padded to 8 bytes).
+ * 
+ * Chunks are in stream order: a memory block comes before the command that
+ * accesses it. Memory is copied when the debugging engine processes the
+ * command, so the color buffer might already contain part of the frame.
+ * The capture can be inspected and timed on PC with the rdpsim tool.
+ * 
+ * The capture buffer (RDPQ_DEBUG_CAPTURE_SIZE bytes, 1 MiB by default) is
+ * allocated by this function. It must be called after #rdpq_debug_start.
+ * 
+ * @param   fn      Output file, or NULL to send the capture via USB
+ */
+void rdpq_debug_capture_frame(const char *fn);
+
 /**
  * @brief Disassemble a RDP command
  * 
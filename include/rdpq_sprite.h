@@ -13,6 +13,7 @@
 #define LIBDRAGON_RDPQ_SPRITE_H
 
 #include <stdint.h>
+#include "graphics.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -24,6 +25,9 @@ typedef struct rdpq_texparms_s rdpq_texparms_t;
 typedef struct rdpq_blitparms_s rdpq_blitparms_t;
 ///@endcond
 
+/** @brief A batch of sprite blits (see #rdpq_spritebatch_new) */
+typedef struct rdpq_spritebatch_s rdpq_spritebatch_t;
+
 /**
  * @brief Upload a sprite to TMEM, making it ready for drawing
  * 
@@ -120,6 +124,108 @@ int rdpq_sprite_upload(rdpq_tile_t tile, sprite_t *sprite, const rdpq_texparms_t
  */
 void rdpq_sprite_blit(sprite_t *sprite, float x0, float y0, const rdpq_blitparms_t *parms);
 
+/**
+ * @brief Create a sprite batch
+ * 
+ * A sprite batch collects many sprite blits (see #rdpq_spritebatch_add), and
+ * then draws all of them at once (see #rdpq_spritebatch_draw). Before drawing,
+ * blits are sorted so that all blits of the same sprite are done together:
+ * each sprite is uploaded to TMEM (together with its palette) only once,
+ * and the render mode is changed only when switching between sprites with
+ * and without palettes. This is much faster than calling #rdpq_sprite_blit
+ * for each blit, when the same sprites are drawn many times per frame.
+ * 
+ * Since sorting changes the drawing order, sprites that overlap must be put in
+ * different layers (see #rdpq_spritebatch_set_layer): layers are always drawn
+ * in increasing order. Within the same sprite, blits are drawn in the order
+ * they were added.
+ * 
+ * @code{.c}
+ *      rdpq_spritebatch_t *batch = rdpq_spritebatch_new(1024);
+ * 
+ *      // Every frame:
+ *      rdpq_set_mode_standard();
+ *      rdpq_mode_alphacompare(1);
+ *      rdpq_spritebatch_set_layer(batch, 0);
+ *      for (int i=0; i<num_tiles; i++)
+ *          rdpq_spritebatch_add(batch, tiles[i].sprite, tiles[i].x, tiles[i].y, NULL);
+ *      rdpq_spritebatch_set_layer(batch, 1);
+ *      for (int i=0; i<num_enemies; i++)
+ *          rdpq_spritebatch_add(batch, enemies[i].sprite, enemies[i].x, enemies[i].y, 
+ *              &(rdpq_blitparms_t){ .theta = enemies[i].angle });
+ *      rdpq_spritebatch_draw(batch);
+ * @endcode
+ * 
+ * @param max_sprites   Maximum number of blits in the batch (up to 4096). At most
+ *                      1024 different sprites can be used in the same batch.
+ * @return              The new sprite batch
+ * 
+ * @see #rdpq_spritebatch_free
+ */
+rdpq_spritebatch_t* rdpq_spritebatch_new(int max_sprites);
+
+/**
+ * @brief Free a sprite batch
+ * 
+ * @param batch         Sprite batch to free
+ */
+void rdpq_spritebatch_free(rdpq_spritebatch_t *batch);
+
+/**
+ * @brief Set the layer for the next blits added to a sprite batch
+ * 
+ * Layers are drawn in increasing order. After #rdpq_spritebatch_draw,
+ * the layer is reset to 0.
+ * 
+ * @param batch         Sprite batch
+ * @param layer         Layer (0-255)
+ */
+void rdpq_spritebatch_set_layer(rdpq_spritebatch_t *batch, int layer);
+
+/**
+ * @brief Add a sprite blit to a sprite batch
+ * 
+ * The blit is not performed until #rdpq_spritebatch_draw is called, so the
+ * sprite must stay valid until then. All the features of #rdpq_sprite_blit
+ * are supported.
+ * 
+ * @param batch         Sprite batch
+ * @param sprite        Sprite to blit
+ * @param x0            X coordinate on the framebuffer where to draw the sprite
+ * @param y0            Y coordinate on the framebuffer where to draw the sprite
+ * @param parms         Parameters for the blit operation (or NULL for default)
+ */
+void rdpq_spritebatch_add(rdpq_spritebatch_t *batch, sprite_t *sprite, float x0, float y0, const rdpq_blitparms_t *parms);
+
+/**
+ * @brief Add a tinted sprite blit to a sprite batch
+ * 
+ * This is like #rdpq_spritebatch_add, but the tint color is also written
+ * to the PRIM register before the blit. To actually apply it, configure a
+ * combiner that modulates the texture by PRIM (eg: #RDPQ_COMBINER_TEX_FLAT).
+ * 
+ * If at least a blit in the batch is tinted, the PRIM register is written for
+ * all the blits (using white for the ones added with #rdpq_spritebatch_add).
+ * 
+ * @param batch         Sprite batch
+ * @param sprite        Sprite to blit
+ * @param x0            X coordinate on the framebuffer where to draw the sprite
+ * @param y0            Y coordinate on the framebuffer where to draw the sprite
+ * @param parms         Parameters for the blit operation (or NULL for default)
+ * @param tint          Tint color
+ */
+void rdpq_spritebatch_add_tinted(rdpq_spritebatch_t *batch, sprite_t *sprite, float x0, float y0, const rdpq_blitparms_t *parms, color_t tint);
+
+/**
+ * @brief Draw all the blits in a sprite batch, and empty it
+ * 
+ * The current render mode is used (apart from the palette mode, which is
+ * configured for each sprite like #rdpq_sprite_blit does).
+ * 
+ * @param batch         Sprite batch
+ */
+void rdpq_spritebatch_draw(rdpq_spritebatch_t *batch);
+
 #ifdef __cplusplus
 }
 #endif
@@ -285,6 +285,59 @@ void rdpq_tex_multi_begin(void);
  */
 int rdpq_tex_multi_end(void);
 
+/**
+ * @brief Enable or disable the TMEM cache
+ * 
+ * When the TMEM cache is enabled, rdpq remembers which textures (or
+ * sub-rectangles of textures) are currently resident in TMEM, and at which
+ * address. Uploading a texture that is still resident (via #rdpq_tex_upload,
+ * #rdpq_tex_upload_sub, #rdpq_sprite_upload, #rdpq_tex_blit or #rdpq_sprite_blit)
+ * will then skip the actual load, and just configure the tile descriptor.
+ * 
+ * This is very useful when the same few textures are drawn many times per
+ * frame, like in tile-based 2D games. Textures are allocated in TMEM by the
+ * cache itself; when TMEM is full, the least recently used textures are evicted.
+ * 
+ * Textures are identified by the address of their pixels in RDRAM, their format,
+ * stride and the loaded rectangle. Since TMEM contents are not visible to the
+ * CPU, the following rules apply while the cache is enabled:
+ * 
+ *  * The cache is not used when specifying an explicit TMEM address in
+ *    #rdpq_texparms_t, and while recording blocks.
+ *  * Running a block invalidates the cache, as the block might load textures.
+ *  * Uploading a palette via #rdpq_tex_upload_tlut reserves TMEM from the palette
+ *    address upwards: the cache will not allocate textures there anymore.
+ *  * If you modify the contents of a texture (eg: by rendering to it, or
+ *    by freeing it and allocating another one at the same address), call
+ *    #rdpq_tex_cache_invalidate_surface or #rdpq_tex_cache_invalidate.
+ *  * If you load TMEM manually (eg: via #rdpq_load_tile or #rdpq_load_block),
+ *    call #rdpq_tex_cache_invalidate.
+ * 
+ * The cache is disabled by default. Enabling or disabling it also invalidates it.
+ * 
+ * @param enable        True to enable the cache, false to disable it
+ * 
+ * @see #rdpq_tex_cache_invalidate
+ */
+void rdpq_tex_cache_enable(bool enable);
+
+/**
+ * @brief Invalidate the TMEM cache
+ * 
+ * All textures will be loaded again on their next upload. See #rdpq_tex_cache_enable.
+ */
+void rdpq_tex_cache_invalidate(void);
+
+/**
+ * @brief Invalidate the TMEM cache for a texture whose contents changed
+ * 
+ * All the cached rectangles of the specified texture (or overlapping its
+ * memory) will be loaded again on their next upload. See #rdpq_tex_cache_enable.
+ * 
+ * @param tex           Texture whose contents changed
+ */
+void rdpq_tex_cache_invalidate_surface(const surface_t *tex);
+
 
 /**
  * @brief Blitting parameters for #rdpq_tex_blit.
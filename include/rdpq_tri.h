@@ -9,6 +9,7 @@
 #define LIBDRAGON_RDPQ_TRI_H
 
 #include "rdpq.h"
+#include "rdpq_constants.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -240,6 +241,89 @@ extern const rdpq_trifmt_t TRIFMT_ZBUF_SHADE_TEX;
  */
 void rdpq_triangle(const rdpq_trifmt_t *fmt, const float *v1, const float *v2, const float *v3);
 
+/**
+ * @brief Primitive types for #rdpq_mesh_draw
+ */
+typedef enum {
+    RDPQ_MESH_TRIANGLES,            ///< Each group of 3 indices is a triangle
+    RDPQ_MESH_TRIANGLE_STRIP,       ///< Each index after the first two forms a triangle with the previous two
+} rdpq_mesh_prim_t;
+
+/**
+ * @brief Load vertices into the RSP vertex cache
+ * 
+ * The RSP keeps a cache of #RDPQ_VTXCACHE_SIZE vertices that can be referenced
+ * by index via #rdpq_triangle_indexed. This allows to upload each vertex only once,
+ * even if it is shared by many triangles, while #rdpq_triangle needs to upload
+ * all three vertices for each triangle.
+ * 
+ * The vertices are converted to the RSP fixed point format on the CPU, so the
+ * same rules described in #rdpq_triangle apply. Loading a vertex overwrites
+ * whatever was in its slot before, so it is possible to draw a mesh of any size
+ * by loading a batch of vertices, drawing the triangles that reference them, and
+ * then loading the next batch. #rdpq_mesh_draw does all of this automatically.
+ * 
+ * Loaded vertices are also written back to a copy of the cache in RDRAM, so they
+ * are preserved if other RSP overlays run in the meantime. The cache is then
+ * fetched back by the next #rdpq_triangle_indexed, so it is a good idea to avoid
+ * interleaving indexed triangles with commands of other overlays.
+ * 
+ * @param fmt           Format of the vertices. It must match the format later
+ *                      used by #rdpq_triangle_indexed.
+ * @param slot          First cache slot to load (0 to #RDPQ_VTXCACHE_SIZE-1)
+ * @param vertices      Array of vertex components
+ * @param vtx_stride    Number of floats between the start of two vertices in the array
+ * @param count         Number of vertices to load
+ * 
+ * @see #rdpq_triangle_indexed
+ */
+void rdpq_vertex_load(const rdpq_trifmt_t *fmt, int slot, const float *vertices, int vtx_stride, int count);
+
+/**
+ * @brief Draw a triangle using vertices previously loaded in the RSP vertex cache
+ * 
+ * This is equivalent to #rdpq_triangle, but the three vertices are referenced by
+ * their slot in the vertex cache (see #rdpq_vertex_load). Each triangle costs just
+ * 8 bytes in the command queue, instead of the 88 bytes required by #rdpq_triangle.
+ * 
+ * Flat shading (#rdpq_trifmt_t::shade_flat) is not supported, as each vertex in the
+ * cache has its own shade.
+ * 
+ * @param fmt           Format of the triangle (see #rdpq_triangle)
+ * @param s1            Cache slot of vertex 1
+ * @param s2            Cache slot of vertex 2
+ * @param s3            Cache slot of vertex 3
+ */
+void rdpq_triangle_indexed(const rdpq_trifmt_t *fmt, int s1, int s2, int s3);
+
+/**
+ * @brief Draw an indexed triangle mesh
+ * 
+ * This function draws a mesh described by an array of vertices and an array of
+ * indices into it, using the RSP vertex cache. Vertices are loaded into the cache
+ * the first time they are referenced, and reused by all the following triangles
+ * until the cache is full; at that point, the cache is flushed and refilled.
+ * For typical meshes, where triangles sharing vertices are close to each other
+ * in the index array, this reduces the size of the commands sent to the RSP
+ * by 2-3 times compared to calling #rdpq_triangle for each triangle.
+ * 
+ * Degenerate triangles (with two identical indices, as commonly used to stitch
+ * strips together) are skipped.
+ * 
+ * If the format requires flat shading, the mesh is drawn with #rdpq_triangle
+ * instead, as flat shading is not supported by the vertex cache.
+ * 
+ * @param fmt           Format of the vertices (see #rdpq_triangle)
+ * @param vertices      Array of vertex components
+ * @param vtx_stride    Number of floats between the start of two vertices in the array
+ * @param num_vertices  Number of vertices in the array
+ * @param indices       Array of indices into the vertex array
+ * @param num_indices   Number of indices
+ * @param prim          How the indices form triangles (list or strip)
+ */
+void rdpq_mesh_draw(const rdpq_trifmt_t *fmt, const float *vertices, int vtx_stride, int num_vertices,
+    const uint16_t *indices, int num_indices, rdpq_mesh_prim_t prim);
+
 #ifdef __cplusplus
 }
 #endif
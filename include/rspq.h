@@ -199,6 +199,15 @@ extern "C" {
  */
 typedef struct rspq_block_s rspq_block_t;
 
+/**
+ * @brief A suspended block recording context
+ * 
+ * This is the state of a block whose creation has been suspended via
+ * #rspq_block_suspend. It can be resumed later via #rspq_block_resume,
+ * which also disposes the context.
+ */
+typedef struct rspq_block_ctx_s rspq_block_ctx_t;
+
 /**
  * @brief A syncpoint in the queue
  * 
@@ -701,6 +710,64 @@ void rspq_block_begin(void);
  */
 rspq_block_t* rspq_block_end(void);
 
+/**
+ * @brief Suspend the creation of the current block
+ * 
+ * This function detaches the block currently being created (see #rspq_block_begin)
+ * and returns its recording context. After this call, all subsequent
+ * #rspq_write will go to the normal queue again, or into another block if
+ * #rspq_block_begin or #rspq_block_resume is called.
+ * 
+ * This allows to record multiple blocks at the same time, for instance
+ * from different coroutines that traverse separate parts of a scene, or
+ * to keep a per-object block open across the traversal. Each context keeps its
+ * own write pointers and its own rdpq state (eg: autosync tracking), so
+ * commands recorded in one block never leak into the others. The blocks
+ * can then be finished with #rspq_block_end and stitched together by
+ * running them (#rspq_block_run) in the queue or in another block.
+ * 
+ * @code{.c}
+ *      rspq_block_begin();
+ *          draw_background();
+ *      rspq_block_ctx_t *bg = rspq_block_suspend();
+ * 
+ *      rspq_block_begin();
+ *          draw_actors();
+ *      rspq_block_ctx_t *actors = rspq_block_suspend();
+ * 
+ *      rspq_block_resume(bg);
+ *          draw_more_background();
+ *      rspq_block_t *bg_block = rspq_block_end();
+ * 
+ *      rspq_block_resume(actors);
+ *      rspq_block_t *actors_block = rspq_block_end();
+ * 
+ *      rspq_block_run(bg_block);
+ *      rspq_block_run(actors_block);
+ * @endcode
+ * 
+ * @return The recording context of the suspended block
+ * 
+ * @see #rspq_block_resume
+ */
+rspq_block_ctx_t* rspq_block_suspend(void);
+
+/**
+ * @brief Resume the creation of a suspended block
+ * 
+ * This function reattaches a block whose creation was suspended via
+ * #rspq_block_suspend. All subsequent #rspq_write will go into it again,
+ * until it is either finished via #rspq_block_end or suspended again.
+ * 
+ * No block must be in creation when this function is called (suspend it
+ * first if needed). The context is freed and must not be used anymore.
+ * 
+ * @param ctx   The recording context returned by #rspq_block_suspend
+ * 
+ * @see #rspq_block_suspend
+ */
+void rspq_block_resume(rspq_block_ctx_t *ctx);
+
 /**
  * @brief Add to the RSP queue a command that runs a block.
  * 
@@ -714,6 +781,11 @@ rspq_block_t* rspq_block_end(void);
  * creation of a second block B; this means that B will contain the special
  * command that will call A.
  *
+ * Blocks can be run both in the normal queue and in the high-priority queue
+ * (see #rspq_highpri_begin). The RSP keeps separate save slots for the two
+ * modes, so a block run in high-priority mode can safely interrupt any
+ * block being run in the normal queue.
+ *
  * @param block The block that must be run
  * 
  * @note The maximum depth of nested block calls is 8.
@@ -766,8 +838,9 @@ void rspq_block_free(rspq_block_t *block);
  * @note It is not possible to create a block while the high-priority queue is
  *       active. Arrange for constructing blocks beforehand.
  *       
- * @note It is currently not possible to call a block from the
- *       high-priority queue. (FIXME: to be implemented)
+ * @note Blocks can be run from the high-priority queue via #rspq_block_run,
+ *       even if the same block is being run at the same time in the
+ *       normal queue.
  *       
  */
 void rspq_highpri_begin(void);
@@ -836,6 +909,100 @@ void rspq_dma_to_rdram(void *rdram_addr, uint32_t dmem_addr, uint32_t len, bool
  */
 void rspq_dma_to_dmem(uint32_t dmem_addr, void *rdram_addr, uint32_t len, bool is_async);
 
+/**
+ * @brief Profiling counters of an overlay ID or a command (see #rspq_profile_get)
+ */
+typedef struct {
+    uint64_t total_ticks;       ///< RCP clock cycles spent (see #RCP_FREQUENCY)
+    uint64_t sample_count;      ///< Number of commands executed
+} rspq_profile_slot_t;
+
+/**
+ * @brief RSP profiling data (see #rspq_profile_get)
+ */
+typedef struct {
+    /**
+     * @brief Counters for each overlay ID (0-15)
+     * 
+     * Slot 0 refers to builtin commands, and also includes the time spent
+     * by the RSP waiting for new commands. An overlay registered
+     * with multiple IDs has one slot per ID.
+     */
+    rspq_profile_slot_t overlays[16];
+    /** @brief Counters for each command of the overlay ID selected via #rspq_profile_detail */
+    rspq_profile_slot_t commands[16];
+    uint32_t detail_ovl_id;     ///< Overlay ID whose commands are profiled in #commands
+    uint64_t frame_count;       ///< Number of frames profiled (see #rspq_profile_next_frame)
+} rspq_profile_data_t;
+
+/**
+ * @brief Start profiling the RSP
+ * 
+ * The RSP profiler measures how many RCP cycles are spent executing each
+ * command, accumulating them per overlay ID, and per command for one
+ * overlay ID (see #rspq_profile_detail). Cycles are sampled by the
+ * RSP queue engine between each command, so they include the time needed
+ * to load the overlay, to fetch commands from RDRAM, and any time spent
+ * waiting for RDP or DMA within the command.
+ * 
+ * The profiler must be enabled at build time, by defining RSPQ_PROFILE=1 when
+ * building both libdragon and the ucodes, as it costs some DMEM and some
+ * cycles for each command. If it is not enabled, this function asserts.
+ * 
+ * This function resets all counters. Call #rspq_profile_next_frame once
+ * per frame to collect the counters from the RSP.
+ */
+void rspq_profile_start(void);
+
+/**
+ * @brief Stop profiling the RSP
+ * 
+ * Counters collected so far are still available via #rspq_profile_get.
+ */
+void rspq_profile_stop(void);
+
+/**
+ * @brief Select the overlay ID whose commands are profiled individually
+ * 
+ * Since DMEM is scarce, the RSP keeps per-command counters for only one
+ * overlay ID at a time. This function selects it, and resets the per-command
+ * counters. The selection takes effect at the next #rspq_profile_next_frame.
+ * 
+ * @param ovl_id    Overlay ID (as returned by #rspq_overlay_register), or 0
+ *                  to profile builtin commands.
+ */
+void rspq_profile_detail(uint32_t ovl_id);
+
+/**
+ * @brief Collect the profiling counters of the current frame
+ * 
+ * This function enqueues a command that makes the RSP write its counters
+ * to RDRAM and clear them, so that they can be accumulated into 64-bit
+ * counters by the CPU. It should be called once per frame, so that the
+ * per-frame averages reported by #rspq_profile_dump are meaningful, and
+ * so that the 32-bit counters in DMEM never overflow.
+ */
+void rspq_profile_next_frame(void);
+
+/**
+ * @brief Get the profiling counters collected so far
+ * 
+ * This function waits for the RSP to write the counters of the last
+ * frame, if needed.
+ * 
+ * @param[out] data     Profiling data
+ */
+void rspq_profile_get(rspq_profile_data_t *data);
+
+/**
+ * @brief Dump the profiling counters collected so far via debugf
+ * 
+ * The dump reports, for each overlay ID and for each command of the
+ * selected overlay ID, the average RSP time per frame and the number
+ * of commands executed per frame.
+ */
+void rspq_profile_dump(void);
+
 /** @cond */
 __attribute__((deprecated("may not work anymore. use rspq_syncpoint_new/rspq_syncpoint_check instead")))
 void rspq_signal(uint32_t signal);
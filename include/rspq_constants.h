@@ -3,6 +3,15 @@
 
 #define RSPQ_DEBUG                     1
 
+/** 
+ * Enable the RSP profiler (see rspq_profile_start). This costs about 270 bytes
+ * of DMEM and a few cycles per command, so it is disabled by default.
+ * It must be enabled for both the C library and the ucodes.
+ */
+#ifndef RSPQ_PROFILE
+#define RSPQ_PROFILE                   0
+#endif
+
 #define RSPQ_DRAM_LOWPRI_BUFFER_SIZE   0x200   ///< Size of each RSPQ RDRAM buffer for lowpri queue (in 32-bit words)
 #define RSPQ_DRAM_HIGHPRI_BUFFER_SIZE  0x80    ///< Size of each RSPQ RDRAM buffer for highpri queue (in 32-bit words)
 
@@ -23,8 +32,14 @@
 
 /** Maximum number of nested block calls */
 #define RSPQ_MAX_BLOCK_NESTING_LEVEL   8
-#define RSPQ_LOWPRI_CALL_SLOT          (RSPQ_MAX_BLOCK_NESTING_LEVEL+0)  ///< Special slot used to store the current lowpri pointer
-#define RSPQ_HIGHPRI_CALL_SLOT         (RSPQ_MAX_BLOCK_NESTING_LEVEL+1)  ///< Special slot used to store the current highpri pointer
+#define RSPQ_HIGHPRI_NESTING_SLOT      (RSPQ_MAX_BLOCK_NESTING_LEVEL+0)    ///< First slot used by nested block calls in highpri mode
+#define RSPQ_LOWPRI_CALL_SLOT          (RSPQ_MAX_BLOCK_NESTING_LEVEL*2+0)  ///< Special slot used to store the current lowpri pointer
+#define RSPQ_HIGHPRI_CALL_SLOT         (RSPQ_MAX_BLOCK_NESTING_LEVEL*2+1)  ///< Special slot used to store the current highpri pointer
+
+/** Number of profiling slots (one per overlay ID, or one per command of an overlay ID) */
+#define RSPQ_PROFILE_SLOT_COUNT        16
+/** Size of a profiling slot in DMEM (32-bit cycles + 32-bit calls) */
+#define RSPQ_PROFILE_SLOT_SIZE         8
 
 /** Signal used by RDP SYNC_FULL command to notify that an interrupt is pending */
 #define SP_STATUS_SIG_RDPSYNCFULL              SP_STATUS_SIG1
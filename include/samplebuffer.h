@@ -248,6 +248,9 @@ void* samplebuffer_append(samplebuffer_t *buf, int wlen);
  * sample that should be kept: all samples that come before will be discarded.
  * This function will silently do nothing if there are no samples to discard.
  * 
+ * A few samples before "wpos" might be kept, so that the remaining samples
+ * keep the same 8-byte phase within the buffer.
+ * 
  * @param[in]   buf     Sample buffer
  * @param[in]   wpos    Absolute waveform position of the first sample that
  *                      must be kept.
@@ -0,0 +1,120 @@
+/**
+ * @file timeline.h
+ * @brief Frame timeline profiler
+ * @ingroup timeline
+ */
+#ifndef __LIBDRAGON_TIMELINE_H
+#define __LIBDRAGON_TIMELINE_H
+
+#include <stdint.h>
+
+/**
+ * @defgroup timeline Frame timeline profiler
+ * @ingroup lowlevel
+ * @brief Record CPU, RSP and RDP events on a common timeline.
+ *
+ * The timeline profiler records timestamped events into a ring buffer, to
+ * understand where the time of each frame goes across the three processors.
+ * The following events are recorded:
+ *
+ *  * CPU zones, marked by the application with #timeline_zone_begin /
+ *    #timeline_zone_end (or the scoped #TIMELINE_ZONE macro), and
+ *    CPU instant markers (#timeline_mark).
+ *  * RSP syncpoints: both their creation by the CPU (#rspq_syncpoint_new)
+ *    and the moment the RSP reaches them.
+ *  * RDP SYNC_FULL completion (see #rdpq_sync_full).
+ *  * VI interrupts (vertical blanks), which mark frame boundaries.
+ *
+ * All timestamps come from the CPU counter (#TICKS_READ): RSP and RDP
+ * events are timestamped by the interrupt handlers that notice them, so they
+ * are delayed by the interrupt latency (usually a few microseconds).
+ *
+ * The ring buffer can be exported with #timeline_dump in the Chrome trace
+ * event format (JSON), which can be opened with chrome://tracing or
+ * https://ui.perfetto.dev. The dump is emitted via #debugf, so it goes
+ * to any active debugging channel (USB, ISViewer, SD card log).
+ *
+ * Recording an event costs less than a microsecond, and when the
+ * profiler is not initialized the hooks in rspq and rdpq are skipped
+ * with a single pointer check.
+ * @{
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Initialize the timeline profiler
+ *
+ * @param[in]  max_events   Size of the ring buffer in events. When it is full,
+ *                          the oldest events are overwritten. Each event
+ *                          takes 12 bytes.
+ */
+void timeline_init(int max_events);
+
+/** @brief Shut down the timeline profiler and free the ring buffer */
+void timeline_close(void);
+
+/** @brief Discard all the events recorded so far */
+void timeline_reset(void);
+
+/**
+ * @brief Begin a CPU zone
+ *
+ * Zones can be nested, and must be closed with #timeline_zone_end in
+ * reverse order.
+ *
+ * @param[in]  name     Name of the zone. The string is not copied, so it
+ *                      must be valid until the timeline is dumped (use a
+ *                      string literal).
+ */
+void timeline_zone_begin(const char *name);
+
+/** @brief End the innermost CPU zone (see #timeline_zone_begin) */
+void timeline_zone_end(void);
+
+/**
+ * @brief Record a CPU instant marker
+ *
+ * @param[in]  name     Name of the marker (see #timeline_zone_begin).
+ */
+void timeline_mark(const char *name);
+
+/**
+ * @brief Export the recorded events via debugf, in Chrome trace event format
+ *
+ * The ring buffer is copied with interrupts disabled, and then formatted
+ * with interrupts enabled. Ends of zones whose beginning was overwritten
+ * in the ring buffer are omitted. This is a slow operation: call it outside
+ * of the part of the program being profiled.
+ */
+void timeline_dump(void);
+
+/// @cond
+void __timeline_zone_cleanup(int *unused);
+/// @endcond
+
+/**
+ * @brief Mark a CPU zone that lasts until the end of the current scope
+ *
+ * @code{.c}
+ *      void update_physics(void) {
+ *          TIMELINE_ZONE("physics");
+ *          ...
+ *      }
+ * @endcode
+ *
+ * Only one TIMELINE_ZONE can be used per scope.
+ */
+#define TIMELINE_ZONE(name) \
+    __attribute__((cleanup(__timeline_zone_cleanup), unused)) \
+    int __timeline_zone = (timeline_zone_begin(name), 0)
+
+#ifdef __cplusplus
+}
+#endif
+
+/** @} */ /* timeline */
+
+#endif
@@ -35,6 +35,11 @@
  * TICKS_READ), it's not possible to schedule a timer more than 90 seconds
  * in the future.
  *
+ * Active timers are kept in a min-heap sorted by expiration time, so starting
+ * and stopping a timer is O(log n), and finding the next expiring timer is O(1).
+ * Timers created by #new_timer are allocated from an internal pool, so that
+ * creating and deleting timers is cheap and does not fragment the heap.
+ *
  * @{
  */
 
@@ -63,8 +68,10 @@ typedef struct timer_link
     };
     /** @brief Callback context parameter */
     void *ctx;
-    /** @brief Link to next timer */
+    /** @brief Link to next free timer in the timer pool (internal use) */
     struct timer_link *next;
+    /** @brief Position in the heap of active timers (internal use) */
+    int index;
 } timer_link_t;
 
 /** @brief Timer should fire only once */
@@ -199,6 +206,11 @@ timer_link_t *new_timer_context(int ticks, int flags, timer_callback2_t callback
  * If you need to associate some data with the timer, consider using
  * #start_timer_context to include a pointer in the callback.
  *
+ * Starting a timer never allocates memory, so it can be done from within
+ * an interrupt. For this reason, the number of active timers that were not
+ * created with #new_timer (that is, allocated by the caller) is limited:
+ * room for 32 of them is always available.
+ *
  * @param[in] timer
  *            Pointer to timer structure to reinsert and start
  * @param[in] ticks
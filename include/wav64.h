@@ -20,10 +20,15 @@ extern "C" {
  * file. It is meant to be played back through the audio mixer, implementing
  * the #waveform_t interface. As such, samples are not preloaded in memory
  * but rather loaded on request when needed for playback, streaming directly
- * from ROM. See #waveform_t for more details.
+ * from ROM, from any other filesystem (eg: "sd:/"), or from a buffer in RAM.
+ * See #waveform_t for more details.
  * 
  * Use #wav64_play to playback. For more advanced usage, call directly the
  * mixer functions, accessing the #wave structure field.
+ * 
+ * Compressed (VADPCM) files support seeking with #mixer_ch_set_pos like
+ * uncompressed ones. Files converted by audioconv64 contain a seek table
+ * that allows to restart decoding at any position with minimal CPU overhead.
  */
 typedef struct {
 	/** @brief #waveform_t for this WAV64. 
@@ -32,11 +37,13 @@ typedef struct {
 	 */
 	waveform_t wave;
 
-	/** @brief Absolute ROM address of WAV64 */
+	/** @brief Absolute ROM address of WAV64 samples (0 if the file is not in ROM) */
 	uint32_t rom_addr;
 
 	int format;			     ///< Internal format of the file
 	void *ext;               ///< Pointer to extended data (internal use)
+	void *stream;            ///< Stream the samples are read from (internal use)
+	int data_offset;         ///< Offset of the samples in the stream (internal use)
 } wav64_t;
 
 /** @brief Open a WAV64 file for playback.
@@ -44,12 +51,28 @@ typedef struct {
  * This function opens the file, parses the header, and initializes for
  * playing back through the audio mixer.
  * 
+ * Files in ROM ("rom:/") are streamed via PI DMA, which runs in parallel
+ * with decompression. Files on other filesystems (eg: "sd:/", to load music
+ * during development without rebuilding the ROM) are read through a
+ * read-ahead buffer sized for a few mixer polls.
+ * 
  * @param   wav         Pointer to wav64_t structure
- * @param   fn          Filename of the wav64 (with filesystem prefix). Currently,
- *                      only files on DFS ("rom:/") are supported.
+ * @param   fn          Filename of the wav64 (with filesystem prefix).
  */ 
 void wav64_open(wav64_t *wav, const char *fn);
 
+/** @brief Open a WAV64 file that is already loaded in RAM.
+ * 
+ * This is useful to play a WAV64 file that was loaded with #asset_load (which
+ * also takes care of decompressing it, if it was compressed with mkasset).
+ * The buffer is not copied and must stay valid until #wav64_close.
+ * 
+ * @param   wav         Pointer to wav64_t structure
+ * @param   buf         Contents of the WAV64 file
+ * @param   size        Size of the buffer in bytes
+ */
+void wav64_open_buf(wav64_t *wav, const void *buf, int size);
+
 /** @brief Configure a WAV64 file for looping playback. */
 void wav64_set_loop(wav64_t *wav, bool loop);
 
@@ -58,6 +58,7 @@ typedef struct xm64player_s {
 	waveform_t *waves;        ///< array of all waveforms (one per XM "sample")
 	int nwaves;               ///< number of wavers (XM "samples")
 	FILE *fh;                 ///< open handle of XM64 file
+	void *stream;             ///< stream used to read the samples (internal use)
 	int first_ch;             ///< first channel used in the mixer
 	bool playing;             ///< playing flag
 	bool looping;             ///< true if the XM is configured to loop
@@ -73,8 +74,9 @@ typedef struct xm64player_s {
  * (via mixer_init).
  * 
  * @param player Pointer to the xm64player_t player structure to use
- * @param fn     Filename of the XM64 (with filesystem prefix). Currently,
- *               only files on DFS ("rom:/") are supported.
+ * @param fn     Filename of the XM64 (with filesystem prefix). Files on
+ *               any filesystem are supported (eg: "sd:/"), but files in ROM
+ *               ("rom:/") are streamed more efficiently via PI DMA.
  */
 void xm64player_open(xm64player_t *player, const char *fn);
 
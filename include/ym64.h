@@ -39,7 +39,11 @@ extern "C" {
  * 
  * The main conversion option to pay attention too is whether the output file
  * must be compressed or not. Compressed files are smaller but takes 18 KiB
- * more of RDRAM to be played back and cannot be seeked.
+ * more of RDRAM to be played back. Compressed files are split by audioconv64
+ * into independently compressed segments (by default, of 1024 audio frames
+ * each, see the `--ym-seek-interval` option), so that seeking only requires
+ * decompressing from the beginning of the closest segment. A segment also
+ * begins at the loop point, so looping is as fast as in uncompressed files.
  * 
  * This player is dedicated to the late Sir Clive Sinclair whose computer,
  * powered by the AY-3-8910, helped popularize what we now call
@@ -61,8 +65,15 @@ typedef struct {
 	FILE *f;                  ///< Open file handle
 	void *decoder;            ///< Optional LHA decoder (compressed YM files)
 	int start_off;            ///< Starting offset of the first audio frame
+	int member_left;          ///< Bytes left to decompress in the current LHA member
+	struct ym64_keyframe_s *keyframes; ///< Seek keyframes (compressed YM files)
+	int nkeys;                ///< Number of seek keyframes
+	int curkey;               ///< Current seek keyframe (LHA member being decompressed)
+	int seek_frame;           ///< Audio frame the decoder was moved to by #ym64player_seek (-1: none)
 
 	AY8910 ay;                ///< AY8910 emulator
+	AYRun *runs;              ///< Runs of samples being expanded by the RSP
+	int max_runs;             ///< Capacity of the runs buffer
 	uint8_t regs[16];         ///< Current cached value of the AY registers
 	uint32_t nframes;         ///< Number of YM audio frames
 	uint32_t chipfreq;        ///< Operating frequency of the AY chip
@@ -140,13 +151,17 @@ void ym64player_tell(ym64player_t *player, int *pos, float *secs);
  * @brief Seek to a specific position in the YM module.
  * 
  * The function seeks to a new absolute position expressed in ticks (internal
- * YM position). Notice that it's not possible to seek in a YM64 file that has
- * been compressed. audioconv64 compresses YM files by default.
+ * YM position). Seeking in a compressed YM64 file requires decompressing
+ * the file from the beginning of the closest segment, so it is slower: this
+ * is done by this function, not by the mixer during playback.
+ * Notice that it's not possible to seek in compressed files that have been
+ * converted without seek index (`--ym-seek-interval 0`), or with older
+ * versions of audioconv64.
  * 
  * @param[in]	player 		YM64 player
  * @param[out] 	pos 		Absolute position in ticks
  * @return                  True if it was possible to seek, false if 
- *                          the file is compressed.
+ *                          the file is compressed without seek index.
  */
 bool ym64player_seek(ym64player_t *player, int pos);
 
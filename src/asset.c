@@ -3,6 +3,7 @@
 #include "compress/aplib_dec_internal.h"
 #include "compress/lz4_dec_internal.h"
 #include "compress/shrinkler_dec_internal.h"
+#include "utils.h"
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
@@ -147,6 +148,68 @@ static void* decompress_inplace(asset_compression_t *algo, const char *fn, FILE
     return ptr;
 }
 
+/** @brief Read the chunk index of a chunked asset (see #ASSET_FLAG_CHUNKED) */
+static asset_chunk_index_t* chunk_index_read(FILE *fp)
+{
+    uint32_t head[2];
+    fread(head, 1, sizeof(head), fp);
+    if (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__) {  // for mkasset running on PC
+        head[0] = __builtin_bswap32(head[0]);
+        head[1] = __builtin_bswap32(head[1]);
+    }
+
+    asset_chunk_index_t *index = malloc(sizeof(asset_chunk_index_t) + (head[1]+1) * sizeof(uint32_t));
+    assertf(index, "asset: out of memory");
+    index->chunk_size = head[0];
+    index->num_chunks = head[1];
+    fread(index->offsets, 1, (index->num_chunks+1) * sizeof(uint32_t), fp);
+    if (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__) {
+        for (int i=0; i<=index->num_chunks; i++)
+            index->offsets[i] = __builtin_bswap32(index->offsets[i]);
+    }
+    return index;
+}
+
+static void* decompress_chunked(asset_compression_t *algo, const char *fn, FILE *fp, size_t size)
+{
+    asset_chunk_index_t *index = chunk_index_read(fp);
+    long data_offset = ftell(fp);
+
+    // Find the biggest compressed chunk, to allocate the input buffer.
+    int max_cmp_size = 0;
+    for (int i=0; i<index->num_chunks; i++) {
+        int cmp_size = index->offsets[i+1] - index->offsets[i];
+        if (max_cmp_size < cmp_size) max_cmp_size = cmp_size;
+    }
+
+    // Decompress all chunks one after the other. Add 8 bytes to the output
+    // because the assembly decompressors do writes up to 8 bytes out-of-bounds.
+    uint8_t *s = memalign(ASSET_ALIGNMENT, size + 8);
+    uint8_t *in = algo->decompress_full_inplace ? memalign(16, max_cmp_size) : NULL;
+    assertf(s && (in || !algo->decompress_full_inplace), "asset_load: out of memory");
+
+    for (int i=0; i<index->num_chunks; i++) {
+        int cmp_size = index->offsets[i+1] - index->offsets[i];
+        int pos = i * index->chunk_size;
+        int len = MIN(index->chunk_size, size - pos);
+
+        fseek(fp, data_offset + index->offsets[i], SEEK_SET);
+        if (in) {
+            fread(in, 1, cmp_size, fp);
+            int n = algo->decompress_full_inplace(in, cmp_size, s+pos, len); (void)n;
+            assertf(n == len, "asset: decompression error on file %s: corrupted? (%d/%d)", fn, n, len);
+        } else {
+            void *chunk = algo->decompress_full(fn, fp, cmp_size, len);
+            memcpy(s+pos, chunk, len);
+            free(chunk);
+        }
+    }
+
+    free(in);
+    free(index);
+    return realloc(s, size);
+}
+
 void *asset_load(const char *fn, int *sz)
 {
     uint8_t *s; int size;
@@ -181,7 +244,9 @@ void *asset_load(const char *fn, int *sz)
             "asset: compression level %d not initialized. Call asset_init_compression(%d) at initialization time", header.algo, header.algo);
 
         size = header.orig_size;
-        if ((header.flags & ASSET_FLAG_INPLACE) && algos[header.algo-1].decompress_full_inplace)
+        if (header.flags & ASSET_FLAG_CHUNKED)
+            s = decompress_chunked(&algos[header.algo-1], fn, f, size);
+        else if ((header.flags & ASSET_FLAG_INPLACE) && algos[header.algo-1].decompress_full_inplace)
             s = decompress_inplace(&algos[header.algo-1], fn, f, header.cmp_size, size, header.inplace_margin);
         else
             s = algos[header.algo-1].decompress_full(fn, f, header.cmp_size, size);
@@ -290,6 +355,103 @@ static int closefn_cmp(void *c)
     return 0;
 }
 
+typedef struct  {
+    FILE *fp;
+    int pos;
+    int size;
+    int chunk_left;
+    long data_offset;
+    asset_chunk_index_t *index;
+    void (*reset)(void *state);
+    ssize_t (*read)(void *state, void *buf, size_t len);
+    uint8_t alignas(8) state[];
+} cookie_chunked_t;
+
+// Restart decompression at the beginning of the chunk containing the
+// current position, and skip data up to the current position.
+static void chunked_restart(cookie_chunked_t *cookie)
+{
+    int chunk = cookie->pos / cookie->index->chunk_size;
+    int chunk_pos = chunk * cookie->index->chunk_size;
+
+    fseek(cookie->fp, cookie->data_offset + cookie->index->offsets[chunk], SEEK_SET);
+    cookie->reset(cookie->state);
+    cookie->chunk_left = MIN(cookie->index->chunk_size, cookie->size - chunk_pos);
+
+    int skip = cookie->pos - chunk_pos;
+    uint8_t buf[128];
+    while (skip > 0) {
+        int n = cookie->read(cookie->state, buf, MIN(skip, sizeof(buf)));
+        if (n <= 0) break;
+        skip -= n;
+        cookie->chunk_left -= n;
+    }
+}
+
+static int readfn_chunked(void *c, char *buf, int sz)
+{
+    cookie_chunked_t *cookie = (cookie_chunked_t*)c;
+    int total = 0;
+    while (sz > 0 && cookie->pos < cookie->size) {
+        // Move to the next chunk when the current one is finished
+        if (cookie->chunk_left == 0)
+            chunked_restart(cookie);
+        int n = cookie->read(cookie->state, (uint8_t*)buf, MIN(sz, cookie->chunk_left));
+        if (n <= 0) break;
+        cookie->pos += n;
+        cookie->chunk_left -= n;
+        buf += n; sz -= n; total += n;
+    }
+    return total;
+}
+
+static fpos_t seekfn_chunked(void *c, fpos_t pos, int whence)
+{
+    cookie_chunked_t *cookie = (cookie_chunked_t*)c;
+
+    switch (whence) {
+    case SEEK_SET: break;
+    case SEEK_CUR: pos += cookie->pos; break;
+    case SEEK_END: pos += cookie->size; break;
+    default: return -1;
+    }
+    if (pos < 0 || pos > cookie->size)
+        return -1;
+    if (pos == cookie->pos)
+        return pos;
+
+    // Seeking forward within the current chunk can be done by just
+    // decompressing and discarding data. Otherwise, restart from the
+    // chunk that contains the requested position.
+    int chunk_end = cookie->pos + cookie->chunk_left;
+    if (pos > cookie->pos && pos < chunk_end) {
+        uint8_t buf[128];
+        while (cookie->pos < pos) {
+            int n = cookie->read(cookie->state, buf, MIN(pos - cookie->pos, sizeof(buf)));
+            if (n <= 0) return -1;
+            cookie->pos += n;
+            cookie->chunk_left -= n;
+        }
+        return pos;
+    }
+
+    cookie->pos = pos;
+    if (pos < cookie->size)
+        chunked_restart(cookie);
+    else
+        cookie->chunk_left = 0;
+    return pos;
+}
+
+static int closefn_chunked(void *c)
+{
+    cookie_chunked_t *cookie = (cookie_chunked_t*)c;
+    fclose(cookie->fp); cookie->fp = NULL;
+    free(cookie->index);
+    free(cookie);
+    return 0;
+}
+
 FILE *asset_fopen(const char *fn, int *sz)
 {
     FILE *f = must_fopen(fn);
@@ -325,6 +487,23 @@ FILE *asset_fopen(const char *fn, int *sz)
             "asset: compression level %d does not currently support asset_fopen()", header.algo);
 
         int winsize = asset_winsize_from_flags(header.flags);
+
+        if (header.flags & ASSET_FLAG_CHUNKED) {
+            // Chunked file: the returned FILE* supports seeking.
+            cookie_chunked_t *cookie = malloc(sizeof(cookie_chunked_t) + algos[header.algo-1].state_size + winsize);
+            cookie->read = algos[header.algo-1].decompress_read;
+            cookie->reset = algos[header.algo-1].decompress_reset;
+            cookie->index = chunk_index_read(f);
+            cookie->data_offset = ftell(f);
+            cookie->fp = f;
+            cookie->pos = 0;
+            cookie->size = header.orig_size;
+            algos[header.algo-1].decompress_init(cookie->state, f, winsize);
+            chunked_restart(cookie);
+            if (sz) *sz = header.orig_size;
+            return funopen(cookie, readfn_chunked, NULL, seekfn_chunked, closefn_chunked);
+        }
+
         cookie = malloc(sizeof(cookie_cmp_t) + algos[header.algo-1].state_size + winsize);
         cookie->read = algos[header.algo-1].decompress_read;
         cookie->reset = algos[header.algo-1].decompress_reset;
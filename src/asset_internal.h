@@ -15,6 +15,7 @@
 #define ASSET_FLAG_WINSIZE_128K     0x0006  ///< 128 KiB window size
 #define ASSET_FLAG_WINSIZE_256K     0x0007  ///< 256 KiB window size
 #define ASSET_FLAG_INPLACE          0x0100  ///< Decompress in-place
+#define ASSET_FLAG_CHUNKED          0x0200  ///< Data is split in independently compressed chunks (see #asset_chunk_index_t)
 #define ASSET_ALIGNMENT             32
 
 __attribute__((used))
@@ -52,6 +53,23 @@ typedef struct {
 
 _Static_assert(sizeof(asset_header_t) == 20, "invalid sizeof(asset_header_t)");
 
+/**
+ * @brief Chunk index of a chunked asset
+ * 
+ * Assets with the #ASSET_FLAG_CHUNKED flag are split into chunks of
+ * the same decompressed size (except the last one), and each chunk is
+ * compressed independently. The chunk index follows the header, and is
+ * followed by the compressed data of all chunks. This allows to start
+ * decompression at any chunk, so that the file can be seeked efficiently.
+ * 
+ * The #asset_header_t::cmp_size field includes the size of the index.
+ */
+typedef struct {
+    uint32_t chunk_size;    ///< Decompressed size of each chunk (except the last one)
+    uint32_t num_chunks;    ///< Number of chunks
+    uint32_t offsets[];     ///< Offsets of compressed chunks (num_chunks+1 entries, relative to the end of the index)
+} asset_chunk_index_t;
+
 /** @brief A decompression algorithm used by the asset library */
 typedef struct {
     int state_size;     ///< Basic size of the decompression state (without ringbuffer)
@@ -1,4 +1,9 @@
 #include "ay8910.h"
+#include "mixer_internal.h"
+#include "rspq.h"
+#include "n64sys.h"
+#include "utils.h"
+#include "debug.h"
 #include <assert.h>
 #include <memory.h>
 
@@ -146,15 +151,80 @@ static float fastrandf() {
 	return fastrand() * 2.3283064365386963e-10f;
 }
 
+/**
+ * @brief Step the generator of the random amplitudes used by the fast-noise modulation.
+ * 
+ * This is a 16-bit xorshift generator, with a period of 65535 samples: it
+ * is simple enough to be stepped once per sample by the RSP as well, and
+ * long enough not to be heard as a pitched tone.
+ * NOTE: keep in sync with AY8910_Render in rsp_mixer.S
+ */
+static inline uint16_t fastnoise_next(uint16_t x) {
+	x ^= x << 7;
+	x ^= x >> 9;
+	x ^= x << 8;
+	return x;
+}
+
+/**
+ * @brief Reseed the fast-noise generator after a call that rendered samples.
+ * 
+ * The RSP does not return the final state of the generator, so both the CPU
+ * and the RSP paths start each call from a new seed (never zero, which is a
+ * fixed point of the generator).
+ */
+static void fastnoise_reseed(AY8910 *ay) {
+	ay->fastnoise_state = (fastrand() >> 16) | 1;
+}
+
+_Static_assert(sizeof(AYRun) == 12, "invalid AYRun size");   // NOTE: keep in sync with rsp_mixer.S
+
+/** @brief Destination of the runs generated by #ay8910_gen_runs */
+typedef struct {
+	AYRun *runs;          ///< Buffer of runs
+	int nruns;            ///< Number of runs in the buffer
+	int max_runs;         ///< Capacity of the buffer
+	int16_t *out;         ///< If not NULL, expand the runs here when the buffer is full
+} AYRunBuffer;
+
+static void ay8910_render_runs(AY8910 *ay, const AYRun *runs, int nruns, int16_t *out);
+
+/** @brief Append a run to the buffer, merging it with the previous one if possible */
+static inline void emit_run(AY8910 *ay, AYRunBuffer *rb, float l, float r, float fnl, float fnr, int count) {
+	int16_t il = l, ir = r;
+	uint16_t ifnl = MIN(fnl, 65535.f), ifnr = MIN(fnr, 65535.f);
+	if (rb->nruns) {
+		AYRun *last = &rb->runs[rb->nruns-1];
+		if (last->l == il && last->r == ir && last->fnl == ifnl && last->fnr == ifnr && last->count + count <= 0xFFFF) {
+			last->count += count;
+			return;
+		}
+	}
+	if (rb->nruns == rb->max_runs) {
+		assert(rb->out);
+		ay8910_render_runs(ay, rb->runs, rb->nruns, rb->out);
+		for (int i=0; i<rb->nruns; i++)
+			rb->out += rb->runs[i].count * (AY8910_OUTPUT_STEREO ? 2 : 1);
+		rb->nruns = 0;
+	}
+	rb->runs[rb->nruns++] = (AYRun){ .l = il, .r = ir, .fnl = ifnl, .fnr = ifnr, .count = count };
+}
+
+#if AY8910_OUTPUT_STEREO
+#define EMIT(sl_, sr_, fnl_, fnr_, n_)  emit_run(ay, rb, sl_, sr_, fnl_, fnr_, n_)
+#else
+#define EMIT(s_, fn_, n_)               emit_run(ay, rb, s_, s_, fn_, fn_, n_)
+#endif
+
 // Optimized implementation, much faster.
 // This implementation is more complex compared to the reference once. It
 // inspects the internal state of the AY8910 and decides when the next state
 // change is going to happen. Then, it emits a fixed output for all the cycles
-// until next state change.
-int ay8910_gen(AY8910 *ay, int16_t *out, int nsamples) {
+// until next state change, as a run of identical samples (see #AYRun).
+// Runs are then expanded into samples by ay8910_render_runs (or by the RSP).
+static void ay8910_gen_runs(AY8910 *ay, AYRunBuffer *rb, int nsamples) {
 	nsamples *= AY8910_DECIMATE;
 
-	int16_t *iout = out;
 	#if AY8910_OUTPUT_STEREO
 	float sample_accum_l = 0;
 	float sample_accum_r = 0;
@@ -231,9 +301,12 @@ int ay8910_gen(AY8910 *ay, int16_t *out, int nsamples) {
 
 	// If the chip is completely silent, just early exit
 	if (!noise && ch0->tone_en && ch1->tone_en && ch2->tone_en) {
-		for (int i=0; i<nsamples/AY8910_DECIMATE; i++)
-			OUTS(VOL_TABLE[0]);
-		return nsamples/AY8910_DECIMATE;
+		#if AY8910_OUTPUT_STEREO
+		EMIT(SAMPLE_CONV(VOL_TABLE[0]), SAMPLE_CONV(VOL_TABLE[0]), 0, 0, nsamples/AY8910_DECIMATE);
+		#else
+		EMIT(SAMPLE_CONV(VOL_TABLE[0]), 0, nsamples/AY8910_DECIMATE);
+		#endif
+		return;
 	}
 
 	#if 0
@@ -350,34 +423,26 @@ int ay8910_gen(AY8910 *ay, int16_t *out, int nsamples) {
 						#if AY8910_OUTPUT_STEREO
 						sample_accum_l += (samplel - fnl*fr) * sa;
 						sample_accum_r += (sampler - fnr*fr) * sa;
-						OUT(sample_accum_l * (1.f / AY8910_DECIMATE), sample_accum_r * (1.f / AY8910_DECIMATE));
+						EMIT(sample_accum_l * (1.f / AY8910_DECIMATE), sample_accum_r * (1.f / AY8910_DECIMATE), 0, 0, 1);
 						#else
 						sample_accum += (sample - fn*fr) * sa;
-						OUT(sample_accum * (1.f / AY8910_DECIMATE));
+						EMIT(sample_accum * (1.f / AY8910_DECIMATE), 0, 1);
 						#endif
 						next -= sa;
 						sample_accum_n = 0;
 					}
 				}
 
+				// Emit the samples until the next state change as a single run.
+				// If fast-noise is active, the random amplitude is applied
+				// when the run is expanded.
 				int nn = next / AY8910_DECIMATE;
-				if (fastnoise) {
-					for (int i=0; i<nn; i++) {
-						float fr = fastrandf();
-						#if AY8910_OUTPUT_STEREO
-						OUT(samplel - fnl*fr, sampler - fnr*fr);
-						#else
-						OUT(sample - fn*fr);
-						#endif
-					}
-				} else {
-					for (int i=0; i<nn; i++) {
-						#if AY8910_OUTPUT_STEREO
-						OUT(samplel, sampler);
-						#else
-						OUT(sample);
-						#endif
-					}
+				if (nn) {
+					#if AY8910_OUTPUT_STEREO
+					EMIT(samplel, sampler, fnl, fnr, nn);
+					#else
+					EMIT(sample, fn, nn);
+					#endif
 				}
 
 				next -= nn*AY8910_DECIMATE;
@@ -392,13 +457,11 @@ int ay8910_gen(AY8910 *ay, int16_t *out, int nsamples) {
 				end_decim: (void)0;
 
 			} else {
-				for (int i=0; i<next; i++) {
-					#if AY8910_OUTPUT_STEREO
-					OUT(samplel, sampler);
-					#else
-					OUT(sample);
-					#endif
-				}
+				#if AY8910_OUTPUT_STEREO
+				EMIT(samplel, sampler, 0, 0, next);
+				#else
+				EMIT(sample, 0, next);
+				#endif
 			}
 		}
 
@@ -457,12 +520,65 @@ int ay8910_gen(AY8910 *ay, int16_t *out, int nsamples) {
 	}
 
 	assert(nsamples == 0);
-	return (out-iout) / (AY8910_OUTPUT_STEREO ? 2 : 1);
 }
+
+/** @brief Expand runs into samples. NOTE: keep in sync with AY8910_Render in rsp_mixer.S */
+static void ay8910_render_runs(AY8910 *ay, const AYRun *runs, int nruns, int16_t *out) {
+	uint16_t rnd = ay->fastnoise_state;
+	for (int i=0; i<nruns; i++) {
+		const AYRun *run = &runs[i];
+		for (int j=0; j<run->count; j++) {
+			// Same arithmetic of RSP opcodes VMUDL (unsigned*unsigned, high part) and
+			// VSUB (saturated), so that the output is bit-exact.
+			rnd = fastnoise_next(rnd);
+			int32_t sl = run->l - (int32_t)(((uint32_t)run->fnl * rnd) >> 16);
+			sl = sl < -32768 ? -32768 : sl > 32767 ? 32767 : sl;
+			#if AY8910_OUTPUT_STEREO
+			int32_t sr = run->r - (int32_t)(((uint32_t)run->fnr * rnd) >> 16);
+			sr = sr < -32768 ? -32768 : sr > 32767 ? 32767 : sr;
+			OUT(sl, sr);
+			#else
+			OUT(sl);
+			#endif
+		}
+	}
+	ay->fastnoise_state = rnd;
+}
+
+int ay8910_gen(AY8910 *ay, int16_t *out, int nsamples) {
+	// Use a small buffer on the stack, expanding the runs whenever it is full
+	AYRun runs[64];
+	AYRunBuffer rb = { .runs = runs, .max_runs = 64, .out = out };
+	ay8910_gen_runs(ay, &rb, nsamples);
+	ay8910_render_runs(ay, rb.runs, rb.nruns, rb.out);
+	fastnoise_reseed(ay);
+	return nsamples;
+}
+
+#if AY8910_OUTPUT_STEREO
+int ay8910_gen_rsp(AY8910 *ay, AYRun *runs, int16_t *out, int nsamples) {
+	assertf(nsamples <= 0xFFFF, "too many samples: %d", nsamples);
+	assertf(((uint32_t)out & 3) == 0, "output buffer must be 4-byte aligned");
+
+	// The buffer is big enough for the worst case (one run per sample)
+	AYRunBuffer rb = { .runs = runs, .max_runs = nsamples };
+	ay8910_gen_runs(ay, &rb, nsamples);
+	int nruns = rb.nruns;
+	data_cache_hit_writeback(runs, nruns * sizeof(AYRun));
+	rspq_write(__mixer_overlay_id, 0x2,
+		(ay->fastnoise_state << 16) | nruns,
+		PhysicalAddr(runs),
+		PhysicalAddr(out));
+
+	fastnoise_reseed(ay);
+	return nruns;
+}
+#endif
 #endif
 
 void ay8910_reset(AY8910 *ay) {
 	memset(ay, 0, sizeof(*ay));
+	ay->fastnoise_state = 1;
 	ay->ns.out = 1;
 	ay->ns.period = 1;
 	ay->env.period = 1;
@@ -107,6 +107,66 @@ int xm_create_context_safe(xm_context_t** ctxp, const char* moddata, size_t modd
 
 #if !defined(N64) && !XM_STREAM_PATTERNS && !XM_STREAM_WAVEFORMS
 
+/* Number of VADPCM frames stored for a compressed sample. Frames are
+ * decoded in pairs (32 samples), and one additional pair is stored at
+ * the end to account for the overread. */
+static uint32_t xm_sample_vadpcm_frames(xm_sample_t* s) {
+	return (s->length + 31) / 32 * 2 + 2;
+}
+
+/* Size in bytes of the data of a VADPCM compressed sample: header,
+ * codebook, frames and seek table. The header begins with the number of
+ * predictors and their order, which define the codebook size, followed
+ * by the seek table interval (0 if there is no seek table). */
+static uint32_t xm_sample_vadpcm_size(xm_sample_t* s) {
+	uint8_t npredictors = s->data8[0], order = s->data8[1];
+	uint16_t seek_interval = ((uint8_t)s->data8[2] << 8) | (uint8_t)s->data8[3];
+	uint32_t nframes = xm_sample_vadpcm_frames(s);
+	uint32_t nseek = seek_interval ? (nframes + seek_interval - 1) / seek_interval : 0;
+	return XM_VADPCM_HEADER_SIZE + npredictors * order * 16 + nframes * 9 + nseek * order * 2;
+}
+
+/* Load a VADPCM compressed sample, decoding it into the sample buffer as PCM
+ * with the original bit width of the sample. This is only used on the host
+ * (when waveforms are not streamed), where the VADPCM decoder is provided by
+ * audioconv64. */
+static void xm_sample_vadpcm_load(xm_sample_t* s, FILE* in) {
+	uint8_t head[XM_VADPCM_HEADER_SIZE];
+	fread(head, 1, sizeof(head), in);
+	int npredictors = head[0], order = head[1];
+	int seek_interval = (head[2] << 8) | head[3];
+
+	struct vadpcm_vector codebook[npredictors * order];
+	for (int i=0;i<npredictors * order;i++)
+		for (int j=0;j<8;j++) {
+			uint8_t v[2]; fread(v, 1, 2, in);
+			codebook[i].v[j] = (int16_t)((v[0] << 8) | v[1]);
+		}
+
+	uint32_t nframes = xm_sample_vadpcm_frames(s);
+	uint8_t *frames = malloc(nframes * 9);
+	int16_t *pcm = malloc(nframes * 16 * sizeof(int16_t));
+	fread(frames, 1, nframes * 9, in);
+	struct vadpcm_vector state = {0};
+	vadpcm_decode(npredictors, order, codebook, &state, nframes, pcm, frames);
+
+	int n = s->length + XM_WAVEFORM_OVERREAD / (s->bits / 8);
+	if (n > nframes * 16) n = nframes * 16;
+	for (int k=0;k<n;k++) {
+		if (s->bits == 8)
+			s->data8[k] = pcm[k] >> 8;
+		else
+			s->data16[k] = pcm[k];
+	}
+	s->format = XM_SAMPLE_FORMAT_RAW;
+	free(pcm);
+	free(frames);
+
+	/* Skip the seek table */
+	if (seek_interval)
+		fseek(in, (nframes + seek_interval - 1) / seek_interval * order * 2, SEEK_CUR);
+}
+
 void xm_context_save(xm_context_t* ctx, FILE* out) {
 
 	#undef _W64 // defined by mingw
@@ -127,7 +187,7 @@ void xm_context_save(xm_context_t* ctx, FILE* out) {
 	#define WALIGN()  ({ while (ftell(out) % 8) _W8(0); })
 
 
-	const uint8_t version = 6;
+	const uint8_t version = 7;
 	WA("XM64", 4);
 	W8(version);
 	W32(ctx->ctx_size);
@@ -224,6 +284,7 @@ void xm_context_save(xm_context_t* ctx, FILE* out) {
 			W32(s->loop_type);
 			WF(s->panning);
 			W8(s->relative_note);
+			W8(s->format);
 			sam_off[sam_off_idx++] = ftell(out);
 			W32(0); // will fill later
 		}
@@ -248,7 +309,9 @@ void xm_context_save(xm_context_t* ctx, FILE* out) {
 			fseek(out, pos, SEEK_SET);
 
 			assert(s->bits == 8 || s->bits == 16);
-			if (s->bits == 8)
+			if (s->format == XM_SAMPLE_FORMAT_VADPCM)
+				WA(s->data8, xm_sample_vadpcm_size(s));
+			else if (s->bits == 8)
 				WA(s->data8, s->length+XM_WAVEFORM_OVERREAD);
 			else {
 				for (int k=0;k<s->length+XM_WAVEFORM_OVERREAD/2;k++)
@@ -445,8 +508,9 @@ int xm_context_load(xm_context_t** ctxp, FILE* in, uint32_t rate) {
 	//  5: first public version
 	//  6: added overread for non-looping samples. The size of optimal
 	//     stream sample buffer size must change, hance the version bump.
+	//  7: added per-sample format, to support VADPCM compressed samples.
 	R8(version);
-	if (version != 5 && version != 6) {
+	if (version < 5 || version > 7) {
 		DEBUG("invalid XM64 version %d\n", version);
 		return 1;		
 	}
@@ -574,6 +638,8 @@ int xm_context_load(xm_context_t** ctxp, FILE* in, uint32_t rate) {
 			R32(s->loop_type);
 			RF(s->panning);
 			R8(s->relative_note);
+			if (version >= 7)
+				R8(s->format);
 			R32(s->data8_offset);
 		}
 	}
@@ -609,7 +675,9 @@ int xm_context_load(xm_context_t** ctxp, FILE* in, uint32_t rate) {
 			mempool += s->length * (s->bits / 8) + XM_WAVEFORM_OVERREAD;
 			if ((size_t)mempool & 7) mempool += 8 - ((size_t)mempool & 7);
 
-			if (s->bits == 8)
+			if (s->format == XM_SAMPLE_FORMAT_VADPCM)
+				xm_sample_vadpcm_load(s, in);
+			else if (s->bits == 8)
 				RA(s->data8, s->length+XM_WAVEFORM_OVERREAD);
 			else {
 				RA(s->data8, s->length*2+XM_WAVEFORM_OVERREAD);
@@ -16,6 +16,14 @@
 // this amount of bytes. See also rspxm.S for details.
 #define XM_WAVEFORM_OVERREAD      64
 
+// Format of the waveform data of a sample (see xm_sample_t.format).
+#define XM_SAMPLE_FORMAT_RAW      0   // Raw 8-bit or 16-bit PCM
+#define XM_SAMPLE_FORMAT_VADPCM   1   // VADPCM compressed (decoded to 16-bit PCM)
+
+// Size of the header that precedes the codebook in VADPCM-compressed
+// waveforms. Its layout matches wav64_header_vadpcm_t.
+#define XM_VADPCM_HEADER_SIZE     72
+
 #if XM_STREAM_WAVEFORMS
 typedef struct waveform_s waveform_t;
 #endif
@@ -106,6 +114,7 @@ struct xm_sample_s {
 	uint32_t loop_end;
 	float volume;
 	int8_t finetune;
+	uint8_t format; /* XM_SAMPLE_FORMAT_* */
 	xm_loop_type_t loop_type;
 	float panning;
 	int8_t relative_note;
@@ -16,6 +16,7 @@
 #include "n64sys.h"
 #include "interrupt.h"
 #include <memory.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <math.h>
 #include <stdio.h>
@@ -42,16 +43,8 @@
 #define AI_STATUS_FULL  ( 1 << 31 )
 /** @} */
 
-/** @brief Maximum number of mixer events */
-#define MAX_EVENTS              32
-/** @brief Number of expected #mixer_poll calls per second 
- *
- * This is used to allocate memory for the sample buffers
- * according to the expected number of samples that must
- * be calculated and held in memory.
- */
-#define MIXER_POLL_PER_SECOND   8
-
+/** @brief Initial capacity of the mixer event heap (it grows as needed) */
+#define MIXER_EVENTS_CHUNK      16
 /**
  * RSP mixer ucode (rsp_mixer.S)
  */
@@ -128,8 +121,25 @@ typedef struct rsp_mixer_settings_s {
 	uint32_t lvol[MIXER_MAX_CHANNELS/2] __attribute__((aligned(16)));
 	uint32_t rvol[MIXER_MAX_CHANNELS/2];
 	rsp_mixer_channel_t channels[MIXER_MAX_CHANNELS] __attribute__((aligned(16)));
+	/// State of the filter of each channel. This is not part of the settings
+	/// loaded in DMEM: it is only loaded and saved by command_exec_fx.
+	int16_t filter_state[MIXER_MAX_CHANNELS] __attribute__((aligned(16)));
 } rsp_mixer_settings_t;
 
+/// @cond
+_Static_assert(offsetof(rsp_mixer_settings_t, filter_state) == 0x380, "filter_state must follow SETTINGS_END in rsp_mixer.S");
+/// @endcond
+
+// NOTE: keep these in sync with rsp_mixer.S
+#define FX_CMD_SIZE         0x98     ///< Size of command_exec_fx in bytes
+
+/** @brief Minimum length of the reverb delay line (in samples).
+ *
+ * The RSP reads a whole loop of samples (MAX_SAMPLES_PER_LOOP) from the delay
+ * line before writing it back, so the delay must be longer than that.
+ */
+#define MIXER_REVERB_MIN_LEN    64
+
 /** @brief Configured limits of a mixer channel. 
  *
  * This structure describes the playback limits for a mixer channel. The limits
@@ -146,8 +156,22 @@ typedef struct {
 	int64_t ticks;          ///< Absolute time at which the event will trigger (ticks = output samples)
 	MixerEvent cb;          ///< Callback for the event
 	void *ctx;              ///< Opaque context pointer to pass to the callback
+	uint32_t seq;           ///< Scheduling order, to fire events due at the same tick in FIFO order
 } mixer_event_t;
 
+/** @brief A voice played through the voice allocator (see #mixer_voice_play) */
+typedef struct {
+	waveform_t *wave;       ///< Waveform being played (NULL if the slot is free)
+	mixer_fx64_t pos;       ///< Current position (in samples), valid while the voice is virtual
+	mixer_fx64_t step;      ///< Step between samples to playback at the correct frequency
+	float freq;             ///< Playback frequency
+	float vol;              ///< Volume
+	float pan;              ///< Panning
+	int priority;           ///< Priority (higher is more important)
+	int16_t ch;             ///< Mixer channel the voice is mapped to, or -1 if virtual
+	uint16_t gen;           ///< Generation counter, used to detect stale handles
+} mixer_voice_state_t;
+
 static struct {
 	uint32_t sample_rate;
 	int num_channels;
@@ -155,7 +179,10 @@ static struct {
 
 	int64_t ticks;
 	int num_events;
-	mixer_event_t events[MAX_EVENTS];
+	int max_events;
+	mixer_event_t *events;      ///< Min-heap of pending events, ordered by ticks
+	uint32_t event_seq;         ///< Sequence number of the next scheduled event
+	mixer_event_t *event_firing; ///< Event whose callback is being invoked (NULL if none)
 
 	uint8_t *ch_buf_mem;
 	samplebuffer_t ch_buf[MIXER_MAX_CHANNELS];
@@ -164,6 +191,21 @@ static struct {
 	mixer_channel_t channels[MIXER_MAX_CHANNELS];
 	mixer_fx15_t lvol[MIXER_MAX_CHANNELS];
 	mixer_fx15_t rvol[MIXER_MAX_CHANNELS];
+	uint16_t filter[MIXER_MAX_CHANNELS];        ///< Filter coefficient (0.16), or 0 if disabled
+	mixer_fx15_t send[MIXER_MAX_CHANNELS];      ///< Reverb send level
+
+	int16_t *reverb_buf;        ///< Reverb delay line (stereo samples, uncached), or NULL
+	int reverb_len;             ///< Length of the delay line (in samples)
+	int reverb_pos;             ///< Current position in the delay line (in samples)
+	mixer_fx15_t reverb_fb;     ///< Reverb feedback
+	mixer_fx15_t reverb_level;  ///< Reverb output level
+
+	int voice_first_ch;
+	int voice_num_ch;
+	int num_voices;
+	uint16_t voice_gen;
+	mixer_voice_state_t *voices;
+	uint16_t *voice_order;
 
 	rsp_mixer_settings_t ucode_settings __attribute__((aligned(16)));
 
@@ -252,6 +294,23 @@ void mixer_close(void) {
 		Mixer.ch_buf_mem = NULL;
 	}
 
+	if (Mixer.reverb_buf) {
+		free_uncached(Mixer.reverb_buf);
+		Mixer.reverb_buf = NULL;
+	}
+
+	free(Mixer.events);
+	Mixer.events = NULL;
+	Mixer.num_events = 0;
+	Mixer.max_events = 0;
+
+	free(Mixer.voices);
+	free(Mixer.voice_order);
+	Mixer.voices = NULL;
+	Mixer.voice_order = NULL;
+	Mixer.num_voices = 0;
+	Mixer.voice_num_ch = 0;
+
 	Mixer.num_channels = 0;
 }
 
@@ -299,6 +358,54 @@ void mixer_ch_set_vol_dolby(int ch, float fl, float fr,
 	);
 }
 
+void mixer_ch_set_filter(int ch, float cutoff) {
+	mixer_channel_t *c = &Mixer.channels[ch];
+	assertf(!(c->flags & CH_FLAGS_STEREO_SUB), "mixer_ch_set_filter: cannot call on secondary stereo channel %d", ch);
+	assertf(cutoff >= 0, "mixer_ch_set_filter: invalid cutoff frequency on channel %d: %f", ch, cutoff);
+
+	// One-pole low-pass filter: y[n] = x[n] + c * (y[n-1] - x[n]), with
+	// c = exp(-2*pi*fc/fs). A coefficient of 0 disables the filter.
+	uint16_t coeff = 0;
+	if (cutoff > 0 && cutoff < Mixer.sample_rate * 0.5f)
+		coeff = MIN(expf(-2.0f * (float)M_PI * cutoff / (float)Mixer.sample_rate) * 65536.0f, 65535.0f);
+	Mixer.filter[ch] = coeff;
+}
+
+void mixer_ch_set_reverb_send(int ch, float send) {
+	mixer_channel_t *c = &Mixer.channels[ch];
+	assertf(!(c->flags & CH_FLAGS_STEREO_SUB), "mixer_ch_set_reverb_send: cannot call on secondary stereo channel %d", ch);
+	assertf(send >= 0 && send <= 1, "mixer_ch_set_reverb_send: invalid send level on channel %d: %f", ch, send);
+	Mixer.send[ch] = MIXER_FX15(send);
+}
+
+void mixer_set_reverb(float delay, float feedback, float level) {
+	assertf(feedback >= 0 && feedback < 1, "mixer_set_reverb: invalid feedback: %f", feedback);
+	assertf(level >= 0 && level <= 1, "mixer_set_reverb: invalid level: %f", level);
+
+	int len = ROUND_UP((int)(delay * Mixer.sample_rate), 2);
+	if (len > 0 && len < MIXER_REVERB_MIN_LEN)
+		len = MIXER_REVERB_MIN_LEN;
+
+	if (len != Mixer.reverb_len) {
+		if (Mixer.reverb_buf) {
+			// Make sure the RSP is not using the delay line anymore
+			rspq_highpri_sync();
+			free_uncached(Mixer.reverb_buf);
+			Mixer.reverb_buf = NULL;
+		}
+		if (len) {
+			Mixer.reverb_buf = malloc_uncached(len * 2 * sizeof(int16_t));
+			assertf(Mixer.reverb_buf, "out of memory allocating reverb delay line");
+			memset(Mixer.reverb_buf, 0, len * 2 * sizeof(int16_t));
+		}
+		Mixer.reverb_len = len;
+		Mixer.reverb_pos = 0;
+	}
+
+	Mixer.reverb_fb = MIXER_FX15(feedback);
+	Mixer.reverb_level = MIXER_FX15(level);
+}
+
 // Given a position within a looping waveform, calculate its wrapped position
 // in the range [0, len], according to loop definition.
 // NOTE: this function should only be called on looping waveforms.
@@ -324,12 +431,18 @@ static void waveform_read(void *ctx, samplebuffer_t *sbuf, int wpos, int wlen, b
 		// No loop defined: just call the waveform's read function.
 		wave->read(wave->ctx, sbuf, wpos, wlen, seeking);
 	} else {
-		// Calculate wrapped position
-		if (wpos >= wave->len)
+		int loop_start = wave->len - wave->loop_len;
+
+		// Calculate wrapped position. If it wraps exactly to the loop point,
+		// we force seeking because it means that previous read finished just
+		// exactly at the end of the waveform.
+		if (wpos >= wave->len) {
 			wpos = waveform_wrap_wpos(wpos, wave->len, wave->loop_len);
+			if (wpos == loop_start)
+				seeking = true;
+		}
 
-		// If we are requesting a read from 0, we force seeking because it
-		// means that previous read finished just exactly at the loop point.
+		// Same if we are requesting a read from 0.
 		if (wpos == 0)
 			seeking = true;
 
@@ -362,7 +475,6 @@ static void waveform_read(void *ctx, samplebuffer_t *sbuf, int wpos, int wlen, b
 		// overread, we need to read the loop as many times as necessary
 		// (though technically, once would be sufficient without overread).
 		while (len2 > 0) {
-			int loop_start = wave->len - wave->loop_len;
 			int ns = MIN(len2, wave->loop_len);
 			wave->read(wave->ctx, sbuf, loop_start, ns, true);
 			len2 -= ns;
@@ -473,7 +585,220 @@ void mixer_ch_set_limits(int ch, int max_bits, float max_frequency, int max_buf_
 	}
 }
 
-static void mixer_exec(int32_t *out, int num_samples) {
+/** @brief Minimum number of voices allocated at once */
+#define MIXER_VOICES_CHUNK      16
+
+void mixer_voices_init(int first_ch, int num_ch) {
+	assert(mixer_initialized());
+	assertf(num_ch > 0 && first_ch >= 0 && first_ch + num_ch <= Mixer.num_channels,
+		"invalid channel range for voices: %d-%d (mixer has %d channels)", first_ch, first_ch+num_ch-1, Mixer.num_channels);
+
+	for (int i=0; i<Mixer.num_voices; i++)
+		mixer_voice_stop(((uint32_t)Mixer.voices[i].gen << 16) | (i+1));
+
+	Mixer.voice_first_ch = first_ch;
+	Mixer.voice_num_ch = num_ch;
+}
+
+static mixer_voice_state_t* voice_get(mixer_voice_t voice) {
+	int idx = (int)(voice & 0xFFFF) - 1;
+	if (idx < 0 || idx >= Mixer.num_voices)
+		return NULL;
+	mixer_voice_state_t *v = &Mixer.voices[idx];
+	if (!v->wave || v->gen != (voice >> 16))
+		return NULL;
+	return v;
+}
+
+mixer_voice_t mixer_voice_play(waveform_t *wave, int priority, float vol, float pan) {
+	assertf(Mixer.voice_num_ch, "mixer_voices_init() must be called before mixer_voice_play()");
+	assert(wave->channels == 1 || wave->channels == 2);
+
+	int idx = 0;
+	while (idx < Mixer.num_voices && Mixer.voices[idx].wave)
+		idx++;
+
+	if (idx == Mixer.num_voices) {
+		int size = Mixer.num_voices ? Mixer.num_voices * 2 : MIXER_VOICES_CHUNK;
+		assertf(size <= 0xFFFF, "too many voices");
+		Mixer.voices = realloc(Mixer.voices, size * sizeof(mixer_voice_state_t));
+		Mixer.voice_order = realloc(Mixer.voice_order, size * sizeof(uint16_t));
+		assertf(Mixer.voices && Mixer.voice_order, "out of memory allocating voices");
+		memset(&Mixer.voices[Mixer.num_voices], 0, (size - Mixer.num_voices) * sizeof(mixer_voice_state_t));
+		Mixer.num_voices = size;
+	}
+
+	mixer_voice_state_t *v = &Mixer.voices[idx];
+	*v = (mixer_voice_state_t){
+		.wave = wave,
+		.freq = wave->frequency,
+		.step = MIXER_FX64(wave->frequency / (float)Mixer.sample_rate),
+		.vol = vol,
+		.pan = pan,
+		.priority = priority,
+		.ch = -1,
+		.gen = ++Mixer.voice_gen,
+	};
+
+	tracef("mixer_voice_play: voice=%d prio=%d vol=%.2f wave=%s\n", idx, priority, vol, wave->name);
+	return ((uint32_t)v->gen << 16) | (idx+1);
+}
+
+void mixer_voice_set_vol_pan(mixer_voice_t voice, float vol, float pan) {
+	mixer_voice_state_t *v = voice_get(voice);
+	if (!v) return;
+	v->vol = vol;
+	v->pan = pan;
+	if (v->ch >= 0)
+		mixer_ch_set_vol_pan(v->ch, vol, pan);
+}
+
+void mixer_voice_set_freq(mixer_voice_t voice, float frequency) {
+	mixer_voice_state_t *v = voice_get(voice);
+	if (!v) return;
+	assertf(frequency >= 0, "mixer_voice_set_freq: cannot set negative frequency: %f", frequency);
+	v->freq = frequency;
+	v->step = MIXER_FX64(frequency / (float)Mixer.sample_rate);
+	if (v->ch >= 0)
+		mixer_ch_set_freq(v->ch, frequency);
+}
+
+void mixer_voice_stop(mixer_voice_t voice) {
+	mixer_voice_state_t *v = voice_get(voice);
+	if (!v) return;
+	if (v->ch >= 0)
+		mixer_ch_stop(v->ch);
+	v->ch = -1;
+	v->wave = NULL;
+}
+
+bool mixer_voice_playing(mixer_voice_t voice) {
+	mixer_voice_state_t *v = voice_get(voice);
+	// A mapped voice might have been stopped by the mixer at the end of the
+	// waveform. It will be released at next mixer_exec.
+	return v && (v->ch < 0 || Mixer.channels[v->ch].ptr);
+}
+
+bool mixer_voice_audible(mixer_voice_t voice) {
+	mixer_voice_state_t *v = voice_get(voice);
+	return v && v->ch >= 0 && Mixer.channels[v->ch].ptr;
+}
+
+// Wrap the position of a voice within the waveform, following the loop.
+// Returns false if the voice reached the end of the waveform.
+static bool voice_wrap_pos(mixer_voice_state_t *v) {
+	mixer_fx64_t len = MIXER_FX64((int64_t)v->wave->len);
+	mixer_fx64_t loop_len = MIXER_FX64((int64_t)v->wave->loop_len);
+	if (v->pos < len)
+		return true;
+	if (!loop_len)
+		return false;
+	v->pos = len - loop_len + (v->pos - len) % loop_len;
+	return true;
+}
+
+// Sort voices by audibility: priority first, then volume. At parity,
+// prefer voices that are already mapped, to avoid continuously swapping
+// voices with the same audibility.
+static int voice_cmp(const void *a, const void *b) {
+	const mixer_voice_state_t *va = &Mixer.voices[*(const uint16_t*)a];
+	const mixer_voice_state_t *vb = &Mixer.voices[*(const uint16_t*)b];
+	if (va->priority != vb->priority)
+		return vb->priority - va->priority;
+	if (va->vol != vb->vol)
+		return va->vol < vb->vol ? 1 : -1;
+	return (vb->ch >= 0) - (va->ch >= 0);
+}
+
+// Map the most audible voices to the reserved mixer channels, and
+// virtualize the others. Called before mixing.
+static void mixer_voices_map(void) {
+	uint16_t *order = Mixer.voice_order;
+	int n = 0;
+
+	for (int i=0; i<Mixer.num_voices; i++) {
+		mixer_voice_state_t *v = &Mixer.voices[i];
+		if (!v->wave) continue;
+		// Release voices whose channel was stopped at the end of the waveform
+		if (v->ch >= 0 && !Mixer.channels[v->ch].ptr) {
+			v->ch = -1;
+			v->wave = NULL;
+			continue;
+		}
+		order[n++] = i;
+	}
+	if (!n) return;
+
+	qsort(order, n, sizeof(uint16_t), voice_cmp);
+
+	// Select the voices to map, in order of audibility. Voices with no volume
+	// are never mapped, as they would waste mixing time.
+	int free_ch = Mixer.voice_num_ch;
+	int nsel = 0;
+	for (int i=0; i<n; i++) {
+		mixer_voice_state_t *v = &Mixer.voices[order[i]];
+		if (v->vol <= 0 || v->wave->channels > free_ch) {
+			// Not selected: if it was mapped, virtualize it, saving the
+			// current position.
+			if (v->ch >= 0) {
+				mixer_channel_t *c = &Mixer.channels[v->ch];
+				v->pos = c->pos >> (c->flags & CH_FLAGS_BPS_SHIFT);
+				mixer_ch_stop(v->ch);
+				v->ch = -1;
+				tracef("mixer_voices_map: virtualize voice %d\n", order[i]);
+				if (!voice_wrap_pos(v))
+					v->wave = NULL;
+			}
+			continue;
+		}
+		free_ch -= v->wave->channels;
+		order[nsel++] = order[i];
+	}
+
+	// Compute the channels still used by the voices that stay mapped
+	uint32_t used = 0;
+	for (int i=0; i<nsel; i++) {
+		mixer_voice_state_t *v = &Mixer.voices[order[i]];
+		if (v->ch >= 0)
+			used |= ((1u << v->wave->channels) - 1) << (v->ch - Mixer.voice_first_ch);
+	}
+
+	// Map the selected virtual voices to free channels. Stereo voices need
+	// two consecutive channels: if there are none because of fragmentation,
+	// the voice stays virtual for now.
+	for (int i=0; i<nsel; i++) {
+		mixer_voice_state_t *v = &Mixer.voices[order[i]];
+		if (v->ch >= 0) continue;
+
+		uint32_t mask = (1u << v->wave->channels) - 1;
+		for (int ch=0; ch + v->wave->channels <= Mixer.voice_num_ch; ch++) {
+			if (used & (mask << ch)) continue;
+			used |= mask << ch;
+			v->ch = Mixer.voice_first_ch + ch;
+
+			mixer_ch_play(v->ch, v->wave);
+			mixer_ch_set_freq(v->ch, v->freq);
+			mixer_ch_set_vol_pan(v->ch, v->vol, v->pan);
+			mixer_channel_t *c = &Mixer.channels[v->ch];
+			c->pos = v->pos << (c->flags & CH_FLAGS_BPS_SHIFT);
+			tracef("mixer_voices_map: map voice %d to channel %d\n", order[i], v->ch);
+			break;
+		}
+	}
+}
+
+// Advance the position of virtual voices. Called after mixing.
+static void mixer_voices_advance(int num_samples) {
+	for (int i=0; i<Mixer.num_voices; i++) {
+		mixer_voice_state_t *v = &Mixer.voices[i];
+		if (!v->wave || v->ch >= 0) continue;
+		v->pos += v->step * num_samples;
+		if (!voice_wrap_pos(v))
+			v->wave = NULL;
+	}
+}
+
+static void mixer_exec(int16_t *out, int num_samples) {
 	if (!Mixer.ch_buf_mem) {
 		// If we have not yet allocated the memory for the sample buffers,
 		// this is a good moment to do so.
@@ -482,6 +807,9 @@ static void mixer_exec(int32_t *out, int num_samples) {
 
 	tracef("mixer_exec: 0x%x samples\n", num_samples);
 
+	if (Mixer.num_voices)
+		mixer_voices_map();
+
 	uint32_t fake_loop = 0;
 
 	for (int i=0; i<Mixer.num_channels; i++) {
@@ -666,13 +994,61 @@ static void mixer_exec(int32_t *out, int num_samples) {
 		gvol *= (FADE_OUT_TIME - MIN(elapsed, FADE_OUT_TIME)) / FADE_OUT_TIME;
 	}
 
+	// Check whether any effect is active. If not, use the standard mixing
+	// command, which is faster.
+	bool fx = Mixer.reverb_buf != NULL;
+	uint16_t filter[MIXER_MAX_CHANNELS] __attribute__((aligned(8))) = {0};
+	mixer_fx15_t send[MIXER_MAX_CHANNELS] __attribute__((aligned(8))) = {0};
+	for (int ch=0;ch<Mixer.num_channels;ch++) {
+		mixer_channel_t *c = &Mixer.channels[ch];
+		// The right half of a stereo waveform uses the effects of the left one.
+		int src = (c->flags & CH_FLAGS_STEREO_SUB) ? ch-1 : ch;
+		filter[ch] = Mixer.filter[src];
+		// The RSP computes the sends from the samples before the volume is
+		// applied, so scale them by the channel volume (which is 0 for
+		// stopped channels) and the global volume.
+		int vol = MAX(lvol[ch], rvol[ch]);
+		send[ch] = MIN((int)(Mixer.send[src] * vol * gvol) >> MIXER_FX15_FRAC, 0x7FFF);
+		if (filter[ch]) fx = true;
+	}
+
 	uint32_t t0 = TICKS_READ();
 	rspq_highpri_begin();
-	rspq_write(__mixer_overlay_id, 0,
-		(((uint32_t)MIXER_FX16(gvol)) & 0xFFFF),
-		(num_samples << 16) | Mixer.num_channels,
-		PhysicalAddr(out),
-		PhysicalAddr(&Mixer.ucode_settings));
+	if (!fx) {
+		rspq_write(__mixer_overlay_id, 0,
+			(((uint32_t)MIXER_FX16(gvol)) & 0xFFFF),
+			(num_samples << 16) | Mixer.num_channels,
+			PhysicalAddr(out),
+			PhysicalAddr(&Mixer.ucode_settings));
+	} else {
+		// Split the mixing so that each command never wraps around the
+		// reverb delay line.
+		uint32_t *filter32 = (uint32_t*)filter;
+		uint32_t *send32 = (uint32_t*)send;
+		for (int done = 0; done < num_samples; ) {
+			int ns = num_samples - done;
+			uint32_t reverb = 0;
+			if (Mixer.reverb_buf) {
+				ns = MIN(ns, Mixer.reverb_len - Mixer.reverb_pos);
+				reverb = PhysicalAddr(Mixer.reverb_buf + Mixer.reverb_pos*2);
+				Mixer.reverb_pos = (Mixer.reverb_pos + ns) % Mixer.reverb_len;
+			}
+
+			rspq_write_t w = rspq_write_begin(__mixer_overlay_id, 3, FX_CMD_SIZE/4);
+			rspq_write_arg(&w, ((uint32_t)MIXER_FX16(gvol)) & 0xFFFF);
+			rspq_write_arg(&w, (ns << 16) | Mixer.num_channels);
+			rspq_write_arg(&w, reverb);
+			rspq_write_arg(&w, ((uint16_t)Mixer.reverb_fb << 16) | (uint16_t)Mixer.reverb_level);
+			for (int i=0;i<MIXER_MAX_CHANNELS/2;i++)
+				rspq_write_arg(&w, filter32[i]);
+			for (int i=0;i<MIXER_MAX_CHANNELS/2;i++)
+				rspq_write_arg(&w, send32[i]);
+			rspq_write_arg(&w, PhysicalAddr(out + done*2));
+			rspq_write_arg(&w, PhysicalAddr(&Mixer.ucode_settings));
+			rspq_write_end(&w);
+			done += ns;
+		}
+	}
 	rspq_highpri_end();
 
 	rspq_highpri_sync();
@@ -685,60 +1061,126 @@ static void mixer_exec(int32_t *out, int num_samples) {
 			ch->pos += (uint64_t)rsp_wv[i].pos - (uint64_t)(ch->pos & 0x7FFFFFFF);
 	}
 
+	if (Mixer.num_voices)
+		mixer_voices_advance(num_samples);
+
 	Mixer.ticks += num_samples;
 }
 
-static mixer_event_t* mixer_next_event(void) {
-	mixer_event_t *e = NULL;
-	for (int i=0;i<Mixer.num_events;i++) {
-		if (!e || Mixer.events[i].ticks < e->ticks)
-			e = &Mixer.events[i];
+/** @brief Return true if event a must fire before event b */
+static inline bool mixer_event_before(mixer_event_t *a, mixer_event_t *b) {
+	if (a->ticks != b->ticks)
+		return a->ticks < b->ticks;
+	return (int32_t)(a->seq - b->seq) < 0;
+}
+
+/** @brief Move an event up in the heap until the heap property is restored */
+static void mixer_events_sift_up(int idx) {
+	mixer_event_t e = Mixer.events[idx];
+	while (idx > 0) {
+		int parent = (idx - 1) / 2;
+		if (!mixer_event_before(&e, &Mixer.events[parent]))
+			break;
+		Mixer.events[idx] = Mixer.events[parent];
+		idx = parent;
+	}
+	Mixer.events[idx] = e;
+}
+
+/** @brief Move an event down in the heap until the heap property is restored */
+static void mixer_events_sift_down(int idx) {
+	mixer_event_t e = Mixer.events[idx];
+	while (1) {
+		int child = idx * 2 + 1;
+		if (child >= Mixer.num_events)
+			break;
+		if (child + 1 < Mixer.num_events && mixer_event_before(&Mixer.events[child + 1], &Mixer.events[child]))
+			child++;
+		if (!mixer_event_before(&Mixer.events[child], &e))
+			break;
+		Mixer.events[idx] = Mixer.events[child];
+		idx = child;
+	}
+	Mixer.events[idx] = e;
+}
+
+/** @brief Insert an event in the heap, growing it if required */
+static void mixer_events_push(mixer_event_t e) {
+	if (Mixer.num_events == Mixer.max_events) {
+		int size = Mixer.max_events ? Mixer.max_events * 2 : MIXER_EVENTS_CHUNK;
+		Mixer.events = realloc(Mixer.events, size * sizeof(mixer_event_t));
+		assertf(Mixer.events, "out of memory allocating mixer events");
+		Mixer.max_events = size;
 	}
-	return e;
+	e.seq = Mixer.event_seq++;
+	Mixer.events[Mixer.num_events++] = e;
+	mixer_events_sift_up(Mixer.num_events - 1);
+}
+
+/** @brief Remove the event at the specified position of the heap */
+static void mixer_events_remove_at(int idx) {
+	Mixer.num_events--;
+	if (idx == Mixer.num_events)
+		return;
+	Mixer.events[idx] = Mixer.events[Mixer.num_events];
+	mixer_events_sift_down(idx);
+	mixer_events_sift_up(idx);
 }
 
 void mixer_add_event(int64_t delay, MixerEvent cb, void *ctx) {
-	Mixer.events[Mixer.num_events++] = (mixer_event_t){
+	mixer_events_push((mixer_event_t){
 		.cb = cb,
 		.ctx = ctx,
 		.ticks = Mixer.ticks + delay
-	};
+	});
 }
 
 void mixer_remove_event(MixerEvent cb, void *ctx) {
+	// If the callback being invoked removes itself, mark it so that it is
+	// not rescheduled, irrespective of its return value.
+	mixer_event_t *f = Mixer.event_firing;
+	if (f && f->cb == cb && f->ctx == ctx) {
+		f->cb = NULL;
+		return;
+	}
 	for (int i=0;i<Mixer.num_events;i++) {
 		if (Mixer.events[i].cb == cb && Mixer.events[i].ctx == ctx) {
-			memmove(&Mixer.events[i], &Mixer.events[i+1], sizeof(mixer_event_t) * (Mixer.num_events-i-1));
-			Mixer.num_events--;
+			mixer_events_remove_at(i);
 			return;
 		}
 	}
-	assertf("mixer_remove_event: specified event does not exist\ncb:%p ctx:%p", (void*)cb, ctx);
+	// The event might have been already deregistered (eg: it fired and
+	// returned 0), so ignore events that are not found.
 }
 
-void mixer_poll(int16_t *out16, int num_samples) {
-	int32_t *out = (int32_t*)out16;
-
+void mixer_poll(int16_t *out, int num_samples) {
 	// Since the AI can only play an even number of samples,
 	// it's not possible to call this function with an odd number,
 	// otherwise buffering might become complicated / impossible.
 	assert(num_samples % 2 == 0);
 
 	while (num_samples > 0) {
-		mixer_event_t *e = mixer_next_event();
-
-		int ns = MIN(num_samples, e ? e->ticks - Mixer.ticks : num_samples);
-		if (ns > 0) {
-			mixer_exec(out, ns);
-			out += ns;
-			num_samples -= ns;
-		}
-		if (e && Mixer.ticks == e->ticks) {
-			int64_t repeat = e->cb(e->ctx);
-			if (repeat)
-				e->ticks += repeat;
-			else
-				mixer_remove_event(e->cb, e->ctx);
+		// Fire all the events that are due. Each event is popped from the heap
+		// before invoking its callback, so that the callback is free to add or
+		// remove events (including itself: see mixer_remove_event).
+		while (Mixer.num_events && Mixer.events[0].ticks <= Mixer.ticks) {
+			mixer_event_t e = Mixer.events[0];
+			mixer_events_remove_at(0);
+			Mixer.event_firing = &e;
+			int64_t repeat = e.cb(e.ctx);
+			Mixer.event_firing = NULL;
+			if (repeat && e.cb) {
+				e.ticks += repeat;
+				mixer_events_push(e);
+			}
 		}
+
+		// Mix up to the next event, so that it fires exactly at its sample.
+		int ns = num_samples;
+		if (Mixer.num_events)
+			ns = MIN(ns, Mixer.events[0].ticks - Mixer.ticks);
+		mixer_exec(out, ns);
+		out += ns*2;
+		num_samples -= ns;
 	}
 }
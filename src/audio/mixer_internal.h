@@ -3,6 +3,14 @@
 
 #include <stdint.h>
 
+/** @brief Number of expected #mixer_poll calls per second 
+ *
+ * This is used to allocate memory for the sample buffers
+ * according to the expected number of samples that must
+ * be calculated and held in memory.
+ */
+#define MIXER_POLL_PER_SECOND   8
+
 /** @brief RSPQ overlay ID assigned to the mixer ucode */
 extern uint32_t __mixer_overlay_id;
 
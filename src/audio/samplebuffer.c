@@ -184,13 +184,14 @@ void samplebuffer_discard(samplebuffer_t *buf, int wpos) {
 		idx = buf->widx;
 
 	// Make sure moving this sample at the beginning of the buffer doesn't change
-	// the 2-byte phase of the waveform address. This is not strictly required,
-	// but it helps waveform implementations that want to use dma_read().
-	if ((idx << SAMPLES_BPS_SHIFT(buf)) & 1) {
+	// the 8-byte phase of the waveform address. This is required by waveforms
+	// decoded by the RSP (whose DMA ignores the lower bits of RDRAM addresses,
+	// see vadpcm_waveform_read), and it helps waveform implementations that
+	// want to use dma_read() (which requires the same 2-byte phase).
+	while ((idx << SAMPLES_BPS_SHIFT(buf)) & 7)
 		idx--;
-		if (idx == 0)
-			return;
-	}
+	if (idx == 0)
+		return;
 
 	tracef("samplebuffer_discard: wpos=%x idx:%x buf->wpos=%x buf->widx=%x\n", wpos, idx, buf->wpos, buf->widx);
 	int kept_bytes = (buf->widx - idx) << SAMPLES_BPS_SHIFT(buf);
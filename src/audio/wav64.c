@@ -19,6 +19,7 @@
 #include <string.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <stdio.h>
 #include <errno.h>
 #include <limits.h>
 #include <stdalign.h>
@@ -31,10 +32,24 @@
 /** ID of a WAVX file (big-endian WAV) */
 #define WAV_RIFX_ID   "RIFX"
 
+/** @brief Maximum number of VADPCM frames decoded by the RSP in a single command */
+#define VADPCM_MAX_BLOCK_FRAMES      256
+
+/** @brief Maximum number of frames decoded by the CPU to reach a seek position from a known state */
+#define VADPCM_MAX_SEEK_FRAMES       64
+
+/** @brief Convert a ROM address into a PI address suitable for #dma_read_async */
+#define WAV64_PI_ADDR(rom_addr)      (((rom_addr) | 0x10000000) & 0x1FFFFFFF)
+
+/** @brief Granularity of reads from filesystems (size of a SD card sector) */
+#define WAV64_STREAM_SECTOR_SIZE     512
+
+/** @brief Number of mixer polls worth of data read ahead when streaming from a filesystem */
+#define WAV64_STREAM_READAHEAD_POLLS 2
+
 /** @brief Profile of DMA usage by WAV64, used for debugging purposes. */
 int64_t __wav64_profile_dma = 0;
 
-#if VADPCM_REFERENCE_DECODER
 /** @brief VADPCM decoding errors */
 typedef enum {
     // No error (success). Equal to 0.
@@ -69,7 +84,6 @@ static int vadpcm_clamp16(int x) {
     return x;
 }
 
-__attribute__((unused))
 static vadpcm_error vadpcm_decode(int predictor_count, int order,
                            const wav64_vadpcm_vector_t *restrict codebook,
                            wav64_vadpcm_vector_t *restrict state,
@@ -132,12 +146,12 @@ static vadpcm_error vadpcm_decode(int predictor_count, int order,
     }
     return 0;
 }
-#else
 
+#if !VADPCM_REFERENCE_DECODER
 static inline void rsp_vadpcm_decompress(void *input, int16_t *output, bool stereo, int nframes, 
 	wav64_vadpcm_vector_t *state, wav64_vadpcm_vector_t *codebook)
 {
-	assert(nframes > 0 && nframes <= 256);
+	assert(nframes > 0 && nframes <= VADPCM_MAX_BLOCK_FRAMES);
 	rspq_write(__mixer_overlay_id, 0x1,
 		PhysicalAddr(input), 
 		PhysicalAddr(output) | (nframes-1) << 24,
@@ -147,79 +161,404 @@ static inline void rsp_vadpcm_decompress(void *input, int16_t *output, bool ster
 
 #endif /* VADPCM_REFERENCE_DECODER */
 
-void raw_waveform_read(samplebuffer_t *sbuf, int base_rom_addr, int wpos, int wlen, int bps) {
-	uint32_t rom_addr = base_rom_addr + (wpos << bps);
+wav64_stream_t* wav64_stream_open(const char *fn) {
+	wav64_stream_t *st = calloc(1, sizeof(wav64_stream_t));
+
+	// Files on DFS are read via PI DMA. For backward compatibility, we also
+	// accept a non-prefixed path as a file on DFS.
+	const char *dfs_fn = NULL;
+	if (!strstr(fn, ":/"))
+		dfs_fn = fn;
+	else if (strncmp(fn, "rom:/", 5) == 0)
+		dfs_fn = fn + 5;
+
+	if (dfs_fn) {
+		st->rom_addr = dfs_rom_addr(dfs_fn);
+		assertf(st->rom_addr, "error opening file %s: file not found\n", fn);
+	} else {
+		st->fh = fopen(fn, "rb");
+		assertf(st->fh, "error opening file %s: %s\n", fn, strerror(errno));
+		fseek(st->fh, 0, SEEK_END);
+		st->size = ftell(st->fh);
+		wav64_stream_set_readahead(st, WAV64_STREAM_SECTOR_SIZE, 1);
+	}
+	return st;
+}
+
+wav64_stream_t* wav64_stream_open_buf(const void *buf, int size) {
+	assertf(buf, "invalid NULL buffer");
+	wav64_stream_t *st = calloc(1, sizeof(wav64_stream_t));
+	st->mem = buf;
+	st->size = size;
+	return st;
+}
+
+static void wav64_stream_free_bufs(wav64_stream_t *st) {
+	for (int i=0; i<st->num_bufs; i++)
+		free(st->bufs[i].data);
+	free(st->bufs);
+	st->bufs = NULL;
+	st->num_bufs = 0;
+}
+
+void wav64_stream_set_readahead(wav64_stream_t *st, int bytes, int count) {
+	if (!st->fh) return;
+	bytes = ROUND_UP(bytes, WAV64_STREAM_SECTOR_SIZE);
+	if (!bytes) count = 0;
+	if (bytes == st->buf_size && count == st->num_bufs) return;
+	wav64_stream_free_bufs(st);
+	if (count) {
+		st->bufs = calloc(count, sizeof(wav64_stream_buf_t));
+		assertf(st->bufs, "out of memory allocating stream buffers");
+		for (int i=0; i<count; i++) {
+			st->bufs[i].data = malloc(bytes);
+			assertf(st->bufs[i].data, "out of memory allocating stream buffer");
+		}
+	}
+	st->num_bufs = count;
+	st->buf_size = bytes;
+}
+
+void wav64_stream_read(wav64_stream_t *st, void *dst, int offset, int bytes) {
+	if (st->rom_addr) {
+		// We rely on libdragon's PI DMA function which works also for
+		// misaligned addresses and odd lengths.
+		dma_read(dst, st->rom_addr + offset, bytes);
+		return;
+	}
+
+	// Zero the part of the read past the end of the data, as the mixer
+	// overreads waveforms on purpose.
+	int avail = MAX(st->size - offset, 0);
+	if (bytes > avail) {
+		memset((uint8_t*)dst + avail, 0, bytes - avail);
+		bytes = avail;
+	}
+
+	if (st->mem) {
+		memcpy(dst, st->mem + offset, bytes);
+		return;
+	}
+
+	uint8_t *out = dst;
+	while (bytes > 0) {
+		// Serve the request from a read-ahead buffer if possible. Otherwise,
+		// pick the buffer to refill: the one which was read up to this offset
+		// (so that a sequential reader keeps using its own buffer), or else
+		// the least recently used one.
+		wav64_stream_buf_t *b = NULL, *victim = NULL;
+		for (int i=0; i<st->num_bufs; i++) {
+			wav64_stream_buf_t *cur = &st->bufs[i];
+			if (offset >= cur->offset && offset < cur->offset + cur->len) {
+				b = cur;
+				break;
+			}
+			if (!victim || (victim->offset + victim->len != offset &&
+			    (cur->offset + cur->len == offset || cur->last_use < victim->last_use)))
+				victim = cur;
+		}
+		if (b) {
+			int n = MIN(bytes, b->offset + b->len - offset);
+			memcpy(out, b->data + offset - b->offset, n);
+			b->last_use = ++st->buf_clock;
+			out += n; offset += n; bytes -= n;
+			continue;
+		}
+
+		// Reads larger than the buffers go directly to the destination
+		if (bytes >= st->buf_size) {
+			fseek(st->fh, offset, SEEK_SET);
+			int n = fread(out, 1, bytes, st->fh);
+			assertf(n == bytes, "error reading stream at offset %d: %d/%d bytes", offset, n, bytes);
+			return;
+		}
+
+		// Refill the buffer, starting from the sector containing the offset
+		victim->offset = offset & ~(WAV64_STREAM_SECTOR_SIZE-1);
+		fseek(st->fh, victim->offset, SEEK_SET);
+		victim->len = fread(victim->data, 1, st->buf_size, st->fh);
+		assertf(victim->offset + victim->len > offset, "error reading stream at offset %d", offset);
+	}
+}
+
+void wav64_stream_read_async(wav64_stream_t *st, void *dst, int offset, int bytes) {
+	if (st->rom_addr)
+		dma_read_async(dst, WAV64_PI_ADDR(st->rom_addr + offset), bytes);
+	else
+		wav64_stream_read(st, dst, offset, bytes);
+}
+
+void wav64_stream_wait(wav64_stream_t *st) {
+	if (st->rom_addr)
+		dma_wait();
+}
+
+void wav64_stream_close(wav64_stream_t *st) {
+	if (st->fh)
+		fclose(st->fh);
+	wav64_stream_free_bufs(st);
+	free(st);
+}
+
+void raw_waveform_read(samplebuffer_t *sbuf, wav64_stream_t *st, int base_offset, int wpos, int wlen, int bps) {
+	int offset = base_offset + (wpos << bps);
 	uint8_t* ram_addr = (uint8_t*)samplebuffer_append(sbuf, wlen);
 	int bytes = wlen << bps;
 
 	uint32_t t0 = TICKS_READ();
-	// Run the DMA transfer. We rely on libdragon's PI DMA function which works
-	// also for misaligned addresses and odd lengths.
 	// The mixer/samplebuffer guarantees that ROM/RAM addresses are always
 	// on the same 2-byte phase, as the only requirement of dma_read.
-	dma_read(ram_addr, rom_addr, bytes);
+	wav64_stream_read(st, ram_addr, offset, bytes);
 	__wav64_profile_dma += TICKS_READ() - t0;
 }
 
 static void waveform_read(void *ctx, samplebuffer_t *sbuf, int wpos, int wlen, bool seeking) {
 	wav64_t *wav = (wav64_t*)ctx;
 	int bps = (wav->wave.bits == 8 ? 0 : 1) + (wav->wave.channels == 2 ? 1 : 0);
-	raw_waveform_read(sbuf, wav->rom_addr, wpos, wlen, bps);
+	raw_waveform_read(sbuf, wav->stream, wav->data_offset, wpos, wlen, bps);
 }
 
-static void waveform_vadpcm_read(void *ctx, samplebuffer_t *sbuf, int wpos, int wlen, bool seeking) {
-	wav64_t *wav = (wav64_t*)ctx;
-	wav64_header_vadpcm_t *vhead = (wav64_header_vadpcm_t*)wav->ext;
+/**
+ * @brief Decode VADPCM frames on the CPU, starting from a known state.
+ * 
+ * Frames from @p start_frame (included) to @p end_frame (excluded) are decoded.
+ * Only the samples of the last two frames are kept in @p pcm, as frame f goes
+ * to pcm[ch][(f & 1) * 16]. @p state is updated with the final decoding state.
+ * 
+ * @return Offset in the stream of the first frame after @p end_frame
+ */
+static uint32_t vadpcm_cpu_decode(wav64_header_vadpcm_t *vhead, wav64_stream_t *st, int base_offset,
+	int channels, wav64_vadpcm_vector_t *state, int start_frame, int end_frame, int16_t pcm[2][32])
+{
+	// Copy the codebook into cached memory, to speed up CPU decoding
+	int codebook_size = vhead->npredictors * vhead->order * channels;
+	wav64_vadpcm_vector_t codebook[codebook_size];
+	memcpy(codebook, vhead->codebook, sizeof(codebook));
+
+	// Decode in chunks of 16 frames.
+	uint8_t src[16*9*2] __attribute__((aligned(16)));
+	uint32_t offset = base_offset + start_frame * 9 * channels;
+	for (int f = start_frame; f < end_frame; ) {
+		int nframes = MIN(end_frame - f, 16);
+		data_cache_hit_writeback_invalidate(src, sizeof(src));
+		uint32_t t0 = TICKS_READ();
+		wav64_stream_read(st, src, offset, nframes * 9 * channels);
+		__wav64_profile_dma += TICKS_READ() - t0;
+		offset += nframes * 9 * channels;
+
+		for (int i=0; i<nframes; i++, f++) {
+			for (int ch=0; ch<channels; ch++) {
+				vadpcm_error err = vadpcm_decode(
+					vhead->npredictors, vhead->order, codebook + vhead->npredictors * vhead->order * ch,
+					&state[ch], 1, &pcm[ch][(f & 1) * 16], src + (i * channels + ch) * 9);
+				assertf(err == 0, "VADPCM decoding error: %d\n", err);
+			}
+		}
+	}
+	return offset;
+}
+
+/**
+ * @brief Seek a VADPCM stream to an arbitrary position.
+ * 
+ * The decoding starts from the nearest preceding position with a known
+ * state (start of the stream, loop point, or entry of the seek table),
+ * and the CPU decodes forward up to the first even frame after @p wpos
+ * (so that the RSP can then continue with the same ROM/RDRAM 2-byte phase).
+ * The last two decoded frames (which contain @p wpos) are appended to the
+ * sample buffer, whose start is moved back to the first of them.
+ * 
+ * If no known state is close enough (eg: the file has no seek table), the
+ * decoding restarts from a zero state, which might cause a small glitch.
+ * 
+ * @return Number of samples appended from @p wpos onward (0-31)
+ */
+static int vadpcm_seek(samplebuffer_t *sbuf, wav64_header_vadpcm_t *vhead, wav64_stream_t *st, int base_offset,
+	int channels, int loop_pos, int seek_offset, int wpos)
+{
+	int frame = wpos / 16;
+	int end_frame = ROUND_UP(frame + (wpos % 16 ? 1 : 0), 2);
+	int n = end_frame * 16 - wpos;
+	int start_frame = 0;
+	wav64_vadpcm_vector_t state[2] = {0};
+
+	// Search the nearest known state. We need to decode at least the last
+	// two frames if n > 0.
+	if (seek_offset && vhead->seek_interval) {
+		int entry = (n > 0 ? end_frame - 2 : end_frame) / vhead->seek_interval;
+		int entry_size = vhead->order * sizeof(int16_t) * channels;
+		int16_t buf[8*2] __attribute__((aligned(16)));
+		data_cache_hit_writeback_invalidate(buf, sizeof(buf));
+		wav64_stream_read(st, buf, seek_offset + entry * entry_size, entry_size);
+		for (int ch=0; ch<channels; ch++)
+			for (int i=0; i<vhead->order; i++)
+				state[ch].v[8 - vhead->order + i] = buf[ch * vhead->order + i];
+		start_frame = entry * vhead->seek_interval;
+	}
+	// The loop state refers to the frame containing the loop point.
+	int loop_frame = loop_pos / 16;
+	if (loop_frame > start_frame && loop_frame <= (n > 0 ? end_frame - 2 : end_frame)) {
+		memcpy(state, vhead->loop_state, sizeof(state));
+		start_frame = loop_frame;
+	}
+	if (end_frame - start_frame > VADPCM_MAX_SEEK_FRAMES) {
+		memset(state, 0, sizeof(state));
+		start_frame = frame & ~1;
+	}
 
+	int16_t pcm[2][32] __attribute__((aligned(16)));
+	vhead->current_offset = vadpcm_cpu_decode(vhead, st, base_offset, channels, state, start_frame, end_frame, pcm);
+	memcpy(&vhead->state, state, sizeof(state));
+
+	// Append the decoded samples. The RSP will continue decoding right after
+	// them, and its output must be 8-byte aligned (RSP DMA ignores the lower
+	// bits of the address). So rather than appending an arbitrary number of
+	// samples from wpos onward, move the start of the sample buffer (which
+	// is empty after a seek) back to the start of the frame pair, and append
+	// all of its 32 samples. The ones before wpos are simply never played.
+	if (n > 0) {
+		assertf(sbuf->widx == 0, "vadpcm_seek: sample buffer not empty (widx:%x)", sbuf->widx);
+		sbuf->wpos -= wpos - (end_frame * 16 - 32);
+		int16_t *dst = samplebuffer_append(sbuf, 32);
+		for (int i = 0; i < 32; i++)
+			for (int ch=0; ch<channels; ch++)
+				*dst++ = pcm[ch][i];
+	}
+	return n;
+}
+
+/**
+ * @brief Continue decoding a VADPCM stream from the loop point.
+ * 
+ * This is used when the mixer unrolls a loop whose start is not aligned to
+ * a pair of frames, so that the RSP cannot restart from there. The CPU
+ * decodes the frames up to the first even frame after @p loop_pos, starting
+ * from the loop state (which refers to the frame containing the loop point),
+ * and appends only the samples from @p loop_pos onward, after the ones
+ * already present in the sample buffer.
+ * 
+ * @return Number of samples appended (1-31)
+ */
+static int vadpcm_loop(samplebuffer_t *sbuf, wav64_header_vadpcm_t *vhead, wav64_stream_t *st, int base_offset,
+	int channels, int loop_pos)
+{
+	#if !VADPCM_REFERENCE_DECODER
+	// The RSP might still be decoding the end of the waveform into the sample
+	// buffer, past the end that we are going to write to (see the truncation
+	// in vadpcm_waveform_read). Wait for it before writing from the CPU.
+	rspq_highpri_sync();
+	#endif
+
+	int start_frame = loop_pos / 16;
+	int end_frame = ROUND_UP(start_frame + 1, 2);
+	wav64_vadpcm_vector_t state[2];
+	memcpy(state, vhead->loop_state, sizeof(state));
+
+	int16_t pcm[2][32] __attribute__((aligned(16)));
+	vhead->current_offset = vadpcm_cpu_decode(vhead, st, base_offset, channels, state, start_frame, end_frame, pcm);
+	memcpy(&vhead->state, state, sizeof(state));
+
+	int n = end_frame * 16 - loop_pos;
+	int16_t *dst = samplebuffer_append(sbuf, n);
+	for (int i = 32 - n; i < 32; i++)
+		for (int ch=0; ch<channels; ch++)
+			*dst++ = pcm[ch][i];
+	return n;
+}
+
+void vadpcm_waveform_read(samplebuffer_t *sbuf, wav64_header_vadpcm_t *vhead, wav64_stream_t *st, int base_offset,
+	int channels, int len, int loop_pos, int seek_offset, int wpos, int wlen, bool seeking)
+{
 	if (seeking) {
-		if (wpos == 0) {
-			memset(&vhead->state, 0, sizeof(vhead->state));
-			vhead->current_rom_addr = wav->rom_addr;
+		int frame = wpos / 16;
+		if (wpos == 0 || (wpos == loop_pos && loop_pos % 32 == 0)) {
+			// Fast path: seeking to the start or to the loop point, where
+			// the decoding state is known and the RSP can directly restart
+			// (it needs to start on an even frame).
+			if (wpos == 0)
+				memset(&vhead->state, 0, sizeof(vhead->state));
+			else
+				memcpy(&vhead->state, &vhead->loop_state, sizeof(vhead->state));
+			vhead->current_offset = base_offset + frame * 9 * channels;
 		} else {
-			assertf(wpos == wav->wave.len - wav->wave.loop_len,
-				"wav64: seeking to %x not supported (%x %x)\n", wpos, wav->wave.len, wav->wave.loop_len);
-			memcpy(&vhead->state, &vhead->loop_state, sizeof(vhead->state));
-			vhead->current_rom_addr = wav->rom_addr + (wav->wave.len - wav->wave.loop_len) / 16 * 9;
+			// If the sample buffer is not empty, the mixer is unrolling the loop:
+			// the new samples must be appended right after the existing ones.
+			// Otherwise, this is a real seek.
+			int n;
+			if (sbuf->widx != 0) {
+				assertf(wpos == loop_pos, "vadpcm: invalid loop read at %x (loop: %x)", wpos, loop_pos);
+				n = vadpcm_loop(sbuf, vhead, st, base_offset, channels, loop_pos);
+			} else {
+				n = vadpcm_seek(sbuf, vhead, st, base_offset, channels, loop_pos, seek_offset, wpos);
+			}
+			wpos += n;
+			wlen -= n;
+			if (wlen <= 0) return;
 		}
 	}
 
 	wlen = ROUND_UP(wlen, 32);
 	if (wlen == 0) return;
 
+	// The RSP always decodes pairs of frames, so it might go past the end of
+	// the waveform. If the waveform loops, the extra samples must not be
+	// kept, as the mixer will append the loop right after the end.
+	int overread = 0;
+	if (loop_pos < len && wpos + wlen > len)
+		overread = wpos + wlen - len;
+
+	// Acquire the destination buffer for all the requested frames at once.
+	// Appending multiple times would risk compacting the sample buffer while
+	// the RSP is still decoding into it.
+	int nframes_left = wlen / 16;
+	uint8_t *dest = samplebuffer_append(sbuf, nframes_left*16);
+	int bps = SAMPLES_BPS_SHIFT(sbuf);
+
+	// Decode in blocks of up to VADPCM_MAX_BLOCK_FRAMES frames (the maximum
+	// supported by the RSP ucode in a single command). Blocks are pipelined:
+	// while a block is being decoded, the compressed data of the next one is
+	// being fetched from ROM via PI DMA (streams from other sources are
+	// read synchronously).
+	// The compressed data of each block is placed at the end of its own
+	// destination area, as VADPCM decoding can be safely made in-place, so no
+	// auxillary buffer is necessary. Block sizes are always multiple of 2 frames,
+	// so that the compressed data keeps the same 2-byte phase of ROM addresses.
+	int nframes = MIN(nframes_left, VADPCM_MAX_BLOCK_FRAMES);
+	int src_bytes = 9 * nframes * channels;
+	void *src = dest + ((nframes*16) << bps) - src_bytes;
+
+	uint32_t t0 = TICKS_READ();
+	wav64_stream_read_async(st, src, vhead->current_offset, src_bytes);
+	vhead->current_offset += src_bytes;
+
 	bool highpri = false;
-	while (wlen > 0) {
-		int nframes = wlen / 16;
-		// Most of the code here would be ready to loop over multiple blocks of
-		// 256 frames, but the problem is that we don't doublebuffer the RDRAM
-		// buffers, so the RSP doesn't get to process the data in time. This
-		// would require CPU-spinning here. Since it's a very rare case, just
-		// block it for now.
-		assert(nframes <= 256);
-		nframes = MIN(nframes, 256);
-
-		// Acquire destination buffer from the sample buffer
-		int16_t *dest = (int16_t*)samplebuffer_append(sbuf, nframes*16);
-
-		// Calculate source pointer at the end of the destination buffer.
-		// VADPCM decoding can be safely made in-place, so no auxillary buffer
-		// is necessary.
-		int src_bytes = 9 * nframes * wav->wave.channels;
-		void *src = (void*)dest + ((nframes*16) << SAMPLES_BPS_SHIFT(sbuf)) - src_bytes;
-
-		// Fetch compressed data
-		dma_read(src, vhead->current_rom_addr, src_bytes);
-		vhead->current_rom_addr += src_bytes;
+	while (1) {
+		// Wait for the compressed data of the current block
+		wav64_stream_wait(st);
+		__wav64_profile_dma += TICKS_READ() - t0;
+
+		// Start fetching the next block, if any
+		nframes_left -= nframes;
+		uint8_t *next_dest = dest + ((nframes*16) << bps);
+		int next_nframes = MIN(nframes_left, VADPCM_MAX_BLOCK_FRAMES);
+		int next_src_bytes = 9 * next_nframes * channels;
+		void *next_src = next_dest + ((next_nframes*16) << bps) - next_src_bytes;
+		if (next_nframes) {
+			t0 = TICKS_READ();
+			wav64_stream_read_async(st, next_src, vhead->current_offset, next_src_bytes);
+			vhead->current_offset += next_src_bytes;
+		}
 
 		#if VADPCM_REFERENCE_DECODER
-		if (wav->wave.channels == 1) {
+		if (channels == 1) {
 			vadpcm_error err = vadpcm_decode(
 				vhead->npredictors, vhead->order, vhead->codebook, vhead->state,
-				nframes, dest, src);
+				nframes, (int16_t*)dest, src);
 			assertf(err == 0, "VADPCM decoding error: %d\n", err);
 		} else {
-			assert(wav->wave.channels == 2);
+			assert(channels == 2);
 			int16_t uncomp[2][16];
-			int16_t *dst = dest;
+			int16_t *dst = (int16_t*)dest;
 
 			for (int i=0; i<nframes; i++) {
 				for (int j=0; j<2; j++) {
@@ -241,39 +580,52 @@ static void waveform_vadpcm_read(void *ctx, samplebuffer_t *sbuf, int wpos, int
 			rspq_highpri_begin();
 			highpri = true;
 		}
-		rsp_vadpcm_decompress(src, dest, wav->wave.channels==2, nframes, vhead->state, vhead->codebook);
+		rsp_vadpcm_decompress(src, (int16_t*)dest, channels==2, nframes, vhead->state, vhead->codebook);
 		#endif
 
-		wlen -= 16*nframes;
+		if (!next_nframes)
+			break;
+
+		dest = next_dest;
+		src = next_src;
+		nframes = next_nframes;
 	}
 
 	if (highpri)
 		rspq_highpri_end();
-}
 
-void wav64_open(wav64_t *wav, const char *fn) {
-	memset(wav, 0, sizeof(*wav));
+	sbuf->widx -= overread;
+}
 
-	// Currently, we only support streaming WAVs from DFS (ROMs). Any other
-	// filesystem is unsupported.
-	// For backward compatibility, we also silently accept a non-prefixed path.
-	if (strstr(fn, ":/")) {
-		assertf(strncmp(fn, "rom:/", 5) == 0, "Cannot open %s: wav64 only supports files in ROM (rom:/)", fn);
-		fn += 5;
+static void waveform_vadpcm_read(void *ctx, samplebuffer_t *sbuf, int wpos, int wlen, bool seeking) {
+	wav64_t *wav = (wav64_t*)ctx;
+	wav64_header_vadpcm_t *vhead = (wav64_header_vadpcm_t*)wav->ext;
+	int seek_offset = 0;
+	if (vhead->seek_interval) {
+		// The seek table is stored right after the compressed frames
+		int nframes = (wav->wave.len + 15) / 16;
+		seek_offset = wav->data_offset + ROUND_UP(nframes * 9 * wav->wave.channels, 2);
 	}
+	vadpcm_waveform_read(sbuf, vhead, wav->stream, wav->data_offset, wav->wave.channels,
+		wav->wave.len, wav->wave.len - wav->wave.loop_len, seek_offset, wpos, wlen, seeking);
+}
 
-	int fh = dfs_open(fn);
-	assertf(fh >= 0, "error opening file %s: %s (%d)\n", fn, dfs_strerror(fh), fh);
+static void wav64_load(wav64_t *wav, wav64_stream_t *st, const char *fn) {
+	memset(wav, 0, sizeof(*wav));
+	wav->stream = st;
 
-	wav64_header_t head = {0};
-	dfs_read(&head, 1, sizeof(head), fh);
+	// Headers are read via PI DMA for files in ROM, so make sure they
+	// are not in the data cache.
+	wav64_header_t head __attribute__((aligned(8))) = {0};
+	data_cache_hit_writeback_invalidate(&head, sizeof(head));
+	wav64_stream_read(st, &head, 0, sizeof(head));
 	if (memcmp(head.id, WAV64_ID, 4) != 0) {
 		assertf(memcmp(head.id, WAV_RIFF_ID, 4) != 0 && memcmp(head.id, WAV_RIFX_ID, 4) != 0,
 			"wav64 %s: use audioconv64 to convert to wav64 format", fn);
 		assertf(0, "wav64 %s: invalid ID: %02x%02x%02x%02x\n",
 			fn, head.id[0], head.id[1], head.id[2], head.id[3]);
 	}
-	assertf(head.version == WAV64_FILE_VERSION, "wav64 %s: invalid version: %02x\n",
+	assertf(head.version == 2 || head.version == WAV64_FILE_VERSION, "wav64 %s: invalid version: %02x\n",
 		fn, head.version);
 
 	wav->wave.name = fn;
@@ -282,7 +634,8 @@ void wav64_open(wav64_t *wav, const char *fn) {
 	wav->wave.frequency = head.freq;
 	wav->wave.len = head.len;
 	wav->wave.loop_len = head.loop_len; 
-	wav->rom_addr = dfs_rom_addr(fn) + head.start_offset;
+	wav->rom_addr = st->rom_addr ? st->rom_addr + head.start_offset : 0;
+	wav->data_offset = head.start_offset;
 	wav->format = head.format;
 
 	switch (head.format) {
@@ -293,17 +646,20 @@ void wav64_open(wav64_t *wav, const char *fn) {
 
 	case WAV64_FORMAT_VADPCM: {
 		wav64_header_vadpcm_t vhead = {0};
-		dfs_read(&vhead, 1, sizeof(vhead), fh);
+		data_cache_hit_writeback_invalidate(&vhead, sizeof(vhead));
+		wav64_stream_read(st, &vhead, sizeof(head), sizeof(vhead));
 
 		int codebook_size = vhead.npredictors * vhead.order * head.channels * sizeof(wav64_vadpcm_vector_t);
 
 		void *ext = malloc_uncached(sizeof(vhead) + codebook_size);
 		memcpy(ext, &vhead, sizeof(vhead));
-		dfs_read(ext + sizeof(vhead), 1, codebook_size, fh);
+		wav64_stream_read(st, ext + sizeof(vhead), sizeof(head) + sizeof(vhead), codebook_size);
 		wav->ext = ext;
 		wav->wave.read = waveform_vadpcm_read;
 		wav->wave.ctx = wav;
-		assertf(head.loop_len == 0 || head.loop_len % 16 == 0, 
+		// The RSP writes decoded samples at 8-byte aligned addresses, so
+		// unrolling the loop must keep the 8-byte phase of the sample buffer.
+		assertf(((head.loop_len * head.channels * 2) & 7) == 0,
 			"wav64 %s: invalid loop length: %ld\n", fn, head.loop_len);
 	}	break;
 	
@@ -311,7 +667,18 @@ void wav64_open(wav64_t *wav, const char *fn) {
 		assertf(0, "wav64 %s: invalid format: %02x\n", fn, head.format);
 	}
 
-	dfs_close(fh);
+	// When streaming from a filesystem, read ahead enough data for a few
+	// mixer polls, so that each poll does not need to access the filesystem.
+	int bytes_per_poll = wav64_get_bitrate(wav) / 8 / MIXER_POLL_PER_SECOND;
+	wav64_stream_set_readahead(st, bytes_per_poll * WAV64_STREAM_READAHEAD_POLLS, 1);
+}
+
+void wav64_open(wav64_t *wav, const char *fn) {
+	wav64_load(wav, wav64_stream_open(fn), fn);
+}
+
+void wav64_open_buf(wav64_t *wav, const void *buf, int size) {
+	wav64_load(wav, wav64_stream_open_buf(buf, size), "<memory>");
 }
 
 void wav64_play(wav64_t *wav, int ch)
@@ -331,6 +698,11 @@ void wav64_set_loop(wav64_t *wav, bool loop) {
 	// Notice that audioconv64 does the same during conversion.
 	if (wav->wave.bits == 8 && wav->wave.loop_len & 1)
 		wav->wave.loop_len -= 1;
+
+	// Same for VADPCM waveforms, whose loop must span a multiple of 8 bytes
+	// of decoded samples (see wav64_load).
+	if (wav->format == WAV64_FORMAT_VADPCM)
+		wav->wave.loop_len &= wav->wave.channels == 2 ? ~1 : ~3;
 }
 
 int wav64_get_bitrate(wav64_t *wav) {
@@ -353,4 +725,8 @@ void wav64_close(wav64_t *wav)
 		}
 		wav->ext = NULL;
 	}
+	if (wav->stream) {
+		wav64_stream_close(wav->stream);
+		wav->stream = NULL;
+	}
 }
\ No newline at end of file
@@ -1,8 +1,12 @@
 #ifndef __LIBDRAGON_WAV64_INTERNAL_H
 #define __LIBDRAGON_WAV64_INTERNAL_H
 
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
 #define WAV64_ID            "WV64"
-#define WAV64_FILE_VERSION  2
+#define WAV64_FILE_VERSION  3
 #define WAV64_FORMAT_RAW    0
 #define WAV64_FORMAT_VADPCM 1
 
@@ -26,12 +30,20 @@ typedef struct __attribute__((aligned(8))) {
 	int16_t v[8];						///< Samples
 } wav64_vadpcm_vector_t;
 
-/** @brief Extended header for a WAV64 file with VADPCM compression. */
+/**
+ * @brief Extended header for a WAV64 file with VADPCM compression.
+ * 
+ * Starting from version 3, the compressed frames can be followed by a seek
+ * table (aligned to 2 bytes), with one entry every seek_interval frames (an
+ * even number). Each
+ * entry contains the decoder state before the corresponding frame: the last
+ * `order` samples of the state vector of each channel (16-bit, big-endian).
+ */
 typedef struct __attribute__((packed, aligned(8))) {
 	int8_t npredictors;					///< Number of predictors
 	int8_t order;						///< Order of the predictors
-	int16_t padding;					///< Padding				
-	uint32_t current_rom_addr;			///< Current address in ROM
+	int16_t seek_interval;				///< Frames between seek table entries (0 if no seek table)
+	uint32_t current_offset;			///< Current offset in the stream
 	wav64_vadpcm_vector_t loop_state[2];///< State at the loop point
 	wav64_vadpcm_vector_t state[2];		///< Current decompression state
 	wav64_vadpcm_vector_t codebook[];	///< Codebook of the predictors
@@ -39,11 +51,135 @@ typedef struct __attribute__((packed, aligned(8))) {
 
 typedef struct samplebuffer_s samplebuffer_t;
 
+/**
+ * @brief Source of the data of a waveform.
+ * 
+ * Waveforms can be streamed from a file in ROM (via PI DMA, which can run
+ * asynchronously), from a file in any other filesystem (eg: "sd:/"), or from
+ * a buffer in RAM. Files on other filesystems are read through read-ahead
+ * buffers, so that the small reads done at each mixer poll do not turn into
+ * many filesystem accesses.
+ */
+typedef struct {
+	uint8_t *data;          ///< Contents of the buffer
+	int offset;             ///< Offset in the file of the contents
+	int len;                ///< Number of valid bytes
+	uint32_t last_use;      ///< Value of the stream use counter at the last access
+} wav64_stream_buf_t;
+
+/** @brief Source of the data of a waveform (see #wav64_stream_buf_t). */
+typedef struct {
+	uint32_t rom_addr;      ///< ROM address of the file (files on DFS), or 0
+	const uint8_t *mem;     ///< Contents of the file (buffers in RAM), or NULL
+	FILE *fh;               ///< File handle (files on other filesystems), or NULL
+	int size;               ///< Size of the data (not tracked for files on DFS)
+	wav64_stream_buf_t *bufs; ///< Read-ahead buffers (files on other filesystems)
+	int num_bufs;           ///< Number of read-ahead buffers
+	int buf_size;           ///< Size of each read-ahead buffer
+	uint32_t buf_clock;     ///< Use counter, for least-recently-used replacement
+} wav64_stream_t;
+
+/**
+ * @brief Open a stream on a file.
+ * 
+ * Files on DFS ("rom:/", or without a filesystem prefix) are read via PI DMA.
+ * Files on other filesystems are read via stdio, with a read-ahead buffer
+ * (see #wav64_stream_set_readahead).
+ */
+wav64_stream_t* wav64_stream_open(const char *fn);
+
+/** @brief Open a stream on a buffer in RAM. The buffer must stay valid until the stream is closed. */
+wav64_stream_t* wav64_stream_open_buf(const void *buf, int size);
+
+/**
+ * @brief Configure the read-ahead buffers.
+ * 
+ * This has no effect for streams that are not backed by a filesystem.
+ * The size is rounded up to a multiple of the filesystem sector size.
+ * A size of 0 disables the read-ahead, so that each read goes directly
+ * to the filesystem.
+ * 
+ * Streams read sequentially at several independent positions (eg: the
+ * samples of the channels of a module) should use one buffer per position:
+ * a buffer whose contents end where a read begins is refilled with the
+ * data that follows, otherwise the least recently used one is replaced.
+ * 
+ * @param st        Stream
+ * @param bytes     Size of each buffer
+ * @param count     Number of buffers
+ */
+void wav64_stream_set_readahead(wav64_stream_t *st, int bytes, int count);
+
+/**
+ * @brief Read data from a stream.
+ * 
+ * For streams in ROM, the data is transferred via PI DMA: if @p dst is in
+ * cached memory, the caller must invalidate it beforehand. @p dst and the
+ * data in ROM must have the same 2-byte phase (see #dma_read).
+ * 
+ * The mixer reads a bit past the end of the waveforms on purpose (see
+ * #MIXER_LOOP_OVERREAD, and VADPCM reads which are rounded up to 32
+ * samples). For streams not in ROM, bytes past the end of the data are
+ * returned as zeros.
+ */
+void wav64_stream_read(wav64_stream_t *st, void *dst, int offset, int bytes);
+
+/**
+ * @brief Start reading data from a stream asynchronously.
+ * 
+ * Only streams in ROM are actually read asynchronously (via PI DMA); other
+ * streams are read immediately. Call #wav64_stream_wait to wait for the
+ * data to be available.
+ */
+void wav64_stream_read_async(wav64_stream_t *st, void *dst, int offset, int bytes);
+
+/** @brief Wait for the pending asynchronous reads on a stream to complete */
+void wav64_stream_wait(wav64_stream_t *st);
+
+/** @brief Close a stream */
+void wav64_stream_close(wav64_stream_t *st);
+
 /**
  * @brief Utility function to help implementing #WaveformRead for uncompressed (raw) samples.
  * 
- * This function uses PI DMA to load samples from ROM into the sample buffer.
+ * This function reads samples from the stream into the sample buffer.
  */  
-void raw_waveform_read(samplebuffer_t *sbuf, int base_rom_addr, int wpos, int wlen, int bps);
+void raw_waveform_read(samplebuffer_t *sbuf, wav64_stream_t *st, int base_offset, int wpos, int wlen, int bps);
+
+/**
+ * @brief Utility function to help implementing #WaveformRead for VADPCM-compressed samples.
+ * 
+ * This function reads the compressed frames from the stream (pipelining PI
+ * DMA and decompression for streams in ROM), and uses the RSP
+ * to decompress them into the sample buffer. The decoding state is kept
+ * in @p vhead, which must be allocated in uncached memory, followed by the
+ * codebook.
+ * 
+ * Seeking is supported to any position. Seeking to the start of the
+ * waveform or to the loop point (where the decoding state is restored from
+ * vhead->loop_state) is immediate. Otherwise, the state is fetched from the
+ * seek table (if available) and the CPU decodes forward to the requested
+ * position.
+ * 
+ * When the mixer unrolls a loop, reads of looping waveforms stop exactly at
+ * @p len, and the loop point is then read with @p seeking set while the
+ * sample buffer is not empty. If the loop point is not aligned to 32 samples,
+ * the CPU decodes the first samples of the loop from vhead->loop_state, which
+ * must refer to the frame containing the loop point.
+ * 
+ * @param sbuf            Sample buffer to fill
+ * @param vhead           VADPCM header (holding codebook and decoding state)
+ * @param st              Stream to read the compressed frames from
+ * @param base_offset     Offset in the stream of the first compressed frame
+ * @param channels        Number of interleaved channels (1 or 2)
+ * @param len             Length of the waveform in samples
+ * @param loop_pos        Position of the loop point in samples (equal to @p len if not looping)
+ * @param seek_offset     Offset in the stream of the seek table (or 0 if not available)
+ * @param wpos            Position to read from (in samples)
+ * @param wlen            Number of samples to read (will be rounded up to 32)
+ * @param seeking         True if this read is not contiguous to the previous one
+ */
+void vadpcm_waveform_read(samplebuffer_t *sbuf, wav64_header_vadpcm_t *vhead, wav64_stream_t *st, int base_offset,
+	int channels, int len, int loop_pos, int seek_offset, int wpos, int wlen, bool seeking);
 
 #endif
@@ -11,9 +11,35 @@
 #include "libxm/xm_internal.h"
 #include <stdbool.h>
 
+_Static_assert(sizeof(wav64_header_vadpcm_t) == XM_VADPCM_HEADER_SIZE, "invalid XM_VADPCM_HEADER_SIZE");
+
+/** @brief Size of the read-ahead buffer of each channel, when streaming from a filesystem */
+#define XM64_STREAM_READAHEAD       1024
+
+/** @brief Playback state of a XM64 sample */
+typedef struct {
+	xm_sample_t *samp;              ///< XM sample being played
+	wav64_stream_t *stream;         ///< Stream the sample data is read from
+} xm64_wave_t;
+
+/** @brief Playback state of a VADPCM-compressed XM64 sample */
+typedef struct {
+	xm64_wave_t w;                  ///< XM sample being played
+	int seek_offset;                ///< Offset of the seek table in the stream (0 if none)
+	wav64_header_vadpcm_t vhead;    ///< VADPCM decoding state (followed by the codebook)
+} xm64_vadpcm_wave_t;
+
 static void wave_read(void *ctx, samplebuffer_t *sbuf, int wpos, int wlen, bool seeking) {
-	xm_sample_t *samp = (xm_sample_t*)ctx;
-	raw_waveform_read(sbuf, samp->data8_offset, wpos, wlen, samp->bits >> 4);
+	xm64_wave_t *w = (xm64_wave_t*)ctx;
+	xm_sample_t *samp = w->samp;
+	raw_waveform_read(sbuf, w->stream, samp->data8_offset, wpos, wlen, samp->bits >> 4);
+}
+
+static void wave_read_vadpcm(void *ctx, samplebuffer_t *sbuf, int wpos, int wlen, bool seeking) {
+	xm64_vadpcm_wave_t *vw = (xm64_vadpcm_wave_t*)ctx;
+	xm_sample_t *samp = vw->w.samp;
+	int loop_pos = samp->loop_type == XM_NO_LOOP ? samp->length : samp->loop_end - samp->loop_length;
+	vadpcm_waveform_read(sbuf, &vw->vhead, vw->w.stream, samp->data8_offset, 1, samp->length, loop_pos, vw->seek_offset, wpos, wlen, seeking);
 }
 
 static int tick(void *arg) {
@@ -118,8 +144,12 @@ void xm64player_open(xm64player_t *player, const char *fn) {
 		assertf(0, "error loading XM64 file: %s\nFile corrupted", fn);
 	}
 
-	assertf(strncmp(fn, "rom:/", 5) == 0, "xm64player only supports files in ROM (rom:/)");
-	uint32_t base_rom_addr = dfs_rom_addr(fn+5);
+	// Open a separate stream to read the samples. Files in ROM are read via
+	// PI DMA. On other filesystems, the channels read from unrelated offsets
+	// of the file, so give each channel its own small read-ahead buffer.
+	wav64_stream_t *stream = wav64_stream_open(fn);
+	wav64_stream_set_readahead(stream, XM64_STREAM_READAHEAD, player->ctx->module.num_channels);
+	player->stream = stream;
 
 	// Count samples
 	int ninst = xm_get_number_of_instruments(player->ctx);
@@ -130,15 +160,13 @@ void xm64player_open(xm64player_t *player, const char *fn) {
 	// Allocate waveforms (one per XM64's "samples" aka waveforms)
 	player->waves = malloc(sizeof(waveform_t) * nwaves);
 	assert(player->waves);
+	player->nwaves = nwaves;
 	int nw = 0;
 	for (int i=0;i<ninst;i++) {
 		xm_instrument_t *inst = &player->ctx->module.instruments[i];
 		for (int j=0;j<inst->num_samples;j++) {
 			xm_sample_t *samp = &inst->samples[j];
 
-			// Convert offset of samples from relative to absolute
-			samp->data8_offset += base_rom_addr;
-
 			// Initialize the waveform_t structures with information
 			// coming from the XM "sample".
 			samp->wave = &player->waves[nw++];
@@ -155,8 +183,43 @@ void xm64player_open(xm64player_t *player, const char *fn) {
 			// loop by 1 sample to define an even-length loop.
 			if (samp->wave->bits == 8 && samp->wave->loop_len&1)
 				samp->wave->loop_len -= 1;
+			xm64_wave_t *w = malloc(sizeof(xm64_wave_t));
+			w->samp = samp;
+			w->stream = stream;
 			samp->wave->read = wave_read;
-			samp->wave->ctx = samp;
+			samp->wave->ctx = w;
+
+			if (samp->format == XM_SAMPLE_FORMAT_VADPCM) {
+				// The waveform data begins with the VADPCM header and the
+				// codebook. Load them into uncached memory, as they will be
+				// accessed by the RSP during decoding.
+				wav64_header_vadpcm_t vhead;
+				fseek(player->fh, samp->data8_offset, SEEK_SET);
+				fread(&vhead, 1, sizeof(vhead), player->fh);
+				int codebook_size = vhead.npredictors * vhead.order * sizeof(wav64_vadpcm_vector_t);
+
+				xm64_vadpcm_wave_t *vw = malloc_uncached(sizeof(xm64_vadpcm_wave_t) + codebook_size);
+				vw->w = *w;
+				free(w);
+				memcpy(&vw->vhead, &vhead, sizeof(vhead));
+				fread(vw->vhead.codebook, 1, codebook_size, player->fh);
+				samp->data8_offset += sizeof(vhead) + codebook_size;
+
+				// The seek table (if any) is stored right after the frames.
+				// Frames are stored in pairs, plus an additional pair for the
+				// overread.
+				vw->seek_offset = 0;
+				if (vhead.seek_interval)
+					vw->seek_offset = samp->data8_offset + ((samp->length + 31) / 32 * 2 + 2) * 9;
+
+				// Samples are always decompressed to 16-bit. Loop lengths have
+				// been extended by audioconv64 to a multiple of 4 samples, so
+				// they never need to be shortened.
+				samp->wave->bits = 16;
+				samp->wave->loop_len = samp->loop_type == XM_NO_LOOP ? 0 : samp->loop_length;
+				samp->wave->read = wave_read_vadpcm;
+				samp->wave->ctx = vw;
+			}
 		}
 	}
 
@@ -254,9 +317,19 @@ void xm64player_close(xm64player_t *player) {
 		player->fh = NULL;
 	}
 
+	if (player->stream != NULL) {
+		wav64_stream_close(player->stream);
+		player->stream = NULL;
+	}
+
 	if (player->waves) {
-		for (int i=0;i<player->nwaves;i++)
+		for (int i=0;i<player->nwaves;i++) {
 			free((void*)player->waves[i].name);
+			if (player->waves[i].read == wave_read_vadpcm)
+				free_uncached(player->waves[i].ctx);
+			else
+				free(player->waves[i].ctx);
+		}
 		free(player->waves);
 		player->waves = NULL;
 	}
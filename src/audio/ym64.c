@@ -11,6 +11,7 @@
 #include "debug.h"
 #include "asset_internal.h"
 #include "utils.h"
+#include "rspq.h"
 #include <assert.h>
 #include <string.h>
 #include <stdio.h>
@@ -29,10 +30,151 @@ typedef struct __attribute__((packed)) {
 
 _Static_assert(sizeof(ym5header) == 22, "invalid header size");
 
+/** @brief Version of the seek index of compressed YM64 files */
+#define YM64_SEEK_VERSION    2
+
+/** @brief Header of the seek index of a compressed YM64 file */
+typedef struct __attribute__((packed)) {
+	char magic[4];            ///< Magic ("YMSK")
+	uint32_t version;         ///< Version of the seek index (#YM64_SEEK_VERSION)
+	uint32_t interval;        ///< Maximum number of audioframes between keyframes
+	uint32_t nkeys;           ///< Number of keyframes
+} ym64seekheader;
+
+_Static_assert(sizeof(ym64seekheader) == 16, "invalid seek header size");
+
+/**
+ * @brief Seek keyframe of a compressed YM64 file
+ * 
+ * Compressed YM64 files are LHA archives made of multiple members, each
+ * one compressed independently and containing a fixed number of audioframes.
+ * A keyframe contains the position of one member in the file, and the
+ * state of the AY registers at the beginning of it. A member also begins
+ * at the loop point, so that looping never requires to decompress the
+ * audioframes that precede it.
+ */
+typedef struct __attribute__((packed)) ym64_keyframe_s {
+	uint32_t offset;          ///< Offset of the LHA member within the file
+	uint32_t frame;           ///< First audioframe contained in the LHA member
+	uint8_t regs[14];         ///< Cached AY registers before the first audioframe
+	uint8_t env_shape;        ///< Last envelope shape written to the AY (0xFF: none)
+	uint8_t padding;          ///< Padding
+} ym64_keyframe_t;
+
+_Static_assert(sizeof(ym64_keyframe_t) == 24, "invalid keyframe size");
+
+/**
+ * @brief Start decompressing a LHA member of the file
+ * 
+ * @param player        YM64 player
+ * @param offset        Offset of the LHA member header within the file
+ * @return              Offset of the end of the LHA member
+ */
+static uint32_t ym_open_member(ym64player_t *player, uint32_t offset) {
+	uint8_t head[22];
+	fseek(player->f, offset, SEEK_SET);
+	fread(head, 1, sizeof(head), player->f);
+	assertf(head[2] == '-' && head[3] == 'l' && head[4] == 'h' && head[5] == '5' && head[6] == '-',
+		"Unsupported LHA compression algorithm: %.5s", &head[2]);
+
+	// The LHA header is little-endian. Skip it and start decompressing
+	// the member data.
+	uint32_t csize = head[7] | (head[8] << 8) | (head[9] << 16) | (head[10] << 24);
+	uint32_t dsize = head[11] | (head[12] << 8) | (head[13] << 16) | (head[14] << 24);
+	offset += head[0]+2;
+	fseek(player->f, offset, SEEK_SET);
+	decompress_lzh5_init(player->decoder, player->f, DECOMPRESS_LZH5_DEFAULT_WINDOW_SIZE);
+	player->member_left = dsize;
+	return offset + csize;
+}
+
 static int ymread(ym64player_t *player, void *buf, int sz) {
-	if (player->decoder)
-		return decompress_lzh5_read(player->decoder, buf, sz);
-	return fread(buf, 1, sz, player->f);
+	if (!player->decoder)
+		return fread(buf, 1, sz, player->f);
+
+	// Decompress from the current LHA member. When it is exhausted,
+	// continue with the next one (if any).
+	uint8_t *out = buf;
+	int total = 0;
+	while (sz > 0) {
+		if (player->member_left == 0) {
+			if (player->curkey+1 >= player->nkeys)
+				break;
+			player->curkey++;
+			ym_open_member(player, player->keyframes[player->curkey].offset);
+		}
+		int n = decompress_lzh5_read(player->decoder, out, MIN(sz, player->member_left));
+		if (n <= 0)
+			break;
+		player->member_left -= n;
+		out += n; sz -= n; total += n;
+	}
+	return total;
+}
+
+/** @brief Apply the AY registers of an audioframe to the emulator */
+static void ym_write_regs(ym64player_t *player, const uint8_t *regs) {
+	// Iterate over the 14 ay8910 registers and see which ones
+	// changed since last tick.
+	for (int i=0;i<14;i++) {
+		if (player->regs[i] != regs[i]) {
+			player->regs[i] = regs[i];
+			// Envelope register: the special value 0xFF means
+			// "don't touch". Writing the reg always restarts the
+			// envelope calculation, so it requires special handling.
+			if (i == 13 && regs[i] == 0xFF) continue;
+			ay8910_write_addr(&player->ay, i);
+			ay8910_write_data(&player->ay, regs[i]);
+		}
+	}
+}
+
+/**
+ * @brief Seek to the specified audioframe in a compressed file
+ * 
+ * This restarts decompression from the LHA member containing the audioframe,
+ * restores the AY registers from the keyframe, and then goes through the
+ * audioframes that precede the requested one, without generating audio.
+ */
+static void ym_seek_compressed(ym64player_t *player, int frame) {
+	// Find the last keyframe at or before the requested audioframe
+	int k = 0, n = player->nkeys;
+	while (n > 1) {
+		int half = n / 2;
+		if (player->keyframes[k + half].frame <= frame)
+			k += half;
+		n -= half;
+	}
+	ym64_keyframe_t *key = &player->keyframes[k];
+
+	player->curkey = k;
+	ym_open_member(player, key->offset);
+
+	// The first member also contains the YM header. Skip it.
+	uint8_t regs[16];
+	if (k == 0) {
+		for (int sz = player->start_off; sz > 0; sz -= sizeof(regs))
+			ymread(player, regs, MIN(sz, sizeof(regs)));
+	}
+
+	// Restore the AY registers. The envelope shape is restored only if it
+	// was ever written, as writing it restarts the envelope.
+	memcpy(player->regs, key->regs, sizeof(key->regs));
+	for (int i=0;i<13;i++) {
+		ay8910_write_addr(&player->ay, i);
+		ay8910_write_data(&player->ay, key->regs[i]);
+	}
+	if (key->env_shape != 0xFF) {
+		ay8910_write_addr(&player->ay, 13);
+		ay8910_write_data(&player->ay, key->env_shape);
+	}
+
+	// Apply the register changes of the audioframes preceding the
+	// requested one.
+	for (int f = key->frame; f < frame; f++) {
+		ymread(player, regs, 16);
+		ym_write_regs(player, regs);
+	}
 }
 
 static void ym_wave_read(void *ctx, samplebuffer_t *sbuf, int wpos, int wlen, bool seeking) {
@@ -51,10 +193,17 @@ static void ym_wave_read(void *ctx, samplebuffer_t *sbuf, int wpos, int wlen, bo
 	// both ym64player_seek and the looping position are defined in terms of
 	// audioframes position not samples, so there should be no issue in
 	// converting them back from sample number.
-	if (seeking && !player->decoder) {
+	// In compressed files, #ym64player_seek has usually already moved the
+	// decoder to the requested audioframe, so that the mixer does not need
+	// to decompress the audioframes preceding it.
+	if (seeking && (!player->decoder || player->keyframes)) {
 		player->curframe = ((float)wpos / f_samples_per_frame);
-		fseek(player->f, player->start_off + player->curframe * 16, SEEK_SET);
+		if (!player->decoder)
+			fseek(player->f, player->start_off + player->curframe * 16, SEEK_SET);
+		else if (player->curframe != player->seek_frame)
+			ym_seek_compressed(player, player->curframe);
 	}
+	player->seek_frame = -1;
 
 	// Calculate the last audioframe to be reconstructed in this call. Notice
 	// that we calculate it from its absolute position using the fractional
@@ -73,31 +222,54 @@ static void ym_wave_read(void *ctx, samplebuffer_t *sbuf, int wpos, int wlen, bo
 	int16_t *out = samples;
 	const int num_channels = AY8910_OUTPUT_STEREO ? 2 : 1;
 
+	#if AY8910_OUTPUT_STEREO
+	// The CPU only computes the state changes of the AY8910, as runs of
+	// identical samples, while the RSP expands them into the sample buffer.
+	// The runs must stay valid until the RSP has processed them, so use
+	// a buffer big enough for two audioframes, and wait for the RSP when
+	// it is full. The runs of a previous call might also be still pending
+	// (if the mixer read again from this channel before syncing with the
+	// RSP), so wait for them before reusing or freeing the buffer.
+	rspq_highpri_sync();
+	int max_runs = samples_per_frame*2 + 2;
+	if (player->max_runs < max_runs) {
+		free(player->runs);
+		player->runs = malloc(max_runs * sizeof(AYRun));
+		assertf(player->runs, "out of memory allocating AY8910 runs");
+		player->max_runs = max_runs;
+	}
+	int used_runs = 0;
+	rspq_highpri_begin();
+	#endif
+
 	for (int i=0;i<nframes;i++) {
 		// Read 14 ay8910 registers (+ maybe 2 digidrums regs, unsupported)
 		uint8_t regs[16];
 		ymread(player, regs, 16);
-
-		// Iterate over the 14 ay8910 registers and see which ones
-		// changed since last tick.
-		for (int i=0;i<14;i++) {
-			if (player->regs[i] != regs[i]) {
-				player->regs[i] = regs[i];
-				// Envelope register: the special value 0xFF means
-				// "don't touch". Writing the reg always restarts the
-				// envelope calculation, so it requires special handling.
-				if (i == 13 && regs[i] == 0xFF) continue;
-				ay8910_write_addr(&player->ay, i);
-				ay8910_write_data(&player->ay, regs[i]);
-			}
-		}
+		ym_write_regs(player, regs);
 
 		// Generate the required number of samples, and store them into the
 		// sample buffer.
+		#if AY8910_OUTPUT_STEREO
+		if (used_runs + samples_per_frame > player->max_runs) {
+			rspq_highpri_end();
+			rspq_highpri_sync();
+			rspq_highpri_begin();
+			used_runs = 0;
+		}
+		// Keep each batch of runs 8-byte aligned, as required by RSP DMA.
+		int nruns = ay8910_gen_rsp(&player->ay, player->runs + used_runs, out, samples_per_frame);
+		used_runs += ROUND_UP(nruns, 2);
+		#else
 		ay8910_gen(&player->ay, out, samples_per_frame);
+		#endif
 		out += (int)samples_per_frame * num_channels;
 		player->curframe++;
 	}
+
+	#if AY8910_OUTPUT_STEREO
+	rspq_highpri_end();
+	#endif
 }
 
 void ym64player_open(ym64player_t *player, const char *fn, ym64player_songinfo_t *info) {
@@ -118,16 +290,34 @@ void ym64player_open(ym64player_t *player, const char *fn, ym64player_songinfo_t
 	if (head[2] == '-' && head[3] == 'l' && head[6] == '-') {
 		assertf(head[4] == 'h' && head[5] == '5', "Unsupported LHA compression algorithm: -l%c%c-", head[4], head[5]);
 
-		// Skip the header. We don't need anything else from it, just go straight
-		// to the first compressed file which ought to be our YM file.
-		fseek(player->f, head[0]+2, SEEK_SET);
-
-		// Initialize decompressor and re-read the header (this time, it will
-		// be decompressed and we should find a valid YM header).
+		// Initialize decompressor on the first member of the archive and
+		// re-read the header (this time, it will be decompressed).
 		player->decoder = malloc(DECOMPRESS_LZH5_STATE_SIZE + DECOMPRESS_LZH5_DEFAULT_WINDOW_SIZE);
+		uint32_t end_off = ym_open_member(player, 0);
 		offset = 0;
-		decompress_lzh5_init(player->decoder, player->f, DECOMPRESS_LZH5_DEFAULT_WINDOW_SIZE);
 		_ymread(head, 12);
+
+		// Check if the first member is a seek index. If so, load it and then
+		// move to the next member which ought to be our YM file.
+		if (strncmp(head, "YMSK", 4) == 0) {
+			ym64seekheader sh;
+			memcpy(&sh, head, 12);
+			ymread(player, (uint8_t*)&sh + 12, sizeof(sh) - 12);
+			assertf(sh.version == YM64_SEEK_VERSION, "%s: unsupported YM64 seek index version (%ld)\nPlease reconvert the file with audioconv64", fn, sh.version);
+			player->keyframes = malloc(sh.nkeys * sizeof(ym64_keyframe_t));
+			assertf(player->keyframes, "out of memory");
+			ymread(player, player->keyframes, sh.nkeys * sizeof(ym64_keyframe_t));
+
+			// Keyframe offsets are relative to the end of the index
+			for (int i=0;i<sh.nkeys;i++)
+				player->keyframes[i].offset += end_off;
+			player->nkeys = sh.nkeys;
+
+			player->curkey = 0;
+			ym_open_member(player, player->keyframes[0].offset);
+			offset = 0;
+			_ymread(head, 12);
+		}
 	}
 
 	int loop_pos = 0;
@@ -207,6 +397,7 @@ void ym64player_open(ym64player_t *player, const char *fn, ym64player_songinfo_t
 
 	ay8910_reset(&player->ay);
 	player->first_ch = -1;
+	player->seek_frame = -1;
 	debugf("ym64: loading %s (freq:%ld, wfreq:%ld)\n", fn, player->chipfreq/8, player->chipfreq/8/AY8910_DECIMATE);
 }
 
@@ -239,10 +430,18 @@ void ym64player_tell(ym64player_t *player, int *pos, float *secs) {
 }
 
 bool ym64player_seek(ym64player_t *player, int pos) {
-	// Cannot seek in a compressed file
-	if (player->decoder)
+	// Cannot seek in a compressed file without seek index
+	if (player->decoder && !player->keyframes)
 		return false;
 
+	// In compressed files, move the decoder to the requested audioframe
+	// right away. This requires decompressing the audioframes that precede
+	// it in its segment, which is better done here than within the mixer.
+	if (player->decoder) {
+		ym_seek_compressed(player, pos);
+		player->seek_frame = pos;
+	}
+
 	// If playing, seek through the mixer. Otherwise, at least record
 	// the current audioframe, that will be applied later when ym64player_play
 	// is called.
@@ -260,6 +459,17 @@ void ym64player_close(ym64player_t *player) {
 		player->decoder = NULL;
 	}
 
+	if (player->keyframes) {
+		free(player->keyframes);
+		player->keyframes = NULL;
+	}
+
+	if (player->runs) {
+		free(player->runs);
+		player->runs = NULL;
+		player->max_runs = 0;
+	}
+
 	if (player->f) {
 		fclose(player->f);
 		player->f = NULL;
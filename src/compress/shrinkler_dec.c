@@ -17,7 +17,7 @@
 #define unlikely(x)     (x)
 #endif
 
-#if defined(__LITTLE_ENDIAN__)
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
 #define read32be(ptr) __builtin_bswap32(*(uint32_t*)(ptr))
 #else
 #define read32be(ptr) (*(uint32_t*)(ptr))
@@ -7,6 +7,7 @@
 #include "n64types.h"
 #include "n64sys.h"
 #include "interrupt.h"
+#include "dma.h"
 #include "debug.h"
 #include "utils.h"
 #include "regsinternal.h"
@@ -26,6 +27,15 @@
 /** @brief Structure used to interact with the PI registers */
 static volatile struct PI_regs_s * const PI_regs = (struct PI_regs_s *)0xa4600000;
 
+/** @brief Head of the queue of pending DMA requests (the one in flight, if any) */
+static dma_request_t *dma_queue_head = NULL;
+/** @brief Tail of the queue of pending DMA requests */
+static dma_request_t *dma_queue_tail = NULL;
+/** @brief True if the request at the head of the queue has been started */
+static bool dma_queue_running = false;
+/** @brief True if the PI interrupt handler has been installed */
+static bool dma_queue_init = false;
+
 static volatile int __dma_busy(void)
 {
     return PI_regs->status & (PI_STATUS_DMA_BUSY | PI_STATUS_IO_BUSY);
@@ -212,6 +222,109 @@ void dma_wait(void)
     while (__dma_busy()) {}
 }
 
+/**
+ * @brief Start the transfers in the DMA queue.
+ * 
+ * Starts the request at the head of the queue. Requests that are completed
+ * synchronously (because they are very small, so that #dma_read_async is able
+ * to serve them via CPU I/O, or because the transfer finished already) are
+ * retired immediately, and the next request is started.
+ * 
+ * @note This function must be called with interrupts disabled.
+ */
+static void __dma_queue_kick(void)
+{
+    while (dma_queue_head && !dma_queue_running) {
+        dma_request_t *req = dma_queue_head;
+        dma_read_async(req->ram_address, req->pi_address, req->len);
+
+        // If the PI is busy, the transfer is in flight: the PI interrupt will
+        // tell us when it is done.
+        if (__dma_busy()) {
+            dma_queue_running = true;
+            break;
+        }
+
+        // The transfer is already finished. Retire it.
+        dma_queue_head = req->next;
+        if (!dma_queue_head) dma_queue_tail = NULL;
+        req->done = true;
+        if (req->cb) req->cb(req->ctx);
+    }
+}
+
+/**
+ * @brief PI interrupt handler: retire the current request and start the next one.
+ */
+static void __dma_queue_interrupt(void)
+{
+    // The PI interrupt is also triggered by transfers started outside of the
+    // queue (eg: dma_read). If the PI is still busy, either our transfer has
+    // not finished yet, or another transfer was started after it: in both
+    // cases, another interrupt will follow.
+    if (!dma_queue_running || __dma_busy())
+        return;
+
+    dma_request_t *req = dma_queue_head;
+    dma_queue_head = req->next;
+    if (!dma_queue_head) dma_queue_tail = NULL;
+    dma_queue_running = false;
+
+    req->done = true;
+    if (req->cb) req->cb(req->ctx);
+
+    __dma_queue_kick();
+}
+
+void dma_read_enqueue(dma_request_t *req, void *ram_address, unsigned long pi_address,
+    unsigned long len, dma_callback_t cb, void *ctx)
+{
+    req->ram_address = ram_address;
+    req->pi_address = pi_address;
+    req->len = len;
+    req->cb = cb;
+    req->ctx = ctx;
+    req->done = false;
+    req->next = NULL;
+
+    if (len == 0) {
+        req->done = true;
+        if (cb) cb(ctx);
+        return;
+    }
+
+    disable_interrupts();
+
+    if (!dma_queue_init) {
+        register_PI_handler(__dma_queue_interrupt);
+        set_PI_interrupt(1);
+        dma_queue_init = true;
+    }
+
+    if (dma_queue_tail)
+        dma_queue_tail->next = req;
+    else
+        dma_queue_head = req;
+    dma_queue_tail = req;
+
+    __dma_queue_kick();
+
+    enable_interrupts();
+}
+
+void dma_request_wait(dma_request_t *req)
+{
+    while (!req->done) {
+        // Poll the queue manually, so that this works even if interrupts
+        // are currently disabled.
+        disable_interrupts();
+        __dma_queue_interrupt();
+        enable_interrupts();
+    }
+}
+
+extern inline bool dma_request_done(dma_request_t *req);
+
 
 void dma_read(void *ram_address, unsigned long pi_address, unsigned long len)
 {
@@ -6,6 +6,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <sys/stat.h>
 #include <errno.h>
 #include "libdragon.h"
@@ -46,6 +47,10 @@ static uint32_t directories[MAX_DIRECTORY_DEPTH];
 static uint32_t directory_top = 0;
 /** @brief Pointer to next directory entry set when doing a directory walk */
 static directory_entry_t *next_entry = 0;
+/** @brief Pointer to the path index, or 0 if the filesystem has no index */
+static uint32_t index_ptr = 0;
+/** @brief Number of hash buckets in the path index */
+static uint32_t index_buckets = 0;
 /** @brief Convert an open file pointer to a handle */
 #define OPENFILE_TO_HANDLE(file)        ((int)PhysicalAddr(file))
 /** @brief Convert a handle to an open file pointer */
@@ -70,6 +75,27 @@ static inline void grab_sector(void *cart_loc, void *ram_loc)
     dma_read((void *)(((uint32_t)ram_loc) & 0x1FFFFFFF), (uint32_t)cart_loc, SECTOR_SIZE);
 }
 
+/**
+ * @brief Read an arbitrary amount of data from cartspace
+ *
+ * Same as #grab_sector, but for reads smaller than a sector (used
+ * to access the path index).
+ *
+ * @param[in]  cart_loc
+ *             Pointer to cartridge location
+ * @param[out] ram_loc
+ *             Pointer to RAM buffer to place the read data
+ * @param[in]  size
+ *             Number of bytes to read
+ */
+static inline void grab_data(void *cart_loc, void *ram_loc, int size)
+{
+    /* Make sure we have fresh cache */
+    data_cache_hit_writeback_invalidate(ram_loc, size);
+
+    dma_read((void *)(((uint32_t)ram_loc) & 0x1FFFFFFF), (uint32_t)cart_loc, size);
+}
+
 /**
  * @brief Look up a sector number based on offset
  *
@@ -541,6 +567,141 @@ static int recurse_path(const char * const path, int mode, directory_entry_t **d
     return ret;
 }
 
+/**
+ * @brief Look up a file using the path index
+ *
+ * The path index (if present) allows to resolve a path with a fixed number
+ * of DMA transfers, irrespective of the number of files in the filesystem
+ * or the depth of the directory tree. Only absolute paths (or paths relative
+ * to the root directory) made of plain components can be looked up: paths
+ * containing "." or ".." components, or relative to a different directory,
+ * must go through #recurse_path.
+ *
+ * @param[in]  path
+ *             Path of the file to look up
+ * @param[out] dirent
+ *             Directory entry of the file, or NULL if the file does not exist
+ *
+ * @return true if the index was used (and thus *dirent is valid), false
+ *         if the caller must fall back to walking the directory tree.
+ */
+static bool index_lookup(const char * const path, directory_entry_t **dirent)
+{
+    if(!index_ptr || !path)
+    {
+        return false;
+    }
+
+    const char *p = path;
+
+    if(p[0] == '/')
+    {
+        /* Absolute path */
+        p++;
+    }
+    else if(directory_top != 0)
+    {
+        /* Relative to a directory different from root */
+        return false;
+    }
+
+    /* Validate the components of the path */
+    const char *comp = p;
+    int len = 0;
+    for(const char *c = p; ; c++)
+    {
+        if(*c == '/' || *c == 0)
+        {
+            int comp_len = c - comp;
+            if(comp_len == 0 || comp_len > MAX_FILENAME_LEN ||
+               (comp_len == 1 && comp[0] == '.') ||
+               (comp_len == 2 && comp[0] == '.' && comp[1] == '.'))
+            {
+                /* Empty, too long or relative component: walk the tree */
+                return false;
+            }
+            if(*c == 0)
+            {
+                len = c - p;
+                break;
+            }
+            comp = c + 1;
+        }
+    }
+
+    if(len >= DFS_INDEX_MAX_PATH)
+    {
+        /* Too long to be verified against the index: walk the tree */
+        return false;
+    }
+
+    uint32_t hash = dfs_path_hash(p, len);
+    uint32_t bucket = ((uint64_t)hash * index_buckets) >> 32;
+
+    /* Fetch the range of entries belonging to this bucket */
+    uint32_t range[2] __attribute__((aligned(16)));
+    grab_data((void *)(index_ptr + sizeof(dfs_index_header_t) + bucket * 4), range, sizeof(range));
+
+    uint32_t entries = index_ptr + sizeof(dfs_index_header_t) + (index_buckets + 1) * 4;
+    uint32_t first = range[0];
+    uint32_t count = range[1] - range[0];
+
+    *dirent = 0;
+    while(count)
+    {
+        dfs_index_entry_t chunk[16] __attribute__((aligned(16)));
+        int n = MIN(count, 16);
+
+        grab_data((void *)(entries + first * sizeof(dfs_index_entry_t)), chunk, n * sizeof(dfs_index_entry_t));
+
+        for(int i = 0; i < n; i++)
+        {
+            if(chunk[i].hash != hash)
+            {
+                continue;
+            }
+
+            /* Verify the full path of the candidate, to rule out hash collisions */
+            char cand_path[DFS_INDEX_MAX_PATH] __attribute__((aligned(16)));
+            grab_data((void *)(index_ptr + chunk[i].path), cand_path, len + 1);
+
+            if(memcmp(cand_path, p, len) == 0 && cand_path[len] == 0)
+            {
+                *dirent = (directory_entry_t *)(chunk[i].dirent + base_ptr);
+                return true;
+            }
+        }
+
+        first += n;
+        count -= n;
+    }
+
+    /* The index covers all files: if it is not here, it does not exist */
+    return true;
+}
+
+/**
+ * @brief Find the directory entry of a file
+ *
+ * Uses the path index if possible, otherwise walks the directory tree.
+ *
+ * @param[in]  path
+ *             Path of the file to find
+ * @param[out] dirent
+ *             Directory entry of the file
+ *
+ * @return DFS_ESUCCESS on success, or a negative error on failure.
+ */
+static int find_file(const char * const path, directory_entry_t **dirent)
+{
+    if(index_lookup(path, dirent))
+    {
+        return *dirent ? DFS_ESUCCESS : DFS_ENOFILE;
+    }
+
+    return recurse_path(path, WALK_OPEN, dirent, TYPE_FILE);
+}
+
 /**
  * @brief Helper functioner to initialize the filesystem
  *
@@ -562,6 +723,21 @@ static int __dfs_init(uint32_t base_fs_loc)
         base_ptr = base_fs_loc;
         clear_directory();
 
+        /* Check whether the image was built with a path index */
+        index_ptr = 0;
+        index_buckets = 0;
+        if(id_node.file_pointer)
+        {
+            dfs_index_header_t header __attribute__((aligned(16)));
+            grab_data((void *)(base_fs_loc + id_node.file_pointer), &header, sizeof(header));
+
+            if(header.magic == DFS_INDEX_MAGIC && header.num_buckets > 0)
+            {
+                index_ptr = base_fs_loc + id_node.file_pointer;
+                index_buckets = header.num_buckets;
+            }
+        }
+
         /* Good FS */
         return DFS_ESUCCESS;
     }
@@ -652,7 +828,7 @@ int dfs_open(const char * const path)
 {
     /* Try to find file */
     directory_entry_t *dirent;
-    int ret = recurse_path(path, WALK_OPEN, &dirent, TYPE_FILE);
+    int ret = find_file(path, &dirent);
 
     if(ret != DFS_ESUCCESS)
     {
@@ -901,6 +1077,49 @@ int dfs_read(void * const buf, int size, int count, uint32_t handle)
     return (void*)data - buf;
 }
 
+int dfs_read_async(void * const buf, int size, int count, uint32_t handle,
+    dma_request_t *req, dma_callback_t cb, void *ctx)
+{
+    dfs_open_file_t *file = HANDLE_TO_OPENFILE(handle);
+
+    if(!file)
+    {
+        return DFS_EBADHANDLE;
+    }
+
+    /* The buffer must have the same 2-byte phase of the file position, as
+     * there is no intermediate buffer to realign the data */
+    if(!buf || !req || (((uint32_t)buf ^ (uint32_t)file->loc) & 1))
+    {
+        return DFS_EBADINPUT;
+    }
+
+    int to_read = size * count;
+
+    /* Bounds check to make sure we don't read past the end */
+    if(file->loc + to_read > file->size)
+    {
+        to_read = file->size - file->loc;
+    }
+
+    /* Calculate ROM address. NOTE: do this before invalidation,
+     * in case the file object is false-sharing the buffer. */
+    uint32_t rom_address = ((file->cart_start_loc + file->loc) | 0x10000000) & 0x1FFFFFFF;
+
+    if (to_read)
+    {
+        /* 16-byte alignment: we can simply invalidate the buffer. */
+        if ((((uint32_t)buf | to_read) & 15) == 0)
+            data_cache_hit_invalidate(buf, to_read);
+        else
+            data_cache_hit_writeback_invalidate(buf, to_read);
+    }
+
+    file->loc += to_read;
+    dma_read_enqueue(req, buf, rom_address, to_read, cb, ctx);
+    return to_read;
+}
+
 /**
  * @brief Return the file size of an open file
  *
@@ -944,7 +1163,7 @@ uint32_t dfs_rom_addr(const char *path)
 {
     /* Try to find file */
     directory_entry_t *dirent;
-    int ret = recurse_path(path, WALK_OPEN, &dirent, TYPE_FILE);
+    int ret = find_file(path, &dirent);
 
     if(ret != DFS_ESUCCESS)
     {
@@ -359,8 +359,10 @@
 
 #include "rdpq.h"
 #include "rdpq_internal.h"
+#include "rdpq_tex.h"
 #include "rdpq_constants.h"
 #include "rdpq_debug_internal.h"
+#include "timeline_internal.h"
 #include "rspq.h"
 #include "rspq/rspq_internal.h"
 #include "rspq_constants.h"
@@ -388,7 +390,7 @@ DEFINE_RSP_UCODE(rsp_rdpq,
 typedef struct rdpq_state_s {
     uint64_t sync_full;                 ///< Last SYNC_FULL command
     uint32_t rspq_syncpoint_id;         ///< Syncpoint ID at the time of the last SYNC_FULL command
-    uint32_t padding;                   ///< Padding
+    uint32_t rdram_vtxcache_address;    ///< Address of the copy of the vertex cache in RDRAM
     uint32_t rdram_state_address;       ///< Address of this state structure in RDRAM
     uint32_t rdram_syncpoint_id;        ///< Address of the syncpoint ID in RDRAM
 } rdpq_state_t;
@@ -396,6 +398,9 @@ typedef struct rdpq_state_s {
 /** @brief Mirror in RDRAM of the state of the rdpq ucode. */ 
 static rdpq_state_t *rdpq_state;
 
+/** @brief Copy in RDRAM of the vertex cache of the rdpq ucode (written by RSP only). */
+static uint32_t rdpq_vtxcache[8*RDPQ_VTXCACHE_SIZE] __attribute__((aligned(16)));
+
 bool __rdpq_inited = false;             ///< True if #rdpq_init was called
 
 /** @brief Current configuration of the rdpq library. */ 
@@ -433,6 +438,8 @@ static void __rdpq_interrupt(void) {
     MEMORY_BARRIER();
     *SP_STATUS = SP_WSTATUS_CLEAR_SIG_RDPSYNCFULL;
 
+    if (__timeline_hook) __timeline_hook(TIMELINE_RDP_SYNC_FULL, 0);
+
     // If there was a callback registered, call it.
     if (w0) {
         void (*callback)(void*) = (void (*)(void*))CachedAddr(w0 | 0x80000000);
@@ -457,6 +464,8 @@ void rdpq_init()
     memset(rdpq_state, 0, sizeof(rdpq_state_t));
     rdpq_state->rdram_state_address = PhysicalAddr(rdpq_state);
     rdpq_state->rdram_syncpoint_id = PhysicalAddr(&__rspq_syncpoints_done);
+    rdpq_state->rdram_vtxcache_address = PhysicalAddr(rdpq_vtxcache);
+    data_cache_hit_writeback_invalidate(rdpq_vtxcache, sizeof(rdpq_vtxcache));
     assert((rdpq_state->rdram_state_address & 7) == 0);  // check alignment for DMA
     assert((rdpq_state->rdram_syncpoint_id & 7) == 0);  // check alignment for DMA
     
@@ -633,6 +642,24 @@ void __rdpq_block_begin()
     __rdpq_block_run(NULL);    
 }
 
+/**
+ * @brief Forget the shadowed RDP state if commands were written to the block bypassing rdpq
+ * 
+ * Commands written with rspq_write rather than #rdpq_write (eg: by other
+ * overlays) are not seen by the peephole optimizer, and might change the RDP
+ * state or emit RDP commands. They are detected because the rspq write
+ * pointer moved since the last command written by rdpq (see #__rdpq_block_written).
+ */
+static void block_check_foreign(struct rdpq_block_state_s *st)
+{
+    extern volatile uint32_t *rspq_cur_pointer;
+    if (__builtin_expect(rspq_cur_pointer != st->rspq_mark, 0)) {
+        st->shadow_valid = 0;
+        st->last_sync_end = NULL;
+        st->rspq_mark = rspq_cur_pointer;
+    }
+}
+
 /** 
  * @brief Allocate a new RDP block buffer, chaining it to the current one (if any) 
  * 
@@ -648,6 +675,7 @@ void __rdpq_block_next_buffer(void)
 {
     struct rdpq_block_state_s *st = &rdpq_block_state;
     assertf(__rdpq_inited, "a rdpq command was issued during block recording, but rdpq_init() hasn't been called yet");
+    block_check_foreign(st);
 
     if (st->pending_wptr) {
         st->wptr = st->pending_wptr;
@@ -678,6 +706,9 @@ void __rdpq_block_next_buffer(void)
         st->wend = b->cmds + st->bufsize;
     }
 
+    // A chain of SYNC commands cannot span buffers
+    st->last_sync_end = NULL;
+
     assertf((PhysicalAddr(st->wptr) & 0x7) == 0,
         "start not aligned to 8 bytes: %lx", PhysicalAddr(st->wptr));
     assertf((PhysicalAddr(st->wend) & 0x7) == 0,
@@ -692,6 +723,7 @@ void __rdpq_block_next_buffer(void)
     // new buffer (though with DP_START==DP_END, as the buffer is currently empty).
     rspq_int_write(RSPQ_CMD_RDP_SET_BUFFER,
         PhysicalAddr(st->wptr), PhysicalAddr(st->wptr), PhysicalAddr(st->wend));
+    __rdpq_block_written();
 
     // Grow size for next buffer
     // We use doubling here to reduce overheads for large blocks
@@ -737,9 +769,58 @@ rdpq_block_t* __rdpq_block_end()
     return ret;
 }
 
+/**
+ * @brief Suspend creation of a RDP block.
+ * 
+ * This is called by #rspq_block_suspend. It saves the current block state
+ * (including the tracking state of the block so far) into the provided
+ * structure, and goes back to tracking the state of the queue, as if
+ * the block creation was finished.
+ * 
+ * @param state      Where to save the block state
+ * 
+ * @see #__rdpq_block_resume
+ */
+void __rdpq_block_suspend(rdpq_block_state_t *state)
+{
+    *state = rdpq_block_state;
+    state->suspended_tracking = rdpq_tracking;
+
+    // Recover tracking state before the block creation started
+    rdpq_tracking = rdpq_block_state.previous_tracking;
+    memset(&rdpq_block_state, 0, sizeof(rdpq_block_state));
+}
+
+/**
+ * @brief Resume creation of a RDP block.
+ * 
+ * This is called by #rspq_block_resume. It restores a block state previously
+ * saved by #__rdpq_block_suspend.
+ * 
+ * @param state      The block state to restore
+ */
+void __rdpq_block_resume(rdpq_block_state_t *state)
+{
+    rdpq_block_state = *state;
+
+    // The tracking state of the queue might have changed since the block
+    // creation was started, so save the current one to be recovered when
+    // the block is done.
+    rdpq_block_state.previous_tracking = rdpq_tracking;
+    rdpq_tracking = state->suspended_tracking;
+}
+
 /** @brief Run a block (called by #rspq_block_run). */
 void __rdpq_block_run(rdpq_block_t *block)
 {
+    // If we are recording a block, the RDP state after the block that
+    // we are calling is unknown.
+    rdpq_block_state.shadow_valid = 0;
+    rdpq_block_state.last_sync_end = NULL;
+
+    // The block might load textures, so TMEM contents are unknown.
+    rdpq_tex_cache_invalidate();
+
     // We are about to run a block that contains rdpq commands.
     // During creation, we tracked some state for the block 
     // and saved it into the block structure; set it as current,
@@ -793,6 +874,121 @@ void __rdpq_block_free(rdpq_block_t *block)
     }
 }
 
+/** @brief Index in #rdpq_block_state_t::shadow of a RDP state command, or -1 if not shadowed */
+static int block_shadow_slot(uint32_t cmd_id)
+{
+    switch (cmd_id) {
+    case RDPQ_CMD_SET_KEY_GB:           return 0;
+    case RDPQ_CMD_SET_KEY_R:            return 1;
+    case RDPQ_CMD_SET_CONVERT:          return 2;
+    case RDPQ_CMD_SET_PRIM_DEPTH:       return 3;
+    case RDPQ_CMD_SET_FILL_COLOR:       return 4;
+    case RDPQ_CMD_SET_FOG_COLOR:        return 5;
+    case RDPQ_CMD_SET_BLEND_COLOR:      return 6;
+    case RDPQ_CMD_SET_PRIM_COLOR:       return 7;
+    case RDPQ_CMD_SET_ENV_COLOR:        return 8;
+    case RDPQ_CMD_SET_COMBINE_MODE_RAW: return 9;
+    default:                            return -1;
+    }
+}
+
+/**
+ * @brief Return the shadowed state registers that might be changed by a RSP command
+ * 
+ * RSP commands can generate arbitrary RDP commands, that the CPU does not see.
+ * This function returns the bitmask of the shadow entries (see #block_shadow_slot)
+ * that must be invalidated when the specified command is recorded in a block.
+ * Commands of other overlays are assumed to change everything.
+ */
+static uint32_t block_shadow_clobbers(uint32_t ovl_id, uint32_t cmd_id)
+{
+    if (ovl_id != RDPQ_OVL_ID)
+        return ~0u;
+
+    switch (cmd_id) {
+    case RDPQ_CMD_SET_PRIM_COLOR_COMPONENT:
+        return 1 << block_shadow_slot(RDPQ_CMD_SET_PRIM_COLOR);
+    case RDPQ_CMD_SET_FILL_COLOR_32:
+    case RDPQ_CMD_SET_COLOR_IMAGE:
+        return 1 << block_shadow_slot(RDPQ_CMD_SET_FILL_COLOR);
+    case RDPQ_CMD_RESET_RENDER_MODE:
+    case RDPQ_CMD_SET_COMBINE_MODE_2PASS:
+    case RDPQ_CMD_PUSH_RENDER_MODE:
+    case RDPQ_CMD_POP_RENDER_MODE:
+    case RDPQ_CMD_MODIFY_OTHER_MODES:
+    case RDPQ_CMD_SET_BLENDING_MODE:
+    case RDPQ_CMD_SET_FOG_MODE:
+    case RDPQ_CMD_SET_COMBINE_MODE_1PASS:
+    case RDPQ_CMD_SET_OTHER_MODES:
+        // Render mode changes are recalculated by the RSP, that might
+        // emit a new combiner.
+        return 1 << block_shadow_slot(RDPQ_CMD_SET_COMBINE_MODE_RAW);
+    case RDPQ_CMD_NOOP:
+    case RDPQ_CMD_FILL_RECTANGLE_EX:
+    case RDPQ_CMD_TRIANGLE_INDEXED:
+    case RDPQ_CMD_TRI ... RDPQ_CMD_TRI_SHADE_TEX_ZBUF:
+    case RDPQ_CMD_TEXTURE_RECTANGLE_EX:
+    case RDPQ_CMD_SET_SCISSOR_EX:
+    case RDPQ_CMD_AUTOTMEM_SET_ADDR:
+    case RDPQ_CMD_AUTOTMEM_SET_TILE:
+    case RDPQ_CMD_TRIANGLE:
+    case RDPQ_CMD_TRIANGLE_DATA:
+    case RDPQ_CMD_SYNC_FULL:
+    case RDPQ_CMD_SET_SCISSOR:
+    case RDPQ_CMD_SET_TEXTURE_IMAGE:
+    case RDPQ_CMD_SET_Z_IMAGE:
+        return 0;
+    default:
+        return ~0u;
+    }
+}
+
+/**
+ * @brief Check whether a 8-byte passthrough command is redundant in the block being recorded
+ * 
+ * This is a peephole optimizer run while recording a block. It drops:
+ * 
+ *  * State commands (see #block_shadow_slot) that write the same value
+ *    already written by the previous command of the same kind, with nothing
+ *    that could have changed it inbetween.
+ *  * SYNC commands that are already present in the chain of SYNC commands
+ *    immediately preceding it in the RDP buffer.
+ * 
+ * If the command is not redundant, its value is recorded for later checks.
+ * 
+ * @return true if the command must not be written
+ */
+static bool block_redundant8(uint32_t cmd_id, uint32_t arg0, uint32_t arg1)
+{
+    struct rdpq_block_state_s *st = &rdpq_block_state;
+    block_check_foreign(st);
+
+    if (cmd_id >= RDPQ_CMD_SYNC_LOAD && cmd_id <= RDPQ_CMD_SYNC_TILE) {
+        uint32_t bit = 1 << (cmd_id - RDPQ_CMD_SYNC_LOAD);
+        if (st->last_sync_end && st->wptr == st->last_sync_end) {
+            if (st->last_sync_mask & bit)
+                return true;
+        } else {
+            st->last_sync_mask = 0;
+        }
+        st->last_sync_mask |= bit;
+        // If the command is going to start a new buffer, the chain is broken anyway
+        st->last_sync_end = (st->wptr && st->wptr + 2 <= st->wend) ? st->wptr + 2 : NULL;
+        return false;
+    }
+
+    int slot = block_shadow_slot(cmd_id);
+    if (slot < 0)
+        return false;
+
+    uint64_t value = ((uint64_t)(arg0 & 0xFFFFFF) << 32) | arg1;
+    if ((st->shadow_valid & (1 << slot)) && st->shadow[slot] == value)
+        return true;
+    st->shadow[slot] = value;
+    st->shadow_valid |= 1 << slot;
+    return false;
+}
+
 /**
  * @brief Reserve space in the RDP static buffer for a number of RDP commands
  * 
@@ -800,11 +996,21 @@ void __rdpq_block_free(rdpq_block_t *block)
  * the static buffer has enough space for the specified number of RDP commands,
  * and also switch back to the dynamic buffer if the command is going to generate
  * a large or unbounded number of commands.
+ * 
+ * Since the RDP commands will be generated by the RSP, the CPU cannot know
+ * their contents: the RDP state shadowed so far (see #rdpq_block_state_t::shadow)
+ * is invalidated, depending on the RSP command being written.
+ * 
+ * After the RSP command is written, #__rdpq_block_written must be called.
  */
-void __rdpq_block_reserve(int num_rdp_commands)
+void __rdpq_block_reserve(int num_rdp_commands, uint32_t ovl_id, uint32_t cmd_id)
 {   
     struct rdpq_block_state_s *st = &rdpq_block_state;
 
+    block_check_foreign(st);
+    st->last_sync_end = NULL;
+    st->shadow_valid &= ~block_shadow_clobbers(ovl_id, cmd_id);
+
     if (num_rdp_commands < 0 || num_rdp_commands >= RDPQ_BLOCK_MIN_SIZE/2/2) {
         // Check if there is a RDP static buffer currently active
         if (st->wptr) {
@@ -835,6 +1041,19 @@ void __rdpq_block_reserve(int num_rdp_commands)
     }
 }
 
+/**
+ * @brief Notify that a RSP command written by rdpq in a block is complete
+ * 
+ * This is called after writing a command whose effects on the RDP state were
+ * accounted by #__rdpq_block_reserve, so that the peephole optimizer does not
+ * consider it as written bypassing rdpq (see #block_check_foreign).
+ */
+void __rdpq_block_written(void)
+{
+    extern volatile uint32_t *rspq_cur_pointer;
+    rdpq_block_state.rspq_mark = rspq_cur_pointer;
+}
+
 /**
  * @brief Set a new RDP write pointer, and enqueue a RSP command to run the buffer until there
  * 
@@ -853,6 +1072,7 @@ void __rdpq_block_reserve(int num_rdp_commands)
 void __rdpq_block_update(volatile uint32_t *wptr)
 {
     struct rdpq_block_state_s *st = &rdpq_block_state;
+    block_check_foreign(st);
     uint32_t phys_old = PhysicalAddr(st->wptr);
     uint32_t phys_new = PhysicalAddr(wptr);
     st->wptr = wptr;
@@ -874,6 +1094,7 @@ void __rdpq_block_update(volatile uint32_t *wptr)
         st->last_rdp_append_buffer = rspq_cur_pointer;
         rspq_int_write(RSPQ_CMD_RDP_APPEND_BUFFER, phys_new);
     }
+    __rdpq_block_written();
 }
 
 /** @} */
@@ -894,6 +1115,8 @@ void __rdpq_block_update(volatile uint32_t *wptr)
 __attribute__((noinline))
 void __rdpq_write8(uint32_t cmd_id, uint32_t arg0, uint32_t arg1)
 {
+    if (__builtin_expect(rspq_in_block(), 0) && block_redundant8(cmd_id, arg0, arg1))
+        return;
     rdpq_passthrough_write((cmd_id, arg0, arg1));
 }
 
@@ -901,8 +1124,11 @@ void __rdpq_write8(uint32_t cmd_id, uint32_t arg0, uint32_t arg1)
 __attribute__((noinline))
 void __rdpq_write8_syncchange(uint32_t cmd_id, uint32_t arg0, uint32_t arg1, uint32_t autosync)
 {
+    // A redundant state change does not require any sync either
+    if (__builtin_expect(rspq_in_block(), 0) && block_redundant8(cmd_id, arg0, arg1))
+        return;
     __rdpq_autosync_change(autosync);
-    __rdpq_write8(cmd_id, arg0, arg1);
+    rdpq_passthrough_write((cmd_id, arg0, arg1));
 }
 
 /** @brief Write a standard 8-byte RDP command, which uses some autosync resources  */
@@ -917,9 +1143,11 @@ void __rdpq_write8_syncuse(uint32_t cmd_id, uint32_t arg0, uint32_t arg1, uint32
 __attribute__((noinline))
 void __rdpq_write8_syncchangeuse(uint32_t cmd_id, uint32_t arg0, uint32_t arg1, uint32_t autosync_c, uint32_t autosync_u)
 {
+    if (__builtin_expect(rspq_in_block(), 0) && block_redundant8(cmd_id, arg0, arg1))
+        return;
     __rdpq_autosync_change(autosync_c);
     __rdpq_autosync_use(autosync_u);
-    __rdpq_write8(cmd_id, arg0, arg1);
+    rdpq_passthrough_write((cmd_id, arg0, arg1));
 }
 
 /** @brief Write a standard 16-byte RDP command  */
@@ -1077,7 +1305,7 @@ void rdpq_set_tile_autotmem(int16_t tmem_bytes)
         assertf((tmem_bytes % 8) == 0   , "tmem_bytes must be a multiple of 8");
         tmem_bytes /= 8;
     }
-    rspq_write(RDPQ_OVL_ID, RDPQ_CMD_AUTOTMEM_SET_ADDR, (uint16_t)tmem_bytes);
+    rdpq_write(0, RDPQ_OVL_ID, RDPQ_CMD_AUTOTMEM_SET_ADDR, (uint16_t)tmem_bytes);
 }
 
 void rdpq_sync_full(void (*callback)(void*), void* arg)
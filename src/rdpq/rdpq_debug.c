@@ -17,6 +17,8 @@
 #include "utils.h"
 #include "rspq_constants.h"
 #include "rdpq_constants.h"
+#include "usb.h"
+#include <stdlib.h>
 #else
 ///@cond
 #define debugf(msg, ...)  fprintf(stderr, msg, ##__VA_ARGS__)
@@ -37,6 +39,8 @@
 #define RDPQ_CMD_DEBUG_SHOWLOG  0x00010000
 /** @brief RDP Debug command: debug message */
 #define RDPQ_CMD_DEBUG_MESSAGE  0x00020000
+/** @brief RDP Debug command: begin a frame capture */
+#define RDPQ_CMD_DEBUG_CAPTURE  0x00030000
 
 /** @brief Flags that configure the logging */
 int __rdpq_debug_log_flags;
@@ -53,6 +57,17 @@ int __rdpq_debug_log_flags;
 #define RDPQ_DEBUG_DEBUG     0
 #endif
 
+#ifndef RDPQ_DEBUG_CAPTURE_SIZE
+/**
+ * @brief Size of the buffer used by #rdpq_debug_capture_frame
+ * 
+ * The buffer is allocated when the capture is requested and freed
+ * once it has been written. If a frame does not fit, the capture is
+ * truncated (see #RDPQ_CAPTURE_FLAG_TRUNCATED).
+ */
+#define RDPQ_DEBUG_CAPTURE_SIZE     (1024*1024)
+#endif
+
 #if RDPQ_DEBUG_DEBUG
 /** @brief Like debugf, but guarded by #RDPQ_DEBUG_DEBUG */
 #define intdebugf(...) debugf(__VA_ARGS__)
@@ -198,6 +213,34 @@ static int show_log;                                      ///< != 0 if logging i
 static void (*hooks[MAX_HOOKS])(void*, uint64_t*, int);   ///< Custom hooks
 static void* hooks_ctx[MAX_HOOKS];                        ///< Context for the hooks
 
+/** @brief Maximum number of memory blocks tracked to avoid duplicates in a capture */
+#define CAPTURE_MAX_MEM 64
+
+/** @brief State of the frame capture (see #rdpq_debug_capture_frame) */
+static struct {
+    enum { 
+        CAPTURE_IDLE,                      ///< No capture requested
+        CAPTURE_ARMED,                     ///< Waiting for the capture marker in the RDP stream
+        CAPTURE_RECORDING,                 ///< Recording commands until the next SYNC_FULL
+        CAPTURE_DONE,                      ///< Capture complete, waiting to be written
+    } state;
+    char *fn;                              ///< Output filename (NULL: USB)
+    uint8_t *buf;                          ///< Capture buffer
+    int size;                              ///< Bytes used in the capture buffer
+    int cmds_chunk;                        ///< Offset of the current command chunk (-1: none)
+    uint32_t flags;                        ///< Capture flags (RDPQ_CAPTURE_FLAG_*)
+    struct { uint32_t addr; int width, size; } tex;             ///< Current texture image
+    struct { uint32_t addr; int width, height, size; } col;     ///< Current color image
+    uint32_t z_addr;                       ///< Current Z image
+    bool col_pending, z_pending;           ///< True if color/Z image must be captured at next draw
+    struct { uint32_t addr, len; } mem[CAPTURE_MAX_MEM];        ///< Memory blocks already captured
+    int num_mem;                           ///< Number of entries in mem
+} capture;
+
+static void capture_command(uint64_t *cmd, int sz);
+static void capture_begin(void);
+static void capture_write(void);
+
 // Documented in rdpq_debug_internal.h
 void (*rdpq_trace)(void);
 void (*rdpq_trace_fetch)(bool new_buffer);
@@ -299,6 +342,9 @@ void __rdpq_debug_cmd(uint64_t cmd)
     case 0x02: // Message
         // Nothing to do. Debugging messages are shown by the disassembler
         return;
+    case 0x03: // Capture
+        if (capture.state == CAPTURE_ARMED) capture_begin();
+        return;
     }
 }
 
@@ -309,6 +355,11 @@ void __rdpq_trace(void)
     // is up to date.
     __rdpq_trace_fetch(false);
     __rdpq_trace_flush();
+
+    // If a frame capture is complete, write it out. Avoid doing it
+    // within interrupts, as it can take a long time.
+    if (capture.state == CAPTURE_DONE && get_interrupts_state() == INTERRUPTS_ENABLED)
+        capture_write();
 }
 
 void __rdpq_trace_flush(void)
@@ -345,6 +396,10 @@ void __rdpq_trace_flush(void)
             uint32_t val_flags = shown ? RDPQ_VALIDATE_FLAG_NOECHO : 0;
             rdpq_validate(cur, val_flags, NULL, NULL);
 
+            // Record the command if a frame capture is active
+            if (capture.state == CAPTURE_RECORDING)
+                capture_command(cur, sz);
+
             // Run trace hooks
             for (int i=0;i<MAX_HOOKS && hooks[i];i++)
                 hooks[i](hooks_ctx[i], cur, sz);
@@ -391,6 +446,14 @@ void rdpq_debug_log_msg(const char *msg)
 
 void rdpq_debug_stop(void)
 {
+    // Write a complete capture, and discard one still in progress
+    if (capture.state == CAPTURE_DONE) capture_write();
+    else if (capture.state != CAPTURE_IDLE) {
+        free(capture.buf);
+        free(capture.fn);
+        capture.state = CAPTURE_IDLE;
+    }
+
     rdpq_trace = NULL;
     rdpq_trace_fetch = NULL;
     rspq_write(RDPQ_OVL_ID, RDPQ_CMD_SET_DEBUG_MODE, 0);
@@ -407,6 +470,197 @@ void rdpq_debug_install_hook(void (*hook)(void*, uint64_t*, int), void* ctx)
     assertf(0, "reached maximum number of hooks (%d)", MAX_HOOKS);
 }
 
+/** @brief Reserve space in the capture buffer. Returns NULL if the buffer is full. */
+static void *capture_alloc(int size)
+{
+    if (capture.size + size > RDPQ_DEBUG_CAPTURE_SIZE) return NULL;
+    void *ptr = capture.buf + capture.size;
+    capture.size += size;
+    return ptr;
+}
+
+/** @brief Append RDP commands to the capture */
+static void capture_append(uint64_t *cmd, int sz)
+{
+    if (capture.cmds_chunk < 0) {
+        uint32_t *hdr = capture_alloc(8);
+        if (!hdr) goto full;
+        hdr[0] = RDPQ_CAPTURE_CHUNK_CMDS;
+        hdr[1] = 0;
+        capture.cmds_chunk = (uint8_t*)hdr - capture.buf;
+    }
+
+    uint64_t *dst = capture_alloc(sz * 8);
+    if (!dst) goto full;
+    memcpy(dst, cmd, sz * 8);
+    ((uint32_t*)(capture.buf + capture.cmds_chunk))[1] += sz * 8;
+    return;
+
+full:
+    capture.flags |= RDPQ_CAPTURE_FLAG_TRUNCATED;
+    capture.state = CAPTURE_DONE;
+}
+
+/** @brief Append a block of RDRAM to the capture, as seen by the RDP */
+static void capture_mem(uint32_t addr, int len)
+{
+    if (len <= 0) return;
+
+    // Textures are often loaded multiple times: skip blocks already captured
+    for (int i=0; i<capture.num_mem; i++)
+        if (capture.mem[i].addr == addr && capture.mem[i].len == len)
+            return;
+
+    uint32_t *hdr = capture_alloc(16 + ROUND_UP(len, 8));
+    if (!hdr) {
+        // Skip the block, but keep recording commands
+        capture.flags |= RDPQ_CAPTURE_FLAG_MEM_MISSING;
+        return;
+    }
+    hdr[0] = RDPQ_CAPTURE_CHUNK_MEM;
+    hdr[1] = 8 + ROUND_UP(len, 8);
+    hdr[2] = addr;
+    hdr[3] = len;
+    memcpy(hdr+4, UncachedAddr(0x80000000 | addr), len);
+    capture.cmds_chunk = -1;
+
+    if (capture.num_mem < CAPTURE_MAX_MEM) {
+        capture.mem[capture.num_mem].addr = addr;
+        capture.mem[capture.num_mem].len = len;
+        capture.num_mem++;
+    }
+}
+
+/** @brief Capture the memory accessed by a LOAD_BLOCK / LOAD_TILE / LOAD_TLUT command */
+static void capture_load(uint64_t cmd)
+{
+    int bpp = 4 << capture.tex.size;
+    int stride = capture.tex.width * bpp / 8;
+    int sl = BITS(cmd, 44, 55), tl = BITS(cmd, 32, 43);
+    int sh = BITS(cmd, 12, 23), th = BITS(cmd, 0, 11);
+
+    if (CMD(cmd) == 0x33) { // LOAD_BLOCK: sl/sh are in texels, tl is a line
+        capture_mem(capture.tex.addr + tl * stride + sl * bpp / 8, ((sh - sl + 1) * bpp + 7) / 8);
+    } else {                // LOAD_TILE / LOAD_TLUT: 10.2 coordinates
+        sl >>= 2; tl >>= 2; sh >>= 2; th >>= 2;
+        capture_mem(capture.tex.addr + tl * stride + sl * bpp / 8, 
+            (th - tl) * stride + ((sh - sl + 1) * bpp + 7) / 8);
+    }
+}
+
+/** @brief Record a command of the frame being captured */
+static void capture_command(uint64_t *cmd, int sz)
+{
+    switch (CMD(cmd[0])) {
+    case 0x3D: // SET_TEXTURE_IMAGE
+        capture.tex.addr = BITS(cmd[0], 0, 24);
+        capture.tex.size = BITS(cmd[0], 51, 52);
+        capture.tex.width = BITS(cmd[0], 32, 41) + 1;
+        break;
+    case 0x3F: // SET_COLOR_IMAGE
+        capture.col.addr = BITS(cmd[0], 0, 24);
+        capture.col.size = BITS(cmd[0], 51, 52);
+        capture.col.width = BITS(cmd[0], 32, 41) + 1;
+        capture.col.height = (BITS(cmd[0], 42, 50) | (BIT(cmd[0], 31) << 9)) + 1;  // libdragon extension
+        capture.col_pending = true;
+        break;
+    case 0x3E: // SET_Z_IMAGE
+        capture.z_addr = BITS(cmd[0], 0, 24);
+        capture.z_pending = true;
+        break;
+    case 0x30: case 0x33: case 0x34: // LOAD_TLUT, LOAD_BLOCK, LOAD_TILE
+        capture_load(cmd[0]);
+        break;
+    case 0x08 ... 0x0F: case 0x24: case 0x25: case 0x36: // Triangles and rectangles
+        // Capture the framebuffers at the first draw, when their size is known
+        if (capture.col_pending)
+            capture_mem(capture.col.addr, capture.col.width * capture.col.height * (4 << capture.col.size) / 8);
+        if (capture.z_pending)
+            capture_mem(capture.z_addr, capture.col.width * capture.col.height * 2);
+        capture.col_pending = capture.z_pending = false;
+        break;
+    }
+
+    capture_append(cmd, sz);
+
+    // The frame ends with a SYNC_FULL
+    if (capture.state == CAPTURE_RECORDING && CMD(cmd[0]) == 0x29)
+        capture.state = CAPTURE_DONE;
+}
+
+/** @brief Start recording a capture, when its marker is found in the RDP stream */
+static void capture_begin(void)
+{
+    capture.state = CAPTURE_RECORDING;
+
+    // Begin with the RDP state set before the capture started (as tracked by
+    // the validator), so that the frame can be replayed standalone.
+    uint64_t *state[] = { rdp.last_col, rdp.last_z, rdp.last_tex, rdp.last_som, rdp.last_cc };
+    uint64_t state_data[] = { rdp.last_col_data, rdp.last_z_data, rdp.last_tex_data, rdp.last_som_data, rdp.last_cc_data };
+    for (int i=0; i<sizeof(state)/sizeof(state[0]); i++)
+        if (state[i]) capture_command(&state_data[i], 1);
+    for (int i=0; i<8; i++) {
+        if (rdp.tile[i].last_settile) capture_command(&rdp.tile[i].last_settile_data, 1);
+        if (rdp.tile[i].last_setsize) capture_command(&rdp.tile[i].last_setsize_data, 1);
+    }
+}
+
+/** @brief Write out a complete capture */
+static void capture_write(void)
+{
+    uint32_t *hdr = (uint32_t*)capture.buf;
+    hdr[2] = capture.flags;
+
+    if (capture.fn) {
+        FILE *f = fopen(capture.fn, "wb");
+        if (f) {
+            fwrite(capture.buf, 1, capture.size, f);
+            fclose(f);
+            debugf("rdpq_debug: frame captured to %s (%d bytes)\n", capture.fn, capture.size);
+        } else {
+            debugf("rdpq_debug: cannot open capture file: %s\n", capture.fn);
+        }
+    } else if (usb_getcart() != CART_NONE) {
+        usb_write(DATATYPE_RAWBINARY, capture.buf, capture.size);
+        debugf("rdpq_debug: frame captured to USB (%d bytes)\n", capture.size);
+    } else {
+        debugf("rdpq_debug: cannot send capture: no USB cart detected\n");
+    }
+    if (capture.flags & RDPQ_CAPTURE_FLAG_TRUNCATED)
+        debugf("rdpq_debug: capture truncated: increase RDPQ_DEBUG_CAPTURE_SIZE\n");
+
+    free(capture.buf);
+    free(capture.fn);
+    capture.buf = NULL;
+    capture.fn = NULL;
+    capture.state = CAPTURE_IDLE;
+}
+
+void rdpq_debug_capture_frame(const char *fn)
+{
+    assertf(rdpq_trace, "rdpq trace engine not started");
+    assertf(capture.state == CAPTURE_IDLE, "a frame capture is already in progress");
+
+    capture.buf = malloc(RDPQ_DEBUG_CAPTURE_SIZE);
+    assertf(capture.buf, "cannot allocate capture buffer (%d bytes)", RDPQ_DEBUG_CAPTURE_SIZE);
+    capture.fn = fn ? strdup(fn) : NULL;
+    capture.size = 0;
+    capture.cmds_chunk = -1;
+    capture.flags = 0;
+    capture.num_mem = 0;
+    capture.col_pending = capture.z_pending = false;
+
+    uint32_t *hdr = capture_alloc(16);
+    hdr[0] = RDPQ_CAPTURE_MAGIC;
+    hdr[1] = RDPQ_CAPTURE_VERSION;
+    hdr[2] = 0;
+    hdr[3] = 0;
+
+    // Recording starts when the RDP stream reaches this point
+    capture.state = CAPTURE_ARMED;
+    rdpq_passthrough_write((RDPQ_CMD_DEBUG, RDPQ_CMD_DEBUG_CAPTURE, 0));
+}
+
 #endif
 
 /** @brief Decode a SET_COMBINE command into a #colorcombiner_t structure */
@@ -724,6 +978,7 @@ static void __rdpq_debug_disasm(uint64_t *addr, uint64_t *buf, FILE *out)
     }   return;
     case 0x31: switch(BITS(buf[0], 48, 55)) {
         case 0x01: fprintf(out, "RDPQ_SHOWLOG     show=%d\n", BIT(buf[0], 0)); return;
+        case 0x03: fprintf(out, "RDPQ_CAPTURE\n"); return;
         #ifdef N64
         case 0x02: fprintf(out, "RDPQ_MESSAGE     %s\n", (char*)CachedAddr(0x80000000|BITS(buf[0], 0, 24))); return;
         #endif
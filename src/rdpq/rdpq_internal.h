@@ -76,6 +76,15 @@ typedef struct rdpq_block_s {
     uint32_t cmds[] __attribute__((aligned(8)));  ///< RDP commands
 } rdpq_block_t;
 
+/**
+ * @brief Number of RDP state commands shadowed during block creation
+ * 
+ * While recording a block, the last value written via passthrough to some
+ * RDP state registers (colors, combiner, keying, ...) is remembered, so that
+ * writing the same value again can be dropped. See #rdpq_block_state_t::shadow.
+ */
+#define RDPQ_BLOCK_SHADOW_COUNT  10
+
 /** 
  * @brief RDP block management state 
  * 
@@ -106,6 +115,36 @@ typedef struct rdpq_block_state_s {
      * @brief Tracking state before starting building the block.
      */
     rdpq_tracking_t previous_tracking;
+    /**
+     * @brief Tracking state of the block while its creation is suspended.
+     */
+    rdpq_tracking_t suspended_tracking;
+    /**
+     * @brief Last value written to each shadowed state register during block creation.
+     * 
+     * See #RDPQ_BLOCK_SHADOW_COUNT for the list of shadowed commands. The value
+     * is the 56-bit payload of the command (excluding the command ID).
+     */
+    uint64_t shadow[RDPQ_BLOCK_SHADOW_COUNT];
+    /** @brief Bitmask of the valid entries in #shadow */
+    uint32_t shadow_valid;
+    /**
+     * @brief End of the last chain of consecutive SYNC commands in the RDP buffer.
+     * 
+     * This is NULL if the chain was broken by something that the CPU cannot
+     * see (eg: a RSP command that generates RDP commands).
+     */
+    volatile uint32_t *last_sync_end;
+    /** @brief Bitmask of the SYNC commands in the chain ending at #last_sync_end */
+    uint32_t last_sync_mask;
+    /**
+     * @brief Position in the rspq block after the last command written by rdpq.
+     * 
+     * If the rspq write pointer moved past it, commands were written bypassing
+     * rdpq (eg: by other overlays with rspq_write), so the RDP state shadowed
+     * in the block is not reliable anymore.
+     */
+    volatile uint32_t *rspq_mark;
 } rdpq_block_state_t;
 
 void __rdpq_block_begin();
@@ -114,7 +153,10 @@ void __rdpq_block_free(rdpq_block_t *block);
 void __rdpq_block_run(rdpq_block_t *block);
 void __rdpq_block_next_buffer(void);
 void __rdpq_block_update(volatile uint32_t *wptr);
-void __rdpq_block_reserve(int num_rdp_commands);
+void __rdpq_block_reserve(int num_rdp_commands, uint32_t ovl_id, uint32_t cmd_id);
+void __rdpq_block_written(void);
+void __rdpq_block_suspend(rdpq_block_state_t *state);
+void __rdpq_block_resume(rdpq_block_state_t *state);
 
 inline void __rdpq_autosync_use(uint32_t res)
 {
@@ -10,8 +10,12 @@
 #include "rdpq_sprite_internal.h"
 #include "rdpq_mode.h"
 #include "rdpq_tex.h"
+#include "rdpq_tex_internal.h"
 #include "sprite.h"
 #include "sprite_internal.h"
+#include "utils.h"
+#include <stdlib.h>
+#include <string.h>
 
 static void sprite_upload_palette(sprite_t *sprite, int palidx, bool set_mode)
 {
@@ -137,3 +141,221 @@ void rdpq_sprite_blit(sprite_t *sprite, float x0, float y0, const rdpq_blitparms
     surface_t surf = sprite_get_pixels(sprite);
     rdpq_tex_blit(&surf, x0, y0, parms);
 }
+
+/** @brief Maximum number of sprites in a batch */
+#define SPRITEBATCH_MAX_SPRITES     4096
+/** @brief Maximum number of different sprites (per tile) in a batch */
+#define SPRITEBATCH_MAX_GROUPS      1024
+
+/** @brief A blit recorded in a sprite batch */
+typedef struct {
+    sprite_t *sprite;               ///< Sprite to blit
+    float x0, y0;                   ///< Position on the framebuffer
+    color_t tint;                   ///< Tint color (written to the PRIM register)
+    rdpq_blitparms_t parms;         ///< Blit parameters
+} spritebatch_entry_t;
+
+/** @brief Slot of the hash table that assigns group IDs to sprites */
+typedef struct {
+    sprite_t *sprite;               ///< Sprite (NULL if the slot is empty)
+    uint16_t tile;                  ///< Tile used to blit the sprite
+    uint16_t id;                    ///< Group ID
+} spritebatch_group_t;
+
+/** @brief A sprite batch (see #rdpq_spritebatch_new) */
+struct rdpq_spritebatch_s {
+    int max_sprites;                ///< Maximum number of sprites in the batch
+    int count;                      ///< Number of sprites currently in the batch
+    int layer;                      ///< Current layer
+    bool tinted;                    ///< True if at least one sprite in the batch is tinted
+    spritebatch_entry_t *entries;   ///< Blits recorded in the batch
+    uint32_t *keys;                 ///< Sort keys (layer, TLUT mode, group, index)
+    uint32_t *tmp_keys;             ///< Temporary buffer for sorting
+    int num_groups;                 ///< Number of groups assigned so far
+    int groups_mask;                ///< Size of the group hash table minus 1
+    spritebatch_group_t *groups;    ///< Hash table of groups
+    uint16_t *group_slots;          ///< Slot in the hash table of each group (to clear it quickly)
+};
+
+rdpq_spritebatch_t* rdpq_spritebatch_new(int max_sprites)
+{
+    assertf(max_sprites > 0 && max_sprites <= SPRITEBATCH_MAX_SPRITES,
+        "invalid number of sprites in batch: %d (max: %d)", max_sprites, SPRITEBATCH_MAX_SPRITES);
+
+    int max_groups = MIN(max_sprites, SPRITEBATCH_MAX_GROUPS);
+    int table_size = 1;
+    while (table_size < max_groups*2) table_size *= 2;
+
+    rdpq_spritebatch_t *batch = calloc(1, sizeof(rdpq_spritebatch_t));
+    batch->max_sprites = max_sprites;
+    batch->entries = malloc(max_sprites * sizeof(spritebatch_entry_t));
+    batch->keys = malloc(max_sprites * sizeof(uint32_t));
+    batch->tmp_keys = malloc(max_sprites * sizeof(uint32_t));
+    batch->groups_mask = table_size - 1;
+    batch->groups = calloc(table_size, sizeof(spritebatch_group_t));
+    batch->group_slots = malloc(max_groups * sizeof(uint16_t));
+    return batch;
+}
+
+void rdpq_spritebatch_free(rdpq_spritebatch_t *batch)
+{
+    if (!batch) return;
+    free(batch->entries);
+    free(batch->keys);
+    free(batch->tmp_keys);
+    free(batch->groups);
+    free(batch->group_slots);
+    free(batch);
+}
+
+void rdpq_spritebatch_set_layer(rdpq_spritebatch_t *batch, int layer)
+{
+    assertf(layer >= 0 && layer < 256, "invalid sprite batch layer: %d", layer);
+    batch->layer = layer;
+}
+
+/** @brief Find (or assign) the group ID of a sprite blitted with the specified tile */
+static int spritebatch_group(rdpq_spritebatch_t *batch, sprite_t *sprite, rdpq_tile_t tile)
+{
+    uint32_t h = (((uint32_t)(uintptr_t)sprite >> 3) ^ tile) * 0x9E3779B1;
+    int slot = (h >> 16) & batch->groups_mask;
+
+    while (batch->groups[slot].sprite) {
+        spritebatch_group_t *g = &batch->groups[slot];
+        if (g->sprite == sprite && g->tile == tile)
+            return g->id;
+        slot = (slot + 1) & batch->groups_mask;
+    }
+
+    assertf(batch->num_groups < SPRITEBATCH_MAX_GROUPS, "too many different sprites in batch (max: %d)", SPRITEBATCH_MAX_GROUPS);
+    int id = batch->num_groups++;
+    batch->groups[slot] = (spritebatch_group_t){ .sprite = sprite, .tile = tile, .id = id };
+    batch->group_slots[id] = slot;
+    return id;
+}
+
+void rdpq_spritebatch_add_tinted(rdpq_spritebatch_t *batch, sprite_t *sprite, float x0, float y0, const rdpq_blitparms_t *parms, color_t tint)
+{
+    assertf(batch->count < batch->max_sprites, "sprite batch is full (max: %d)", batch->max_sprites);
+    int idx = batch->count++;
+
+    spritebatch_entry_t *e = &batch->entries[idx];
+    e->sprite = sprite;
+    e->x0 = x0;
+    e->y0 = y0;
+    e->tint = tint;
+    if (parms) e->parms = *parms;
+    else memset(&e->parms, 0, sizeof(e->parms));
+
+    if (color_to_packed32(tint) != 0xFFFFFFFF)
+        batch->tinted = true;
+
+    // Sort key: blits are ordered by layer, then by TLUT mode (to minimize
+    // render mode changes), then by sprite (to minimize TMEM loads), and
+    // finally by insertion order.
+    int group = spritebatch_group(batch, sprite, e->parms.tile);
+    rdpq_tlut_t tlut = rdpq_tlut_from_format(sprite_get_format(sprite));
+    batch->keys[idx] = ((uint32_t)batch->layer << 24) | (tlut << 22) | (group << 12) | idx;
+}
+
+void rdpq_spritebatch_add(rdpq_spritebatch_t *batch, sprite_t *sprite, float x0, float y0, const rdpq_blitparms_t *parms)
+{
+    rdpq_spritebatch_add_tinted(batch, sprite, x0, y0, parms, RGBA32(0xFF,0xFF,0xFF,0xFF));
+}
+
+/** @brief Sort the keys of a sprite batch (LSD radix sort, 8 bits per pass) */
+static void spritebatch_sort(rdpq_spritebatch_t *batch)
+{
+    uint32_t *src = batch->keys, *dst = batch->tmp_keys;
+    int n = batch->count;
+
+    for (int shift = 0; shift < 32; shift += 8) {
+        int offsets[256] = {0};
+        for (int i=0; i<n; i++)
+            offsets[(src[i] >> shift) & 0xFF]++;
+        // Skip the pass if all keys have the same byte
+        if (offsets[(src[0] >> shift) & 0xFF] == n)
+            continue;
+        for (int i=0, sum=0; i<256; i++) {
+            int c = offsets[i]; offsets[i] = sum; sum += c;
+        }
+        for (int i=0; i<n; i++)
+            dst[offsets[(src[i] >> shift) & 0xFF]++] = src[i];
+        uint32_t *t = src; src = dst; dst = t;
+    }
+
+    batch->keys = src;
+    batch->tmp_keys = dst;
+}
+
+/** 
+ * @brief Implement large_tex_draw protocol for a surface already resident in TMEM
+ * 
+ * This is used by #rdpq_spritebatch_draw to draw a sprite that has been
+ * uploaded in full just once for multiple blits.
+ */
+static void ltd_resident(rdpq_tile_t tile, const surface_t *tex, int s0, int t0, int s1, int t1, 
+    void (*draw_cb)(rdpq_tile_t tile, int s0, int t0, int s1, int t1), bool filtering)
+{
+    draw_cb(tile, s0, t0, s1, t1);
+}
+
+void rdpq_spritebatch_draw(rdpq_spritebatch_t *batch)
+{
+    if (batch->count == 0) return;
+
+    spritebatch_sort(batch);
+
+    sprite_t *cur_sprite = NULL;
+    rdpq_tile_t cur_tile = 0;
+    int cur_tlut = -1;
+    uint32_t cur_tint = 0;
+    bool resident = false;
+    surface_t surf;
+
+    for (int i=0; i<batch->count; i++) {
+        spritebatch_entry_t *e = &batch->entries[batch->keys[i] & 0xFFF];
+
+        if (e->sprite != cur_sprite || e->parms.tile != cur_tile) {
+            cur_sprite = e->sprite;
+            cur_tile = e->parms.tile;
+
+            // Configure the TLUT render mode only when it changes
+            rdpq_tlut_t tlut = rdpq_tlut_from_format(sprite_get_format(cur_sprite));
+            if (tlut != cur_tlut) {
+                rdpq_mode_tlut(tlut);
+                cur_tlut = tlut;
+            }
+            sprite_upload_palette(cur_sprite, 0, false);
+
+            // Upload the sprite once for all its blits, if it fits TMEM. Otherwise,
+            // each blit will go through the standard path (uploading it in chunks).
+            surf = sprite_get_pixels(cur_sprite);
+            tex_loader_t tload = tex_loader_init(cur_tile, &surf);
+            resident = tex_loader_calc_max_height(&tload, surf.width) >= surf.height;
+            if (resident)
+                rdpq_tex_upload(cur_tile, &surf, NULL);
+        }
+
+        if (batch->tinted) {
+            uint32_t tint = color_to_packed32(e->tint);
+            if (tint != cur_tint || i == 0) {
+                rdpq_set_prim_color(e->tint);
+                cur_tint = tint;
+            }
+        }
+
+        if (resident)
+            __rdpq_tex_blit(&surf, e->x0, e->y0, &e->parms, ltd_resident);
+        else
+            rdpq_tex_blit(&surf, e->x0, e->y0, &e->parms);
+    }
+
+    // Reset the batch for the next frame
+    for (int i=0; i<batch->num_groups; i++)
+        batch->groups[batch->group_slots[i]].sprite = NULL;
+    batch->num_groups = 0;
+    batch->count = 0;
+    batch->layer = 0;
+    batch->tinted = false;
+}
@@ -12,6 +12,7 @@
 #include "rdpq_rect.h"
 #include "rdpq_tex.h"
 #include "rdpq_tex_internal.h"
+#include "rdpq_internal.h"
 #include "utils.h"
 #include <math.h>
 
@@ -20,6 +21,8 @@ typedef struct rdpq_multi_upload_s {
     int  used;
     int  bytes;
     int  limit;
+    int  autotmem;          ///< TMEM bytes allocated via autotmem (starting from address 0)
+    bool autotmem_split;    ///< True if a texture allocated via autotmem also uses the upper TMEM half
 } rdpq_multi_upload_t;
 static rdpq_multi_upload_t multi_upload;
 /** @brief Information on last image uploaded we are doing a multi-texture upload */
@@ -28,6 +31,31 @@ tex_loader_t last_tload;
 /** @brief Address in TMEM where the palettes must be loaded */
 #define TMEM_PALETTE_ADDR   0x800
 
+/** @brief Maximum number of textures tracked by the TMEM cache */
+#define TMEM_CACHE_MAX_ENTRIES   16
+
+/** @brief A texture (or a sub-rectangle of it) resident in TMEM */
+typedef struct {
+    uint32_t buffer;            ///< Physical address of the texture pixels
+    uint16_t stride;            ///< Stride of the texture in bytes
+    uint8_t fmt;                ///< Format of the texture (#tex_format_t)
+    bool split;                 ///< True if the texture is split between the two TMEM halves (RGBA32)
+    int16_t s0, t0, s1, t1;     ///< Rectangle of the texture that was loaded
+    uint16_t tmem_addr;         ///< Address in TMEM
+    uint16_t tmem_size;         ///< Bytes used in TMEM (in each half, if split)
+    uint32_t last_use;          ///< Value of the cache clock when the entry was last used (for LRU)
+} tmem_cache_entry_t;
+
+/** @brief State of the TMEM cache (see #rdpq_tex_cache_enable) */
+static struct {
+    bool enabled;               ///< True if the cache is enabled
+    int count;                  ///< Number of valid entries
+    uint32_t clock;             ///< Incremented at every cached load
+    uint32_t pin_clock;         ///< Entries used since this clock are pinned until the end of the multi-texture upload
+    int tlut_addr;              ///< Lowest TMEM address used by palettes: TMEM above it is not used by the cache
+    tmem_cache_entry_t entries[TMEM_CACHE_MAX_ENTRIES];
+} tmem_cache;
+
 /// @brief Calculates the first power of 2 that is equal or larger than size
 /// @param x input in units
 /// @return Power of 2 that is equal or larger than x
@@ -362,13 +390,210 @@ int tex_loader_calc_max_height(tex_loader_t *tload, int width)
 
 ///@endcond
 
+/** @brief Check whether a TMEM cache entry overlaps the specified TMEM range */
+static bool tmem_cache_overlaps(const tmem_cache_entry_t *e, int addr, int size)
+{
+    if (addr < e->tmem_addr + e->tmem_size && e->tmem_addr < addr + size)
+        return true;
+    if (e->split && addr < e->tmem_addr + 2048 + e->tmem_size && e->tmem_addr + 2048 < addr + size)
+        return true;
+    return false;
+}
+
+/** @brief Remove from the TMEM cache all the textures overwritten by a load to the specified range */
+static void tmem_cache_evict(int addr, int size, bool split)
+{
+    for (int i=0; i<tmem_cache.count; i++) {
+        tmem_cache_entry_t *e = &tmem_cache.entries[i];
+        if (tmem_cache_overlaps(e, addr, size) || (split && tmem_cache_overlaps(e, addr+2048, size)))
+            tmem_cache.entries[i--] = tmem_cache.entries[--tmem_cache.count];
+    }
+}
+
+/** 
+ * @brief Remove the least recently used texture from the TMEM cache
+ * 
+ * Textures used by the current multi-texture upload are never evicted.
+ * 
+ * @return false if there was no texture that could be evicted
+ */
+static bool tmem_cache_evict_lru(void)
+{
+    int lru = -1;
+    for (int i=0; i<tmem_cache.count; i++) {
+        tmem_cache_entry_t *e = &tmem_cache.entries[i];
+        if (multi_upload.used && (int32_t)(e->last_use - tmem_cache.pin_clock) >= 0)
+            continue;
+        if (lru < 0 || (int32_t)(e->last_use - tmem_cache.entries[lru].last_use) < 0)
+            lru = i;
+    }
+    if (lru < 0) return false;
+    tmem_cache.entries[lru] = tmem_cache.entries[--tmem_cache.count];
+    return true;
+}
+
+/** @brief Find the lowest free TMEM address for a texture of the specified size, or -1 if there is none */
+static int tmem_cache_find_free(int size, bool split, bool low_half)
+{
+    int end = low_half ? 2048 : 4096;
+    end = MIN(end, split ? tmem_cache.tlut_addr - 2048 : tmem_cache.tlut_addr);
+
+    // The candidate addresses are the start of TMEM and the end of each texture
+    // (also in the upper half for split textures and allocations).
+    int best = -1;
+    for (int i=-1; i<tmem_cache.count; i++) {
+        int cands[3] = { 0, -1, -1 };
+        if (i >= 0) {
+            tmem_cache_entry_t *e = &tmem_cache.entries[i];
+            cands[0] = e->tmem_addr + e->tmem_size;
+            cands[1] = cands[0] + (e->split ? 2048 : 0);
+            cands[2] = split ? cands[1] - 2048 : -1;
+        }
+        for (int j=0; j<3; j++) {
+            int addr = cands[j];
+            if (addr < 0 || addr + size > end || (best >= 0 && addr >= best))
+                continue;
+            // During a multi-texture upload, also skip the TMEM allocated via autotmem
+            tmem_cache_entry_t autotmem = { .tmem_addr = 0, .tmem_size = multi_upload.autotmem, .split = multi_upload.autotmem_split };
+            bool free = !multi_upload.used || !multi_upload.autotmem ||
+                (!tmem_cache_overlaps(&autotmem, addr, size) && !(split && tmem_cache_overlaps(&autotmem, addr+2048, size)));
+            for (int k=0; k<tmem_cache.count && free; k++) {
+                tmem_cache_entry_t *e = &tmem_cache.entries[k];
+                free = !tmem_cache_overlaps(e, addr, size) && !(split && tmem_cache_overlaps(e, addr+2048, size));
+            }
+            if (free) best = addr;
+        }
+    }
+    return best;
+}
+
+/**
+ * @brief Skip the textures loaded through the TMEM cache in the autotmem allocation
+ * 
+ * During a multi-texture upload, textures that cannot go through the cache
+ * are allocated via autotmem, which starts from TMEM address 0. Move the
+ * autotmem position past the textures used so far by the multi-texture upload,
+ * so that they are not overwritten.
+ * 
+ * @param split     True if the texture to load also uses the upper TMEM half
+ */
+static void tmem_cache_autotmem_skip(bool split)
+{
+    int end = multi_upload.autotmem;
+    for (int i=0; i<tmem_cache.count; i++) {
+        tmem_cache_entry_t *e = &tmem_cache.entries[i];
+        if ((int32_t)(e->last_use - tmem_cache.pin_clock) < 0)
+            continue;
+        int e_end = e->tmem_addr + e->tmem_size;
+        if (split && e->tmem_addr >= 2048) e_end -= 2048;
+        end = MAX(end, e_end);
+    }
+    if (end > multi_upload.autotmem) {
+        rdpq_set_tile_autotmem(end - multi_upload.autotmem);
+        multi_upload.autotmem = end;
+    }
+}
+
+/**
+ * @brief Load a rectangle of a texture through the TMEM cache
+ * 
+ * If the rectangle is still resident in TMEM, only the tile descriptor is
+ * configured. Otherwise, a TMEM area is allocated (evicting the least recently
+ * used textures if needed) and the rectangle is loaded there.
+ * 
+ * @return Number of bytes used in TMEM, or -1 if the TMEM cache cannot be used
+ *         for this load (in which case nothing was emitted).
+ */
+static int tex_loader_load_cached(tex_loader_t *tload, int s0, int t0, int s1, int t1)
+{
+    tex_format_t fmt = surface_get_format(tload->tex);
+    if (fmt == FMT_YUV16)
+        return -1;
+
+    uint32_t buffer = PhysicalAddr(tload->tex->buffer);
+    uint32_t clock = ++tmem_cache.clock;
+    int nbytes = texload_set_rect(tload, s0, t0, s1, t1);
+
+    for (int i=0; i<tmem_cache.count; i++) {
+        tmem_cache_entry_t *e = &tmem_cache.entries[i];
+        if (e->buffer == buffer && e->fmt == fmt && e->stride == tload->tex->stride &&
+            e->s0 == s0 && e->t0 == t0 && e->s1 == s1 && e->t1 == t1) {
+            // Cache hit: just configure the tile descriptor, like the loaders do
+            e->last_use = clock;
+            tex_loader_set_tmem_addr(tload, e->tmem_addr);
+            if (TEX_FORMAT_BITDEPTH(fmt) == 4) { s0 &= ~1; s1 = (s1+1) & ~1; }
+            texload_settile(tload, s0, t0, s1, t1);
+            return nbytes;
+        }
+    }
+
+    bool split = fmt == FMT_RGBA32;
+    bool low_half = split || fmt == FMT_CI4 || fmt == FMT_CI8;
+    if (tmem_cache.count == TMEM_CACHE_MAX_ENTRIES && !tmem_cache_evict_lru())
+        return -1;
+
+    int addr;
+    while ((addr = tmem_cache_find_free(nbytes, split, low_half)) < 0) {
+        if (!tmem_cache_evict_lru()) {
+            assertf(!multi_upload.used, "Multi-texture upload exceeded TMEM size");
+            return -1;
+        }
+    }
+
+    tmem_cache.entries[tmem_cache.count++] = (tmem_cache_entry_t){
+        .buffer = buffer, .stride = tload->tex->stride, .fmt = fmt, .split = split,
+        .s0 = s0, .t0 = t0, .s1 = s1, .t1 = t1,
+        .tmem_addr = addr, .tmem_size = nbytes, .last_use = clock,
+    };
+    tex_loader_set_tmem_addr(tload, addr);
+    tex_loader_load(tload, s0, t0, s1, t1);
+    return nbytes;
+}
+
+void rdpq_tex_cache_enable(bool enable)
+{
+    tmem_cache.enabled = enable;
+    tmem_cache.count = 0;
+    tmem_cache.tlut_addr = 4096;
+}
+
+void rdpq_tex_cache_invalidate(void)
+{
+    tmem_cache.count = 0;
+}
+
+void rdpq_tex_cache_invalidate_surface(const surface_t *tex)
+{
+    uint32_t start = PhysicalAddr(tex->buffer);
+    uint32_t end = start + tex->stride * tex->height;
+    for (int i=0; i<tmem_cache.count; i++) {
+        tmem_cache_entry_t *e = &tmem_cache.entries[i];
+        if (e->buffer < end && start < e->buffer + e->stride * e->t1)
+            tmem_cache.entries[i--] = tmem_cache.entries[--tmem_cache.count];
+    }
+}
+
 int rdpq_tex_upload_sub(rdpq_tile_t tile, const surface_t *tex, const rdpq_texparms_t *parms, int s0, int t0, int s1, int t1)
 {
     last_tload = tex_loader_init(tile, tex);
     if (parms) tex_loader_set_texparms(&last_tload, parms);
+
+    // Go through the TMEM cache if possible. Within a block, the TMEM contents
+    // at playback time are unknown, so the cache is not used.
+    if (tmem_cache.enabled && !rspq_in_block() && (parms == NULL || parms->tmem_addr == 0)) {
+        int nbytes = tex_loader_load_cached(&last_tload, s0, t0, s1, t1);
+        if (nbytes >= 0) {
+            if (multi_upload.used) multi_upload.bytes += nbytes;
+            return nbytes;
+        }
+    }
     
+    tex_format_t fmt = surface_get_format(tex);
+    bool split = fmt == FMT_RGBA32 || fmt == FMT_YUV16;
     if (multi_upload.used) {
         assertf(parms == NULL || parms->tmem_addr == 0, "Do not specify a TMEM address while doing a multi-texture upload");
+        if (tmem_cache.count && !rspq_in_block())
+            tmem_cache_autotmem_skip(split);
         tex_loader_set_tmem_addr(&last_tload, RDPQ_AUTOTMEM);
     } else {
         tex_loader_set_tmem_addr(&last_tload, parms ? parms->tmem_addr : 0);
@@ -376,16 +601,24 @@ int rdpq_tex_upload_sub(rdpq_tile_t tile, const surface_t *tex, const rdpq_texpa
 
     int nbytes = tex_loader_load(&last_tload, s0, t0, s1, t1);
 
+    if (tmem_cache.count && !rspq_in_block()) {
+        // Forget about the textures that were overwritten. With the autotmem
+        // engine, the texture was loaded at the current autotmem position.
+        int addr = multi_upload.used ? multi_upload.autotmem : last_tload.tmem_addr;
+        tmem_cache_evict(addr, nbytes, split);
+    }
+
     if (multi_upload.used) {
         rdpq_set_tile_autotmem(nbytes);
         multi_upload.bytes += nbytes;
+        multi_upload.autotmem += nbytes;
+        multi_upload.autotmem_split |= split;
 
         #ifndef NDEBUG
         // Do a best-effort check to make sure we don't exceed TMEM size. This is not 100%
         // guaranteed to catch all cases: if a texture is uploaded via block playback, we will
         // not know about its size. Anyway, the RSP will also do check and trigger a RSP assert,
         // with the only gotcha that there will be no traceback for it.
-        tex_format_t fmt = surface_get_format(tex);
         if (fmt == FMT_CI4 || fmt == FMT_CI8 || fmt == FMT_RGBA32 || fmt == FMT_YUV16)
             multi_upload.limit = 2048;
         assertf(multi_upload.bytes <= multi_upload.limit, "Multi-texture upload exceeded TMEM size");
@@ -407,10 +640,14 @@ int rdpq_tex_reuse_sub(rdpq_tile_t tile, const rdpq_texparms_t *parms, int s0, i
     assertf(parms == NULL || parms->tmem_addr == 0, "Do not specify a TMEM address while reusing an existing texture");
 
     // Check if just copying a tile descriptor is enough
+    // If the texture was loaded through the TMEM cache, its address is known
+    // to the CPU, otherwise it was allocated by the autotmem engine.
+    bool cached = !(last_tload.tmem_addr & (RDPQ_AUTOTMEM | RDPQ_AUTOTMEM_REUSE(0)));
+
     if(!s0 && !t0 && s1 == last_tload.rect.width && t1 == last_tload.rect.height){
         if(!parms){
             last_tload.tile = tile;
-            last_tload.tmem_addr = RDPQ_AUTOTMEM_REUSE(0);
+            if (!cached) last_tload.tmem_addr = RDPQ_AUTOTMEM_REUSE(0);
             texload_settile(&last_tload, s0, t0, s1, t1);
             return 0;
         }
@@ -428,7 +665,7 @@ int rdpq_tex_reuse_sub(rdpq_tile_t tile, const rdpq_texparms_t *parms, int s0, i
     assertf(tmem_offset % 8 == 0, "Due to 8-byte texture alignment, for %s format, s0=%i must be in multiples of %i pixels", tex_format_name(fmt), s0, TEX_FORMAT_BYTES2PIX(fmt, 8));
     
     tmem_offset += tload.rect.tmem_pitch*t0;
-    tload.tmem_addr = RDPQ_AUTOTMEM_REUSE(tmem_offset);
+    tload.tmem_addr = cached ? last_tload.tmem_addr + tmem_offset : RDPQ_AUTOTMEM_REUSE(tmem_offset);
 
     if(parms) tload.texparms = parms;
     int subwidth = s1 - s0, subheight = t1 - t0;
@@ -464,6 +701,17 @@ static void ltd_texloader(rdpq_tile_t tile, const surface_t *tex, int s0, int t0
 
     // Calculate the optimal height for a strip, based on strips of maximum length.
     int tile_h = tex_loader_calc_max_height(&tload, tex->width);
+
+    if (tmem_cache.enabled && !rspq_in_block()) {
+        // If the whole rectangle fits in a single strip, go through the TMEM cache
+        int tm = filtering ? MAX(t0 - 1, 0) : t0;
+        if (tm + tile_h >= t1 && tex_loader_load_cached(&tload, s0, tm, s1, t1) >= 0) {
+            draw_cb(tile, s0, t0, s1, t1);
+            return;
+        }
+        // Strips are loaded at the start of TMEM
+        tmem_cache_evict(0, tile_h * tload.rect.tmem_pitch, surface_get_format(tex) == FMT_RGBA32);
+    }
     
     // Go through the surface
     while (t0 < t1) 
@@ -671,6 +919,14 @@ void rdpq_tex_blit(const surface_t *surf, float x0, float y0, const rdpq_blitpar
 
 void rdpq_tex_upload_tlut(uint16_t *tlut, int color_idx, int num_colors)
 {
+    if (tmem_cache.enabled && !rspq_in_block()) {
+        // Reserve the TMEM area from the palette upwards, so that it is not
+        // overwritten by cached textures.
+        int addr = TMEM_PALETTE_ADDR + color_idx*2*4;
+        tmem_cache_evict(addr, num_colors*2*4, false);
+        tmem_cache.tlut_addr = MIN(tmem_cache.tlut_addr, addr);
+    }
+
     rdpq_set_texture_image_raw(0, PhysicalAddr(tlut), FMT_RGBA16, num_colors, 1);
     rdpq_set_tile(RDPQ_TILE_INTERNAL, FMT_I4, TMEM_PALETTE_ADDR + color_idx*2*4, num_colors, NULL);
     rdpq_load_tlut_raw(RDPQ_TILE_INTERNAL, 0, num_colors);
@@ -683,7 +939,10 @@ void rdpq_tex_multi_begin(void)
     if (multi_upload.used++ == 0) {
         multi_upload.bytes = 0;
         multi_upload.limit = 4096;
+        multi_upload.autotmem = 0;
+        multi_upload.autotmem_split = false;
         last_tload.tex = 0;
+        tmem_cache.pin_clock = tmem_cache.clock + 1;
     }
 }
 
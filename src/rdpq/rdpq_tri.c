@@ -3,7 +3,9 @@
  * @brief RDP Command queue: triangle drawing routine
  * @ingroup rdp
  * 
- * This file contains the implementation of a single function: #rdpq_triangle.
+ * This file contains the implementation of #rdpq_triangle, and of the indexed
+ * variants that draw triangles out of the RSP vertex cache (#rdpq_vertex_load,
+ * #rdpq_triangle_indexed and #rdpq_mesh_draw).
  * 
  * The RDP triangle commands are complex to assemble because they are designed
  * for the hardware that will be drawing them, rather than for the programmer
@@ -17,6 +19,8 @@
 
 #include <math.h>
 #include <float.h>
+#include <stdlib.h>
+#include <string.h>
 #include "rdpq.h"
 #include "rdpq_tri.h"
 #include "rspq.h"
@@ -407,6 +411,35 @@ static inline void __rdpq_write_zbuf_coeffs(rspq_write_t *w, rdpq_tri_edge_data_
     tracef("dzde: %f (%08llx)\n", DzDe, (uint64_t)(DzDe * 65536.0f));
 }
 
+/**
+ * @brief Notify the block recorder that the RSP is going to emit a triangle
+ * 
+ * Triangles are enqueued with rspq_write, bypassing #rdpq_write, so the
+ * peephole optimizer of blocks would otherwise assume that the RDP commands
+ * recorded before and after the triangle are adjacent (and drop a SYNC
+ * that is still required). Call #__rdpq_triangle_block_done after writing
+ * the command.
+ */
+static inline void __rdpq_triangle_block_notify(uint32_t cmd_id)
+{
+    if (__builtin_expect(rspq_in_block(), 0))
+        __rdpq_block_reserve(0, RDPQ_OVL_ID, cmd_id);
+}
+
+/** @brief Notify the block recorder that a triangle command was written (see #__rdpq_triangle_block_notify) */
+static inline void __rdpq_triangle_block_done(void)
+{
+    if (__builtin_expect(rspq_in_block(), 0))
+        __rdpq_block_written();
+}
+
+/** @brief Write a rdpq triangle command, notifying the block recorder */
+#define __rdpq_triangle_write(cmd_id, ...) ({ \
+    __rdpq_triangle_block_notify(cmd_id); \
+    rspq_write(RDPQ_OVL_ID, cmd_id, ##__VA_ARGS__); \
+    __rdpq_triangle_block_done(); \
+})
+
 /** @brief RDP triangle primitive assembled on the CPU */
 void rdpq_triangle_cpu(const rdpq_trifmt_t *fmt, const float *v1, const float *v2, const float *v3)
 {
@@ -436,6 +469,7 @@ void rdpq_triangle_cpu(const rdpq_trifmt_t *fmt, const float *v1, const float *v
         cmd_id |= 0x1;
     }
 
+    __rdpq_triangle_block_notify(cmd_id);
     rspq_write_t w = rspq_write_begin(RDPQ_OVL_ID, cmd_id, size);
 
     if( v1[fmt->pos_offset + 1] > v2[fmt->pos_offset + 1] ) { SWAP(v1, v2); }
@@ -460,10 +494,23 @@ void rdpq_triangle_cpu(const rdpq_trifmt_t *fmt, const float *v1, const float *v
     }
 
     rspq_write_end(&w);
+    __rdpq_triangle_block_done();
 }
 
-/** @brief RDP triangle primitive assembled on the RSP */
-void rdpq_triangle_rsp(const rdpq_trifmt_t *fmt, const float *v1, const float *v2, const float *v3)
+/** @brief Size in bytes of a vertex slot in the RSP overlay (see RDPQ_TRI_DATA) */
+#define TRI_DATA_LEN        ROUND_UP((2+1+1+3)*4, 16)
+
+/** @brief First vertex slot of the RSP vertex cache (slots 0-2 are used by #rdpq_triangle_rsp) */
+#define VTXCACHE_FIRST_SLOT 3
+
+/**
+ * @brief Prepare the RSP triangle command for the specified format.
+ * 
+ * This also registers the resources used by the triangle in the autosync engine.
+ * 
+ * @return The high 16 bits of the triangle command, as expected by RDPQCmd_Triangle.
+ */
+static uint32_t __rdpq_triangle_rsp_cmd(const rdpq_trifmt_t *fmt)
 {
     uint32_t res = AUTOSYNC_PIPE;
     if (fmt->tex_offset >= 0) {
@@ -480,54 +527,68 @@ void rdpq_triangle_rsp(const rdpq_trifmt_t *fmt, const float *v1, const float *v
     if (fmt->tex_offset >= 0)   cmd_id |= 0x2;
     if (fmt->z_offset >= 0)     cmd_id |= 0x1;
 
-    const int TRI_DATA_LEN = ROUND_UP((2+1+1+3)*4, 16);
+    return 0xC000 | (cmd_id << 8) | 
+        (fmt->tex_mipmaps ? (fmt->tex_mipmaps-1) << 3 : 0) | 
+        (fmt->tex_tile & 7);
+}
 
-    const float *vtx[3] = {v1, v2, v3};
-    for (int i=0;i<3;i++) {
-        const float *v = vtx[i];
-
-        // X,Y: s13.2
-        int16_t x = floorf(v[fmt->pos_offset+0] * 4.0f);
-        int16_t y = floorf(v[fmt->pos_offset+1] * 4.0f);
-        
-        int16_t z = 0;
-        if (fmt->z_offset >= 0) {
-            z = v[fmt->z_offset+0] * 0x7FFF;
-        } 
-
-        int32_t rgba = 0;
-        if (fmt->shade_offset >= 0) {
-            const float *v_shade = fmt->shade_flat ? v1 : v;
-            uint32_t r = v_shade[fmt->shade_offset+0] * 255.0;
-            uint32_t g = v_shade[fmt->shade_offset+1] * 255.0;
-            uint32_t b = v_shade[fmt->shade_offset+2] * 255.0;
-            uint32_t a = v_shade[fmt->shade_offset+3] * 255.0;
-            rgba = (r << 24) | (g << 16) | (b << 8) | a;
-        }
+/**
+ * @brief Convert a vertex to fixed point and load it into a RSP vertex slot.
+ * 
+ * @param fmt       Format of the vertex
+ * @param v         Vertex components
+ * @param v_shade   Vertex to take the shade component from (for flat shading)
+ * @param slot      Vertex slot in the RSP overlay
+ */
+static void __rdpq_triangle_rsp_vertex(const rdpq_trifmt_t *fmt, const float *v, const float *v_shade, int slot)
+{
+    // X,Y: s13.2
+    int16_t x = floorf(v[fmt->pos_offset+0] * 4.0f);
+    int16_t y = floorf(v[fmt->pos_offset+1] * 4.0f);
+    
+    int16_t z = 0;
+    if (fmt->z_offset >= 0) {
+        z = v[fmt->z_offset+0] * 0x7FFF;
+    } 
 
-        int16_t s=0, t=0;
-        int32_t w=0, inv_w=0;
-        if (fmt->tex_offset >= 0) {
-            s     = v[fmt->tex_offset+0] * 32.0f;
-            t     = v[fmt->tex_offset+1] * 32.0f;
-            w     = float_to_s16_16(1.0f / v[fmt->tex_offset+2]);
-            inv_w = float_to_s16_16(       v[fmt->tex_offset+2]);
-        }
+    int32_t rgba = 0;
+    if (fmt->shade_offset >= 0) {
+        uint32_t r = v_shade[fmt->shade_offset+0] * 255.0;
+        uint32_t g = v_shade[fmt->shade_offset+1] * 255.0;
+        uint32_t b = v_shade[fmt->shade_offset+2] * 255.0;
+        uint32_t a = v_shade[fmt->shade_offset+3] * 255.0;
+        rgba = (r << 24) | (g << 16) | (b << 8) | a;
+    }
 
-        rspq_write(RDPQ_OVL_ID, RDPQ_CMD_TRIANGLE_DATA,
-            TRI_DATA_LEN * i, 
-            (x << 16) | (y & 0xFFFF), 
-            (z << 16), 
-            rgba, 
-            (s << 16) | (t & 0xFFFF), 
-            w,
-            inv_w);
+    int16_t s=0, t=0;
+    int32_t w=0, inv_w=0;
+    if (fmt->tex_offset >= 0) {
+        s     = v[fmt->tex_offset+0] * 32.0f;
+        t     = v[fmt->tex_offset+1] * 32.0f;
+        w     = float_to_s16_16(1.0f / v[fmt->tex_offset+2]);
+        inv_w = float_to_s16_16(       v[fmt->tex_offset+2]);
     }
 
-    rspq_write(RDPQ_OVL_ID, RDPQ_CMD_TRIANGLE, 
-        0xC000 | (cmd_id << 8) | 
-        (fmt->tex_mipmaps ? (fmt->tex_mipmaps-1) << 3 : 0) | 
-        (fmt->tex_tile & 7));
+    __rdpq_triangle_write(RDPQ_CMD_TRIANGLE_DATA,
+        TRI_DATA_LEN * slot, 
+        (x << 16) | (y & 0xFFFF), 
+        (z << 16), 
+        rgba, 
+        (s << 16) | (t & 0xFFFF), 
+        w,
+        inv_w);
+}
+
+/** @brief RDP triangle primitive assembled on the RSP */
+void rdpq_triangle_rsp(const rdpq_trifmt_t *fmt, const float *v1, const float *v2, const float *v3)
+{
+    uint32_t tricmd = __rdpq_triangle_rsp_cmd(fmt);
+
+    const float *vtx[3] = {v1, v2, v3};
+    for (int i=0;i<3;i++)
+        __rdpq_triangle_rsp_vertex(fmt, vtx[i], fmt->shade_flat ? v1 : vtx[i], i);
+
+    __rdpq_triangle_write(RDPQ_CMD_TRIANGLE, tricmd);
 }
 
 void rdpq_triangle(const rdpq_trifmt_t *fmt, const float *v1, const float *v2, const float *v3)
@@ -538,3 +599,87 @@ void rdpq_triangle(const rdpq_trifmt_t *fmt, const float *v1, const float *v2, c
     rdpq_triangle_rsp(fmt, v1, v2, v3);
 #endif
 }
+
+void rdpq_vertex_load(const rdpq_trifmt_t *fmt, int slot, const float *vertices, int vtx_stride, int count)
+{
+    assertf(slot >= 0 && slot + count <= RDPQ_VTXCACHE_SIZE,
+        "invalid vertex cache range: %d-%d (max: %d)", slot, slot + count - 1, RDPQ_VTXCACHE_SIZE - 1);
+
+    for (int i=0; i<count; i++, vertices += vtx_stride)
+        __rdpq_triangle_rsp_vertex(fmt, vertices, vertices, VTXCACHE_FIRST_SLOT + slot + i);
+}
+
+void rdpq_triangle_indexed(const rdpq_trifmt_t *fmt, int s1, int s2, int s3)
+{
+    assertf(fmt->shade_offset < 0 || !fmt->shade_flat,
+        "flat shading is not supported by indexed triangles, use rdpq_triangle instead");
+    assertf(s1 >= 0 && s1 < RDPQ_VTXCACHE_SIZE && s2 >= 0 && s2 < RDPQ_VTXCACHE_SIZE && s3 >= 0 && s3 < RDPQ_VTXCACHE_SIZE,
+        "invalid vertex cache slot: %d/%d/%d (max: %d)", s1, s2, s3, RDPQ_VTXCACHE_SIZE - 1);
+
+    uint32_t tricmd = __rdpq_triangle_rsp_cmd(fmt);
+    __rdpq_triangle_write(RDPQ_CMD_TRIANGLE_INDEXED, tricmd,
+        ((VTXCACHE_FIRST_SLOT + s1) << 16) | ((VTXCACHE_FIRST_SLOT + s2) << 8) | (VTXCACHE_FIRST_SLOT + s3));
+}
+
+void rdpq_mesh_draw(const rdpq_trifmt_t *fmt, const float *vertices, int vtx_stride, int num_vertices,
+    const uint16_t *indices, int num_indices, rdpq_mesh_prim_t prim)
+{
+    int num_tris = (prim == RDPQ_MESH_TRIANGLE_STRIP) ? MAX(num_indices - 2, 0) : num_indices / 3;
+    int step = (prim == RDPQ_MESH_TRIANGLE_STRIP) ? 1 : 3;
+
+    // Flat shading uses the shade of the first vertex of each triangle, so
+    // it cannot go through the vertex cache: draw triangles one by one.
+    if (RDPQ_TRIANGLE_REFERENCE || (fmt->shade_offset >= 0 && fmt->shade_flat)) {
+        for (int t=0; t<num_tris; t++, indices += step) {
+            int i1 = indices[0], i2 = indices[1], i3 = indices[2];
+            if (i1 == i2 || i2 == i3 || i1 == i3) continue;
+            rdpq_triangle(fmt, vertices + i1*vtx_stride, vertices + i2*vtx_stride, vertices + i3*vtx_stride);
+        }
+        return;
+    }
+
+    uint32_t tricmd = __rdpq_triangle_rsp_cmd(fmt);
+
+    // Map from vertex index to cache slot + 1 (0 = not in cache). The cache is
+    // filled in order, and flushed when a triangle does not fit anymore. Since
+    // the RSP processes commands in order, slots can be overwritten right away.
+    uint8_t map_buf[256];
+    uint8_t *map = num_vertices <= sizeof(map_buf) ? map_buf : malloc(num_vertices);
+    assertf(map, "out of memory drawing a mesh of %d vertices", num_vertices);
+    memset(map, 0, num_vertices);
+    uint16_t cache[RDPQ_VTXCACHE_SIZE];
+    int num_cached = 0;
+
+    for (int t=0; t<num_tris; t++, indices += step) {
+        int idx[3] = { indices[0], indices[1], indices[2] };
+        assertf(idx[0] < num_vertices && idx[1] < num_vertices && idx[2] < num_vertices,
+            "invalid vertex index in triangle %d: %d/%d/%d (vertices: %d)", t, idx[0], idx[1], idx[2], num_vertices);
+
+        // Skip degenerate triangles (eg: used to stitch strips together)
+        if (idx[0] == idx[1] || idx[1] == idx[2] || idx[0] == idx[2]) continue;
+
+        int missing = !map[idx[0]] + !map[idx[1]] + !map[idx[2]];
+        if (num_cached + missing > RDPQ_VTXCACHE_SIZE) {
+            for (int i=0; i<num_cached; i++)
+                map[cache[i]] = 0;
+            num_cached = 0;
+        }
+
+        for (int i=0; i<3; i++) {
+            if (!map[idx[i]]) {
+                const float *v = vertices + idx[i]*vtx_stride;
+                __rdpq_triangle_rsp_vertex(fmt, v, v, VTXCACHE_FIRST_SLOT + num_cached);
+                cache[num_cached++] = idx[i];
+                map[idx[i]] = num_cached;
+            }
+        }
+
+        __rdpq_triangle_write(RDPQ_CMD_TRIANGLE_INDEXED, tricmd,
+            ((VTXCACHE_FIRST_SLOT - 1 + map[idx[0]]) << 16) |
+            ((VTXCACHE_FIRST_SLOT - 1 + map[idx[1]]) << 8) |
+             (VTXCACHE_FIRST_SLOT - 1 + map[idx[2]]));
+    }
+
+    if (map != map_buf)
+        free(map);
+}
@@ -143,6 +143,20 @@
  * is then used as call slot in both all future calls to the block, and by
  * the RSPQ_CMD_RET command placed at the end of the block itself.
  * 
+ * Blocks can also be run in highpri mode. Since a highpri queue can
+ * interrupt a lowpri block at any point, it must not overwrite the save slots
+ * used by lowpri. So the RSP keeps a second range of save slots (starting at
+ * #RSPQ_HIGHPRI_NESTING_SLOT), and both #RSPQ_CMD_CALL and #RSPQ_CMD_RET
+ * offset the slot provided by the CPU into that range while the signal
+ * SP_STATUS_SIG_HIGHPRI_RUNNING is set. This way, the very same block
+ * can be run in both modes without being modified.
+ * 
+ * Multiple blocks can be in creation at the same time: #rspq_block_suspend
+ * saves the recording state (#rspq_block, the current write pointers and the
+ * rdpq block state) into a #rspq_block_ctx_t, and #rspq_block_resume restores
+ * it. Since nesting levels are computed when a block is finished, blocks
+ * recorded in parallel can freely call each other once finished.
+ * 
  * ## Highpri queue
  * 
  * The high priority queue is implemented as an alternative couple of buffers,
@@ -193,6 +207,7 @@
 #include "rdpq_constants.h"
 #include "rdpq/rdpq_internal.h"
 #include "rdpq/rdpq_debug_internal.h"
+#include "timeline_internal.h"
 #include "interrupt.h"
 #include "utils.h"
 #include "n64sys.h"
@@ -328,6 +343,15 @@ rspq_block_t *rspq_block;
 /** @brief Size of the current block memory buffer (in 32-bit words). */
 static int rspq_block_size;
 
+/** @brief Recording state of a suspended block (see #rspq_block_suspend). */
+struct rspq_block_ctx_s {
+    rspq_block_t *block;                ///< Block being created
+    int block_size;                     ///< Size of the current block memory buffer (in 32-bit words)
+    volatile uint32_t *cur;             ///< Write pointer within the block
+    volatile uint32_t *sentinel;        ///< Write sentinel within the block
+    rdpq_block_state_t rdp_state;       ///< State of the RDP block being created
+};
+
 /** @brief ID that will be used for the next syncpoint that will be created. */
 static int rspq_syncpoints_genid;
 /** @brief ID of the last syncpoint reached by RSP. */
@@ -354,6 +378,7 @@ static void rspq_sp_interrupt(void)
         ++__rspq_syncpoints_done;
         // writeback to memory; this is required for RDPQCmd_SyncFull to fetch the correct value 
         data_cache_hit_writeback(&__rspq_syncpoints_done, sizeof(__rspq_syncpoints_done));
+        if (__timeline_hook) __timeline_hook(TIMELINE_RSP_SYNCPOINT, __rspq_syncpoints_done);
     }
     if (status & SP_STATUS_SIG0) {
         wstatus |= SP_WSTATUS_CLEAR_SIG0;
@@ -367,7 +392,7 @@ static void rspq_sp_interrupt(void)
 }
 
 /** @brief Extract the current overlay index and name from the RSP queue state */
-static void rspq_get_current_ovl(rsp_queue_t *rspq, int *ovl_idx, uint8_t *ovl_id, const char **ovl_name)
+void rspq_get_current_ovl(rsp_queue_t *rspq, int *ovl_idx, uint8_t *ovl_id, const char **ovl_name)
 {
     *ovl_id = 0xFF;
     *ovl_idx = rspq->current_ovl / sizeof(rspq_overlay_t);
@@ -1148,6 +1173,40 @@ rspq_block_t* rspq_block_end(void)
     return b;
 }
 
+rspq_block_ctx_t* rspq_block_suspend(void)
+{
+    assertf(rspq_block, "a block was not being created");
+
+    // Save the whole recording state into a new context
+    rspq_block_ctx_t *ctx = malloc(sizeof(rspq_block_ctx_t));
+    ctx->block = rspq_block;
+    ctx->block_size = rspq_block_size;
+    ctx->cur = rspq_cur_pointer;
+    ctx->sentinel = rspq_cur_sentinel;
+    __rdpq_block_suspend(&ctx->rdp_state);
+
+    // Switch back to the normal display list
+    rspq_block = NULL;
+    rspq_switch_context(&lowpri);
+    return ctx;
+}
+
+void rspq_block_resume(rspq_block_ctx_t *ctx)
+{
+    assertf(!rspq_block, "a block was already being created");
+    assertf(rspq_ctx != &highpri, "cannot create a block in highpri mode");
+
+    // Switch to the block buffer, exactly where it was left.
+    rspq_switch_context(NULL);
+    rspq_block = ctx->block;
+    rspq_block_size = ctx->block_size;
+    rspq_cur_pointer = ctx->cur;
+    rspq_cur_sentinel = ctx->sentinel;
+    __rdpq_block_resume(&ctx->rdp_state);
+
+    free(ctx);
+}
+
 void rspq_block_free(rspq_block_t *block)
 {
     // Free RDP blocks first
@@ -1186,13 +1245,6 @@ void rspq_block_free(rspq_block_t *block)
 
 void rspq_block_run(rspq_block_t *block)
 {
-    // TODO: add support for block execution in highpri mode. This would be
-    // possible by allocating another range of nesting levels (eg: 8-16) to use
-    // in highpri mode (to avoid stepping on the call stack of lowpri). This
-    // would basically mean that a block can either work in highpri or in lowpri
-    // mode, but it might be an acceptable limitation.
-    assertf(rspq_ctx != &highpri, "block run is not supported in highpri mode");
-
     // Notify rdpq engine we are about to run a block
     __rdpq_block_run(block->rdp_block);
 
@@ -1245,7 +1297,9 @@ rspq_syncpoint_t rspq_syncpoint_new(void)
     rspq_int_write(RSPQ_CMD_TEST_WRITE_STATUS, 
         SP_WSTATUS_SET_INTR | SP_WSTATUS_SET_SIG_SYNCPOINT,
         SP_STATUS_SIG_SYNCPOINT);
-    return ++rspq_syncpoints_genid;
+    ++rspq_syncpoints_genid;
+    if (__timeline_hook) __timeline_hook(TIMELINE_RSP_SYNCPOINT_NEW, rspq_syncpoints_genid);
+    return rspq_syncpoints_genid;
 }
 
 bool rspq_syncpoint_check(rspq_syncpoint_t sync_id) 
@@ -1310,6 +1364,135 @@ void rspq_dma_to_dmem(uint32_t dmem_addr, void *rdram_addr, uint32_t len, bool i
     rspq_dma(rdram_addr, dmem_addr, len - 1, is_async ? 0 : SP_STATUS_DMA_BUSY | SP_STATUS_DMA_FULL);
 }
 
+#if RSPQ_PROFILE
+static rspq_profile_data_t profile_data;        ///< Profiling counters accumulated so far
+static rspq_profile_frame_t *profile_frame;     ///< RDRAM buffer where the RSP writes its counters
+static rspq_syncpoint_t profile_frame_sync;     ///< Syncpoint after the last RSPQ_CMD_PROFILE_FRAME
+static bool profile_frame_pending;              ///< True if profile_frame is being written by RSP
+static bool profile_frame_discard;              ///< True if the pending counters must be discarded
+static uint32_t profile_rsp_detail_id;          ///< Detail overlay ID used by RSP for the pending counters
+static uint32_t profile_next_detail_id;         ///< Detail overlay ID to send at the next frame
+static bool profile_running;                    ///< True if profiling is active
+
+/** @brief Accumulate the counters written by the RSP, if any */
+static void rspq_profile_collect(void)
+{
+    if (!profile_frame_pending)
+        return;
+    rspq_syncpoint_wait(profile_frame_sync);
+    profile_frame_pending = false;
+    if (profile_frame_discard)
+        return;
+
+    for (int i=0; i<RSPQ_PROFILE_SLOT_COUNT; i++) {
+        profile_data.overlays[i].total_ticks += profile_frame->ovl[i].cycles;
+        profile_data.overlays[i].sample_count += profile_frame->ovl[i].calls;
+    }
+    if (profile_rsp_detail_id == profile_data.detail_ovl_id) {
+        for (int i=0; i<RSPQ_PROFILE_SLOT_COUNT; i++) {
+            profile_data.commands[i].total_ticks += profile_frame->cmd[i].cycles;
+            profile_data.commands[i].sample_count += profile_frame->cmd[i].calls;
+        }
+    }
+}
+
+/** @brief Ask the RSP to write its counters to RDRAM (and clear them) */
+static void rspq_profile_request(bool discard)
+{
+    if (!profile_frame)
+        profile_frame = malloc_uncached(sizeof(rspq_profile_frame_t));
+
+    rspq_int_write(RSPQ_CMD_PROFILE_FRAME, PhysicalAddr(profile_frame), profile_next_detail_id);
+    profile_frame_sync = rspq_syncpoint_new();
+    profile_frame_pending = true;
+    profile_frame_discard = discard;
+    profile_rsp_detail_id = profile_next_detail_id;
+}
+#endif
+
+void rspq_profile_start(void)
+{
+#if RSPQ_PROFILE
+    rspq_profile_collect();
+    memset(&profile_data, 0, sizeof(profile_data));
+    profile_data.detail_ovl_id = profile_next_detail_id;
+
+    // Clear the counters accumulated so far by the RSP
+    rspq_profile_request(true);
+    profile_running = true;
+#else
+    assertf(0, "rspq profiling is disabled: rebuild libdragon and ucodes with RSPQ_PROFILE=1");
+#endif
+}
+
+void rspq_profile_stop(void)
+{
+#if RSPQ_PROFILE
+    profile_running = false;
+#endif
+}
+
+void rspq_profile_detail(uint32_t ovl_id)
+{
+#if RSPQ_PROFILE
+    profile_next_detail_id = ovl_id >> 28;
+    profile_data.detail_ovl_id = profile_next_detail_id;
+    memset(profile_data.commands, 0, sizeof(profile_data.commands));
+#endif
+}
+
+void rspq_profile_next_frame(void)
+{
+#if RSPQ_PROFILE
+    if (!profile_running)
+        return;
+    rspq_profile_collect();
+    rspq_profile_request(false);
+    profile_data.frame_count++;
+#endif
+}
+
+void rspq_profile_get(rspq_profile_data_t *data)
+{
+#if RSPQ_PROFILE
+    rspq_profile_collect();
+    *data = profile_data;
+#else
+    memset(data, 0, sizeof(*data));
+#endif
+}
+
+void rspq_profile_dump(void)
+{
+    rspq_profile_data_t data;
+    rspq_profile_get(&data);
+    uint64_t frames = data.frame_count ? data.frame_count : 1;
+    #define RCP_TICKS_TO_US(t)  ((t) * 1000000 / RCP_FREQUENCY)
+
+    debugf("RSPQ profile: %llu frames\n", data.frame_count);
+    debugf("%-4s %-16s %12s %12s\n", "ID", "Overlay", "us/frame", "calls/frame");
+    for (int i=0; i<RSPQ_OVERLAY_ID_COUNT; i++) {
+        if (!data.overlays[i].sample_count)
+            continue;
+        int ovl_idx = rspq_data.tables.overlay_table[i] / sizeof(rspq_overlay_t);
+        const char *name = (i == 0) ? "builtin" :
+            (ovl_idx && rspq_overlay_ucodes[ovl_idx]) ? rspq_overlay_ucodes[ovl_idx]->name : "?";
+        debugf("%-4X %-16s %12llu %12llu\n", i, name,
+            RCP_TICKS_TO_US(data.overlays[i].total_ticks / frames),
+            data.overlays[i].sample_count / frames);
+    }
+
+    debugf("Commands of overlay ID %lX:\n", data.detail_ovl_id);
+    for (int i=0; i<RSPQ_PROFILE_SLOT_COUNT; i++) {
+        if (!data.commands[i].sample_count)
+            continue;
+        debugf("  %02lX %12llu us/frame %12llu calls/frame\n", (data.detail_ovl_id << 4) | i,
+            RCP_TICKS_TO_US(data.commands[i].total_ticks / frames),
+            data.commands[i].sample_count / frames);
+    }
+    #undef RCP_TICKS_TO_US
+}
+
 /// @cond
 void rspq_signal(uint32_t signal)
 {
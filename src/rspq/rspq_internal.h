@@ -140,6 +140,14 @@ enum {
      * commands appended in the current buffer to be sent to RDP.
      */
     RSPQ_CMD_RDP_APPEND_BUFFER = 0x0B,
+
+    /**
+     * @brief RSPQ Command: write the profiling counters to RDRAM and clear them
+     * 
+     * This command is only available if RSPQ_PROFILE is enabled. It also selects
+     * the overlay ID whose commands are profiled individually from now on.
+     */
+    RSPQ_CMD_PROFILE_FRAME     = 0x0C,
 };
 
 /** @brief Write an internal command to the RSP queue */
@@ -204,6 +212,18 @@ typedef struct rspq_overlay_tables_s {
     rspq_overlay_t overlay_descriptors[RSPQ_MAX_OVERLAY_COUNT];
 } rspq_overlay_tables_t;
 
+/** @brief A profiling slot in DMEM (see RSPQ_ProfileSample in rsp_queue.inc) */
+typedef struct rspq_profile_dmem_slot_s {
+    uint32_t cycles;                     ///< RCP cycles (modulo 2^32)
+    uint32_t calls;                      ///< Number of commands
+} rspq_profile_dmem_slot_t;
+
+/** @brief Profiling counters in DMEM, as written by #RSPQ_CMD_PROFILE_FRAME */
+typedef struct rspq_profile_frame_s {
+    rspq_profile_dmem_slot_t ovl[RSPQ_PROFILE_SLOT_COUNT];  ///< Counters per overlay ID
+    rspq_profile_dmem_slot_t cmd[RSPQ_PROFILE_SLOT_COUNT];  ///< Counters per command of the detail overlay ID
+} rspq_profile_frame_t;
+
 /**
  * @brief RSP Queue data in DMEM.
  * 
@@ -214,6 +234,8 @@ typedef struct rsp_queue_s {
     rspq_overlay_tables_t tables;        ///< Overlay table
     /** @brief Pointer stack used by #RSPQ_CMD_CALL and #RSPQ_CMD_RET. */
     uint32_t rspq_pointer_stack[RSPQ_MAX_BLOCK_NESTING_LEVEL];
+    /** @brief Pointer stack used by #RSPQ_CMD_CALL and #RSPQ_CMD_RET in highpri mode. */
+    uint32_t rspq_pointer_stack_highpri[RSPQ_MAX_BLOCK_NESTING_LEVEL];
     uint32_t rspq_dram_lowpri_addr;      ///< Address of the lowpri queue (special slot in the pointer stack)
     uint32_t rspq_dram_highpri_addr;     ///< Address of the highpri queue  (special slot in the pointer stack)
     uint32_t rspq_dram_addr;             ///< Current RDRAM address being processed
@@ -228,6 +250,12 @@ typedef struct rsp_queue_s {
     uint8_t rdpq_debug;                  ///< Debug mode flag
     uint8_t __padding0;
     int16_t current_ovl;                 ///< Current overlay index
+#if RSPQ_PROFILE
+    uint16_t profile_cur_cmd;            ///< Command byte of the last dispatched command
+    rspq_profile_frame_t profile_slots;  ///< Profiling counters
+    uint32_t profile_clock;              ///< Value of DP_CLOCK at the previous sample
+    uint8_t profile_detail_id;           ///< Overlay ID profiled per command
+#endif
 } __attribute__((aligned(16), packed)) rsp_queue_t;
 
 /** @brief Address of the RSPQ data header in DMEM (see #rsp_queue_t) */
@@ -250,6 +278,19 @@ static inline bool rspq_in_block(void) {
  */
 rsp_queue_t *__rspq_get_state(void);
 
+/**
+ * @brief Extract the current overlay from a RSP queue state
+ * 
+ * The state can be a snapshot of DMEM (eg: taken by a crash handler), so the
+ * overlay ID is looked up in the tables of the state itself.
+ * 
+ * @param rspq          RSP queue state
+ * @param[out] ovl_idx  Index of the overlay (0 = builtin)
+ * @param[out] ovl_id   Overlay ID (0xFF if not found)
+ * @param[out] ovl_name Name of the overlay ucode
+ */
+void rspq_get_current_ovl(rsp_queue_t *rspq, int *ovl_idx, uint8_t *ovl_id, const char **ovl_name);
+
 /**
  * @brief Notify that a RSP command is going to run a block
  */
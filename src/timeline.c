@@ -0,0 +1,193 @@
+/**
+ * @file timeline.c
+ * @brief Frame timeline profiler
+ * @ingroup timeline
+ */
+#include <stdlib.h>
+#include <stdbool.h>
+#include "timeline.h"
+#include "timeline_internal.h"
+#include "interrupt.h"
+#include "n64sys.h"
+#include "debug.h"
+
+/** @brief A recorded event */
+typedef struct {
+    uint32_t ticks;             ///< CPU counter when the event was recorded
+    uint8_t type;               ///< Event type (#timeline_event_type_t)
+    uint8_t __padding[3];
+    uint32_t arg;               ///< Event argument (name or ID, depending on type)
+} timeline_event_t;
+
+_Static_assert(sizeof(timeline_event_t) == 12, "invalid timeline_event_t size");
+
+void (*__timeline_hook)(timeline_event_type_t type, uint32_t arg);
+
+static timeline_event_t *events;        ///< Ring buffer of events
+static int max_events;                  ///< Size of the ring buffer
+static uint32_t num_events;             ///< Number of events recorded so far (including overwritten ones)
+
+/** @brief Record an event in the ring buffer */
+static void timeline_event(timeline_event_type_t type, uint32_t arg)
+{
+    uint32_t ticks = TICKS_READ();
+
+    // Events are also recorded from interrupt handlers, so claim the slot
+    // with interrupts disabled.
+    disable_interrupts();
+    timeline_event_t *ev = &events[num_events++ % max_events];
+    ev->ticks = ticks;
+    ev->type = type;
+    ev->arg = arg;
+    enable_interrupts();
+}
+
+static void timeline_vi_interrupt(void)
+{
+    timeline_event(TIMELINE_VI, 0);
+}
+
+void timeline_init(int max_events_)
+{
+    assertf(!events, "timeline already initialized");
+    assertf(max_events_ > 0, "invalid number of events: %d", max_events_);
+    max_events = max_events_;
+    events = malloc(max_events * sizeof(timeline_event_t));
+    num_events = 0;
+    register_VI_handler(timeline_vi_interrupt);
+    __timeline_hook = timeline_event;
+}
+
+void timeline_close(void)
+{
+    if (!events) return;
+    __timeline_hook = NULL;
+    unregister_VI_handler(timeline_vi_interrupt);
+    free(events);
+    events = NULL;
+}
+
+void timeline_reset(void)
+{
+    disable_interrupts();
+    num_events = 0;
+    enable_interrupts();
+}
+
+void timeline_zone_begin(const char *name)
+{
+    if (events) timeline_event(TIMELINE_ZONE_BEGIN, (uint32_t)name);
+}
+
+void timeline_zone_end(void)
+{
+    if (events) timeline_event(TIMELINE_ZONE_END, 0);
+}
+
+void timeline_mark(const char *name)
+{
+    if (events) timeline_event(TIMELINE_MARK, (uint32_t)name);
+}
+
+/// @cond
+void __timeline_zone_cleanup(int *unused)
+{
+    timeline_zone_end();
+}
+/// @endcond
+
+/** @brief Emit a JSON string, escaping the characters that require it */
+static void timeline_dump_name(const char *name)
+{
+    const char *p = name;
+    while (*p && *p != '"' && *p != '\\' && (uint8_t)*p >= 0x20) p++;
+    if (!*p) {
+        debugf("\"%s\"", name);
+        return;
+    }
+
+    debugf("\"");
+    for (p = name; *p; p++) {
+        if (*p == '"' || *p == '\\') debugf("\\%c", *p);
+        else if ((uint8_t)*p >= 0x20) debugf("%c", *p);
+    }
+    debugf("\"");
+}
+
+void timeline_dump(void)
+{
+    static const char *thread_names[] = { "CPU", "RSP", "RDP", "VI" };
+    if (!events) return;
+
+    // Take a snapshot of the ring with interrupts disabled, so that events
+    // recorded meanwhile do not corrupt it, and then format it with
+    // interrupts enabled: debugf can be very slow.
+    timeline_event_t *snap = malloc(max_events * sizeof(timeline_event_t));
+    assertf(snap, "out of memory");
+
+    disable_interrupts();
+    uint32_t count = num_events < max_events ? num_events : max_events;
+    uint32_t first = num_events - count;
+    for (uint32_t i = 0; i < count; i++)
+        snap[i] = events[(first + i) % max_events];
+    enable_interrupts();
+
+    debugf("{\"traceEvents\":[\n");
+    for (int i = 0; i < 4; i++)
+        debugf("%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+            i ? ",\n" : "", i, thread_names[i]);
+
+    uint64_t ts = 0;
+    uint32_t prev_ticks = 0;
+    int depth = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        timeline_event_t *ev = &snap[i];
+
+        // The CPU counter wraps around every ~90 seconds: accumulate the
+        // differences between consecutive events to get a monotonic timestamp.
+        if (i != 0) ts += ev->ticks - prev_ticks;
+        prev_ticks = ev->ticks;
+        double us = (double)ts * 1000000.0 / TICKS_PER_SECOND;
+
+        // If the ring wrapped around, the beginning of some zones might have
+        // been overwritten: skip their ends, that would be unbalanced.
+        if (ev->type == TIMELINE_ZONE_BEGIN) depth++;
+        if (ev->type == TIMELINE_ZONE_END) {
+            if (depth == 0) continue;
+            depth--;
+        }
+
+        debugf(",\n");
+
+        switch (ev->type) {
+        case TIMELINE_ZONE_BEGIN:
+            debugf("{\"name\":");
+            timeline_dump_name((const char*)ev->arg);
+            debugf(",\"ph\":\"B\",\"ts\":%.3f,\"pid\":0,\"tid\":0}", us);
+            break;
+        case TIMELINE_ZONE_END:
+            debugf("{\"ph\":\"E\",\"ts\":%.3f,\"pid\":0,\"tid\":0}", us);
+            break;
+        case TIMELINE_MARK:
+            debugf("{\"name\":");
+            timeline_dump_name((const char*)ev->arg);
+            debugf(",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":0,\"tid\":0}", us);
+            break;
+        case TIMELINE_RSP_SYNCPOINT_NEW:
+            debugf("{\"name\":\"syncpoint_new\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":0,\"tid\":0,\"args\":{\"id\":%lu}}", us, ev->arg);
+            break;
+        case TIMELINE_RSP_SYNCPOINT:
+            debugf("{\"name\":\"syncpoint\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":0,\"tid\":1,\"args\":{\"id\":%lu}}", us, ev->arg);
+            break;
+        case TIMELINE_RDP_SYNC_FULL:
+            debugf("{\"name\":\"sync_full\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":0,\"tid\":2}", us);
+            break;
+        case TIMELINE_VI:
+            debugf("{\"name\":\"vblank\",\"ph\":\"i\",\"s\":\"p\",\"ts\":%.3f,\"pid\":0,\"tid\":3}", us);
+            break;
+        }
+    }
+    debugf("\n]}\n");
+
+    free(snap);
+}
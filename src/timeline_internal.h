@@ -0,0 +1,30 @@
+/**
+ * @file timeline_internal.h
+ * @brief Frame timeline profiler (internal hooks)
+ * @ingroup timeline
+ */
+#ifndef __LIBDRAGON_TIMELINE_INTERNAL_H
+#define __LIBDRAGON_TIMELINE_INTERNAL_H
+
+#include <stdint.h>
+
+/** @brief Types of events recorded by the timeline */
+typedef enum {
+    TIMELINE_ZONE_BEGIN,        ///< CPU zone begins (arg: name)
+    TIMELINE_ZONE_END,          ///< CPU zone ends
+    TIMELINE_MARK,              ///< CPU instant marker (arg: name)
+    TIMELINE_RSP_SYNCPOINT_NEW, ///< A syncpoint was enqueued by the CPU (arg: syncpoint ID)
+    TIMELINE_RSP_SYNCPOINT,     ///< A syncpoint was reached by the RSP (arg: syncpoint ID)
+    TIMELINE_RDP_SYNC_FULL,     ///< The RDP finished a SYNC_FULL
+    TIMELINE_VI,                ///< VI interrupt (vertical blank)
+} timeline_event_type_t;
+
+/**
+ * @brief Hook called by other modules to record an event.
+ *
+ * This is NULL if the timeline profiler is not initialized, so that
+ * callers can skip the event with a single check.
+ */
+extern void (*__timeline_hook)(timeline_event_type_t type, uint32_t arg);
+
+#endif
@@ -4,6 +4,7 @@
  * @ingroup timer
  */
 #include <malloc.h>
+#include <stdbool.h>
 #include "timer.h"
 #include "interrupt.h"
 #include "debug.h"
@@ -13,160 +14,336 @@
 /** @brief Refcount of #timer_init vs #timer_close calls. */
 static int timer_init_refcount = 0;
 
-/** @brief Internal linked list of timers */
-static timer_link_t *TI_timers = NULL;
+/**
+ * @brief Internal min-heap of active timers
+ *
+ * Timers are ordered by expiration time, so that the first expiring timer
+ * is always at the root. Each timer stores its own position in the heap
+ * (#timer_link::index), so that it can be removed in O(log n).
+ */
+static timer_link_t **TI_heap = NULL;
+/** @brief Number of timers in #TI_heap */
+static int TI_heap_count = 0;
+/** @brief Allocated capacity of #TI_heap */
+static int TI_heap_size = 0;
+
+/**
+ * @brief Reference time for the heap ordering
+ *
+ * Expiration times are compared as unsigned distances from this reference,
+ * which is always before (or at) the first expiring timer. This allows
+ * to correctly order timers across the counter overflow, up to the full
+ * 32-bit range.
+ */
+static uint32_t TI_ref = 0;
+
+/**
+ * @brief How much the reference time is kept behind the current time.
+ *
+ * This allows to correctly handle timers that are started when already
+ * slightly late (eg: negative ticks).
+ */
+#define TIMER_REF_MARGIN    TIMER_TICKS(1000)
+
+/** @brief True while timer callbacks are being processed */
+static bool TI_polling = false;
+
+/** @brief Number of timers allocated at once by the timer pool */
+#define TIMER_POOL_CHUNK    32
+
+/** @brief A chunk of timers allocated by the timer pool */
+typedef struct timer_chunk_s {
+	struct timer_chunk_s *next;                 ///< Next allocated chunk
+	timer_link_t timers[TIMER_POOL_CHUNK];      ///< Timers in this chunk
+} timer_chunk_t;
+
+/** @brief List of chunks allocated by the timer pool */
+static timer_chunk_t *TI_pool_chunks = NULL;
+/** @brief Free list of the timer pool (linked via #timer_link::next) */
+static timer_link_t *TI_pool_free = NULL;
+/** @brief Total number of timers allocated by the timer pool */
+static int TI_pool_size = 0;
 
 /** @brief Timer callback expects a context parameter */
 #define TF_CONTEXT     0x20
 
-/** @brief Timer is the special overflow timer. */
-#define TF_OVERFLOW    0x40
+/** @brief Ordering key of a timer in the heap */
+static inline uint32_t timer_key(timer_link_t *timer)
+{
+	return timer->left - TI_ref;
+}
 
-/** @brief Timer has been called once in this interrupt. */
-#define TF_CALLED      0x80
+/** @brief Store a timer at the specified position of the heap */
+static inline void heap_set(int idx, timer_link_t *timer)
+{
+	TI_heap[idx] = timer;
+	timer->index = idx;
+}
 
-/** @brief Update the compare register to match the first expiring timer. */
-__attribute__((noinline))
-static void timer_update_compare(timer_link_t *head, uint32_t now)
+/** @brief Move a timer up in the heap until the heap property is restored */
+static void heap_sift_up(int idx)
 {
-	uint32_t smallest = 0xFFFFFFFF;
+	timer_link_t *timer = TI_heap[idx];
+	uint32_t key = timer_key(timer);
 
-	while (head)
+	while (idx > 0)
 	{
-		/* See how much time is left before the timer expires. Notice that
-		   the subtraction is also safe with overflows. */
-		uint32_t left = head->left - now;
-		if (left < smallest)
-			smallest = left;
-
-		/* Go to next */
-		head = head->next;
+		int parent = (idx - 1) / 2;
+		if (timer_key(TI_heap[parent]) <= key)
+			break;
+		heap_set(idx, TI_heap[parent]);
+		idx = parent;
 	}
+	heap_set(idx, timer);
+}
 
-	/* set compare to shortest time left */
-	C0_WRITE_COMPARE(now + smallest);
+/** @brief Move a timer down in the heap until the heap property is restored */
+static void heap_sift_down(int idx)
+{
+	timer_link_t *timer = TI_heap[idx];
+	uint32_t key = timer_key(timer);
+
+	while (1)
+	{
+		int child = idx * 2 + 1;
+		if (child >= TI_heap_count)
+			break;
+		if (child + 1 < TI_heap_count && timer_key(TI_heap[child + 1]) < timer_key(TI_heap[child]))
+			child++;
+		if (key <= timer_key(TI_heap[child]))
+			break;
+		heap_set(idx, TI_heap[child]);
+		idx = child;
+	}
+	heap_set(idx, timer);
 }
 
 /**
- * @brief Process linked list of timers
- *
- * Walk the linked list of timers and call the callbacks of any that
- * have expired.
- *
- * @note This function will remove one-shot timers from the list after
- *       they have fired.
- *
- * @param[in] head
- *            Head of the linked list of timers
- *
- * @retval 1 The list needs reprocessing
- * @retval 0 All timer operations were handled successfully
+ * @brief Make sure the heap can contain at least the specified number of timers
+ * 
+ * This allocates memory, so it must never be called while starting a timer
+ * (which can happen within an interrupt).
  */
-static int __proc_timers(timer_link_t * thead)
+static void heap_reserve(int count)
 {
-	timer_link_t *head = thead;
-	timer_link_t *last = 0;
-	uint32_t start = C0_COMPARE();
-	uint32_t now = TICKS_READ();
+	if (count <= TI_heap_size)
+		return;
+	int size = TI_heap_size ? TI_heap_size : TIMER_POOL_CHUNK;
+	while (size < count)
+		size *= 2;
+	TI_heap = realloc(TI_heap, size * sizeof(timer_link_t*));
+	assertf(TI_heap, "out of memory allocating timers");
+	TI_heap_size = size;
+}
 
-	while (head)
-	{
-		/* Consider a timer as expired if its deadline is at the
-		 * COMPARE value (time at which the interrupt triggered) or up to 5
-		 * microseconds after. This 5 microseconds window is useful to cluster
-		 * timers that expire close to each other; eg: if the client creates
-		 * many timers with the same period, they will be created in a fast
-		 * sequence and have a little delay between each other. */
-		if (!(head->flags & TF_CALLED) && 
-			!(head->flags & TF_DISABLED) &&
-			TICKS_DISTANCE(start, head->left) >= 0 && 
-			TICKS_DISTANCE(head->left, now+TIMER_TICKS(5)) >= 0)
-		{
-			/* yes - timed out, do callback */
-			head->ovfl = TICKS_DISTANCE(head->left, now);
-
-			/* invoke the appropriate callback function */
-			if (head->flags & TF_CONTEXT && head->callback_with_context)
-				head->callback_with_context(head->ovfl, head->ctx);
-			else if (head->callback)
-				head->callback(head->ovfl);
-
-			if (head->flags & TF_DISABLED)
-			{
-				/* Timer was disabled during the callback. We need to
-				 * reprocess the list to see if there are other timers
-				 * that need to be called. */
-				return 1;
-			}
-
-			/* reset ticks if continuous */
-			if (head->flags & TF_CONTINUOUS)
-			{
-				head->left += head->set;
-				last = head;
-
-				/* Special case: the internal overflow timer has a period
-				 * of 2**32, so next occurrence will look exactly like the
-				 * current one. Since we're going to reprocess the list, we
-				 * would keep executing it many times until we eventually
-				 * exit the 5 microseconds window.
-				 * So we mark this timer as already called (TF_CALLED) and
-				 * avoid calling it again. 
-				 *
-				 * Notice that we do this only for overflow because other timers
-				 * with a short period might actually be called multiple times
-				 * under interrupt. For instance, if a continuous timer with
-				 * a short period is followed by a very slow one-shot timer,
-				 * when the latter is finished the former might need to fire again.
-				 */
-				if (head->flags & TF_OVERFLOW)
-					head->flags |= TF_CALLED;
-			}
-			else
-			{
-				/* one-shot, remove from list */
-				if (last)
-					last->next = head->next;
-				else
-					TI_timers = head->next;
-			}
-
-			/* Go through timer list again. If the callback was slow, maybe
-			   other timers have expired. */
-			return 1;
-		}
+/**
+ * @brief Move the reference time forward, as close as possible to the current time
+ * 
+ * The reference is never moved past the first expiring timer, so that the
+ * ordering of the heap is preserved.
+ */
+static void heap_rebase(uint32_t now)
+{
+	if (TI_heap_count == 0)
+		TI_ref = now - TIMER_REF_MARGIN;
+	else
+		TI_ref += MIN(timer_key(TI_heap[0]), now - TIMER_REF_MARGIN - TI_ref);
+}
 
-		/* Go to next */
-		last = head;
-		head = head->next;
+/** @brief Check whether a timer is currently in the heap */
+static bool heap_contains(timer_link_t *timer)
+{
+	/* The index might be garbage for timers that were never started
+	   (eg: allocated by the caller), so validate it against the heap. */
+	return timer->index >= 0 && timer->index < TI_heap_count && TI_heap[timer->index] == timer;
+}
+
+/** @brief Add a timer to the heap */
+static void heap_insert(timer_link_t *timer)
+{
+	/* The key of the new timer is computed against the reference time, so
+	   bring it up to date first: a stale reference might be so far in the
+	   past that the new expiration time would wrap around. */
+	heap_rebase(TICKS_READ());
+
+	assertf(TI_heap_count < TI_heap_size, "too many active timers (%d)", TI_heap_count);
+	heap_set(TI_heap_count++, timer);
+	heap_sift_up(timer->index);
+}
+
+/** @brief Remove a timer from the heap */
+static void heap_remove(timer_link_t *timer)
+{
+	int idx = timer->index;
+	timer_link_t *last = TI_heap[--TI_heap_count];
+	timer->index = -1;
+
+	if (idx < TI_heap_count)
+	{
+		heap_set(idx, last);
+		heap_sift_up(idx);
+		heap_sift_down(last->index);
 	}
+}
 
-	/* Clear the TF_CALLED flag from the overflow timer (if any) */
-	while (thead) {
-		thead->flags &= ~TF_CALLED;
-		thead = thead->next;
+/** @brief Update the compare register to match the first expiring timer. */
+__attribute__((noinline))
+static void timer_update_compare(uint32_t now)
+{
+	heap_rebase(now);
+
+	if (TI_heap_count == 0)
+	{
+		/* No timers: just set compare as far as possible in the future */
+		C0_WRITE_COMPARE(now - 1);
+		return;
 	}
-	return 0;							// exit timer callback
+	timer_link_t *head = TI_heap[0];
+
+	/* Set compare to the first expiring timer. If it's already expired
+	   (and not processed yet, eg: we are within a callback), make sure the
+	   interrupt triggers as soon as possible, as writing compare clears
+	   any pending timer interrupt. */
+	uint32_t left = head->left;
+	if (timer_key(head) < now + TIMER_TICKS(1) - TI_ref)
+		left = now + TIMER_TICKS(1);
+	C0_WRITE_COMPARE(left);
 }
 
 /**
- * @brief Poll the timer list and run callbacks for expired timers
+ * @brief Poll the timer heap and run callbacks for expired timers
  *
  * This function is called by the interrupt handler whenever 
  * compare == count, and also when inserting into or removing
- * from the timers list to improve handling timers with tiny delays
+ * from the timers heap to improve handling timers with tiny delays
  */
 static void timer_poll(void)
 {
+	/* Timers might be started from within a callback. In that case, the
+	   outer loop will take care of them. */
+	if (TI_polling)
+		return;
+	TI_polling = true;
+
 	uint32_t loop_count = 0;
-	while (__proc_timers(TI_timers)) {
+	uint32_t now = TICKS_READ();
+
+	while (TI_heap_count > 0)
+	{
+		timer_link_t *head = TI_heap[0];
+
+		/* Consider a timer as expired if its deadline is in the past or up to
+		 * 5 microseconds in the future. This 5 microseconds window is useful
+		 * to cluster timers that expire close to each other; eg: if the client
+		 * creates many timers with the same period, they will be created in a
+		 * fast sequence and have a little delay between each other. */
+		if (timer_key(head) > now + TIMER_TICKS(5) - TI_ref)
+			break;
+
 		++loop_count; (void)loop_count; // avoid warning (loop_count is used in assertf)
 		assertf(loop_count < 1000, "timer interrupt is stuck in an infinite loop.\n"
 			"Check continuous timers with a very short period.\n");
+
+		/* yes - timed out, do callback */
+		head->ovfl = TICKS_DISTANCE(head->left, now);
+
+		/* Reschedule continuous timers before calling the callback, and
+		 * remove one-shot timers. This way, the callback is free to stop,
+		 * restart or start again the timer. */
+		if (head->flags & TF_CONTINUOUS)
+		{
+			head->left += head->set;
+			heap_sift_down(0);
+		}
+		else
+		{
+			heap_remove(head);
+		}
+
+		/* invoke the appropriate callback function */
+		if (head->flags & TF_CONTEXT && head->callback_with_context)
+			head->callback_with_context(head->ovfl, head->ctx);
+		else if (head->callback)
+			head->callback(head->ovfl);
+
+		/* If the callback was slow, maybe other timers have expired. */
+		now = TICKS_READ();
 	}
 
+	TI_polling = false;
+
 	// Update counter for next interrupt.
-	timer_update_compare(TI_timers, TICKS_READ());
+	timer_update_compare(TICKS_READ());
+}
+
+/** @brief Allocate a timer from the timer pool */
+static timer_link_t *timer_alloc(void)
+{
+	if (!TI_pool_free)
+	{
+		timer_chunk_t *chunk = malloc(sizeof(timer_chunk_t));
+		if (!chunk)
+			return NULL;
+		chunk->next = TI_pool_chunks;
+		TI_pool_chunks = chunk;
+		for (int i = TIMER_POOL_CHUNK - 1; i >= 0; i--)
+		{
+			chunk->timers[i].next = TI_pool_free;
+			TI_pool_free = &chunk->timers[i];
+		}
+		TI_pool_size += TIMER_POOL_CHUNK;
+
+		/* Make room in the heap for all the timers in the pool now (plus
+		   some timers allocated by the caller), so that starting timers
+		   never needs to allocate memory. */
+		heap_reserve(TI_pool_size + TIMER_POOL_CHUNK);
+	}
+
+	timer_link_t *timer = TI_pool_free;
+	TI_pool_free = timer->next;
+	timer->next = NULL;
+	timer->index = -1;
+	return timer;
+}
+
+/** @brief Check whether a timer was allocated by the timer pool */
+static bool timer_from_pool(timer_link_t *timer)
+{
+	for (timer_chunk_t *chunk = TI_pool_chunks; chunk; chunk = chunk->next)
+		if (timer >= &chunk->timers[0] && timer < &chunk->timers[TIMER_POOL_CHUNK])
+			return true;
+	return false;
+}
+
+/** @brief Return a timer to the timer pool */
+static void timer_free(timer_link_t *timer)
+{
+	timer->next = TI_pool_free;
+	TI_pool_free = timer;
+}
+
+/**
+ * @brief Configure a timer and add it to the heap (if enabled).
+ *
+ * Must be called with interrupts disabled.
+ */
+static void timer_start(timer_link_t *timer, int ticks, int flags)
+{
+	/* If the timer is already running, remove it first */
+	if (heap_contains(timer))
+		heap_remove(timer);
+	else
+		timer->index = -1;
+
+	timer->left = TICKS_READ() + (int32_t)ticks;
+	timer->set = ticks;
+	timer->flags = flags;
+
+	if (!(flags & TF_DISABLED))
+	{
+		heap_insert(timer);
+		timer_poll();
+	}
 }
 
 void timer_init(void)
@@ -178,6 +355,7 @@ void timer_init(void)
 	// Do not write the COUNT register to avoid interfering with get_ticks().
 	disable_interrupts();
 	C0_WRITE_COMPARE(0);
+	heap_reserve(TIMER_POOL_CHUNK);
 	set_TI_interrupt(1);
 	register_TI_handler(timer_poll);
 	enable_interrupts();
@@ -186,56 +364,30 @@ void timer_init(void)
 timer_link_t *new_timer(int ticks, int flags, timer_callback1_t callback)
 {
 	assertf(timer_init_refcount > 0, "timer module not initialized");
-	timer_link_t *timer = malloc(sizeof(timer_link_t));
+	disable_interrupts();
+	timer_link_t *timer = timer_alloc();
 	if (timer)
 	{
-		disable_interrupts();
-
-		uint32_t now = TICKS_READ();
-		timer->left = now + (int32_t)ticks;
-		timer->set = ticks;
-		timer->flags = flags;
 		timer->callback = callback;
 		timer->ctx = NULL;
-
-		if (!(flags & TF_DISABLED))
-		{
-			timer->next = TI_timers;
-			TI_timers = timer;
-			timer_update_compare(TI_timers, now);
-			timer_poll();
-		}
-
-		enable_interrupts();
+		timer_start(timer, ticks, flags);
 	}
+	enable_interrupts();
 	return timer;
 }
 
 timer_link_t *new_timer_context(int ticks, int flags, timer_callback2_t callback, void *ctx)
 {
 	assertf(timer_init_refcount > 0, "timer module not initialized");
-	timer_link_t *timer = malloc(sizeof(timer_link_t));
+	disable_interrupts();
+	timer_link_t *timer = timer_alloc();
 	if (timer)
 	{
-		disable_interrupts();
-
-		uint32_t now = TICKS_READ();
-		timer->left = now + (int32_t)ticks;
-		timer->set = ticks;
-		timer->flags = flags | TF_CONTEXT;
 		timer->callback_with_context = callback;
 		timer->ctx = ctx;
-
-		if (!(flags & TF_DISABLED))
-		{
-			timer->next = TI_timers;
-			TI_timers = timer;
-			timer_update_compare(TI_timers, now);
-			timer_poll();
-		}
-
-		enable_interrupts();
+		timer_start(timer, ticks, flags | TF_CONTEXT);
 	}
+	enable_interrupts();
 	return timer;
 }
 
@@ -245,22 +397,9 @@ void start_timer(timer_link_t *timer, int ticks, int flags, timer_callback1_t ca
 	if (timer)
 	{
 		disable_interrupts();
-
-		uint32_t now = TICKS_READ();
-		timer->left = now + (int32_t)ticks;
-		timer->set = ticks;
-		timer->flags = flags;
 		timer->callback = callback;
 		timer->ctx = NULL;
-
-		if (!(flags & TF_DISABLED))
-		{
-			timer->next = TI_timers;
-			TI_timers = timer;
-			timer_update_compare(TI_timers, now);
-			timer_poll();
-		}
-
+		timer_start(timer, ticks, flags);
 		enable_interrupts();
 	}
 }
@@ -271,22 +410,9 @@ void start_timer_context(timer_link_t *timer, int ticks, int flags, timer_callba
 	if (timer)
 	{
 		disable_interrupts();
-
-		uint32_t now = TICKS_READ();
-		timer->left = now + (int32_t)ticks;
-		timer->set = ticks;
-		timer->flags = flags | TF_CONTEXT;
 		timer->callback_with_context = callback;
 		timer->ctx = ctx;
-
-		if (flags & TF_DISABLED)
-		{
-			timer->next = TI_timers;
-			TI_timers = timer;
-			timer_update_compare(TI_timers, now);
-			timer_poll();
-		}
-
+		timer_start(timer, ticks, flags | TF_CONTEXT);
 		enable_interrupts();
 	}
 }
@@ -296,48 +422,22 @@ void restart_timer(timer_link_t *timer)
 	if (timer)
 	{
 		disable_interrupts();
-
-		uint32_t now = TICKS_READ();
-		timer->left = now + (int32_t)timer->set;
-		timer->flags &= ~TF_DISABLED;
-
-		timer->next = TI_timers;
-		TI_timers = timer;
-		timer_update_compare(TI_timers, now);
-		timer_poll();
-
+		timer_start(timer, timer->set, timer->flags & ~TF_DISABLED);
 		enable_interrupts();
 	}
 }
 
 void stop_timer(timer_link_t *timer)
 {
-	timer_link_t *head;
-	timer_link_t *last = 0;
-
 	assertf(timer_init_refcount > 0, "timer module not initialized");
 	if (timer)
 	{
 		disable_interrupts();
-		head = TI_timers;
-		while (head)
-		{
-			if (head == timer)
-			{
-				/* remove from list */
-				if (last)
-					last->next = head->next;
-				else
-					TI_timers = head->next;
-
-				break;
-			}
-
-			last = head;
-			head = head->next;
-		}
+		if (heap_contains(timer))
+			heap_remove(timer);
 		timer->flags |= TF_DISABLED;
-		timer_update_compare(TI_timers, TICKS_READ());
+		if (!TI_polling)
+			timer_update_compare(TICKS_READ());
 		enable_interrupts();
 	}
 }
@@ -347,8 +447,10 @@ void delete_timer(timer_link_t *timer)
 	assertf(timer_init_refcount > 0, "timer module not initialized");
 	if (timer)
 	{
+		disable_interrupts();
 		stop_timer(timer);
-		free(timer);
+		timer_free(timer);
+		enable_interrupts();
 	}
 }
 
@@ -365,25 +467,25 @@ void timer_close(void)
 	set_TI_interrupt(0);
 	unregister_TI_handler(timer_poll);
 
-	timer_link_t *head = TI_timers;
-	while (head)
+	for (int i = 0; i < TI_heap_count; i++)
 	{
-		timer_link_t *last = head;
-		head = head->next;
+		timer_link_t *timer = TI_heap[i];
+		timer->index = -1;
 
-		if (last->flags & TF_CONTINUOUS)
+		if ((timer->flags & TF_CONTINUOUS) && timer_from_pool(timer))
 		{
 			/* Only free if it is a continuous timer as one-shot timers are
 			 * freed by the user.  If we free a timer here, the user will
 			 * never know if a one shot expired and needs to be removed or
 			 * was removed automatically by timer_close.  We avoid this race
 			 * condition by ensuring that the timer system never frees a 
-			 * one shot timer.
+			 * one shot timer. Timers allocated by the caller (and started
+			 * with #start_timer) are never freed either.
 			 */
-			free(last);
+			timer_free(timer);
 		}
 	}
-	TI_timers = 0;
+	TI_heap_count = 0;
 	enable_interrupts();
 }
 
@@ -0,0 +1,85 @@
+void test_asset_fopen_chunked(TestContext *ctx) {
+	uint8_t random[8*1024];
+	FILE *f = NULL;
+	DEFER(if (f) fclose(f));
+
+	// Read the uncompressed reference file
+	f = fopen("rom:/random.dat", "rb");
+	ASSERT(f, "cannot open file: rom:/random.dat");
+	int sz = fread(random, 1, sizeof(random), f);
+	ASSERT_EQUAL_UNSIGNED(sz, sizeof(random), "cannot read enough data");
+	fclose(f); f = NULL;
+
+	// Open the same file compressed in chunks of 1 KiB
+	f = asset_fopen("rom:/chunked/random.dat", &sz);
+	ASSERT(f, "cannot open file: rom:/chunked/random.dat");
+	ASSERT_EQUAL_SIGNED(sz, sizeof(random), "invalid decompressed size");
+
+	uint8_t buf[128];
+
+	// Sequential read across chunk boundaries
+	for (int pos = 0; pos < sizeof(random); pos += 100) {
+		int n = sizeof(random) - pos;
+		if (n > 100) n = 100;
+		ASSERT_EQUAL_SIGNED(fread(buf, 1, n, f), n, "short read at %d", pos);
+		ASSERT_EQUAL_MEM(buf, random+pos, n, "invalid sequential read at %d", pos);
+	}
+
+	// Random seeks, both backward and forward, within and across chunks
+	for (int i = 0; i < 256; i++) {
+		int pos = RANDN(sizeof(random));
+		int n = RANDN(sizeof(buf)) + 1;
+		if (n > sizeof(random) - pos) n = sizeof(random) - pos;
+
+		ASSERT_EQUAL_SIGNED(fseek(f, pos, SEEK_SET), 0, "seek to %d failed", pos);
+		ASSERT_EQUAL_SIGNED(ftell(f), pos, "invalid position after seek");
+		ASSERT_EQUAL_SIGNED(fread(buf, 1, n, f), n, "short read at %d", pos);
+		ASSERT_EQUAL_MEM(buf, random+pos, n, "invalid read at %d (%d bytes)", pos, n);
+	}
+
+	// Relative seeks
+	ASSERT_EQUAL_SIGNED(fseek(f, 1000, SEEK_SET), 0, "seek failed");
+	ASSERT_EQUAL_SIGNED(fseek(f, 1500, SEEK_CUR), 0, "seek failed");
+	ASSERT_EQUAL_SIGNED(fread(buf, 1, 16, f), 16, "short read");
+	ASSERT_EQUAL_MEM(buf, random+2500, 16, "invalid read after SEEK_CUR");
+
+	ASSERT_EQUAL_SIGNED(fseek(f, -16, SEEK_END), 0, "seek failed");
+	ASSERT_EQUAL_SIGNED(fread(buf, 1, 32, f), 16, "invalid read size at end of file");
+	ASSERT_EQUAL_MEM(buf, random+sizeof(random)-16, 16, "invalid read after SEEK_END");
+}
+
+void test_asset_parallel(TestContext *ctx) {
+	// Files compressed by mkasset with parallel jobs (and then fetched from
+	// the cache) must decompress to the original contents.
+	const char *files[] = { "random.dat", "counter.dat" };
+	for (int i = 0; i < sizeof(files)/sizeof(files[0]); i++) {
+		char fn[64];
+		int sz, ref_sz;
+		sprintf(fn, "rom:/%s", files[i]);
+		void *ref = asset_load(fn, &ref_sz);
+		DEFER(free(ref));
+		sprintf(fn, "rom:/parallel/%s", files[i]);
+		void *data = asset_load(fn, &sz);
+		DEFER(free(data));
+
+		ASSERT_EQUAL_SIGNED(sz, ref_sz, "invalid decompressed size: %s", fn);
+		ASSERT_EQUAL_MEM(data, ref, sz, "invalid decompressed data: %s", fn);
+	}
+
+	// Sprites converted by mksprite with parallel jobs (and then fetched
+	// from the cache) must be identical to those converted one at a time.
+	const char *sprites[] = { "grass1.rgba32.sprite", "grass1.ci8.sprite" };
+	for (int i = 0; i < sizeof(sprites)/sizeof(sprites[0]); i++) {
+		char fn[64];
+		int sz, ref_sz;
+		sprintf(fn, "rom:/%s", sprites[i]);
+		void *ref = asset_load(fn, &ref_sz);
+		DEFER(free(ref));
+		sprintf(fn, "rom:/parallel/%s", sprites[i]);
+		void *data = asset_load(fn, &sz);
+		DEFER(free(data));
+
+		ASSERT_EQUAL_SIGNED(sz, ref_sz, "invalid sprite size: %s", fn);
+		ASSERT_EQUAL_MEM(data, ref, sz, "invalid sprite data: %s", fn);
+	}
+}
@@ -88,3 +88,68 @@ void test_dfs_rom_addr(TestContext *ctx) {
 
 	ASSERT_EQUAL_MEM(buf1, buf2, 128, "DMA ROM access is different");
 }
+
+void test_dfs_path_lookup(TestContext *ctx) {
+	// Absolute paths are resolved through the path index (if present), while
+	// paths with relative components fall back to walking the directory tree.
+	// Both must agree.
+	uint32_t rom1 = dfs_rom_addr("counter.dat");
+	ASSERT(rom1 != 0, "counter.dat not found");
+	uint32_t rom2 = dfs_rom_addr("/counter.dat");
+	ASSERT_EQUAL_HEX(rom2, rom1, "absolute path lookup mismatch");
+	uint32_t rom3 = dfs_rom_addr("./counter.dat");
+	ASSERT_EQUAL_HEX(rom3, rom1, "relative path lookup mismatch");
+	uint32_t rom4 = dfs_rom_addr("/random.dat");
+	ASSERT(rom4 != 0 && rom4 != rom1, "random.dat not found");
+
+	// Files with the same name in different directories must not be confused
+	uint32_t rom5 = dfs_rom_addr("/chunked/random.dat");
+	ASSERT(rom5 != 0 && rom5 != rom4, "chunked/random.dat not found");
+	ASSERT_EQUAL_HEX(dfs_rom_addr("/chunked/counter.dat"), 0, "file found in the wrong directory");
+
+	ASSERT_EQUAL_SIGNED(dfs_open("/notexist.dat"), DFS_ENOFILE, "missing file found");
+	ASSERT_EQUAL_SIGNED(dfs_open("/counter.dat/x"), DFS_ENOFILE, "file used as directory");
+	ASSERT_EQUAL_HEX(dfs_rom_addr("/Counter.dat"), 0, "lookup is not case sensitive");
+}
+
+void test_dfs_read_async(TestContext *ctx) {
+	int fh = dfs_open("counter.dat");
+	ASSERT(fh >= 0, "counter.dat not found");
+	DEFER(dfs_close(fh));
+
+	uint8_t expected[1024] __attribute__((aligned(16)));
+	dfs_read(expected, 1, sizeof(expected), fh);
+	dfs_seek(fh, 0, SEEK_SET);
+
+	static volatile int num_done;
+	void cb(void *arg) {
+		num_done += (int)arg;
+	}
+
+	uint8_t buf[1024] __attribute__((aligned(16)));
+	dma_request_t reqs[4];
+	num_done = 0;
+
+	// Schedule four reads back to back, of different sizes, and then
+	// a blocking read in the middle of them.
+	ASSERT_EQUAL_SIGNED(dfs_read_async(buf,     1, 256, fh, &reqs[0], cb, (void*)1), 256, "invalid read size");
+	ASSERT_EQUAL_SIGNED(dfs_read_async(buf+256, 1, 2,   fh, &reqs[1], cb, (void*)2), 2, "invalid read size");
+	ASSERT_EQUAL_SIGNED(dfs_read_async(buf+258, 1, 510, fh, &reqs[2], cb, (void*)4), 510, "invalid read size");
+	ASSERT_EQUAL_SIGNED(dfs_read_async(buf+768, 1, 256, fh, &reqs[3], NULL, NULL), 256, "invalid read size");
+
+	uint8_t sync[16] __attribute__((aligned(16)));
+	uint32_t rom = dfs_rom_addr("counter.dat");
+	data_cache_hit_writeback_invalidate(sync, sizeof(sync));
+	dma_read(sync, rom, sizeof(sync));
+	ASSERT_EQUAL_MEM(sync, expected, sizeof(sync), "invalid data in blocking read");
+
+	dma_request_wait(&reqs[3]);
+	for (int i=0; i<4; i++)
+		ASSERT(dma_request_done(&reqs[i]), "request %d not done", i);
+	ASSERT_EQUAL_SIGNED(num_done, 7, "callbacks not called");
+	ASSERT_EQUAL_MEM(buf, expected, sizeof(buf), "invalid data in async read");
+
+	// Misaligned phase between buffer and file position is refused
+	dfs_seek(fh, 1, SEEK_SET);
+	ASSERT_EQUAL_SIGNED(dfs_read_async(buf, 1, 16, fh, &reqs[0], NULL, NULL), DFS_EBADINPUT, "misaligned read accepted");
+}
@@ -0,0 +1,404 @@
+// A mono waveform at the output sample rate, that records the reads issued
+// by the mixer. It is silent, unless a value is configured: in that case, it
+// is either a DC signal, or an impulse at the specified position.
+typedef struct {
+	waveform_t wave;
+	int reads;          // Number of calls to the read callback
+	int first_wpos;     // Position requested by the first read
+	int16_t value;      // Value of the DC signal or of the impulse
+	int impulse_pos;    // Position of the impulse, or -1 for a DC signal
+} mixer_test_wave_t;
+
+static void mixer_test_wave_read(void *ctx, samplebuffer_t *sbuf, int wpos, int wlen, bool seeking)
+{
+	mixer_test_wave_t *w = ctx;
+	if (w->reads++ == 0)
+		w->first_wpos = wpos;
+	int16_t *dst = samplebuffer_append(sbuf, wlen);
+	for (int i=0; i<wlen; i++)
+		dst[i] = (w->impulse_pos < 0 || wpos+i == w->impulse_pos) ? w->value : 0;
+}
+
+static void mixer_test_wave_init(mixer_test_wave_t *w, int len, int loop_len)
+{
+	*w = (mixer_test_wave_t){
+		.wave = {
+			.name = "test",
+			.bits = 16,
+			.channels = 1,
+			.frequency = 32000,
+			.len = len,
+			.loop_len = loop_len,
+			.read = mixer_test_wave_read,
+			.ctx = w,
+		},
+		.impulse_pos = -1,
+	};
+}
+
+void test_mixer_voices_steal(TestContext *ctx) {
+	audio_init(32000, 4);
+	DEFER(audio_close());
+	mixer_init(4);
+	DEFER(mixer_close());
+
+	// Only two channels for the voices, so that at most two are mixed
+	mixer_voices_init(2, 2);
+
+	const int N = 256;
+	int16_t *out = malloc_uncached(N*2*sizeof(int16_t));
+	DEFER(free_uncached(out));
+
+	static mixer_test_wave_t wa, wb, wc, wd;
+	mixer_test_wave_init(&wa, 1<<20, 0);
+	mixer_test_wave_init(&wb, 1<<20, 0);
+	mixer_test_wave_init(&wc, 1<<20, 0);
+	mixer_test_wave_init(&wd, 1<<20, 0);
+
+	// Priority wins over volume, then the loudest voice is mixed
+	mixer_voice_t a = mixer_voice_play(&wa.wave, 0, 0.5f, 0.5f);
+	mixer_voice_t b = mixer_voice_play(&wb.wave, 0, 1.0f, 0.5f);
+	mixer_voice_t c = mixer_voice_play(&wc.wave, 1, 0.1f, 0.5f);
+	mixer_voice_set_freq(c, 16000);
+	mixer_poll(out, N);
+	ASSERT(mixer_voice_audible(b), "loudest voice is not mixed");
+	ASSERT(mixer_voice_audible(c), "highest priority voice is not mixed");
+	ASSERT(!mixer_voice_audible(a), "least audible voice is mixed");
+	ASSERT(mixer_voice_playing(a), "virtual voice was stopped");
+	ASSERT_EQUAL_SIGNED(wa.reads, 0, "virtual voice was read");
+
+	// A new voice with higher priority steals the channel of the least
+	// audible mixed voice, that becomes virtual.
+	mixer_voice_t d = mixer_voice_play(&wd.wave, 2, 0.2f, 0.5f);
+	mixer_poll(out, N);
+	ASSERT(mixer_voice_audible(d), "new voice did not steal a channel");
+	ASSERT(mixer_voice_audible(c), "wrong voice was stolen");
+	ASSERT(!mixer_voice_audible(b), "stolen voice is still mixed");
+	ASSERT(mixer_voice_playing(b), "stolen voice was stopped");
+
+	// Once the channel is free again, the stolen voice resumes from where
+	// it would be if it had kept playing.
+	mixer_voice_stop(d);
+	ASSERT(!mixer_voice_playing(d), "stopped voice is still playing");
+	wb.reads = 0;
+	mixer_poll(out, N);
+	ASSERT(mixer_voice_audible(b), "virtual voice was not mixed again");
+	ASSERT_EQUAL_SIGNED(wb.first_wpos, 2*N, "virtual voice resumed at the wrong position");
+
+	// Changing volumes changes the mixed voices. The voice that was
+	// always virtual starts at the position reached meanwhile.
+	mixer_voice_set_vol_pan(b, 0.3f, 0.5f);
+	mixer_voice_set_vol_pan(a, 0.8f, 0.5f);
+	mixer_poll(out, N);
+	ASSERT(mixer_voice_audible(a), "louder voice is not mixed");
+	ASSERT(!mixer_voice_audible(b), "quieter voice is mixed");
+	ASSERT_EQUAL_SIGNED(wa.first_wpos, 3*N, "virtual voice started at the wrong position");
+
+	// The voice at half the frequency was mixed all the time
+	ASSERT(mixer_ch_get_pos(2) == 2*N || mixer_ch_get_pos(3) == 2*N,
+		"wrong position of the half-frequency voice: %f / %f", mixer_ch_get_pos(2), mixer_ch_get_pos(3));
+
+	// Voices with no volume are never mixed, even with higher priority
+	mixer_voice_set_vol_pan(c, 0, 0.5f);
+	mixer_poll(out, N);
+	ASSERT(!mixer_voice_audible(c), "voice with no volume is mixed");
+	ASSERT(mixer_voice_playing(c), "voice with no volume was stopped");
+	ASSERT(mixer_voice_audible(a) && mixer_voice_audible(b), "free channel was not used");
+}
+
+void test_mixer_voices_handles(TestContext *ctx) {
+	audio_init(32000, 4);
+	DEFER(audio_close());
+	mixer_init(4);
+	DEFER(mixer_close());
+	mixer_voices_init(0, 2);
+
+	const int N = 256;
+	int16_t *out = malloc_uncached(N*2*sizeof(int16_t));
+	DEFER(free_uncached(out));
+
+	// Play many more voices than channels, so that the voices array is
+	// also reallocated. Only the two most audible voices are mixed:
+	// priority 2 and the highest volumes (#38 and #35).
+	enum { NUM_VOICES = 40 };
+	static mixer_test_wave_t waves[NUM_VOICES];
+	mixer_voice_t voices[NUM_VOICES];
+	for (int i=0; i<NUM_VOICES; i++) {
+		mixer_test_wave_init(&waves[i], 1<<20, 0);
+		voices[i] = mixer_voice_play(&waves[i].wave, i%3, (i+1) / 64.0f, 0.5f);
+		ASSERT(voices[i] != 0, "invalid handle");
+	}
+	mixer_poll(out, N);
+	for (int i=0; i<NUM_VOICES; i++) {
+		ASSERT(mixer_voice_playing(voices[i]), "voice %d is not playing", i);
+		ASSERT_EQUAL_SIGNED(mixer_voice_audible(voices[i]), i == 35 || i == 38, "wrong audibility of voice %d", i);
+		if (i != 35 && i != 38)
+			ASSERT_EQUAL_SIGNED(waves[i].reads, 0, "virtual voice %d was read", i);
+	}
+
+	// A new voice reuses the slot of a stopped voice, but with a different
+	// handle: the stale handle must not affect it.
+	static mixer_test_wave_t wx;
+	mixer_test_wave_init(&wx, 1<<20, 0);
+	mixer_voice_stop(voices[5]);
+	mixer_voice_t x = mixer_voice_play(&wx.wave, 0, 0.01f, 0.5f);
+	ASSERT(x != voices[5], "handle of a stopped voice was reused");
+	ASSERT(!mixer_voice_playing(voices[5]), "stale handle reports a playing voice");
+	mixer_voice_stop(voices[5]);
+	ASSERT(mixer_voice_playing(x), "stale handle stopped a new voice");
+
+	// A virtual voice that reaches the end of its waveform is released,
+	// while a looping one wraps around the loop.
+	static mixer_test_wave_t wshort, wloop;
+	mixer_test_wave_init(&wshort, 100, 0);
+	mixer_test_wave_init(&wloop, 1000, 600);
+	mixer_voice_t vshort = mixer_voice_play(&wshort.wave, -1, 1.0f, 0.5f);
+	mixer_voice_t vloop = mixer_voice_play(&wloop.wave, -1, 1.0f, 0.5f);
+	for (int i=0; i<4; i++)
+		mixer_poll(out, N);
+	ASSERT(!mixer_voice_playing(vshort), "virtual voice did not stop at the end of the waveform");
+	ASSERT(mixer_voice_playing(vloop), "looping virtual voice was stopped");
+	ASSERT_EQUAL_SIGNED(wloop.reads, 0, "virtual voice was read");
+
+	// Free all channels: the looping voice is mixed from the wrapped position
+	for (int i=0; i<NUM_VOICES; i++)
+		mixer_voice_stop(voices[i]);
+	mixer_voice_stop(x);
+	mixer_poll(out, N);
+	ASSERT(mixer_voice_audible(vloop), "looping voice is not mixed");
+	ASSERT_EQUAL_SIGNED(wloop.first_wpos, 400 + (4*N - 1000) % 600, "looping voice resumed at the wrong position");
+
+	// A mixed voice that reaches the end of its waveform is released too
+	mixer_test_wave_init(&wshort, 300, 0);
+	vshort = mixer_voice_play(&wshort.wave, 0, 1.0f, 0.5f);
+	mixer_poll(out, N);
+	ASSERT(mixer_voice_audible(vshort), "short voice is not mixed");
+	mixer_poll(out, N);
+	mixer_poll(out, N);
+	ASSERT(!mixer_voice_playing(vshort), "mixed voice did not stop at the end of the waveform");
+}
+
+// Mix a channel playing a DC signal, with or without a low-pass filter
+static void mixer_test_filter_run(int16_t *out, int nsamples, float cutoff)
+{
+	audio_init(32000, 4);
+	mixer_init(1);
+
+	static mixer_test_wave_t w;
+	mixer_test_wave_init(&w, 1<<20, 0);
+	w.value = 0x2000;
+	mixer_ch_set_filter(0, cutoff);
+	mixer_ch_play(0, &w.wave);
+	mixer_ch_set_vol(0, 1.0f, 1.0f);
+
+	int16_t *buf = malloc_uncached(nsamples*2*sizeof(int16_t));
+	mixer_poll(buf, nsamples);
+	memcpy(out, buf, nsamples*2*sizeof(int16_t));
+	free_uncached(buf);
+
+	mixer_close();
+	audio_close();
+}
+
+void test_mixer_filter(TestContext *ctx) {
+	// Reference: the same signal without the filter. Both outputs go through
+	// the same volume smoothing, so the ratio between them is the step
+	// response of the filter: 1 - c^(n+1), with c = exp(-2*pi*fc/fs).
+	const int N = 1024;
+	int16_t *ref = malloc(N*2*sizeof(int16_t));
+	DEFER(free(ref));
+	int16_t *out = malloc(N*2*sizeof(int16_t));
+	DEFER(free(out));
+	mixer_test_filter_run(ref, N, 0);
+	mixer_test_filter_run(out, N, 100);
+
+	int level = ref[(N-1)*2];
+	ASSERT(level > 0x1000, "DC signal was not mixed: %d", level);
+	ASSERT_EQUAL_SIGNED(ref[(N-1)*2+1], level, "wrong right channel");
+
+	float c = expf(-2.0f * (float)M_PI * 100 / 32000);
+	float k = 1;
+	for (int i=0; i<N; i++) {
+		k *= c;
+		int expected = ref[i*2] * (1-k);
+		int tol = abs(expected) / 32 + 8;
+		ASSERT(abs(out[i*2] - expected) <= tol, "wrong filter output at sample %d: %d (expected: %d)", i, out[i*2], expected);
+		ASSERT_EQUAL_SIGNED(out[i*2+1], out[i*2], "wrong filter output on the right channel at sample %d", i);
+	}
+	ASSERT(abs(out[(N-1)*2] - level) <= 2, "filter did not converge: %d (expected: %d)", out[(N-1)*2], level);
+}
+
+static int mixer_test_nop_event(void *ctx)
+{
+	return 0;
+}
+
+void test_mixer_reverb(TestContext *ctx) {
+	audio_init(32000, 4);
+	DEFER(audio_close());
+	mixer_init(1);
+	DEFER(mixer_close());
+
+	// Play an impulse into a delay line of 100 samples, so that the echoes
+	// are at multiples of 100 samples from it, halving each time.
+	const int delay = 100, impulse = 64;
+	static mixer_test_wave_t w;
+	mixer_test_wave_init(&w, 1<<20, 0);
+	w.value = 0x2000;
+	w.impulse_pos = impulse;
+	mixer_set_reverb(delay / 32000.0f, 0.5f, 0.5f);
+	mixer_ch_set_reverb_send(0, 1.0f);
+	mixer_ch_play(0, &w.wave);
+	mixer_ch_set_vol(0, 1.0f, 1.0f);
+
+	// An event at an odd sample splits the mixing: the next command starts at
+	// a position in the delay line (and in the output) that is 4 mod 8 bytes,
+	// and is split again where the delay line wraps around.
+	mixer_add_event(33, mixer_test_nop_event, NULL);
+
+	const int N = 512;
+	int16_t *out = malloc_uncached(N*2*sizeof(int16_t));
+	DEFER(free_uncached(out));
+	mixer_poll(out, N);
+
+	ASSERT(out[impulse*2] > 0, "impulse was not mixed");
+	int echo = out[(impulse+delay)*2];
+	ASSERT(echo > 0x800, "missing echo: %d", echo);
+	for (int i=0; i<N; i++) {
+		for (int j=0; j<2; j++) {
+			int v = out[i*2+j];
+			if (i == impulse) continue;
+			if (i > impulse && (i - impulse) % delay == 0) {
+				int n = (i - impulse) / delay;
+				int expected = echo >> (n-1);
+				ASSERT(abs(v - expected) <= n, "wrong echo %d at sample %d: %d (expected: %d)", n, i, v, expected);
+			} else {
+				ASSERT(abs(v) <= 1, "unexpected output at sample %d: %d", i, v);
+			}
+		}
+	}
+}
+
+// Log of the mixer events that fired: the identifier of each event (its
+// context) and the sample at which it fired, read from the position of
+// a waveform played at the output sample rate.
+static struct {
+	int id[256];
+	int pos[256];
+	int count;
+} mixer_test_events;
+
+static int mixer_test_log_event(void *ctx)
+{
+	int n = mixer_test_events.count++;
+	if (n < 256) {
+		mixer_test_events.id[n] = (int)(intptr_t)ctx;
+		mixer_test_events.pos[n] = mixer_ch_get_pos(0);
+	}
+	return 0;
+}
+
+static void mixer_test_events_init(mixer_test_wave_t *w)
+{
+	memset(&mixer_test_events, 0, sizeof(mixer_test_events));
+	mixer_test_wave_init(w, 1<<20, 0);
+	mixer_ch_play(0, &w->wave);
+	mixer_ch_set_freq(0, audio_get_frequency());
+}
+
+void test_mixer_events_order(TestContext *ctx) {
+	audio_init(32000, 4);
+	DEFER(audio_close());
+	mixer_init(1);
+	DEFER(mixer_close());
+
+	static mixer_test_wave_t w;
+	mixer_test_events_init(&w);
+
+	// Register many more events than the initial capacity of the queue,
+	// in scrambled order. Every delay is used by two events, that must
+	// fire in the order they were registered.
+	const int N = 100;
+	for (int i=0; i<N; i++)
+		mixer_add_event(((i*37) % (N/2)) * 5 + 1, mixer_test_log_event, (void*)(intptr_t)i);
+
+	// Events in the past fire at the beginning of the next poll, before
+	// all the others.
+	mixer_add_event(0, mixer_test_log_event, (void*)(intptr_t)N);
+	mixer_add_event(-10, mixer_test_log_event, (void*)(intptr_t)(N+1));
+
+	int16_t *out = malloc_uncached(512*2*sizeof(int16_t));
+	DEFER(free_uncached(out));
+	mixer_poll(out, 512);
+
+	ASSERT_EQUAL_SIGNED(mixer_test_events.count, N+2, "wrong number of events fired");
+	ASSERT_EQUAL_SIGNED(mixer_test_events.id[0], N+1, "past event fired out of order");
+	ASSERT_EQUAL_SIGNED(mixer_test_events.id[1], N, "past event fired out of order");
+	ASSERT_EQUAL_SIGNED(mixer_test_events.pos[0], 0, "past event fired late");
+	ASSERT_EQUAL_SIGNED(mixer_test_events.pos[1], 0, "past event fired late");
+
+	for (int i=2; i<N+2; i++) {
+		int id = mixer_test_events.id[i];
+		int prev = mixer_test_events.id[i-1];
+		ASSERT(id >= 0 && id < N, "invalid event %d fired at index %d", id, i);
+		ASSERT_EQUAL_SIGNED(mixer_test_events.pos[i], ((id*37) % (N/2)) * 5 + 1, "event %d fired at the wrong sample", id);
+		if (i > 2 && mixer_test_events.pos[i] == mixer_test_events.pos[i-1])
+			ASSERT(prev < id, "events %d and %d due at the same sample fired out of order", prev, id);
+		else
+			ASSERT(i == 2 || mixer_test_events.pos[i] > mixer_test_events.pos[i-1], "event %d fired out of order", id);
+	}
+}
+
+static int mixer_test_self_remove_event(void *ctx)
+{
+	mixer_test_log_event(ctx);
+	// Deregister explicitly, but ask to be called again: the removal wins
+	mixer_remove_event(mixer_test_self_remove_event, ctx);
+	return 10;
+}
+
+static int mixer_test_repeat_event(void *ctx)
+{
+	mixer_test_log_event(ctx);
+	int fired = 0;
+	for (int i=0; i<mixer_test_events.count; i++)
+		if (mixer_test_events.id[i] == (int)(intptr_t)ctx)
+			fired++;
+	// On the third call, remove another pending event; stop after four calls
+	if (fired == 3)
+		mixer_remove_event(mixer_test_log_event, (void*)(intptr_t)2);
+	return fired < 4 ? 50 : 0;
+}
+
+void test_mixer_events_remove(TestContext *ctx) {
+	audio_init(32000, 4);
+	DEFER(audio_close());
+	mixer_init(1);
+	DEFER(mixer_close());
+
+	static mixer_test_wave_t w;
+	mixer_test_events_init(&w);
+
+	mixer_add_event(10, mixer_test_self_remove_event, (void*)(intptr_t)0);
+	mixer_add_event(5, mixer_test_repeat_event, (void*)(intptr_t)1);
+	mixer_add_event(200, mixer_test_log_event, (void*)(intptr_t)2);
+	mixer_add_event(300, mixer_test_log_event, (void*)(intptr_t)3);
+	mixer_add_event(400, mixer_test_log_event, (void*)(intptr_t)4);
+	mixer_remove_event(mixer_test_log_event, (void*)(intptr_t)4);
+	// Removing an event which is not registered is a no-op
+	mixer_remove_event(mixer_test_log_event, (void*)(intptr_t)5);
+
+	int16_t *out = malloc_uncached(512*2*sizeof(int16_t));
+	DEFER(free_uncached(out));
+	mixer_poll(out, 512);
+
+	static const int expected[][2] = {
+		{ 1, 5 }, { 0, 10 }, { 1, 55 }, { 1, 105 }, { 1, 155 }, { 3, 300 },
+	};
+	const int n = sizeof(expected) / sizeof(expected[0]);
+	ASSERT_EQUAL_SIGNED(mixer_test_events.count, n, "wrong number of events fired");
+	for (int i=0; i<n; i++) {
+		ASSERT_EQUAL_SIGNED(mixer_test_events.id[i], expected[i][0], "wrong event fired at index %d", i);
+		ASSERT_EQUAL_SIGNED(mixer_test_events.pos[i], expected[i][1], "event %d fired at the wrong sample", expected[i][0]);
+	}
+}
@@ -306,9 +306,10 @@ void test_rdpq_block_coalescing(TestContext *ctx)
     // This command is a fixup
     rdpq_set_fill_color(RGBA16(0, 0, 0, 0));
 
-    // These 3 should also have their RSPQ_CMD_RDP coalesced
-    rdpq_set_env_color(RGBA32(0,0,0,0));
-    rdpq_set_blend_color(RGBA32(0, 0, 0, 0));
+    // These 3 should also have their RSPQ_CMD_RDP coalesced. Use different
+    // values, otherwise the redundant state changes would be dropped.
+    rdpq_set_env_color(RGBA32(1,1,1,1));
+    rdpq_set_blend_color(RGBA32(1, 1, 1, 1));
     rdpq_set_tile(TILE0, FMT_RGBA16, 0, 16, 0);
 
     rspq_block_t *block = rspq_block_end();
@@ -331,6 +332,94 @@ void test_rdpq_block_coalescing(TestContext *ctx)
     ASSERT_EQUAL_MEM((uint8_t*)block->cmds, (uint8_t*)expected_cmds, sizeof(expected_cmds), "Block commands don't match!");
 }
 
+void test_rdpq_block_redundant(TestContext *ctx)
+{
+    RDPQ_INIT();
+
+    // The actual commands don't matter because they are never executed
+    rspq_block_begin();
+
+    rdpq_set_env_color(RGBA32(0x11,0x11,0x11,0x11));
+    rdpq_set_prim_register_raw(RGBA32(0x22,0x22,0x22,0x22), 0, 0);
+    // Redundant: same value, nothing changed it inbetween
+    rdpq_set_env_color(RGBA32(0x11,0x11,0x11,0x11));
+    // Not redundant: the value changed
+    rdpq_set_env_color(RGBA32(0x33,0x33,0x33,0x33));
+
+    // Consecutive syncs: only the first of each kind is kept
+    rdpq_sync_pipe();
+    rdpq_sync_tile();
+    rdpq_sync_pipe();
+    rdpq_sync_tile();
+
+    // A RSP command that changes the PRIM register: the next
+    // SET_PRIM_COLOR is not redundant anymore
+    rdpq_set_prim_lod_frac(0x10);
+    rdpq_set_prim_register_raw(RGBA32(0x22,0x22,0x22,0x22), 0, 0);
+
+    rspq_block_t *block = rspq_block_end();
+    DEFER(rspq_block_free(block));
+
+    uint64_t *rdp_cmds = (uint64_t*)block->rdp_block->cmds;
+
+    uint64_t expected_cmds[8] = {
+        // Autosync at the start of the block (RDP state is unknown)
+        (uint64_t)(RDPQ_CMD_SYNC_PIPE + 0xC0) << 56,
+        ((uint64_t)(RDPQ_CMD_SET_ENV_COLOR + 0xC0) << 56) | 0x11111111,
+        ((uint64_t)(RDPQ_CMD_SET_PRIM_COLOR + 0xC0) << 56) | 0x22222222,
+        ((uint64_t)(RDPQ_CMD_SET_ENV_COLOR + 0xC0) << 56) | 0x33333333,
+        (uint64_t)(RDPQ_CMD_SYNC_PIPE + 0xC0) << 56,
+        (uint64_t)(RDPQ_CMD_SYNC_TILE + 0xC0) << 56,
+        // Slot reserved for the SET_PRIM_COLOR generated by the RSP
+        (uint64_t)0xC0 << 56,
+        ((uint64_t)(RDPQ_CMD_SET_PRIM_COLOR + 0xC0) << 56) | 0x22222222,
+    };
+    ASSERT_EQUAL_MEM((uint8_t*)rdp_cmds, (uint8_t*)expected_cmds, sizeof(expected_cmds), "Block RDP commands don't match!");
+}
+
+void test_rdpq_block_redundant_bypass(TestContext *ctx)
+{
+    RDPQ_INIT();
+    test_ovl_init();
+    DEFER(test_ovl_close());
+
+    const float v1[] = { 4.0f, 4.0f }, v2[] = { 12.0f, 4.0f }, v3[] = { 4.0f, 12.0f };
+
+    // The actual commands don't matter because they are never executed
+    rspq_block_begin();
+
+    rdpq_set_env_color(RGBA32(0x11,0x11,0x11,0x11));
+    rdpq_sync_tile();
+    // A triangle assembled on the CPU is written with rspq_write_begin,
+    // but the RDP commands before and after it are still not adjacent.
+    rdpq_triangle_cpu(&TRIFMT_FILL, v1, v2, v3);
+    rdpq_sync_tile();
+    // Redundant: triangles do not change the ENV register
+    rdpq_set_env_color(RGBA32(0x11,0x11,0x11,0x11));
+
+    // A command written with rspq_write by another overlay: it might do
+    // anything, so the next SET_ENV_COLOR is not redundant anymore.
+    rspq_write(test_ovl_id, 0x0, 0);
+    rdpq_set_env_color(RGBA32(0x11,0x11,0x11,0x11));
+
+    rspq_block_t *block = rspq_block_end();
+    DEFER(rspq_block_free(block));
+
+    uint64_t *rdp_cmds = (uint64_t*)block->rdp_block->cmds;
+
+    uint64_t expected_cmds[6] = {
+        // Autosync at the start of the block (RDP state is unknown)
+        (uint64_t)(RDPQ_CMD_SYNC_PIPE + 0xC0) << 56,
+        ((uint64_t)(RDPQ_CMD_SET_ENV_COLOR + 0xC0) << 56) | 0x11111111,
+        (uint64_t)(RDPQ_CMD_SYNC_TILE + 0xC0) << 56,
+        (uint64_t)(RDPQ_CMD_SYNC_TILE + 0xC0) << 56,
+        // Autosync after the triangle
+        (uint64_t)(RDPQ_CMD_SYNC_PIPE + 0xC0) << 56,
+        ((uint64_t)(RDPQ_CMD_SET_ENV_COLOR + 0xC0) << 56) | 0x11111111,
+    };
+    ASSERT_EQUAL_MEM((uint8_t*)rdp_cmds, (uint8_t*)expected_cmds, sizeof(expected_cmds), "Block RDP commands don't match!");
+}
+
 void test_rdpq_block_contiguous(TestContext *ctx)
 {
     RDPQ_INIT();
@@ -77,3 +77,49 @@ void test_rdpq_sprite_lod(TestContext *ctx)
         return color_from_packed32(0);
     });
 }
+
+void test_rdpq_sprite_batch(TestContext *ctx)
+{
+    RDPQ_INIT();
+    debug_rdp_stream_init();
+
+    sprite_t *s1 = sprite_load("rom:/grass1sq.rgba32.sprite");
+    DEFER(sprite_free(s1));
+    sprite_t *s2 = sprite_load("rom:/grass2.rgba32.sprite");
+    DEFER(sprite_free(s2));
+    surface_t s1surf = sprite_get_pixels(s1);
+    surface_t s2surf = sprite_get_pixels(s2);
+
+    // Each cell of the framebuffer is large enough for both sprites
+    const int CELL = 32;
+    ASSERT(s1surf.width <= CELL && s1surf.height <= CELL, "sprite too large for test");
+    ASSERT(s2surf.width <= CELL && s2surf.height <= CELL, "sprite too large for test");
+    surface_t fb = surface_alloc(FMT_RGBA32, CELL*4, CELL);
+    DEFER(surface_free(&fb));
+    surface_clear(&fb, 0);
+
+    rdpq_spritebatch_t *batch = rdpq_spritebatch_new(16);
+    DEFER(rdpq_spritebatch_free(batch));
+
+    // Alternate the two sprites: the batch must upload each of them only once
+    for (int i=0; i<4; i++)
+        rdpq_spritebatch_add(batch, (i & 1) ? s2 : s1, i*CELL, 0, NULL);
+
+    rdpq_attach(&fb, NULL);
+    rdpq_set_mode_standard();
+    rdpq_spritebatch_draw(batch);
+    rdpq_detach_wait();
+
+    int num_loads = debug_rdp_stream_count_cmd(0xF3) + debug_rdp_stream_count_cmd(0xF4); // LOAD_BLOCK + LOAD_TILE
+    ASSERT_EQUAL_SIGNED(num_loads, 2, "invalid number of TMEM loads");
+
+    ASSERT_SURFACE(&fb, {
+        surface_t *surf = ((x / CELL) & 1) ? &s2surf : &s1surf;
+        x %= CELL;
+        if (x >= surf->width || y >= surf->height)
+            return color_from_packed32(0);
+        color_t c = color_from_packed32(((uint32_t*)surf->buffer)[y*surf->stride/4 + x]);
+        c.a = 0xE0;
+        return c;
+    });
+}
@@ -341,6 +341,86 @@ void test_rdpq_tex_multi_i4(TestContext *ctx) {
     });
 }
 
+void test_rdpq_tex_cache(TestContext *ctx) {
+    RDPQ_INIT();
+    debug_rdp_stream_init();
+
+    rdpq_tex_cache_enable(true);
+    DEFER(rdpq_tex_cache_enable(false));
+
+    const int FBWIDTH = 64;
+    surface_t fb = surface_alloc(FMT_RGBA32, FBWIDTH, FBWIDTH);
+    DEFER(surface_free(&fb));
+    surface_clear(&fb, 0);
+
+    surface_t tex1 = surface_create_random(16, 16, FMT_RGBA16);
+    DEFER(surface_free(&tex1));
+    surface_t tex2 = surface_create_random(16, 16, FMT_RGBA32);
+    DEFER(surface_free(&tex2));
+
+    rdpq_attach(&fb, NULL);
+    DEFER(rdpq_detach());
+    rdpq_set_mode_standard();
+
+    // Alternate between the two textures: only the first upload of each
+    // one must actually load TMEM.
+    for (int i=0; i<4; i++) {
+        surface_t *tex = (i & 1) ? &tex2 : &tex1;
+        rdpq_tex_upload(TILE0, tex, NULL);
+        rdpq_texture_rectangle(TILE0, i*16, i*16, i*16+16, i*16+16, 0, 0);
+    }
+    rspq_wait();
+
+    int num_loads = debug_rdp_stream_count_cmd(0xF3) + debug_rdp_stream_count_cmd(0xF4); // LOAD_BLOCK + LOAD_TILE
+    ASSERT_EQUAL_SIGNED(num_loads, 2, "invalid number of TMEM loads");
+
+    ASSERT_SURFACE(&fb, {
+        int i = x / 16;
+        if (i < 4 && y >= i*16 && y < i*16+16)
+            return surface_debug_expected_color((i & 1) ? &tex2 : &tex1, x-i*16, y-i*16);
+        else
+            return color_from_packed32(0);
+    });
+
+    // After invalidation, the texture must be loaded again
+    debug_rdp_stream_reset();
+    rdpq_tex_cache_invalidate_surface(&tex1);
+    rdpq_tex_upload(TILE0, &tex1, NULL);
+    rdpq_tex_upload(TILE1, &tex2, NULL);
+    rspq_wait();
+
+    num_loads = debug_rdp_stream_count_cmd(0xF3) + debug_rdp_stream_count_cmd(0xF4);
+    ASSERT_EQUAL_SIGNED(num_loads, 1, "invalid number of TMEM loads after invalidation");
+
+    // In a multi-texture upload, a texture that cannot go through the cache
+    // (here, because all the 16 cache entries are used by the same upload)
+    // must not overwrite the textures already loaded.
+    surface_t small[17];
+    for (int i=0; i<17; i++)
+        small[i] = surface_create_random(8, 8, FMT_RGBA16);
+    DEFER(for (int i=0; i<17; i++) surface_free(&small[i]));
+
+    rdpq_tex_cache_invalidate();
+    rdpq_clear(RGBA32(0,0,0,0));
+    rdpq_set_mode_standard();
+    rdpq_tex_multi_begin();
+    for (int i=0; i<17; i++)
+        rdpq_tex_upload(i == 0 ? TILE0 : i == 16 ? TILE2 : TILE1, &small[i], NULL);
+    rdpq_tex_multi_end();
+    rdpq_texture_rectangle(TILE0, 0, 0, 8, 8, 0, 0);
+    rdpq_texture_rectangle(TILE2, 8, 0, 16, 8, 0, 0);
+    rspq_wait();
+
+    ASSERT_SURFACE(&fb, {
+        if (y < 8 && x < 8)
+            return surface_debug_expected_color(&small[0], x, y);
+        else if (y < 8 && x < 16)
+            return surface_debug_expected_color(&small[16], x-8, y);
+        else
+            return color_from_packed32(0);
+    });
+}
+
 void test_rdpq_tex_blit_normal(TestContext *ctx)
 {
     RDPQ_INIT();
@@ -192,3 +192,103 @@ void test_rdpq_triangle_w1(TestContext *ctx) {
     ASSERT_EQUAL_HEX(BITS(rdp_stream[0],56,61), RDPQ_CMD_TRI_TEX, "invalid command");
     ASSERT_EQUAL_HEX(BITS(rdp_stream[4],16,31), 0x7FFF, "invalid W coordinate");
 }
+
+void test_rdpq_triangle_indexed(TestContext *ctx) {
+    RDPQ_INIT();
+    debug_rdp_stream_init();
+
+    const int FBWIDTH = 32;
+    surface_t fb = surface_alloc(FMT_RGBA16, FBWIDTH, FBWIDTH);
+    DEFER(surface_free(&fb));
+    surface_clear(&fb, 0);
+
+    rdpq_set_color_image(&fb);
+    rdpq_set_mode_standard();
+    rdpq_mode_combiner(RDPQ_COMBINER_SHADE);
+    rspq_wait();
+
+    // Build a 7x7 grid of vertices: more than the size of the vertex cache,
+    // so that it must be flushed while drawing.
+    #define GRID 7
+    _Static_assert(GRID*GRID > RDPQ_VTXCACHE_SIZE, "grid too small");
+    float vtx[GRID*GRID][6];
+    for (int y=0; y<GRID; y++) {
+        for (int x=0; x<GRID; x++) {
+            float *v = vtx[y*GRID+x];
+            v[0] = x * 4.5f; v[1] = y * 4.25f;
+            v[2] = x / (float)GRID; v[3] = y / (float)GRID; v[4] = 0.5f; v[5] = 1.0f;
+        }
+    }
+
+    // Triangle list
+    uint16_t list[(GRID-1)*(GRID-1)*6]; int nlist = 0;
+    for (int y=0; y<GRID-1; y++) {
+        for (int x=0; x<GRID-1; x++) {
+            int i = y*GRID+x;
+            list[nlist++] = i;  list[nlist++] = i+1;      list[nlist++] = i+GRID;
+            list[nlist++] = i+1; list[nlist++] = i+GRID+1; list[nlist++] = i+GRID;
+        }
+    }
+
+    // Triangle strip, with degenerate triangles to stitch the rows
+    uint16_t strip[(GRID-1)*(GRID*2+2)]; int nstrip = 0;
+    for (int y=0; y<GRID-1; y++) {
+        if (y > 0) strip[nstrip++] = y*GRID;
+        for (int x=0; x<GRID; x++) {
+            strip[nstrip++] = y*GRID+x;
+            strip[nstrip++] = (y+1)*GRID+x;
+        }
+        if (y < GRID-2) strip[nstrip++] = (y+1)*GRID+GRID-1;
+    }
+
+    static uint64_t expected[4096];
+    for (int prim=0; prim<2; prim++) {
+        const uint16_t *idx = prim ? strip : list;
+        int nidx = prim ? nstrip : nlist;
+        int step = prim ? 1 : 3;
+        int ntris = prim ? nidx-2 : nidx/3;
+
+        // Draw the mesh triangle by triangle, as reference
+        debug_rdp_stream_reset();
+        for (int t=0; t<ntris; t++) {
+            const uint16_t *tri = idx + t*step;
+            if (tri[0] == tri[1] || tri[1] == tri[2] || tri[0] == tri[2]) continue;
+            rdpq_triangle(&TRIFMT_SHADE, vtx[tri[0]], vtx[tri[1]], vtx[tri[2]]);
+        }
+        rspq_wait();
+        int nexpected = rdp_stream_ctx.idx;
+        memcpy(expected, rdp_stream, nexpected*8);
+        ASSERT(nexpected > 0, "no triangles drawn");
+
+        // Draw it again through the vertex cache. The RDP commands must be identical.
+        debug_rdp_stream_reset();
+        rdpq_mesh_draw(&TRIFMT_SHADE, &vtx[0][0], 6, GRID*GRID, idx, nidx,
+            prim ? RDPQ_MESH_TRIANGLE_STRIP : RDPQ_MESH_TRIANGLES);
+        rspq_wait();
+        ASSERT_EQUAL_SIGNED(rdp_stream_ctx.idx, nexpected, "wrong number of RDP commands (prim:%d)", prim);
+        for (int i=0; i<nexpected; i++)
+            ASSERT_EQUAL_HEX(rdp_stream[i], expected[i], "wrong RDP command at %d (prim:%d)", i, prim);
+    }
+
+    // The vertex cache is not saved with the overlay state: check that loaded
+    // vertices survive another overlay running between load and draw.
+    test_ovl_init();
+    DEFER(test_ovl_close());
+    debug_rdp_stream_reset();
+    rdpq_triangle(&TRIFMT_SHADE, vtx[8], vtx[9], vtx[15]);
+    rspq_wait();
+    int nexpected = rdp_stream_ctx.idx;
+    memcpy(expected, rdp_stream, nexpected*8);
+
+    debug_rdp_stream_reset();
+    rdpq_vertex_load(&TRIFMT_SHADE, 20, vtx[8], 6, 2);
+    rdpq_vertex_load(&TRIFMT_SHADE, 22, vtx[15], 6, 1);
+    rspq_test_4(0);
+    rspq_wait();
+    rdpq_triangle_indexed(&TRIFMT_SHADE, 20, 21, 22);
+    rspq_wait();
+    ASSERT_EQUAL_SIGNED(rdp_stream_ctx.idx, nexpected, "wrong number of RDP commands after overlay switch");
+    for (int i=0; i<nexpected; i++)
+        ASSERT_EQUAL_HEX(rdp_stream[i], expected[i], "wrong RDP command at %d after overlay switch", i);
+    #undef GRID
+}
@@ -5,6 +5,7 @@
 #include <rspq_constants.h>
 #include <rdp.h>
 #include <rdpq_constants.h>
+#include "../src/rspq/rspq_internal.h"
 #include "test_rspq_constants.h"
 
 #define ASSERT_GP_BACKWARD           0xF001   // Also defined in rsp_test.S
@@ -374,6 +375,81 @@ void test_rspq_switch_overlay(TestContext *ctx)
     ASSERT_EQUAL_MEM(test2_state, (uint8_t*)expected_state, sizeof(expected_state), "State was not saved!");
 }
 
+void test_rspq_current_ovl(TestContext *ctx)
+{
+    TEST_RSPQ_PROLOG();
+    
+    test_ovl_init();
+    DEFER(test_ovl_close());
+
+    rspq_test_4(0);
+
+    TEST_RSPQ_EPILOG(0, rspq_timeout);
+
+    int ovl_idx; uint8_t ovl_id; const char *ovl_name;
+    static rsp_queue_t snapshot;
+    memcpy(&snapshot, __rspq_get_state(), sizeof(rsp_queue_t));
+    rspq_get_current_ovl(&snapshot, &ovl_idx, &ovl_id, &ovl_name);
+    ASSERT_EQUAL_UNSIGNED(ovl_id, test_ovl_id >> 28, "wrong current overlay ID");
+    ASSERT(ovl_idx != 0, "current overlay is builtin");
+    ASSERT(strcmp(ovl_name, rsp_test.name) == 0, "wrong current overlay name: %s", ovl_name);
+
+    // The overlay ID must be looked up in the snapshot, not in the tables
+    // currently used by the CPU: move the overlay to a free ID in the snapshot.
+    int free_id = 1;
+    while (free_id < RSPQ_OVERLAY_TABLE_SIZE && snapshot.tables.overlay_table[free_id])
+        free_id++;
+    ASSERT(free_id < RSPQ_OVERLAY_TABLE_SIZE, "no free overlay ID");
+    snapshot.tables.overlay_table[free_id] = snapshot.tables.overlay_table[test_ovl_id >> 28];
+    snapshot.tables.overlay_table[test_ovl_id >> 28] = 0;
+    rspq_get_current_ovl(&snapshot, &ovl_idx, &ovl_id, &ovl_name);
+    ASSERT_EQUAL_UNSIGNED(ovl_id, free_id, "overlay ID not looked up in the snapshot");
+}
+
+void test_rspq_profile(TestContext *ctx)
+{
+#if !RSPQ_PROFILE
+    SKIP("RSP profiler disabled: build with RSPQ_PROFILE=1");
+#else
+    TEST_RSPQ_PROLOG();
+    
+    test_ovl_init();
+    DEFER(test_ovl_close());
+
+    const int count = 64;
+    const int wait = 1000;
+    uint32_t id = test_ovl_id >> 28;
+
+    rspq_profile_detail(test_ovl_id);
+    rspq_profile_start();
+    DEFER(rspq_profile_stop());
+    for (int f=0; f<2; f++) {
+        for (int i=0; i<count; i++)
+            rspq_test_wait(wait);
+        rspq_test_4(0);
+        rspq_profile_next_frame();
+    }
+
+    rspq_profile_data_t data;
+    rspq_profile_get(&data);
+    ASSERT_EQUAL_UNSIGNED(data.frame_count, 2, "wrong number of frames");
+    ASSERT_EQUAL_UNSIGNED(data.detail_ovl_id, id, "wrong detail overlay ID");
+
+    // Each command is accounted when the next one is dispatched, so also the
+    // last command of each frame must be counted.
+    ASSERT_EQUAL_UNSIGNED(data.overlays[id].sample_count, 2*(count+1), "wrong number of commands of the test overlay");
+    ASSERT_EQUAL_UNSIGNED(data.commands[3].sample_count, 2*count, "wrong number of wait commands");
+    ASSERT_EQUAL_UNSIGNED(data.commands[0].sample_count, 2, "wrong number of test_4 commands");
+    ASSERT(data.overlays[0].sample_count > 0, "builtin commands not counted");
+
+    // The wait command spins for at least two cycles per iteration
+    ASSERT(data.commands[3].total_ticks >= 2ull*count*wait*2, 
+        "wait commands too fast: %llu ticks", data.commands[3].total_ticks);
+    ASSERT(data.overlays[id].total_ticks >= data.commands[3].total_ticks + data.commands[0].total_ticks,
+        "overlay time (%llu) is less than the sum of its commands", data.overlays[id].total_ticks);
+#endif
+}
+
 void test_rspq_multiple_flush(TestContext *ctx)
 {
     TEST_RSPQ_PROLOG();
@@ -516,6 +592,82 @@ void test_rspq_block(TestContext *ctx)
     TEST_RSPQ_EPILOG(0, rspq_timeout);
 }
 
+void test_rspq_block_suspend(TestContext *ctx)
+{
+    TEST_RSPQ_PROLOG();
+    test_ovl_init();
+    DEFER(test_ovl_close());
+
+    rspq_block_begin();
+    for (uint32_t i = 0; i < 512; i++)
+        rspq_test_8(1);
+    rspq_block_t *b512 = rspq_block_end();
+    DEFER(rspq_block_free(b512));
+
+    // Record two blocks in an interleaved way, making both of them grow
+    // over multiple chunks.
+    rspq_block_begin();
+    rspq_block_ctx_t *ctx1 = rspq_block_suspend();
+    rspq_block_begin();
+    rspq_block_ctx_t *ctx2 = rspq_block_suspend();
+
+    for (int j = 0; j < 64; j++) {
+        rspq_block_resume(ctx1);
+        for (uint32_t i = 0; i < 16; i++)
+            rspq_test_8(1);
+        ctx1 = rspq_block_suspend();
+
+        // Write something to the queue meanwhile, which must not end up
+        // in any block.
+        rspq_test_reset();
+
+        rspq_block_resume(ctx2);
+        rspq_test_16(2);
+        if (j%16 == 0)
+            rspq_block_run(b512);
+        ctx2 = rspq_block_suspend();
+    }
+
+    rspq_block_resume(ctx1);
+    rspq_block_t *b1 = rspq_block_end();
+    DEFER(rspq_block_free(b1));
+    rspq_block_resume(ctx2);
+    rspq_block_t *b2 = rspq_block_end();
+    DEFER(rspq_block_free(b2));
+
+    uint64_t actual_sum[2] __attribute__((aligned(16))) = {0};
+    data_cache_hit_writeback_invalidate(actual_sum, 16);
+
+    rspq_test_reset();
+    rspq_block_run(b1);
+    rspq_test_output(actual_sum);
+    rspq_wait();
+    ASSERT_EQUAL_UNSIGNED(*actual_sum, 64*16, "sum #1 is not correct");
+    data_cache_hit_invalidate(actual_sum, 16);
+
+    rspq_test_reset();
+    rspq_block_run(b2);
+    rspq_test_output(actual_sum);
+    rspq_wait();
+    ASSERT_EQUAL_UNSIGNED(*actual_sum, 64*2 + 4*512, "sum #2 is not correct");
+    data_cache_hit_invalidate(actual_sum, 16);
+
+    // Stitch both blocks together into a third one
+    rspq_block_begin();
+    rspq_block_run(b1);
+    rspq_block_run(b2);
+    rspq_block_t *b3 = rspq_block_end();
+    DEFER(rspq_block_free(b3));
+
+    rspq_test_reset();
+    rspq_block_run(b3);
+    rspq_test_output(actual_sum);
+    rspq_wait();
+    ASSERT_EQUAL_UNSIGNED(*actual_sum, 64*16 + 64*2 + 4*512, "sum #3 is not correct");
+
+    TEST_RSPQ_EPILOG(0, rspq_timeout);
+}
+
 void test_rspq_wait_sync_in_block(TestContext *ctx)
 {
     TEST_RSPQ_PROLOG();
@@ -707,6 +859,74 @@ void test_rspq_highpri_overlay(TestContext *ctx)
     TEST_RSPQ_EPILOG(0, rspq_timeout);
 }
 
+// Test that nested blocks can be run in highpri while lowpri is running
+// nested blocks itself.
+void test_rspq_highpri_block(TestContext *ctx)
+{
+    TEST_RSPQ_PROLOG();
+    test_ovl_init();
+    DEFER(test_ovl_close());
+
+    uint64_t actual_sum[2] __attribute__((aligned(16))) = {0};
+    data_cache_hit_writeback_invalidate(actual_sum, 16);
+
+    // Lowpri: a block that calls a slow block, so that highpri will
+    // interrupt it while its call slots are in use.
+    rspq_block_begin();
+    for (uint32_t i = 0; i < 256; i++) {
+        rspq_test_8(1);
+        if (i%16 == 0)
+            rspq_test_wait(0x10);
+    }
+    rspq_block_t *blow = rspq_block_end();
+    DEFER(rspq_block_free(blow));
+
+    rspq_block_begin();
+    for (uint32_t i = 0; i < 16; i++)
+        rspq_block_run(blow);
+    rspq_block_t *blow_outer = rspq_block_end();
+    DEFER(rspq_block_free(blow_outer));
+
+    // Highpri: a block calling another block, with the same nesting levels.
+    rspq_block_begin();
+    for (uint32_t i = 0; i < 16; i++)
+        rspq_test_high(1);
+    rspq_block_t *bhigh = rspq_block_end();
+    DEFER(rspq_block_free(bhigh));
+
+    rspq_block_begin();
+    rspq_block_run(bhigh);
+    rspq_test_high(2);
+    rspq_block_run(bhigh);
+    rspq_block_t *bhigh_outer = rspq_block_end();
+    DEFER(rspq_block_free(bhigh_outer));
+
+    rspq_test_reset();
+    rspq_block_run(blow_outer);
+    rspq_test_output(actual_sum);
+    rspq_flush();
+
+    uint64_t expected_high = 0;
+    for (int i = 0; i < 8; i++) {
+        rspq_highpri_begin();
+            rspq_block_run(bhigh_outer);
+            rspq_test_output(actual_sum);
+        rspq_highpri_end();
+        rspq_highpri_sync();
+
+        expected_high += 16*2 + 2;
+        ASSERT_EQUAL_UNSIGNED(actual_sum[1], expected_high, "highpri sum is not correct (iteration %d)", i);
+        data_cache_hit_invalidate(actual_sum, 16);
+    }
+
+    // Lowpri must have resumed correctly after each highpri interruption
+    rspq_wait();
+    ASSERT_EQUAL_UNSIGNED(actual_sum[0], 256*16, "lowpri sum is not correct");
+    ASSERT_EQUAL_UNSIGNED(actual_sum[1], expected_high, "highpri sum is not correct");
+
+    TEST_RSPQ_EPILOG(0, rspq_timeout);
+}
+
 void test_rspq_big_command(TestContext *ctx)
 {
     TEST_RSPQ_PROLOG();
@@ -0,0 +1,122 @@
+// Run timeline_dump and capture its output (written via debugf to stderr)
+// into the specified buffer. Returns the length of the output.
+static int timeline_capture(char *buf, int size)
+{
+    memset(buf, 0, size);
+    FILE *f = fmemopen(buf, size-1, "w");
+    if (!f) return -1;
+
+    FILE *old_stderr = stderr;
+    stderr = f;
+    timeline_dump();
+    stderr = old_stderr;
+
+    fclose(f);
+    return strlen(buf);
+}
+
+// Count the occurrences of a substring
+static int timeline_count(const char *out, const char *str)
+{
+    int n = 0;
+    for (const char *p = out; (p = strstr(p, str)); p++) n++;
+    return n;
+}
+
+// Check that the output is well-formed: braces and brackets balanced outside
+// of strings, and timestamps never going backward.
+static void timeline_check_json(TestContext *ctx, const char *out)
+{
+    int depth = 0;
+    bool in_str = false;
+    for (const char *p = out; *p; p++) {
+        if (in_str) {
+            if (*p == '\\') { p++; continue; }
+            if (*p == '"') in_str = false;
+            ASSERT((uint8_t)*p >= 0x20, "control character in string at offset %d", p-out);
+            continue;
+        }
+        if (*p == '"') in_str = true;
+        if (*p == '{' || *p == '[') depth++;
+        if (*p == '}' || *p == ']') {
+            ASSERT(depth > 0, "unbalanced JSON at offset %d", p-out);
+            depth--;
+        }
+    }
+    ASSERT(!in_str, "unterminated JSON string");
+    ASSERT_EQUAL_SIGNED(depth, 0, "unbalanced JSON at end of output");
+
+    double prev = 0;
+    for (const char *p = out; (p = strstr(p, "\"ts\":")); p++) {
+        double ts = strtod(p+5, NULL);
+        ASSERT(ts >= prev, "timestamp going backward at offset %d: %f < %f", p-out, ts, prev);
+        prev = ts;
+    }
+}
+
+void test_timeline_dump(TestContext *ctx) {
+    timeline_init(64);
+    DEFER(timeline_close());
+
+    timeline_zone_begin("frame");
+    timeline_mark("quote\"back\\slash\tend");
+    timeline_zone_end();
+
+    static char out[4096];
+    int len = timeline_capture(out, sizeof(out));
+    ASSERT(len > 0, "no output from timeline_dump");
+    ASSERT(strncmp(out, "{\"traceEvents\":[\n", 17) == 0, "invalid header:\n%s", out);
+    ASSERT(len >= 4 && strcmp(out+len-4, "\n]}\n") == 0, "invalid footer:\n%s", out);
+    timeline_check_json(ctx, out);
+    if (ctx->result == TEST_FAILED) return;
+
+    // One named track per processor
+    static const char *tracks[] = { "CPU", "RSP", "RDP", "VI" };
+    for (int i=0; i<4; i++) {
+        char meta[128];
+        sprintf(meta, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"args\":{\"name\":\"%s\"}}", i, tracks[i]);
+        ASSERT(strstr(out, meta), "missing track %s:\n%s", tracks[i], out);
+    }
+
+    // The zone and the marker, in order, with the name escaped
+    const char *b = strstr(out, "{\"name\":\"frame\",\"ph\":\"B\",\"ts\":");
+    const char *m = strstr(out, "{\"name\":\"quote\\\"back\\\\slashend\",\"ph\":\"i\",\"s\":\"t\",\"ts\":");
+    const char *e = strstr(out, "{\"ph\":\"E\",\"ts\":");
+    ASSERT(b, "missing zone begin:\n%s", out);
+    ASSERT(m, "missing marker:\n%s", out);
+    ASSERT(e, "missing zone end:\n%s", out);
+    ASSERT(b < m && m < e, "events out of order:\n%s", out);
+    ASSERT(strstr(b, "\"pid\":0,\"tid\":0}"), "zone not on the CPU track:\n%s", out);
+}
+
+void test_timeline_wrap(TestContext *ctx) {
+    timeline_init(8);
+    DEFER(timeline_close());
+
+    // The beginning of the first zone is overwritten in the ring buffer,
+    // so its end must be omitted from the dump.
+    timeline_zone_begin("lost");
+    for (int i=0; i<10; i++)
+        timeline_mark("tick");
+    timeline_zone_end();
+    timeline_zone_begin("kept");
+    timeline_zone_end();
+
+    static char out[4096];
+    int len = timeline_capture(out, sizeof(out));
+    ASSERT(len > 0, "no output from timeline_dump");
+    timeline_check_json(ctx, out);
+    if (ctx->result == TEST_FAILED) return;
+
+    ASSERT(!strstr(out, "\"lost\""), "overwritten zone was dumped:\n%s", out);
+    ASSERT(strstr(out, "{\"name\":\"kept\",\"ph\":\"B\""), "missing zone begin:\n%s", out);
+    ASSERT_EQUAL_SIGNED(timeline_count(out, "\"ph\":\"B\""), 1, "wrong number of zone begins:\n%s", out);
+    ASSERT_EQUAL_SIGNED(timeline_count(out, "\"ph\":\"E\""), 1, "wrong number of zone ends:\n%s", out);
+    ASSERT(timeline_count(out, "{\"name\":\"tick\"") <= 6, "too many markers:\n%s", out);
+
+    // After a reset, nothing but the track names is dumped
+    timeline_reset();
+    len = timeline_capture(out, sizeof(out));
+    ASSERT(len > 0, "no output from timeline_dump");
+    ASSERT(!strstr(out, "\"tick\""), "events dumped after reset:\n%s", out);
+}
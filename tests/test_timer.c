@@ -360,3 +360,84 @@ void test_timer_continuous_short(TestContext *ctx) {
 		ASSERT_EQUAL_SIGNED(cb_called, 50, "invalid number of calls to timer callback");
 	}
 }
+
+void test_timer_many(TestContext *ctx) {
+	timer_init();
+	DEFER(timer_close());
+
+	// Start many one-shot timers in scrambled order, and check that they
+	// fire sorted by deadline. Also stop some of them before they fire.
+	#define NUM_TIMERS 64
+	timer_link_t *timers[NUM_TIMERS];
+	volatile uint8_t called_list[NUM_TIMERS];
+	volatile int called_idx = 0;
+
+	void cb(int ovfl, void *ctx) {
+		called_list[called_idx++] = (uint32_t)ctx;
+	}
+
+	disable_interrupts();
+	for (int i=0; i<NUM_TIMERS; i++) {
+		int idx = (i * 37) % NUM_TIMERS;
+		timers[idx] = new_timer_context(TICKS_FROM_US(500 + idx*50), TF_ONE_SHOT, cb, (void*)idx);
+	}
+	for (int i=1; i<NUM_TIMERS; i+=4)
+		stop_timer(timers[i]);
+	enable_interrupts();
+
+	wait_ms(10);
+
+	for (int i=0; i<NUM_TIMERS; i++)
+		delete_timer(timers[i]);
+
+	ASSERT_EQUAL_SIGNED(called_idx, NUM_TIMERS - NUM_TIMERS/4, "invalid number of timer callbacks");
+	int exp = 0;
+	for (int i=0; i<called_idx; i++, exp++) {
+		if (exp % 4 == 1) exp++;
+		ASSERT_EQUAL_SIGNED(called_list[i], exp, "invalid order of timer callbacks at %d", i);
+	}
+	#undef NUM_TIMERS
+}
+
+void test_timer_long(TestContext *ctx) {
+	timer_init();
+	DEFER(timer_close());
+
+	volatile int called_list[2];
+	volatile int called_idx = 0;
+
+	void cb(int ovfl, void *ctx) {
+		called_list[called_idx++] = (int)ctx;
+	}
+
+	// Simulate long timers by moving the hardware counter forward. Timer A
+	// is set for 20 seconds at t=0. Timer B is set for 20 seconds 10 seconds
+	// before the counter overflows, when A has expired but was not processed
+	// yet. The deadline of B is past the overflow, but B must still be
+	// ordered after A.
+	const uint32_t ten_secs = TICKS_PER_SECOND * 10;
+	disable_interrupts();
+	uint32_t old = write_count(0);
+	timer_link_t *ta = new_timer_context(ten_secs * 2, TF_ONE_SHOT, cb, (void*)0);
+	write_count(0 - ten_secs);
+	timer_link_t *tb = new_timer_context(ten_secs * 2, TF_ONE_SHOT, cb, (void*)1);
+	enable_interrupts();
+	wait_ms(2);
+	int called_a = called_idx;
+
+	// Move to right before the deadline of B.
+	disable_interrupts();
+	write_count(ten_secs - TICKS_FROM_MS(1));
+	enable_interrupts();
+	wait_ms(3);
+	int called_b = called_idx;
+
+	write_count(old); // restore counter to not mess up with global time accounting
+	delete_timer(ta);
+	delete_timer(tb);
+
+	ASSERT_EQUAL_SIGNED(called_a, 1, "timer B expired too early");
+	ASSERT_EQUAL_SIGNED(called_list[0], 0, "timer A did not expire first");
+	ASSERT_EQUAL_SIGNED(called_b, 2, "timer B did not expire");
+	ASSERT_EQUAL_SIGNED(called_list[1], 1, "timer B did not expire");
+}
@@ -0,0 +1,310 @@
+#include "../src/audio/wav64internal.h"
+#include <sys/stat.h>
+#include "system.h"
+
+// Play a waveform on channel 0 at the output sample rate (one sample per
+// output sample), and return the mixed output (left channel only).
+static void wav64_test_poll(int16_t *out, int nsamples, int chunk)
+{
+	int16_t *buf = malloc_uncached(chunk*2*sizeof(int16_t));
+	for (int i=0; i<nsamples; i+=chunk) {
+		int n = nsamples-i < chunk ? nsamples-i : chunk;
+		mixer_poll(buf, n);
+		for (int j=0; j<n; j++)
+			out[i+j] = buf[j*2];
+	}
+	free_uncached(buf);
+}
+
+void test_wav64_vadpcm_loop(TestContext *ctx) {
+	audio_init(32000, 4);
+	DEFER(audio_close());
+	mixer_init(1);
+	DEFER(mixer_close());
+
+	wav64_t wav;
+	wav64_open(&wav, "rom:/vadpcm_loop.wav64");
+	DEFER(wav64_close(&wav));
+	ASSERT_EQUAL_SIGNED(wav.format, WAV64_FORMAT_VADPCM, "invalid format");
+
+	int len = wav.wave.len;
+	int loop_len = wav.wave.loop_len;
+	int loop_start = len - loop_len;
+	ASSERT(loop_start % 32 != 0, "loop point must not be aligned for this test (%d)", loop_start);
+
+	// Use a sample buffer smaller than the loop, so that the mixer
+	// must unroll the loop in the sample buffer.
+	const int buf_size = 1024;
+	ASSERT(loop_len > buf_size/2, "loop is too short for this test (%d)", loop_len);
+	mixer_ch_set_limits(0, 16, audio_get_frequency(), buf_size);
+	wav64_play(&wav, 0);
+	mixer_ch_set_freq(0, audio_get_frequency());
+
+	const int nsamples = loop_start + loop_len*4;
+	int16_t *out = malloc(nsamples * sizeof(int16_t));
+	DEFER(free(out));
+	wav64_test_poll(out, nsamples, 128);
+
+	int energy = 0;
+	for (int i=loop_start; i<len; i++)
+		energy |= out[i];
+	ASSERT(energy != 0, "waveform was not played");
+
+	// Every repetition of the loop must be identical to the first one,
+	// including the samples right after the loop point.
+	for (int i=len; i<nsamples; i++) {
+		int j = loop_start + (i - len) % loop_len;
+		ASSERT_EQUAL_SIGNED(out[i], out[j], "loop mismatch at sample %d (repetition %d)", i, (i - loop_start) / loop_len);
+	}
+}
+
+void test_wav64_vadpcm_seek(TestContext *ctx) {
+	audio_init(32000, 4);
+	DEFER(audio_close());
+	mixer_init(1);
+	DEFER(mixer_close());
+
+	wav64_t wav;
+	wav64_open(&wav, "rom:/vadpcm.wav64");
+	DEFER(wav64_close(&wav));
+	wav64_header_vadpcm_t *vhead = wav.ext;
+	ASSERT(vhead->seek_interval > 0, "missing seek table");
+
+	// Decode most of the waveform linearly, as reference. Stop before the
+	// end, so that the channel keeps playing (and the volume ramp of a new
+	// playback does not affect the comparison).
+	const int ref_len = 44*128;
+	ASSERT(ref_len < wav.wave.len, "waveform is too short for this test");
+	int16_t *ref = malloc(ref_len * sizeof(int16_t));
+	DEFER(free(ref));
+	wav64_play(&wav, 0);
+	mixer_ch_set_freq(0, audio_get_frequency());
+	wav64_test_poll(ref, ref_len, 128);
+
+	// Seek to positions far from the start (so that the seek table must be
+	// used), both aligned and misaligned to frames: the decoded samples
+	// must match the reference exactly.
+	const int positions[] = { 2048, 3000+5, 4096+16+7, 5000+31 };
+	int16_t out[256];
+	for (int i=0; i<sizeof(positions)/sizeof(positions[0]); i++) {
+		int pos = positions[i];
+		mixer_ch_set_pos(0, pos);
+		wav64_test_poll(out, 256, 128);
+		for (int j=0; j<256; j++)
+			ASSERT_EQUAL_SIGNED(out[j], ref[pos+j], "seek mismatch at sample %d (seek: %d)", pos+j, pos);
+	}
+}
+
+void test_wav64_vadpcm_pipeline(TestContext *ctx) {
+	audio_init(32000, 4);
+	DEFER(audio_close());
+	// The mixer registers the RSP overlay used for VADPCM decoding
+	mixer_init(1);
+	DEFER(mixer_close());
+
+	wav64_t wav;
+	wav64_open(&wav, "rom:/vadpcm.wav64");
+	DEFER(wav64_close(&wav));
+	int len = wav.wave.len;
+	ASSERT(len > 256*16, "waveform is too short for this test (%d)", len);
+
+	// Decode the whole waveform with a single read. This spans more than one
+	// block of 256 frames, so the RSP decodes a block while the compressed
+	// data of the next one is being fetched.
+	samplebuffer_t big;
+	int big_size = (len + 64) * 2;
+	void *big_mem = malloc_uncached(big_size);
+	DEFER(free_uncached(big_mem));
+	samplebuffer_init(&big, big_mem, big_size);
+	samplebuffer_set_bps(&big, 16);
+	samplebuffer_set_waveform(&big, wav.wave.read, wav.wave.ctx);
+	int wlen = len;
+	int16_t *all = samplebuffer_get(&big, 0, &wlen);
+	rspq_highpri_sync();
+	ASSERT_EQUAL_SIGNED(wlen, len, "not all samples were decoded");
+
+	// Decode it again 32 samples at a time: each read is a single block.
+	samplebuffer_t small;
+	void *small_mem = malloc_uncached(512);
+	DEFER(free_uncached(small_mem));
+	samplebuffer_init(&small, small_mem, 512);
+	samplebuffer_set_bps(&small, 16);
+	samplebuffer_set_waveform(&small, wav.wave.read, wav.wave.ctx);
+	for (int pos=0; pos<len; pos+=32) {
+		int n = 32;
+		int16_t *ptr = samplebuffer_get(&small, pos, &n);
+		rspq_highpri_sync();
+		ASSERT_EQUAL_SIGNED(n, 32, "not all samples were decoded at %d", pos);
+		for (int i=0; i<n && pos+i<len; i++)
+			ASSERT_EQUAL_SIGNED(ptr[i], all[pos+i], "pipelined decoding mismatch at sample %d", pos+i);
+	}
+}
+
+// A minimal filesystem serving a single file from RAM, to test streaming
+// waveforms through stdio (as done for filesystems other than DFS).
+static struct {
+	const uint8_t *data;
+	int size;
+	int reads;          // Number of calls to the read hook
+} wav64_test_memfs;
+
+static void *wav64_test_memfs_open(char *name, int flags)
+{
+	int *pos = malloc(sizeof(int));
+	*pos = 0;
+	return pos;
+}
+
+static int wav64_test_memfs_fstat(void *file, struct stat *st)
+{
+	memset(st, 0, sizeof(*st));
+	st->st_mode = S_IFREG;
+	st->st_size = wav64_test_memfs.size;
+	return 0;
+}
+
+static int wav64_test_memfs_lseek(void *file, int ptr, int dir)
+{
+	int *pos = file;
+	if (dir == SEEK_SET) *pos = ptr;
+	else if (dir == SEEK_CUR) *pos += ptr;
+	else if (dir == SEEK_END) *pos = wav64_test_memfs.size + ptr;
+	return *pos;
+}
+
+static int wav64_test_memfs_read(void *file, uint8_t *ptr, int len)
+{
+	int *pos = file;
+	int n = wav64_test_memfs.size - *pos;
+	if (n > len) n = len;
+	if (n < 0) n = 0;
+	memcpy(ptr, wav64_test_memfs.data + *pos, n);
+	*pos += n;
+	wav64_test_memfs.reads++;
+	return n;
+}
+
+static int wav64_test_memfs_close(void *file)
+{
+	free(file);
+	return 0;
+}
+
+static filesystem_t wav64_test_memfs_fs = {
+	.open = wav64_test_memfs_open,
+	.fstat = wav64_test_memfs_fstat,
+	.lseek = wav64_test_memfs_lseek,
+	.read = wav64_test_memfs_read,
+	.close = wav64_test_memfs_close,
+};
+
+// Decode a waveform linearly and then after a seek, with a fresh mixer so
+// that the output does not depend on previous playbacks.
+static void wav64_test_decode(wav64_t *wav, int16_t *out, int len, int seek)
+{
+	mixer_init(1);
+	wav64_play(wav, 0);
+	mixer_ch_set_freq(0, audio_get_frequency());
+	wav64_test_poll(out, len, 128);
+	mixer_ch_set_pos(0, seek);
+	wav64_test_poll(out+len, 256, 128);
+	mixer_ch_stop(0);
+	mixer_close();
+}
+
+void test_wav64_backends(TestContext *ctx) {
+	audio_init(32000, 4);
+	DEFER(audio_close());
+
+	int size;
+	void *data = asset_load("rom:/vadpcm.wav64", &size);
+	DEFER(free(data));
+	wav64_test_memfs.data = data;
+	wav64_test_memfs.size = size;
+	attach_filesystem("mem:/", &wav64_test_memfs_fs);
+	DEFER(detach_filesystem("mem:/"));
+
+	// Decode the waveform from ROM (via PI DMA) as reference, then from
+	// stdio and from RAM: the output must be identical.
+	const int len = 22*256, seek = 3000+5;
+	const char *backends[] = { "ROM", "stdio", "RAM" };
+	int16_t *mem = malloc(3 * (len+256) * sizeof(int16_t));
+	DEFER(free(mem));
+	int16_t *out[3] = { mem, mem + (len+256), mem + 2*(len+256) };
+
+	for (int i=0; i<3; i++) {
+		wav64_t wav;
+		if (i == 0) wav64_open(&wav, "rom:/vadpcm.wav64");
+		else if (i == 1) wav64_open(&wav, "mem:/vadpcm.wav64");
+		else wav64_open_buf(&wav, data, size);
+		ASSERT(wav.wave.len > len, "waveform is too short for this test");
+		wav64_test_decode(&wav, out[i], len, seek);
+		wav64_close(&wav);
+	}
+
+	for (int i=1; i<3; i++) {
+		for (int j=0; j<len+256; j++) {
+			int pos = j < len ? j : seek + j - len;
+			ASSERT_EQUAL_SIGNED(out[i][j], out[0][j], "%s: mismatch at sample %d%s", backends[i], pos, j < len ? "" : " (after seek)");
+		}
+	}
+}
+
+// Read a stream from several sequential readers at once, with small reads
+// interleaved between them (like the channels of a module), and check the
+// data, including the zero-filled part past the end.
+enum { READERS = 4, CHUNK = 37, LEN = 1500 };
+
+static void wav64_test_check_stream(TestContext *ctx, wav64_stream_t *st, const uint8_t *data, int size)
+{
+	int offset[READERS];
+	for (int r=0; r<READERS; r++)
+		offset[r] = r * (size / READERS) + r*3;
+	// The last reader crosses the end of the data
+	offset[READERS-1] = size - LEN/2;
+
+	uint8_t buf[CHUNK];
+	for (int i=0; i<LEN; i+=CHUNK) {
+		for (int r=0; r<READERS; r++) {
+			wav64_stream_read(st, buf, offset[r], CHUNK);
+			for (int j=0; j<CHUNK; j++) {
+				int expected = offset[r]+j < size ? data[offset[r]+j] : 0;
+				ASSERT_EQUAL_SIGNED(buf[j], expected, "mismatch at offset %d (reader %d)", offset[r]+j, r);
+			}
+			offset[r] += CHUNK;
+		}
+	}
+}
+
+void test_wav64_stream(TestContext *ctx) {
+	int size;
+	uint8_t *data = asset_load("rom:/random.dat", &size);
+	DEFER(free(data));
+	ASSERT(size >= READERS*LEN, "file is too short for this test (%d)", size);
+	wav64_test_memfs.data = data;
+	wav64_test_memfs.size = size;
+	attach_filesystem("mem:/", &wav64_test_memfs_fs);
+	DEFER(detach_filesystem("mem:/"));
+
+	wav64_stream_t *st = wav64_stream_open_buf(data, size);
+	wav64_test_check_stream(ctx, st, data, size);
+	wav64_stream_close(st);
+	if (ctx->result == TEST_FAILED) return;
+
+	// With one read-ahead buffer per reader, each buffer is refilled only
+	// when its reader has consumed it (allow for the alignment of the first
+	// refill, and for stdio splitting or buffering the reads).
+	st = wav64_stream_open("mem:/random.dat");
+	wav64_stream_set_readahead(st, 512, READERS);
+	wav64_test_memfs.reads = 0;
+	wav64_test_check_stream(ctx, st, data, size);
+	wav64_stream_close(st);
+	if (ctx->result == TEST_FAILED) return;
+	ASSERT(wav64_test_memfs.reads <= 2 * READERS * (LEN/512 + 2), "too many filesystem reads: %d", wav64_test_memfs.reads);
+
+	// Without read-ahead, each read goes to the filesystem
+	st = wav64_stream_open("mem:/random.dat");
+	wav64_stream_set_readahead(st, 0, 0);
+	wav64_test_check_stream(ctx, st, data, size);
+	wav64_stream_close(st);
+}
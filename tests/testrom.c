@@ -195,6 +195,7 @@ int assert_equal_mem(TestContext *ctx, const char *file, int line, const uint8_t
 
 #include "test_dfs.c"
 #include "test_eepromfs.c"
+#include "test_asset.c"
 #include "test_cache.c"
 #include "test_ticks.c"
 #include "test_timer.c"
@@ -205,12 +206,15 @@ int assert_equal_mem(TestContext *ctx, const char *file, int line, const uint8_t
 #include "test_cop1.c"
 #include "test_constructors.c"
 #include "test_backtrace.c"
+#include "test_timeline.c"
 #include "test_rspq.c"
 #include "test_rdpq.c"
 #include "test_rdpq_tri.c"
 #include "test_rdpq_tex.c"
 #include "test_rdpq_attach.c"
 #include "test_rdpq_sprite.c"
+#include "test_wav64.c"
+#include "test_mixer.c"
 
 /**********************************************************************
  * MAIN
@@ -244,10 +248,29 @@ static const struct Testsuite
 	TEST_FUNC(test_timer_context,            186, TEST_FLAGS_RESET_COUNT),
 	TEST_FUNC(test_timer_disabled_start,     733, TEST_FLAGS_RESET_COUNT),
 	TEST_FUNC(test_timer_disabled_restart,   733, TEST_FLAGS_RESET_COUNT),
+	TEST_FUNC(test_timer_many,                10, TEST_FLAGS_RESET_COUNT),
+	TEST_FUNC(test_timer_long,                 5, TEST_FLAGS_RESET_COUNT),
 	TEST_FUNC(test_irq_reentrancy,           230, TEST_FLAGS_RESET_COUNT),
+	TEST_FUNC(test_timeline_dump,              0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_timeline_wrap,              0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_dfs_read,                 948, TEST_FLAGS_IO),
 	TEST_FUNC(test_dfs_rom_addr,              25, TEST_FLAGS_IO),
+	TEST_FUNC(test_dfs_path_lookup,            0, TEST_FLAGS_IO),
+	TEST_FUNC(test_dfs_read_async,             0, TEST_FLAGS_IO),
 	TEST_FUNC(test_eepromfs,                   0, TEST_FLAGS_IO),
+	TEST_FUNC(test_asset_fopen_chunked,        0, TEST_FLAGS_IO),
+	TEST_FUNC(test_asset_parallel,             0, TEST_FLAGS_IO),
+	TEST_FUNC(test_wav64_vadpcm_loop,          0, TEST_FLAGS_IO),
+	TEST_FUNC(test_wav64_vadpcm_seek,          0, TEST_FLAGS_IO),
+	TEST_FUNC(test_wav64_vadpcm_pipeline,      0, TEST_FLAGS_IO),
+	TEST_FUNC(test_wav64_backends,             0, TEST_FLAGS_IO),
+	TEST_FUNC(test_wav64_stream,               0, TEST_FLAGS_IO),
+	TEST_FUNC(test_mixer_voices_steal,         0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_mixer_voices_handles,       0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_mixer_filter,               0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_mixer_reverb,               0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_mixer_events_order,         0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_mixer_events_remove,        0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_cache_invalidate,        1763, TEST_FLAGS_NONE),
 	TEST_FUNC(test_debug_sdfs,                 0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_dma_read_misalign,      18591, TEST_FLAGS_NONE),
@@ -266,16 +289,20 @@ static const struct Testsuite
 	TEST_FUNC(test_rspq_high_load,             0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rspq_load_overlay,          0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rspq_switch_overlay,        0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rspq_current_ovl,           0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rspq_profile,               0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rspq_multiple_flush,        0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rspq_wait,                  0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rspq_rapid_sync,            0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rspq_flush,                 0, TEST_FLAGS_NO_BENCHMARK | TEST_FLAGS_NO_EMULATOR),
 	TEST_FUNC(test_rspq_rapid_flush,           0, TEST_FLAGS_NO_BENCHMARK | TEST_FLAGS_NO_EMULATOR),
 	TEST_FUNC(test_rspq_block,                 0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rspq_block_suspend,         0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rspq_wait_sync_in_block,    0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rspq_highpri_basic,         0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rspq_highpri_multiple,      0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rspq_highpri_overlay,       0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rspq_highpri_block,         0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rspq_big_command,           0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rspq_rdp_dynamic,           0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rspq_rdp_dynamic_switch,    0, TEST_FLAGS_NO_BENCHMARK),
@@ -285,6 +312,8 @@ static const struct Testsuite
 	TEST_FUNC(test_rdpq_passthrough_big,       0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_block,                 0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_block_coalescing,      0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rdpq_block_redundant,       0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rdpq_block_redundant_bypass, 0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_block_contiguous,      0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_block_dynamic,         0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_change_other_modes,    0, TEST_FLAGS_NO_BENCHMARK),
@@ -311,14 +340,17 @@ static const struct Testsuite
 	TEST_FUNC(test_rdpq_texrect_passthrough,   0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_triangle,              0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_triangle_w1,           0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rdpq_triangle_indexed,      0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_attach_clear,             0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_attach_stack,             0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_tex_upload,            0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_tex_upload_multi,      0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rdpq_tex_cache,             0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_tex_blit_normal,       0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_tex_multi_i4,          0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_sprite_upload,         0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_sprite_lod,            0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rdpq_sprite_batch,          0, TEST_FLAGS_NO_BENCHMARK),
 };
 
 int main() {
@@ -0,0 +1,493 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "../common/binout.c"
+#include "../common/assetcomp.h"
+
+#include "../../src/asset_internal.h"
+#include "../../src/compress/lz4_dec_internal.h"
+#include "../../src/compress/aplib_dec_internal.h"
+#include "../../src/compress/shrinkler_dec_internal.h"
+
+// LZH5 is not an asset compression level, but it is used by ym64.
+// Like audioconv64, include both the compressor and the decompressor.
+#define memalign(a, b) malloc(b)
+#define assertf(x, ...) assert(x)
+#include "../../src/compress/lzh5_internal.h"
+#include "../../src/compress/lzh5.c"
+#include "../common/lzh5_compress.h"
+#include "../common/lzh5_compress.c"
+
+// Reference C decoder for shrinkler (part of shrinkler_dec.c)
+int shr_unpack(uint8_t *dst, uint8_t *src);
+
+bool flag_verbose = false;
+bool flag_csv = false;
+int flag_winsize = 0;
+int flag_read_size = 4096;
+double flag_min_time = 0.2;
+
+typedef struct {
+    const char *name;       // Name of the algorithm
+    int level;              // Asset compression level (0 = LZH5)
+    bool enabled;           // Selected on the command line
+} codec_t;
+
+static codec_t codecs[] = {
+    { "lz4",       1, true },
+    { "aplib",     2, true },
+    { "shrinkler", 3, true },
+    { "lzh5",      0, true },
+};
+#define NUM_CODECS   (sizeof(codecs) / sizeof(codecs[0]))
+
+typedef struct {
+    int nfiles;             // Number of files benchmarked
+    uint64_t size;          // Total decompressed size
+    uint64_t cmp_size;      // Total compressed size
+    int max_margin;         // Maximum inplace margin
+    double full_time;       // Total time spent in full decompression
+    double stream_time;     // Total time spent in streaming decompression
+    int full_mem;           // Peak memory for full decompression (asset_load)
+    int stream_mem;         // Peak memory for streaming decompression (asset_fopen)
+} stats_t;
+
+static stats_t stats[NUM_CODECS];
+
+// Compressed version of a file, ready to be benchmarked
+typedef struct {
+    codec_t *codec;         // Algorithm used
+    const uint8_t *data;    // Original data
+    int size;               // Original size
+    uint8_t *cmp;           // Compressed data
+    int cmp_size;           // Compressed size
+    int winsize;            // Window size used by the compressor
+    int margin;             // Inplace decompression margin
+    FILE *f;                // Temporary file with the compressed data
+} bench_t;
+
+void print_args(char * name)
+{
+    fprintf(stderr, "%s -- Libdragon asset decompression benchmark\n\n", name);
+    fprintf(stderr, "This tool compresses each input file with all the supported algorithms, and then\n");
+    fprintf(stderr, "measures the host C decompressors in both full (asset_load) and streaming\n");
+    fprintf(stderr, "(asset_fopen) mode. Every decompression is also checked against the original.\n\n");
+    fprintf(stderr, "Usage: %s [flags] <input files or directories...>\n", name);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Command-line flags:\n");
+    fprintf(stderr, "   -v/--verbose            Print results for each file\n");
+    fprintf(stderr, "   -c/--compress <list>    Comma-separated algorithms to benchmark: 1,2,3,lzh5 (default: all)\n");
+    fprintf(stderr, "   -w/--winsize <window>   Size of the matching window in KiB (default: compressor default)\n");
+    fprintf(stderr, "   -r/--read-size <bytes>  Size of each read in streaming mode (default: %d)\n", flag_read_size);
+    fprintf(stderr, "   -t/--time <ms>          Minimum time spent on each measurement (default: %d)\n", (int)(flag_min_time*1000));
+    fprintf(stderr, "   --csv                   Print results for each file in CSV format\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Speeds are measured on the host, so they are only meaningful to compare algorithms\n");
+    fprintf(stderr, "with each other. Memory is the peak memory required on N64: decompressed size plus\n");
+    fprintf(stderr, "inplace margin for asset_load(), decoder state plus window for asset_fopen().\n");
+    fprintf(stderr, "\n");
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static bool isdir(const char *path)
+{
+    struct stat st;
+    return stat(path, &st) == 0 && (st.st_mode & S_IFDIR) != 0;
+}
+
+static bool compress_lzh5(bench_t *b)
+{
+    FILE *in = tmpfile();
+    FILE *out = tmpfile();
+    if (!in || !out) {
+        fprintf(stderr, "cannot create temporary file\n");
+        if (in) fclose(in);
+        if (out) fclose(out);
+        return false;
+    }
+    fwrite(b->data, 1, b->size, in);
+    rewind(in);
+
+    unsigned int crc, csize, dsize;
+    lzh5_init(LZHUFF5_METHOD_NUM);
+    lzh5_encode(in, out, &crc, &csize, &dsize);
+    fclose(in);
+
+    b->cmp_size = csize;
+    b->cmp = malloc(csize);
+    rewind(out);
+    fread(b->cmp, 1, csize, out);
+    fclose(out);
+
+    b->winsize = DECOMPRESS_LZH5_DEFAULT_WINDOW_SIZE;
+    b->margin = 0;
+    return true;
+}
+
+static bool compress(bench_t *b)
+{
+    if (b->codec->level == 0) {
+        if (!compress_lzh5(b))
+            return false;
+    } else {
+        b->winsize = flag_winsize;
+        asset_compress_mem(b->codec->level, b->data, b->size, &b->cmp, &b->cmp_size, &b->winsize, &b->margin);
+    }
+
+    // Decompressors that work through FILE* read from a temporary file,
+    // which will be cached in memory by the OS.
+    b->f = tmpfile();
+    if (!b->f) {
+        fprintf(stderr, "cannot create temporary file\n");
+        return false;
+    }
+    fwrite(b->cmp, 1, b->cmp_size, b->f);
+    return true;
+}
+
+// Decompress the whole file like asset_load() does. Where the host has a C
+// decoder that can work inplace, use it so that the margin is also verified.
+static uint8_t* decompress_full(bench_t *b)
+{
+    rewind(b->f);
+    switch (b->codec->level) {
+    case 1: case 3: {
+        int bufsize = b->size + b->margin;
+        int cmp_offset = bufsize - b->cmp_size;
+        uint8_t *buf = malloc(bufsize);
+        memcpy(buf + cmp_offset, b->cmp, b->cmp_size);
+        int n;
+        if (b->codec->level == 1)
+            n = decompress_lz4_full_inplace(buf + cmp_offset, b->cmp_size, buf, b->size);
+        else
+            n = shr_unpack(buf, buf + cmp_offset);
+        if (n != b->size) {
+            free(buf);
+            return NULL;
+        }
+        return buf;
+    }
+    case 2:
+        return decompress_aplib_full("", b->f, b->cmp_size, b->size);
+    default:
+        return decompress_lzh5_full("", b->f, b->cmp_size, b->size);
+    }
+}
+
+// Decompress the whole file like a sequence of fread() on asset_fopen() does.
+static bool decompress_stream(bench_t *b, void *state, uint8_t *out)
+{
+    rewind(b->f);
+    switch (b->codec->level) {
+    case 1:  decompress_lz4_init(state, b->f, b->winsize); break;
+    case 2:  decompress_aplib_init(state, b->f, b->winsize); break;
+    default: decompress_lzh5_init(state, b->f, b->winsize); break;
+    }
+
+    int pos = 0;
+    while (pos < b->size) {
+        int len = b->size - pos < flag_read_size ? b->size - pos : flag_read_size;
+        ssize_t n;
+        switch (b->codec->level) {
+        case 1:  n = decompress_lz4_read(state, out + pos, len); break;
+        case 2:  n = decompress_aplib_read(state, out + pos, len); break;
+        default: n = decompress_lzh5_read(state, out + pos, len); break;
+        }
+        if (n <= 0)
+            return false;
+        pos += n;
+    }
+    return true;
+}
+
+static int stream_state_size(codec_t *codec)
+{
+    switch (codec->level) {
+    case 1:  return DECOMPRESS_LZ4_STATE_SIZE;
+    case 2:  return DECOMPRESS_APLIB_STATE_SIZE;
+    case 3:  return 0; // not supported
+    default: return DECOMPRESS_LZH5_STATE_SIZE;
+    }
+}
+
+static double mbps(uint64_t bytes, double time)
+{
+    return time > 0 ? bytes / time / (1024*1024) : 0;
+}
+
+static bool bench_file(const char *fn, const uint8_t *data, int size, codec_t *codec, stats_t *st)
+{
+    bench_t b = { .codec = codec, .data = data, .size = size };
+    bool ok = false;
+
+    if (!compress(&b))
+        goto end;
+
+    // Full decompression: verify once, then run it until the minimum time
+    // has elapsed.
+    uint8_t *out = decompress_full(&b);
+    if (!out || memcmp(out, data, size) != 0) {
+        fprintf(stderr, "%s: %s: full decompression mismatch\n", fn, codec->name);
+        free(out);
+        goto end;
+    }
+    free(out);
+
+    int full_iters = 0;
+    double t0 = now(), full_time;
+    do {
+        free(decompress_full(&b));
+        full_iters++;
+    } while ((full_time = now() - t0) < flag_min_time);
+    full_time /= full_iters;
+
+    // Streaming decompression
+    int state_size = stream_state_size(codec);
+    double stream_time = 0;
+    if (state_size) {
+        void *state = malloc(state_size + b.winsize);
+        out = malloc(size);
+        if (!decompress_stream(&b, state, out) || memcmp(out, data, size) != 0) {
+            fprintf(stderr, "%s: %s: streaming decompression mismatch\n", fn, codec->name);
+            free(state); free(out);
+            goto end;
+        }
+
+        int stream_iters = 0;
+        t0 = now();
+        do {
+            decompress_stream(&b, state, out);
+            stream_iters++;
+        } while ((stream_time = now() - t0) < flag_min_time);
+        stream_time /= stream_iters;
+        free(state); free(out);
+    }
+
+    int full_mem = size + b.margin;
+    int stream_mem = state_size ? state_size + b.winsize : 0;
+
+    st->nfiles++;
+    st->size += size;
+    st->cmp_size += b.cmp_size;
+    st->full_time += full_time;
+    st->stream_time += stream_time;
+    if (b.margin > st->max_margin) st->max_margin = b.margin;
+    if (full_mem > st->full_mem) st->full_mem = full_mem;
+    if (stream_mem > st->stream_mem) st->stream_mem = stream_mem;
+
+    if (flag_csv) {
+        printf("%s,%s,%d,%d,%d,%d,%.2f,%d,%.2f,%d\n", fn, codec->name, size, b.cmp_size,
+            b.margin, b.winsize, mbps(size, full_time), full_mem,
+            state_size ? mbps(size, stream_time) : 0, stream_mem);
+    } else if (flag_verbose) {
+        printf("%-40s %-10s %9d %9d %6.1f%% %7d %9.1f", fn, codec->name, size, b.cmp_size,
+            100.0 * b.cmp_size / size, b.margin, mbps(size, full_time));
+        if (state_size)
+            printf(" %9.1f %9d\n", mbps(size, stream_time), stream_mem);
+        else
+            printf(" %9s %9s\n", "-", "-");
+    }
+    ok = true;
+
+end:
+    if (b.f) fclose(b.f);
+    free(b.cmp);
+    return ok;
+}
+
+static bool bench_path(const char *path)
+{
+    if (isdir(path)) {
+        DIR *d = opendir(path);
+        if (!d) {
+            fprintf(stderr, "error opening directory: %s\n", path);
+            return false;
+        }
+        bool ok = true;
+        struct dirent *de;
+        while ((de = readdir(d))) {
+            if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+                continue;
+            char *sub;
+            asprintf(&sub, "%s/%s", path, de->d_name);
+            ok = bench_path(sub) && ok;
+            free(sub);
+        }
+        closedir(d);
+        return ok;
+    }
+
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "error opening file: %s\n", path);
+        return false;
+    }
+    fseek(f, 0, SEEK_END);
+    int size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *data = malloc(size);
+    if (fread(data, 1, size, f) != size) {
+        fprintf(stderr, "error reading file: %s\n", path);
+        fclose(f); free(data);
+        return false;
+    }
+    fclose(f);
+
+    // Empty files are not interesting, and some compressors reject them.
+    bool ok = true;
+    if (size > 0) {
+        for (int i = 0; i < NUM_CODECS; i++)
+            if (codecs[i].enabled)
+                ok = bench_file(path, data, size, &codecs[i], &stats[i]) && ok;
+    }
+    free(data);
+    return ok;
+}
+
+static bool parse_codecs(const char *list)
+{
+    for (int i = 0; i < NUM_CODECS; i++)
+        codecs[i].enabled = false;
+
+    char *s = strdup(list);
+    bool ok = true;
+    for (char *tok = strtok(s, ","); tok; tok = strtok(NULL, ",")) {
+        bool found = false;
+        for (int i = 0; i < NUM_CODECS; i++) {
+            char level[4];
+            snprintf(level, sizeof(level), "%d", codecs[i].level);
+            if (!strcmp(tok, codecs[i].name) || (codecs[i].level && !strcmp(tok, level))) {
+                codecs[i].enabled = found = true;
+                break;
+            }
+        }
+        if (!found) {
+            fprintf(stderr, "invalid compression algorithm: %s\n", tok);
+            ok = false;
+        }
+    }
+    free(s);
+    return ok;
+}
+
+static void print_summary(void)
+{
+    printf("%-10s %6s %11s %11s %7s %7s %9s %9s %9s %9s\n",
+        "algo", "files", "size", "cmp_size", "ratio", "margin",
+        "full MB/s", "full mem", "strm MB/s", "strm mem");
+    for (int i = 0; i < NUM_CODECS; i++) {
+        stats_t *st = &stats[i];
+        if (!codecs[i].enabled || !st->nfiles)
+            continue;
+        printf("%-10s %6d %11llu %11llu %6.1f%% %7d %9.1f %9d", codecs[i].name, st->nfiles,
+            (unsigned long long)st->size, (unsigned long long)st->cmp_size,
+            100.0 * st->cmp_size / st->size, st->max_margin,
+            mbps(st->size, st->full_time), st->full_mem);
+        if (st->stream_mem)
+            printf(" %9.1f %9d\n", mbps(st->size, st->stream_time), st->stream_mem);
+        else
+            printf(" %9s %9s\n", "-", "-");
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        print_args(argv[0]);
+        return 1;
+    }
+
+    const char **paths = malloc(argc * sizeof(char*));
+    int npaths = 0;
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] == '-') {
+            if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
+                print_args(argv[0]);
+                return 0;
+            } else if (!strcmp(argv[i], "-v") || !strcmp(argv[i], "--verbose")) {
+                flag_verbose = true;
+            } else if (!strcmp(argv[i], "--csv")) {
+                flag_csv = true;
+            } else if (!strcmp(argv[i], "-c") || !strcmp(argv[i], "--compress")) {
+                if (++i == argc) {
+                    fprintf(stderr, "missing argument for %s\n", argv[i-1]);
+                    return 1;
+                }
+                if (!parse_codecs(argv[i]))
+                    return 1;
+            } else if (!strcmp(argv[i], "-w") || !strcmp(argv[i], "--winsize")) {
+                if (++i == argc) {
+                    fprintf(stderr, "missing argument for %s\n", argv[i-1]);
+                    return 1;
+                }
+                char extra;
+                if (sscanf(argv[i], "%d%c", &flag_winsize, &extra) != 1) {
+                    fprintf(stderr, "invalid argument for %s: %s\n", argv[i-1], argv[i]);
+                    return 1;
+                }
+                flag_winsize *= 1024;
+                if (asset_winsize_to_flags(flag_winsize) < 0) {
+                    fprintf(stderr, "unsupported window size: %d\n", flag_winsize);
+                    fprintf(stderr, "supported window sizes: 2, 4, 8, 16, 32, 64, 128, 256\n");
+                    return 1;
+                }
+            } else if (!strcmp(argv[i], "-r") || !strcmp(argv[i], "--read-size")) {
+                if (++i == argc) {
+                    fprintf(stderr, "missing argument for %s\n", argv[i-1]);
+                    return 1;
+                }
+                char extra;
+                if (sscanf(argv[i], "%d%c", &flag_read_size, &extra) != 1 || flag_read_size <= 0) {
+                    fprintf(stderr, "invalid argument for %s: %s\n", argv[i-1], argv[i]);
+                    return 1;
+                }
+            } else if (!strcmp(argv[i], "-t") || !strcmp(argv[i], "--time")) {
+                if (++i == argc) {
+                    fprintf(stderr, "missing argument for %s\n", argv[i-1]);
+                    return 1;
+                }
+                char extra; int ms;
+                if (sscanf(argv[i], "%d%c", &ms, &extra) != 1 || ms < 0) {
+                    fprintf(stderr, "invalid argument for %s: %s\n", argv[i-1], argv[i]);
+                    return 1;
+                }
+                flag_min_time = ms / 1000.0;
+            } else {
+                fprintf(stderr, "invalid flag: %s\n", argv[i]);
+                return 1;
+            }
+            continue;
+        }
+        paths[npaths++] = argv[i];
+    }
+
+    if (flag_csv)
+        printf("file,algo,size,cmp_size,margin,winsize,full_mbps,full_mem,stream_mbps,stream_mem\n");
+    else if (flag_verbose)
+        printf("%-40s %-10s %9s %9s %7s %7s %9s %9s %9s\n", "file", "algo", "size", "cmp_size",
+            "ratio", "margin", "full MB/s", "strm MB/s", "strm mem");
+
+    bool ok = true;
+    for (int i = 0; i < npaths; i++)
+        ok = bench_path(paths[i]) && ok;
+    free(paths);
+
+    if (!flag_csv) {
+        if (flag_verbose) printf("\n");
+        print_summary();
+    }
+    return ok ? 0 : 1;
+}
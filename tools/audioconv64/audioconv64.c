@@ -80,8 +80,13 @@ void usage(void) {
 	printf("   --wav-loop <true|false>   Activate playback loop by default\n");
 	printf("   --wav-loop-offset <N>     Set looping offset (in samples; default: 0)\n");
 	printf("\n");
+	printf("XM options:\n");
+	printf("   --xm-compress <0|1>       Enable sample compression: 0=none (default), 1=vadpcm\n");
+	printf("\n");
 	printf("YM options:\n");
 	printf("   --ym-compress <true|false>  Compress output file\n");
+	printf("   --ym-seek-interval <N>      Seek granularity of compressed files, in audio frames\n");
+	printf("                               (default: 1024; 0: not seekable, smaller file)\n");
 	printf("\n");
 }
 
@@ -251,6 +256,16 @@ int main(int argc, char *argv[]) {
 					fprintf(stderr, "invalid argument for --wav-resample: %s\n", argv[i]);
 					return 1;
 				}
+			} else if (!strcmp(argv[i], "--xm-compress")) {
+				if (++i == argc) {
+					fprintf(stderr, "missing argument for --xm-compress\n");
+					return 1;
+				}
+				flag_xm_compress = atoi(argv[i]);
+				if (flag_xm_compress != 0 && flag_xm_compress != 1) {
+					fprintf(stderr, "invalid argument for --xm-compress: %s\n", argv[i]);
+					return 1;
+				}
 			} else if (!strcmp(argv[i], "--ym-compress")) {
 				if (++i == argc) {
 					fprintf(stderr, "missing argument for --ym-compress\n");
@@ -264,6 +279,16 @@ int main(int argc, char *argv[]) {
 					fprintf(stderr, "invalid boolean argument for --ym-compress: %s\n", argv[i]);
 					return 1;
 				}
+			} else if (!strcmp(argv[i], "--ym-seek-interval")) {
+				if (++i == argc) {
+					fprintf(stderr, "missing argument for --ym-seek-interval\n");
+					return 1;
+				}
+				flag_ym_seek_interval = atoi(argv[i]);
+				if (flag_ym_seek_interval < 0 || flag_ym_seek_interval > 65535) {
+					fprintf(stderr, "invalid argument for --ym-seek-interval: %s\n", argv[i]);
+					return 1;
+				}
 			} else {
 				fprintf(stderr, "invalid option: %s\n", argv[i]);
 				return 1;
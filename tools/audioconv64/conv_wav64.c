@@ -8,6 +8,7 @@
 
 #include "vadpcm/vadpcm.h"
 #include "vadpcm/encode.c"
+#include "vadpcm/decode.c"
 #include "vadpcm/error.c"
 
 #include "../common/binout.c"
@@ -33,6 +34,9 @@ int flag_wav_compress = 1;
 int flag_wav_resample = 0;
 bool flag_wav_mono = false;
 
+// Number of VADPCM frames between two entries of the seek table
+#define WAV64_VADPCM_SEEK_INTERVAL   32
+
 typedef struct {
 	int16_t *samples;
 	int channels;
@@ -199,6 +203,26 @@ int wav_convert(const char *infn, const char *outfn) {
 		loop_len -= 1;
 	}
 
+	if (loop_len && flag_wav_compress == 1) {
+		// The loop of VADPCM waveforms must span a multiple of 8 bytes of
+		// decoded samples, so that unrolling it keeps the RSP output aligned.
+		// Repeat the loop as many times as needed (at most 4).
+		int align = wav.channels == 2 ? 2 : 4;
+		int rep = 1;
+		while ((loop_len * rep) % align)
+			rep++;
+		if (rep > 1) {
+			if (flag_verbose)
+				fprintf(stderr, "  repeating loop %d times for alignment\n", rep);
+			wav.samples = realloc(wav.samples, (cnt + loop_len * (rep-1)) * wav.channels * sizeof(int16_t));
+			for (int i=1; i<rep; i++)
+				memcpy(wav.samples + (cnt + loop_len * (i-1)) * wav.channels,
+					wav.samples + (cnt - loop_len) * wav.channels, loop_len * wav.channels * sizeof(int16_t));
+			cnt += loop_len * (rep-1);
+			loop_len *= rep;
+		}
+	}
+
 	FILE *out = fopen(outfn, "wb");
 	if (!out) {
 		fprintf(stderr, "ERROR: %s: cannot create file\n", outfn);
@@ -255,6 +279,7 @@ int wav_convert(const char *infn, const char *outfn) {
 	} break;
 
 	case 1: { // vadpcm
+		int loop_start = cnt - loop_len;
 		if (cnt % kVADPCMFrameSampleCount) {
 			int newcnt = (cnt + kVADPCMFrameSampleCount - 1) / kVADPCMFrameSampleCount * kVADPCMFrameSampleCount;
 			wav.samples = realloc(wav.samples, newcnt * wav.channels * sizeof(int16_t));
@@ -287,13 +312,37 @@ int wav_convert(const char *infn, const char *outfn) {
 			destchan += nframes * kVADPCMFrameByteSize;
 		}
 
+		// Decode the compressed data to calculate the decoder state at
+		// the loop point and at each entry of the seek table. The loop state
+		// refers to the start of the frame containing the loop point: the
+		// player decodes from there the samples of the loop that come before
+		// the first frame it can restart the RSP on.
+		int loop_frame = loop_len ? loop_start / kVADPCMFrameSampleCount : -1;
+		int nseek = (nframes + WAV64_VADPCM_SEEK_INTERVAL - 1) / WAV64_VADPCM_SEEK_INTERVAL;
+		int16_t *seek_table = malloc(nseek * wav.channels * kVADPCMEncodeOrder * sizeof(int16_t));
+		struct vadpcm_vector loop_state[2] = {0};
+		for (int i=0; i<wav.channels; i++) {
+			struct vadpcm_vector state = {0};
+			int16_t pcm[kVADPCMFrameSampleCount];
+			for (int j=0; j<nframes; j++) {
+				if (j % WAV64_VADPCM_SEEK_INTERVAL == 0)
+					for (int k=0; k<kVADPCMEncodeOrder; k++)
+						seek_table[(j / WAV64_VADPCM_SEEK_INTERVAL * wav.channels + i) * kVADPCMEncodeOrder + k] = state.v[8 - kVADPCMEncodeOrder + k];
+				if (j == loop_frame)
+					loop_state[i] = state;
+				vadpcm_decode(kPREDICTORS, kVADPCMEncodeOrder, codebook + kPREDICTORS * kVADPCMEncodeOrder * i,
+					&state, 1, pcm, dest + (i * nframes + j) * kVADPCMFrameByteSize);
+			}
+		}
+
 		struct vadpcm_vector state = {0};
 		w8(out, kPREDICTORS);
 		w8(out, kVADPCMEncodeOrder);
-		w16(out, 0); // padding
+		w16(out, WAV64_VADPCM_SEEK_INTERVAL);
 		w32(out, 0); // padding
-		fwrite(&state, 1, sizeof(struct vadpcm_vector), out);   // TBC: loop_state[0]
-		fwrite(&state, 1, sizeof(struct vadpcm_vector), out);   // TBC: loop_state[1]
+		for (int i=0; i<2; i++)                                 // loop_state
+			for (int j=0; j<8; j++)
+				w16(out, loop_state[i].v[j]);
 		fwrite(&state, 1, sizeof(struct vadpcm_vector), out);   // state
 		fwrite(&state, 1, sizeof(struct vadpcm_vector), out);   // state
 		for (int i=0; i<kPREDICTORS * kVADPCMEncodeOrder * wav.channels; i++)    // codebook
@@ -304,6 +353,10 @@ int wav_convert(const char *infn, const char *outfn) {
 			for (int j=0;j<wav.channels;j++)
 				fwrite(dest + (j * nframes + i) * kVADPCMFrameByteSize, 1, kVADPCMFrameByteSize, out);
 		}
+		walign(out, 2);
+		for (int i=0; i<nseek * wav.channels * kVADPCMEncodeOrder; i++)  // seek table
+			w16(out, seek_table[i]);
+		free(seek_table);
 		free(dest);
 		free(scratch);
 	} break;
@@ -16,6 +16,10 @@
  *    that must contain enough samples for playing one "tick", so the exact
  *    size depends on the playing speed, sample pitch, etc. across the whole
  *    module.
+ *  * Optionally (--xm-compress 1), samples are compressed with VADPCM and
+ *    decompressed at runtime by the RSP, like WAV64 files. Samples for which
+ *    compression does not pay off (eg: very short samples) are kept
+ *    uncompressed.
  */
 
 #include "mixer.h"
@@ -25,11 +29,133 @@
 // information.
 #define XM64_SHORT_ODD_LOOP_LENGTH  1024
 
+// Number of predictors in the codebook of VADPCM-compressed samples
+#define XM64_VADPCM_PREDICTORS      4
+
+#define ALIGN8(n)  ((((n) + 7) >> 3) << 3)
+
+int flag_xm_compress = 0;
+
 // Bring libxm in
 #include "../../src/audio/libxm/play.c"
 #include "../../src/audio/libxm/context.c"
 #include "../../src/audio/libxm/load.c"
 
+static void vadpcm_w16(uint8_t **out, int16_t v) {
+	*(*out)++ = (uint16_t)v >> 8;
+	*(*out)++ = (uint16_t)v & 0xFF;
+}
+
+// Compress a (pre-processed) sample with VADPCM. Returns false if the sample
+// was left uncompressed because compression would not reduce its size.
+static bool xm_compress_sample_vadpcm(xm_context_t *ctx, xm_sample_t *s) {
+	int bps = s->bits / 8;
+	bool loop = s->loop_type != XM_NO_LOOP;
+	int loop_start = s->loop_end - s->loop_length;
+	int length = s->length;
+	int loop_length2 = s->loop_length;
+	if (loop && s->loop_length == 0)
+		return false;
+
+	if (loop) {
+		// The player restarts decoding the loop from the state at the frame
+		// containing the loop start (see loop_state below), so the loop can
+		// start anywhere. Unrolling it in the sample buffer must however keep
+		// the RSP output 8-byte aligned, so repeat the loop as many times as
+		// necessary (at most 4) to make its length a multiple of 4 samples.
+		while (loop_length2 % 4)
+			loop_length2 += s->loop_length;
+		length = loop_start + loop_length2;
+	}
+
+	int nsamples = (length + 31) / 32 * 32 + 32;
+	int nframes = nsamples / kVADPCMFrameSampleCount;
+	int nseek = (nframes + WAV64_VADPCM_SEEK_INTERVAL - 1) / WAV64_VADPCM_SEEK_INTERVAL;
+	int codebook_size = XM64_VADPCM_PREDICTORS * kVADPCMEncodeOrder * 16;
+	int vsize = XM_VADPCM_HEADER_SIZE + codebook_size + nframes * kVADPCMFrameByteSize +
+		nseek * kVADPCMEncodeOrder * 2;
+	if (vsize >= s->length * bps + XM_WAVEFORM_OVERREAD)
+		return false;
+
+	// Expand the sample to 16-bit, unrolling the loop as required.
+	int16_t *pcm = calloc(nsamples, sizeof(int16_t));
+	for (int i=0; i<nsamples; i++) {
+		int k = i;
+		if (k >= s->length) {
+			if (!loop) break;
+			k = loop_start + (k - loop_start) % s->loop_length;
+		}
+		pcm[i] = bps == 1 ? s->data8[k] << 8 : s->data16[k];
+	}
+
+	struct vadpcm_vector codebook[XM64_VADPCM_PREDICTORS * kVADPCMEncodeOrder];
+	struct vadpcm_params parms = { .predictor_count = XM64_VADPCM_PREDICTORS };
+	void *scratch = malloc(vadpcm_encode_scratch_size(nframes));
+	uint8_t *frames = malloc(nframes * kVADPCMFrameByteSize);
+	vadpcm_error err = vadpcm_encode(&parms, codebook, nframes, frames, pcm, scratch);
+	if (err != 0)
+		fatal("VADPCM encoding error: %s\n", vadpcm_error_name(err));
+
+	// Decode the compressed frames to calculate the decoder state at the
+	// start of the frame containing the loop start, and at each entry of
+	// the seek table.
+	int loop_frame = loop ? loop_start / kVADPCMFrameSampleCount : -1;
+	struct vadpcm_vector loop_state = {0}, state = {0};
+	int16_t *seek_table = malloc(nseek * kVADPCMEncodeOrder * sizeof(int16_t));
+	for (int j=0; j<nframes; j++) {
+		int16_t dec[kVADPCMFrameSampleCount];
+		if (j % WAV64_VADPCM_SEEK_INTERVAL == 0)
+			for (int k=0; k<kVADPCMEncodeOrder; k++)
+				seek_table[j / WAV64_VADPCM_SEEK_INTERVAL * kVADPCMEncodeOrder + k] = state.v[8 - kVADPCMEncodeOrder + k];
+		if (j == loop_frame)
+			loop_state = state;
+		vadpcm_decode(XM64_VADPCM_PREDICTORS, kVADPCMEncodeOrder, codebook, &state,
+			1, dec, frames + j * kVADPCMFrameByteSize);
+	}
+
+	// Serialize the header (see wav64_header_vadpcm_t), the codebook, the
+	// frames and the seek table.
+	uint8_t *vdata = calloc(1, vsize);
+	uint8_t *out = vdata;
+	*out++ = XM64_VADPCM_PREDICTORS;
+	*out++ = kVADPCMEncodeOrder;
+	vadpcm_w16(&out, WAV64_VADPCM_SEEK_INTERVAL);
+	out += 4;       // current_offset
+	for (int i=0; i<8; i++) vadpcm_w16(&out, loop_state.v[i]);
+	out += 16*3;    // loop_state[1], state[2]
+	for (int i=0; i<XM64_VADPCM_PREDICTORS * kVADPCMEncodeOrder; i++)
+		for (int j=0; j<8; j++)
+			vadpcm_w16(&out, codebook[i].v[j]);
+	memcpy(out, frames, nframes * kVADPCMFrameByteSize);
+	out += nframes * kVADPCMFrameByteSize;
+	for (int i=0; i<nseek * kVADPCMEncodeOrder; i++)
+		vadpcm_w16(&out, seek_table[i]);
+
+	free(seek_table);
+	free(frames);
+	free(scratch);
+	free(pcm);
+
+	if (length != s->length) {
+		ctx->ctx_size             -= ALIGN8(s->length*bps);
+		ctx->ctx_size_all_samples -= ALIGN8(s->length*bps);
+		ctx->ctx_size             += ALIGN8(length*bps);
+		ctx->ctx_size_all_samples += ALIGN8(length*bps);
+	}
+
+	free(s->data8);
+	s->data8 = (int8_t*)vdata;
+	s->format = XM_SAMPLE_FORMAT_VADPCM;
+	s->length = length;
+	if (loop) {
+		s->loop_start = loop_start;
+		s->loop_length = loop_length2;
+		s->loop_end = length;
+	}
+	assert(xm_sample_vadpcm_size(s) == vsize);
+	return true;
+}
+
 int xm_convert(const char *infn, const char *outfn) {
 	if (flag_verbose)
 		fprintf(stderr, "Converting: %s => %s\n", infn, outfn);
@@ -59,6 +185,8 @@ int xm_convert(const char *infn, const char *outfn) {
 	//   1) Ping-pong loops will be unrolled as regular forward
 	//   2) Repeat initial data after loop end for MIXER_LOOP_OVERREAD bytes
 	//      to speed up decoding in RSP.
+	//   3) If requested, compress them with VADPCM.
+	int num_samples = 0, num_compressed = 0;
 	for (int i=0;i<ctx->module.num_instruments;i++) {
 		xm_instrument_t *ins = &ctx->module.instruments[i];
 
@@ -133,7 +261,6 @@ int xm_convert(const char *infn, const char *outfn) {
 			// required for the context.
 			if (length != s->length*bps)
 			{
-				#define ALIGN8(n)  ((((n) + 7) >> 3) << 3)
 				ctx->ctx_size             -= ALIGN8(s->length*bps);
 				ctx->ctx_size_all_samples -= ALIGN8(s->length*bps);
 				ctx->ctx_size             += ALIGN8(length);
@@ -143,6 +270,15 @@ int xm_convert(const char *infn, const char *outfn) {
 			s->loop_length = loop_length / bps;
 			s->loop_end = loop_end / bps;
 			s->data8 = (int8_t*)sout;
+
+			if (flag_xm_compress == 1) {
+				if (xm_compress_sample_vadpcm(ctx, s))
+					num_compressed++;
+				else
+					fprintf(stderr, "WARNING: %s: sample %d of instrument %d left uncompressed (VADPCM would not reduce its size)\n",
+						infn, j+1, i+1);
+			}
+			num_samples++;
 		}
 	}
 
@@ -169,8 +305,13 @@ int xm_convert(const char *infn, const char *outfn) {
 					n = ch->sample->length;
 				}
 
-				// Convert samples to bytes
-				if (ch->sample->bits == 16)
+				// Convert samples to bytes. VADPCM samples are always decoded
+				// to 16-bit, and each read can append up to 63 extra samples
+				// (the CPU decodes up to a frame pair after seeks and loop
+				// points, and the RSP rounds up to 32 samples).
+				if (ch->sample->format == XM_SAMPLE_FORMAT_VADPCM)
+					n = n*2 + 64*2;
+				else if (ch->sample->bits == 16)
 					n *= 2;
 
 				// Take overread buffer into account
@@ -209,6 +350,8 @@ int xm_convert(const char *infn, const char *outfn) {
 	if (flag_verbose) {	
 		fprintf(stderr, "  * ROM size: %u KiB (samples:%zu)\n",
 			romsize / 1024, mem_sam / 1024);
+		if (flag_xm_compress)
+			fprintf(stderr, "  * VADPCM compressed samples: %d/%d\n", num_compressed, num_samples);
 		fprintf(stderr, "  * RAM size: %zu KiB (ctx:%zu, patterns:%u, samples:%u)\n",
 			(mem_ctx+sam_size+ctx->ctx_size_stream_pattern_buf)/1024,
 			mem_ctx / 1024,
@@ -8,7 +8,8 @@
  *
  *   * Convert from older YM versions (eg: YM3!, YM3b).
  *   * Convert non-interleaved to interleaved.
- *   * Re-compress with LHA -lh5-.
+ *   * Re-compress with LHA -lh5-, splitting the file into independently
+ *     compressed segments to allow seeking (see ym_write_compressed).
  *
  */
 
@@ -26,6 +27,7 @@
 
 
 bool flag_ym_compress = false;
+int flag_ym_seek_interval = 1024;
 
 typedef struct __attribute__((packed)) {
     uint8_t size;
@@ -53,6 +55,27 @@ typedef struct __attribute__((packed)) {
 
 _Static_assert(sizeof(ym5header) == 22, "invalid ym5header size");
 
+#define YM64_SEEK_VERSION       2
+
+typedef struct __attribute__((packed)) {
+    char magic[4];              // "YMSK"
+    uint32_t version;           // Version of the seek index (YM64_SEEK_VERSION)
+    uint32_t interval;          // Maximum number of audio frames between keyframes
+    uint32_t nkeys;             // Number of keyframes
+} ym64seekheader;
+
+_Static_assert(sizeof(ym64seekheader) == 16, "invalid ym64seekheader size");
+
+typedef struct __attribute__((packed)) {
+    uint32_t offset;            // Offset of the LHA member (relative to the end of the index)
+    uint32_t frame;             // First audio frame in the LHA member
+    uint8_t regs[14];           // Cached AY registers before the first frame
+    uint8_t env_shape;          // Last envelope shape written to the AY (0xFF: none)
+    uint8_t padding;
+} ym64keyframe;
+
+_Static_assert(sizeof(ym64keyframe) == 24, "invalid ym64keyframe size");
+
 static FILE *ym_f;
 static bool ym_compressed;
 static uint8_t alignas(8) ym_decoder[DECOMPRESS_LZH5_STATE_SIZE];
@@ -69,24 +92,18 @@ static void ymwrite(const void *buf, int sz) {
     fwrite(buf, 1, sz, ym_f);
 }
 
-// Compress a file with LHA (algorithm -lh5-). This is done using
+// Compress a file with LHA (algorithm -lh5-), appending it as a new member
+// to the LHA archive being written to "out". This is done using
 // a stripped down version of https://github.com/jca02266/lha
 // stored as single file in lzh5_compress.c. The library works only
 // through FILE*, so the compression will happen from disk to disk.
-static void lha_compress(const char *outfn, const char *infn) {
-    
-    FILE *in = fopen(infn, "rb");
-    if (!in) fatal("cannot open file: %s\n", infn);
-
-    FILE *out = fopen(outfn, "wb");
-    if (!out) fatal("cannot create file: %s\n", infn);
+static void lha_compress_member(FILE *out, FILE *in, const char *lha_fn) {
+    long start = ftell(out);
 
     // Prepare a basic LHA header. Leave most fields empty,
-    // we will fill them later. The YM module itself is a file
-    // within the archive whose name doesn't matter, so we
-    // will use a fixed name of "audioconv64.bin".
+    // we will fill them later. The name of the member is only
+    // informative, the player does not use it.
     lhaheader head; uint16_t crc16 = 0;
-    const char *lha_fn = "audioconv64.bin";
     memset(&head, 0, sizeof(head));
 
     head.size = (sizeof(head)-2) + strlen(lha_fn) + 2;
@@ -120,13 +137,166 @@ static void lha_compress(const char *outfn, const char *infn) {
     head.checksum = csum;
 
     // Write again the header and the crc16 of the file.
-    fseek(out, 0, SEEK_SET);
+    fseek(out, start, SEEK_SET);
     fwrite(&head, 1, sizeof(head), out);
 
-    fseek(out, head.size-2+2, SEEK_SET);
+    fseek(out, start + head.size-2+2, SEEK_SET);
     fwrite(&crc16, 1, 2, out);
+    fseek(out, 0, SEEK_END);
+}
 
-    fclose(in); fclose(out);
+// Compress a memory buffer with LHA, appending it as a new member to the
+// LHA archive being written to "out".
+static void lha_compress_buffer(FILE *out, const void *data, int size, const char *lha_fn) {
+    const char *tmpfilename = ".song.tmp";
+    FILE *in = fopen(tmpfilename, "w+b");
+    if (!in) fatal("cannot create: %s", tmpfilename);
+    fwrite(data, 1, size, in);
+    fseek(in, 0, SEEK_SET);
+    lha_compress_member(out, in, lha_fn);
+    fclose(in);
+    remove(tmpfilename);
+}
+
+// Write a compressed YM64 file.
+//
+// Instead of compressing the whole YM file as a single LHA stream (which
+// would require decompressing from the start to reach any audio frame),
+// the file is split into segments of flag_ym_seek_interval audio frames, and
+// each segment is compressed as a separate member of the LHA archive. The
+// decompressor can thus be restarted at the beginning of any segment.
+//
+// The archive starts with an additional member containing the seek index:
+// for each segment, the offset of its LHA member and a keyframe, that is
+// the state of the AY registers right before its first audio frame, so
+// that the player can restore it after seeking.
+//
+// An additional segment boundary is placed at the loop point, so that the
+// player can loop without decompressing the frames that precede it.
+//
+// Segments are compressed independently, so shorter intervals allow faster
+// seeking but worsen the compression ratio. With an interval of 0, the file
+// is compressed as a single segment without seek index (not seekable).
+static void ym_write_compressed(const char *outfn, const uint8_t *header, int header_size,
+    const uint8_t *frames, int nframes, int loop_frame)
+{
+    bool seekable = flag_ym_seek_interval > 0;
+    int interval = seekable ? flag_ym_seek_interval : MAX(nframes, 1);
+    ym64keyframe *keys = calloc((nframes + interval - 1) / interval + 2, sizeof(ym64keyframe));
+    int nkeys = 0;
+
+    // Compress all segments into a temporary archive, recording offsets.
+    const char *tmpfilename = ".song.lha.tmp";
+    FILE *members = fopen(tmpfilename, "w+b");
+    if (!members) fatal("cannot create: %s", tmpfilename);
+
+    // Track the AY register state exactly like the player does: registers
+    // are written only when they change, and 0xFF in the envelope shape
+    // register means "don't touch".
+    uint8_t regs[14] = {0}; uint8_t env_shape = 0xFF;
+    uint8_t *segment = malloc(header_size + interval*16 + 4);
+
+    int f0 = 0;
+    do {
+        int k = nkeys++;
+        int f1 = MIN((f0 / interval + 1) * interval, nframes);
+        if (seekable && loop_frame > f0 && loop_frame < f1)
+            f1 = loop_frame;
+        bool last = f1 >= nframes;
+
+        keys[k].offset = HOST_TO_BE32(ftell(members));
+        keys[k].frame = HOST_TO_BE32(f0);
+        memcpy(keys[k].regs, regs, sizeof(regs));
+        keys[k].env_shape = env_shape;
+
+        for (int f=f0; f<f1; f++) {
+            for (int i=0; i<14; i++) {
+                if (regs[i] != frames[f*16+i]) {
+                    regs[i] = frames[f*16+i];
+                    if (i == 13 && regs[i] != 0xFF)
+                        env_shape = regs[i];
+                }
+            }
+        }
+
+        // The first segment also contains the YM header and metadata, and
+        // the last one the terminator, so that the concatenation of all
+        // segments is a valid YM file.
+        int size = 0;
+        if (k == 0) {
+            memcpy(segment, header, header_size);
+            size += header_size;
+        }
+        memcpy(segment + size, frames + f0*16, (f1-f0)*16);
+        size += (f1-f0)*16;
+        if (last) {
+            memcpy(segment + size, "End!", 4);
+            size += 4;
+        }
+
+        char lha_fn[32];
+        if (seekable) sprintf(lha_fn, "audioconv64.%03d", k);
+        else strcpy(lha_fn, "audioconv64.bin");
+        lha_compress_buffer(members, segment, size, lha_fn);
+        f0 = f1;
+    } while (f0 < nframes);
+
+    // Write the seek index as first member, followed by all segments.
+    FILE *out = fopen(outfn, "wb");
+    if (!out) fatal("cannot create file: %s\n", outfn);
+
+    int index_size = sizeof(ym64seekheader) + nkeys * sizeof(ym64keyframe);
+    uint8_t *index = malloc(index_size);
+    ym64seekheader *sh = (ym64seekheader*)index;
+    memset(sh, 0, sizeof(*sh));
+    memcpy(sh->magic, "YMSK", 4);
+    sh->version = HOST_TO_BE32(YM64_SEEK_VERSION);
+    sh->interval = HOST_TO_BE32(interval);
+    sh->nkeys = HOST_TO_BE32(nkeys);
+    memcpy(index + sizeof(ym64seekheader), keys, nkeys * sizeof(ym64keyframe));
+    if (seekable)
+        lha_compress_buffer(out, index, index_size, "audioconv64.idx");
+
+    fseek(members, 0, SEEK_SET);
+    uint8_t buf[4096]; int n;
+    while ((n = fread(buf, 1, sizeof(buf), members)) > 0)
+        fwrite(buf, 1, n, out);
+
+    if (flag_verbose)
+        fprintf(stderr, "  compressed %d audio frames in %d segments (%ld bytes)\n", nframes, nkeys, ftell(out));
+
+    fclose(out);
+    fclose(members);
+    remove(tmpfilename);
+    free(segment); free(index); free(keys);
+}
+
+// Write a YM64 file (interleaved YM5 format), optionally compressed.
+static void ym_write(const char *outfn, ym5header *ymhead,
+    const char *song_name, const char *song_author, const char *song_comment,
+    const uint8_t *frames, int nframes, bool compress)
+{
+    // Serialize the YM header and the metadata.
+    int header_size = 12 + sizeof(ym5header) + strlen(song_name)+1 + strlen(song_author)+1 + strlen(song_comment)+1;
+    uint8_t *header = malloc(header_size), *h = header;
+    memcpy(h, "YM5!LeOnArD!", 12); h += 12;
+    memcpy(h, ymhead, sizeof(ym5header)); h += sizeof(ym5header);
+    strcpy((char*)h, song_name); h += strlen(song_name)+1;
+    strcpy((char*)h, song_author); h += strlen(song_author)+1;
+    strcpy((char*)h, song_comment); h += strlen(song_comment)+1;
+
+    if (compress) {
+        ym_write_compressed(outfn, header, header_size, frames, nframes, BE32_TO_HOST(ymhead->loop));
+    } else {
+        ym_f = fopen(outfn, "wb");
+        if (!ym_f) fatal("cannot create: %s", outfn);
+        ymwrite(header, header_size);
+        ymwrite(frames, nframes*16);
+        ymwrite("End!", 4);
+        fclose(ym_f); ym_f = NULL;
+    }
+
+    free(header);
 }
 
 int ym_convert(const char *infn, const char *outfn) {
@@ -168,7 +338,7 @@ int ym_convert(const char *infn, const char *outfn) {
     // YM3 is an interleaved format. We need to convert it to non-interleaved
     // otherwise it cannot be streamed and thus would require lots of RAM.
     if (strncmp(head, "YM3!", 4) == 0 || strncmp(head, "YM3b", 4) == 0) {
-        int csize = fsize-4; uint32_t loop;
+        int csize = fsize-4; uint32_t loop = 0;
         if (head[3] == 'b') csize -= 4; // loop frame
 
         // A valid YM3! file contains data for 14 registers, so the actual size
@@ -192,37 +362,16 @@ int ym_convert(const char *infn, const char *outfn) {
             outdata[f*16+r] = data[i];
         }
 
-        // Write a YM5 format (uncompressed) into temporary file.
-        const char *tmpfilename = ".song.tmp";
-        ym_f = fopen(tmpfilename, "wb");
-        if (!ym_f) fatal("cannot create: %s", tmpfilename);
-
-        ymwrite("YM5!LeOnArD!", 12);
-
+        // Write a YM5 format file. YM3 files are always compressed.
         ym5header head;
         memset(&head, 0, sizeof(head));
         head.nvbl = HOST_TO_BE32(nframes);
         head.extfreq = HOST_TO_BE32(1000000);
         head.playfreq = HOST_TO_BE16(50);
         head.loop = loop;
-        ymwrite(&head, sizeof(head));
-
-        const char *song_name = "";
-        const char *song_author = "";
-        const char *song_comment = "";
-        ymwrite(song_name, strlen(song_name)+1);
-        ymwrite(song_author, strlen(song_author)+1);
-        ymwrite(song_comment, strlen(song_comment)+1);
-
-        ymwrite(outdata, csize/14*16);
-        ymwrite("End!", 4);
-        fclose(ym_f);
-
-        // Do LHA compression to convert the temporary file into the final file.
-        lha_compress(outfn, tmpfilename);
+        ym_write(outfn, &head, "", "", "", outdata, nframes, true);
 
         free(data); free(outdata);
-        remove(tmpfilename);
 
     // If this is a YM5! or YM6! file, we might need to convert it if it's not
     // interleaved, and compress it if it's not compressed.
@@ -268,24 +417,9 @@ int ym_convert(const char *infn, const char *outfn) {
         // Turn off interleaving bit in header attributes
         ymhead.attrs = HOST_TO_BE32((BE32_TO_HOST(ymhead.attrs) & ~1));
 
-        // Write back the YM5 file into a temporary file.
-        const char *tmpfilename = ".song.tmp";
-        ym_f = fopen(flag_ym_compress ? tmpfilename : outfn, "wb");
-        if (!ym_f) fatal("cannot create: %s", flag_ym_compress ? tmpfilename : outfn);
-        ymwrite("YM5!LeOnArD!", 12);
-        ymwrite(&ymhead, sizeof(ymhead));
-        ymwrite(song_name, strlen(song_name)+1);
-        ymwrite(song_author, strlen(song_author)+1);
-        ymwrite(song_comment, strlen(song_comment)+1);
-        ymwrite(outdata, datasize);
-        ymwrite("End!", 4);
-        fclose(ym_f);
-
-        // Do LHA compression
-        if (flag_ym_compress) {
-            lha_compress(outfn, tmpfilename);
-            remove(tmpfilename);
-        }
+        // Write back the YM5 file.
+        ym_write(outfn, &ymhead, song_name, song_author, song_comment,
+            outdata, numframes, flag_ym_compress);
 
         free(data); free(outdata);
     } else {
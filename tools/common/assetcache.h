@@ -0,0 +1,117 @@
+#ifndef LIBDRAGON_TOOLS_ASSETCACHE_H
+#define LIBDRAGON_TOOLS_ASSETCACHE_H
+
+/**
+ * Content-addressed cache of converted assets.
+ *
+ * Tools compute a 64-bit key by hashing everything that affects the output
+ * (contents of the input files, conversion options, tool build), and look it
+ * up in a cache directory before doing any work. On a hit, the cached output
+ * is simply copied to the destination; on a miss, the output is converted
+ * as usual and then stored in the cache under its key.
+ *
+ * Cache entries are written to a temporary file and then renamed, so that
+ * multiple threads or processes can share the same cache directory. Stale
+ * entries are never removed: just delete the cache directory to reclaim space.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+/** Initial value of a cache key */
+#define ASSETCACHE_KEY_INIT     0xcbf29ce484222325ull
+
+/** Hash a buffer into a cache key (64-bit FNV-1a) */
+static uint64_t assetcache_hash(uint64_t key, const void *data, size_t size)
+{
+    const uint8_t *p = data;
+    for (size_t i = 0; i < size; i++) {
+        key ^= p[i];
+        key *= 0x100000001b3ull;
+    }
+    return key;
+}
+
+/** Hash a string (including its terminator) into a cache key */
+static uint64_t assetcache_hash_str(uint64_t key, const char *str)
+{
+    return assetcache_hash(key, str ? str : "", str ? strlen(str)+1 : 1);
+}
+
+/** Hash the contents of a file into a cache key. Returns false if the file cannot be read. */
+static bool assetcache_hash_file(uint64_t *key, const char *fn)
+{
+    FILE *f = fopen(fn, "rb");
+    if (!f) return false;
+    uint8_t buf[16384]; size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        *key = assetcache_hash(*key, buf, n);
+    fclose(f);
+    return true;
+}
+
+/** Create the cache directory if it doesn't exist yet */
+static bool assetcache_init(const char *dir)
+{
+    struct stat st;
+    if (stat(dir, &st) == 0)
+        return (st.st_mode & S_IFDIR) != 0;
+    #ifndef __MINGW32__
+    return mkdir(dir, 0777) == 0;
+    #else
+    return mkdir(dir) == 0;
+    #endif
+}
+
+static bool assetcache_copy(const char *src, const char *dst)
+{
+    FILE *in = fopen(src, "rb");
+    if (!in) return false;
+    FILE *out = fopen(dst, "wb");
+    if (!out) { fclose(in); return false; }
+
+    uint8_t buf[16384]; size_t n; bool ok = true;
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+        if (fwrite(buf, 1, n, out) != n) { ok = false; break; }
+    }
+    fclose(in);
+    if (fclose(out) != 0) ok = false;
+    if (!ok) remove(dst);
+    return ok;
+}
+
+/** Copy the cache entry for the specified key to outfn. Returns false if not cached. */
+static bool assetcache_fetch(const char *dir, uint64_t key, const char *outfn)
+{
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%016llx", dir, (unsigned long long)key);
+    return assetcache_copy(path, outfn);
+}
+
+/** Store outfn in the cache under the specified key */
+static void assetcache_store(const char *dir, uint64_t key, const char *outfn)
+{
+    static int counter = 0;
+    int id = __atomic_fetch_add(&counter, 1, __ATOMIC_RELAXED);
+
+    char path[4096], tmppath[4096];
+    snprintf(path, sizeof(path), "%s/%016llx", dir, (unsigned long long)key);
+    snprintf(tmppath, sizeof(tmppath), "%s/%016llx.%d.%d.tmp", dir, (unsigned long long)key, (int)getpid(), id);
+
+    if (!assetcache_copy(outfn, tmppath))
+        return;
+    // If the rename fails, another process stored the same entry meanwhile.
+    if (rename(tmppath, path) != 0)
+        remove(tmppath);
+}
+
+#endif
@@ -20,6 +20,7 @@
 #undef LZ4_DECOMPRESS_INPLACE_MARGIN
 
 #include "lz4_compress.h"
+#include "parallel.h"
 
 void asset_compress_mem(int compression, const uint8_t *data, int sz, uint8_t **output, int *cmp_size, int *winsize, int *margin)
 {
@@ -236,3 +237,135 @@ bool asset_compress(const char *infn, const char *outfn, int compression, int wi
 
     return true;
 }
+
+typedef struct {
+    int compression;            // Compression level
+    const uint8_t *data;        // Data to compress
+    int size;                   // Size of the data
+    int chunk_size;             // Size of each chunk
+    int winsize;                // Requested window size (0 = automatic)
+    uint8_t **outputs;          // Compressed data of each chunk
+    int *cmp_sizes;             // Compressed size of each chunk
+    int *winsizes;              // Window size used for each chunk
+} chunked_compress_t;
+
+static void compress_chunk(int idx, void *arg)
+{
+    chunked_compress_t *ctx = arg;
+    int pos = idx * ctx->chunk_size;
+    int len = ctx->size - pos < ctx->chunk_size ? ctx->size - pos : ctx->chunk_size;
+
+    // Like for whole files, silently decrease the window size if the chunk
+    // is smaller.
+    int winsize = ctx->winsize, margin;
+    if (winsize) {
+        while (len < winsize && winsize > 2*1024)
+            winsize /= 2;
+    }
+
+    asset_compress_mem(ctx->compression, ctx->data + pos, len,
+        &ctx->outputs[idx], &ctx->cmp_sizes[idx], &winsize, &margin);
+    ctx->winsizes[idx] = winsize;
+}
+
+/**
+ * @brief Compress a file in the libdragon asset format, split in chunks.
+ * 
+ * The file is split into chunks of the specified (decompressed) size, and
+ * each chunk is compressed independently (and in parallel). The resulting
+ * file has a slightly worse compression ratio, but can be seeked efficiently
+ * when opened with asset_fopen(), as decompression can start at any chunk.
+ * 
+ * @param infn          Input file to (re-)compress
+ * @param outfn         Output file
+ * @param compression   Requested compression level (only 1 and 2 are supported)
+ * @param winsize       Window size (see #asset_compress)
+ * @param chunk_size    Decompressed size of each chunk
+ * @param nthreads      Number of threads used to compress the chunks (1 = serially)
+ * @return true         File was compressed correctly
+ * @return false        Error compressing the file
+ */
+bool asset_compress_chunked(const char *infn, const char *outfn, int compression, int winsize, int chunk_size, int nthreads)
+{
+    if (compression != 1 && compression != 2) {
+        fprintf(stderr, "chunked compression is only supported with compression levels 1 and 2\n");
+        return false;
+    }
+    if (chunk_size <= 0) {
+        fprintf(stderr, "invalid chunk size: %d\n", chunk_size);
+        return false;
+    }
+
+    asset_init_compression(2);
+    asset_init_compression(3);
+
+    FILE *in = fopen(infn, "rb");
+    if (!in) {
+        fprintf(stderr, "error opening input file: %s\n", infn);
+        return false;
+    }
+    fclose(in);
+
+    if (winsize && asset_winsize_to_flags(winsize) < 0) {
+        fprintf(stderr, "unsupported window size: %d\n", winsize);
+        fprintf(stderr, "supported window sizes: 2, 4, 8, 16, 32, 64, 128, 256\n");
+        return false;
+    }
+
+    // Load the file (decompressing it if it was already compressed).
+    int sz;
+    uint8_t *data = asset_load(infn, &sz);
+
+    // Compress all chunks in parallel.
+    int num_chunks = (sz + chunk_size - 1) / chunk_size;
+    chunked_compress_t ctx = {
+        .compression = compression,
+        .data = data,
+        .size = sz,
+        .chunk_size = chunk_size,
+        .winsize = winsize,
+        .outputs = calloc(num_chunks+1, sizeof(uint8_t*)),
+        .cmp_sizes = calloc(num_chunks+1, sizeof(int)),
+        .winsizes = calloc(num_chunks+1, sizeof(int)),
+    };
+    parallel_run(num_chunks, nthreads, compress_chunk, &ctx);
+
+    // The streaming decompressor must be able to handle the largest window.
+    int max_winsize = 2*1024;
+    int cmp_size = 8 + (num_chunks+1) * 4;
+    for (int i = 0; i < num_chunks; i++) {
+        if (max_winsize < ctx.winsizes[i]) max_winsize = ctx.winsizes[i];
+        cmp_size += ctx.cmp_sizes[i];
+    }
+
+    FILE *out = fopen(outfn, "wb");
+    if (!out) {
+        fprintf(stderr, "error opening output file: %s\n", outfn);
+        return false;
+    }
+    fwrite("DCA3", 1, 4, out);
+    w16(out, compression); // algo
+    w16(out, asset_winsize_to_flags(max_winsize) | ASSET_FLAG_CHUNKED); // flags
+    w32(out, cmp_size); // cmp_size
+    w32(out, sz); // dec_size
+    w32(out, 0); // inplace margin (unused)
+
+    // Chunk index
+    w32(out, chunk_size);
+    w32(out, num_chunks);
+    uint32_t offset = 0;
+    for (int i = 0; i <= num_chunks; i++) {
+        w32(out, offset);
+        offset += ctx.cmp_sizes[i];
+    }
+
+    for (int i = 0; i < num_chunks; i++) {
+        fwrite(ctx.outputs[i], 1, ctx.cmp_sizes[i], out);
+        free(ctx.outputs[i]);
+    }
+    fclose(out);
+
+    free(ctx.outputs); free(ctx.cmp_sizes); free(ctx.winsizes);
+    free(data);
+    return true;
+}
@@ -8,6 +8,7 @@
 #define DEFAULT_WINSIZE_STREAMING    (4*1024)
 
 bool asset_compress(const char *infn, const char *outfn, int compression, int winsize);
+bool asset_compress_chunked(const char *infn, const char *outfn, int compression, int winsize, int chunk_size, int nthreads);
 void asset_compress_mem(int compression, const uint8_t *inbuf, int size, uint8_t **outbuf, int *cmp_size, int *winsize, int *margin);
 
 #endif
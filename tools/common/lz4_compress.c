@@ -1,5 +1,6 @@
 
-int lz4_distance_max = 16384;
+// Thread-local, as tools might compress multiple files in parallel
+__thread int lz4_distance_max = 16384;
 
 #define LZ4_DISTANCE_MAX lz4_distance_max
 #include "lz4/lz4.c"
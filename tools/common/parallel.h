@@ -0,0 +1,84 @@
+#ifndef LIBDRAGON_TOOLS_PARALLEL_H
+#define LIBDRAGON_TOOLS_PARALLEL_H
+
+/**
+ * Minimal worker pool for tools that process many independent files.
+ *
+ * parallel_run() runs a job function for each index in [0, njobs) across a
+ * pool of worker threads. Jobs are handed out one at a time from a shared
+ * counter, so that slow jobs (eg: big files compressed with shrinkler) do
+ * not stall the others. Job functions must be thread-safe: they should only
+ * touch state private to their job index.
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <pthread.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+typedef void (*parallel_job_fn)(int idx, void *ctx);
+
+typedef struct {
+    parallel_job_fn fn;
+    void *ctx;
+    int njobs;
+    int next;
+} parallel_pool_t;
+
+/** Return the default number of worker threads (number of online CPUs) */
+static inline int parallel_default_threads(void)
+{
+    #ifdef _WIN32
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    int n = si.dwNumberOfProcessors;
+    #else
+    int n = sysconf(_SC_NPROCESSORS_ONLN);
+    #endif
+    return n > 0 ? n : 1;
+}
+
+static void* parallel_worker(void *arg)
+{
+    parallel_pool_t *pool = arg;
+    int idx;
+    while ((idx = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED)) < pool->njobs)
+        pool->fn(idx, pool->ctx);
+    return NULL;
+}
+
+/**
+ * Run fn(idx, ctx) for all idx in [0, njobs), using up to nthreads threads.
+ * If nthreads is 1 (or there is only one job), everything runs on the
+ * calling thread, in order.
+ */
+static void parallel_run(int njobs, int nthreads, parallel_job_fn fn, void *ctx)
+{
+    parallel_pool_t pool = { .fn = fn, .ctx = ctx, .njobs = njobs, .next = 0 };
+
+    if (nthreads > njobs) nthreads = njobs;
+    if (nthreads <= 1) {
+        parallel_worker(&pool);
+        return;
+    }
+
+    pthread_t *threads = malloc(nthreads * sizeof(pthread_t));
+    int started = 0;
+    for (int i = 0; i < nthreads; i++) {
+        if (pthread_create(&threads[i], NULL, parallel_worker, &pool) != 0)
+            break;
+        started++;
+    }
+    // If no thread could be created, just run the jobs here.
+    if (started == 0)
+        parallel_worker(&pool);
+    for (int i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+    free(threads);
+}
+
+#endif
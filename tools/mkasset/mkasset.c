@@ -4,37 +4,150 @@
 #include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
+#include <dirent.h>
+#include <sys/stat.h>
 #include "../common/binout.c"
 #include "../common/assetcomp.h"
+#include "../common/assetcache.h"
+#include "../common/parallel.h"
 
 #include "../../src/asset_internal.h"
 
 bool flag_verbose = false;
 
+typedef struct {
+    char *infn;             // Input file
+    char *outfn;            // Output file
+} job_t;
+
+typedef struct {
+    job_t *jobs;            // List of files to compress
+    int njobs;              // Number of files to compress
+    int compression;        // Compression level
+    int winsize;            // Window size
+    int chunk_size;         // Chunk size (0 = not chunked)
+    int chunk_threads;      // Threads used to compress the chunks of each file
+    const char *cachedir;   // Cache directory (or NULL)
+    bool error;             // At least one file failed
+} mkasset_t;
+
 void print_args(char * name)
 {
     fprintf(stderr, "%s -- Libdragon asset compression tool\n\n", name);
     fprintf(stderr, "This tool can be used to compress/decompress arbitrary asset files in a format\n");
     fprintf(stderr, "that can be loaded by the libdragon library. To open the compressed\n");
     fprintf(stderr, "files, use asset_fopen() or asset_load().\n\n");
-    fprintf(stderr, "Usage: %s [flags] <input files...>\n", name);
+    fprintf(stderr, "Usage: %s [flags] <input files or directories...>\n", name);
     fprintf(stderr, "\n");
     fprintf(stderr, "Command-line flags:\n");
     fprintf(stderr, "   -v/--verbose            Verbose output\n");
     fprintf(stderr, "   -o/--output <dir>       Specify output directory (default: .)\n");
     fprintf(stderr, "   -c/--compress <algo>    Compression level 0-%d (default: %d)\n", MAX_COMPRESSION, DEFAULT_COMPRESSION);
     fprintf(stderr, "   -w/--winsize <window>   Maximum size of the matching window in KiB. (default: %d)\n", DEFAULT_WINSIZE_STREAMING/1024);
+    fprintf(stderr, "   --chunk-size <size>     Compress in independent chunks of the specified size in KiB,\n");
+    fprintf(stderr, "                           to allow fast seeking with asset_fopen() (levels 1-2 only)\n");
+    fprintf(stderr, "   -j/--jobs <N>           Number of files to compress in parallel (default: number of CPUs)\n");
+    fprintf(stderr, "   --cache <dir>           Cache compressed files in the specified directory, and\n");
+    fprintf(stderr, "                           skip compression of files that did not change\n");
     fprintf(stderr, "\nSupported window sizes: 2, 4, 8, 16, 32, 64, 128, 256\n");
     fprintf(stderr, "The window size affects the memory used by asset_fopen() only.\n");
     fprintf(stderr, "If you only use asset_load(), use the biggest window (256 KiB) to improve ratio.\n");
     fprintf(stderr, "\n");
+    fprintf(stderr, "Directories are processed recursively, recreating their structure in the output directory.\n");
+    fprintf(stderr, "\n");
+}
+
+static bool isdir(const char *path)
+{
+    struct stat st;
+    return stat(path, &st) == 0 && (st.st_mode & S_IFDIR) != 0;
+}
+
+static void add_job(mkasset_t *mk, const char *infn, const char *outfn)
+{
+    mk->jobs = realloc(mk->jobs, (mk->njobs+1) * sizeof(job_t));
+    mk->jobs[mk->njobs++] = (job_t){ .infn = strdup(infn), .outfn = strdup(outfn) };
+}
+
+// Add all files within a directory (recursively) to the list of jobs,
+// creating the matching output directories.
+static void add_dir(mkasset_t *mk, const char *indir, const char *outdir)
+{
+    if (!isdir(outdir)) {
+        #ifndef __MINGW32__
+        mkdir(outdir, 0777);
+        #else
+        mkdir(outdir);
+        #endif
+    }
+
+    DIR *d = opendir(indir);
+    if (!d) {
+        fprintf(stderr, "error opening directory: %s\n", indir);
+        mk->error = true;
+        return;
+    }
+    struct dirent *de;
+    while ((de = readdir(d))) {
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+            continue;
+        char *insub, *outsub;
+        asprintf(&insub, "%s/%s", indir, de->d_name);
+        asprintf(&outsub, "%s/%s", outdir, de->d_name);
+        if (isdir(insub))
+            add_dir(mk, insub, outsub);
+        else
+            add_job(mk, insub, outsub);
+        free(insub); free(outsub);
+    }
+    closedir(d);
+}
+
+static void compress_job(int idx, void *ctx)
+{
+    mkasset_t *mk = ctx;
+    job_t *job = &mk->jobs[idx];
+    uint64_t key = 0;
+
+    if (mk->cachedir) {
+        // The output depends on the input contents, the compression
+        // parameters, and the tool itself.
+        key = assetcache_hash_str(ASSETCACHE_KEY_INIT, "mkasset " __DATE__ " " __TIME__);
+        key = assetcache_hash(key, &mk->compression, sizeof(mk->compression));
+        key = assetcache_hash(key, &mk->winsize, sizeof(mk->winsize));
+        key = assetcache_hash(key, &mk->chunk_size, sizeof(mk->chunk_size));
+        if (assetcache_hash_file(&key, job->infn) && assetcache_fetch(mk->cachedir, key, job->outfn)) {
+            if (flag_verbose)
+                printf("Cached: %s => %s\n", job->infn, job->outfn);
+            return;
+        }
+    }
+
+    if (flag_verbose)
+        printf("Compressing: %s => %s [algo=%d]\n", job->infn, job->outfn, mk->compression);
+
+    bool ok;
+    if (mk->chunk_size && mk->compression)
+        ok = asset_compress_chunked(job->infn, job->outfn, mk->compression, mk->winsize, mk->chunk_size, mk->chunk_threads);
+    else
+        ok = asset_compress(job->infn, job->outfn, mk->compression, mk->winsize);
+    if (!ok) {
+        mk->error = true;
+        return;
+    }
+
+    if (mk->cachedir)
+        assetcache_store(mk->cachedir, key, job->outfn);
 }
 
 int main(int argc, char *argv[])
 {
-    char *infn = NULL, *outdir = ".", *outfn = NULL;
-    int compression = DEFAULT_COMPRESSION;
-    int winsize = DEFAULT_WINSIZE_STREAMING;
+    char *outdir = ".";
+    mkasset_t mk = {
+        .compression = DEFAULT_COMPRESSION,
+        .winsize = DEFAULT_WINSIZE_STREAMING,
+    };
+    int nthreads = parallel_default_threads();
 
     if (argc < 2) {
         print_args(argv[0]);
@@ -54,13 +167,13 @@ int main(int argc, char *argv[])
                     return 1;
                 }
                 char extra;
-                if (sscanf(argv[i], "%d%c", &winsize, &extra) != 1) {
+                if (sscanf(argv[i], "%d%c", &mk.winsize, &extra) != 1) {
                     fprintf(stderr, "invalid argument for %s: %s\n", argv[i-1], argv[i]);
                     return 1;
                 }            
-                winsize = winsize * 1024;
-                if (asset_winsize_to_flags(winsize) < 0) {
-                    fprintf(stderr, "unsupported window size: %d\n", winsize);
+                mk.winsize = mk.winsize * 1024;
+                if (asset_winsize_to_flags(mk.winsize) < 0) {
+                    fprintf(stderr, "unsupported window size: %d\n", mk.winsize);
                     fprintf(stderr, "supported window sizes: 2, 4, 8, 16, 32, 64, 128, 256\n");
                     return 1;
                 }    
@@ -76,12 +189,43 @@ int main(int argc, char *argv[])
                     return 1;
                 }
                 char extra;
-                if (sscanf(argv[i], "%d%c", &compression, &extra) != 1) {
+                if (sscanf(argv[i], "%d%c", &mk.compression, &extra) != 1) {
                     fprintf(stderr, "invalid argument for %s: %s\n", argv[i-1], argv[i]);
                     return 1;
                 }
-                if (compression < 0 || compression > MAX_COMPRESSION) {
-                    fprintf(stderr, "invalid compression algorithm: %d\n", compression);
+                if (mk.compression < 0 || mk.compression > MAX_COMPRESSION) {
+                    fprintf(stderr, "invalid compression algorithm: %d\n", mk.compression);
+                    return 1;
+                }
+            } else if (!strcmp(argv[i], "--chunk-size")) {
+                if (++i == argc) {
+                    fprintf(stderr, "missing argument for %s\n", argv[i-1]);
+                    return 1;
+                }
+                char extra;
+                if (sscanf(argv[i], "%d%c", &mk.chunk_size, &extra) != 1 || mk.chunk_size <= 0) {
+                    fprintf(stderr, "invalid argument for %s: %s\n", argv[i-1], argv[i]);
+                    return 1;
+                }
+                mk.chunk_size *= 1024;
+            } else if (!strcmp(argv[i], "-j") || !strcmp(argv[i], "--jobs")) {
+                if (++i == argc) {
+                    fprintf(stderr, "missing argument for %s\n", argv[i-1]);
+                    return 1;
+                }
+                char extra;
+                if (sscanf(argv[i], "%d%c", &nthreads, &extra) != 1 || nthreads < 1) {
+                    fprintf(stderr, "invalid argument for %s: %s\n", argv[i-1], argv[i]);
+                    return 1;
+                }
+            } else if (!strcmp(argv[i], "--cache")) {
+                if (++i == argc) {
+                    fprintf(stderr, "missing argument for %s\n", argv[i-1]);
+                    return 1;
+                }
+                mk.cachedir = argv[i];
+                if (!assetcache_init(mk.cachedir)) {
+                    fprintf(stderr, "cannot create cache directory: %s\n", mk.cachedir);
                     return 1;
                 }
             } else {
@@ -91,17 +235,28 @@ int main(int argc, char *argv[])
             continue;
         }
 
-        infn = argv[i];
+        char *infn = argv[i];
         char *basename = strrchr(infn, '/');
         if (!basename) basename = infn; else basename += 1;
 
+        char *outfn;
         asprintf(&outfn, "%s/%s", outdir, basename);
+        if (isdir(infn))
+            add_dir(&mk, infn, outfn);
+        else
+            add_job(&mk, infn, outfn);
+        free(outfn);
+    }
 
-        if (flag_verbose)
-            printf("Compressing: %s => %s [algo=%d]\n", infn, outfn, compression);
-
-        asset_compress(infn, outfn, compression, winsize);
+    // Files are compressed in parallel, so split the threads among them
+    // to compress chunks, without exceeding the requested number.
+    mk.chunk_threads = mk.njobs > 0 && mk.njobs < nthreads ? nthreads / mk.njobs : 1;
+    parallel_run(mk.njobs, nthreads, compress_job, &mk);
 
-        free(outfn);
+    for (int i = 0; i < mk.njobs; i++) {
+        free(mk.jobs[i].infn);
+        free(mk.jobs[i].outfn);
     }
+    free(mk.jobs);
+    return mk.error ? 1 : 0;
 }
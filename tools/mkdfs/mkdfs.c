@@ -5,6 +5,7 @@
 #include <string.h>
 #include <errno.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <sys/types.h>
 #include <sys/param.h>
 #include "dragonfs.h"
@@ -19,6 +20,12 @@
 uint8_t *dfs = NULL;
 uint32_t fs_size = 0;
 
+/* Files collected for the path index */
+dfs_index_entry_t *index_entries = NULL;
+char **index_paths = NULL;
+uint32_t index_count = 0;
+uint32_t index_alloc = 0;
+
 /* Offset from start of filesystem */
 inline uint32_t sector_offset(void *sector)
 {
@@ -75,13 +82,106 @@ void kill_fs()
     {
         free(dfs);
     }
+
+    for(uint32_t i = 0; i < index_count; i++)
+    {
+        free(index_paths[i]);
+    }
+
+    free(index_entries);
+    free(index_paths);
 }
 
 void print_help(const char * const prog_name)
 {
-    fprintf(stderr, "Usage: %s <File> <Directory>\n", prog_name);
+    fprintf(stderr, "Usage: %s [--no-index] <File> <Directory>\n", prog_name);
     fprintf(stderr, "  where <File> is the resulting filesystem image\n");
     fprintf(stderr, "  and <Directory> is the directory (including subdirectories) to include\n");
+    fprintf(stderr, "  --no-index: do not emit the hashed path index (slower file lookups at runtime)\n");
+}
+
+void index_add(const char * const dfs_path, uint32_t dirent)
+{
+    if(index_count == index_alloc)
+    {
+        index_alloc = index_alloc ? index_alloc * 2 : 256;
+        index_entries = realloc(index_entries, index_alloc * sizeof(dfs_index_entry_t));
+        index_paths = realloc(index_paths, index_alloc * sizeof(char *));
+    }
+
+    /* The path is stored in the index so that the runtime can rule out
+     * hash collisions. The entry keeps the position of the path in
+     * index_paths until the entries are sorted. */
+    index_entries[index_count].hash = dfs_path_hash(dfs_path, strlen(dfs_path));
+    index_entries[index_count].dirent = dirent;
+    index_entries[index_count].path = index_count;
+    index_paths[index_count] = strdup(dfs_path);
+    index_count++;
+}
+
+int index_cmp(const void *a, const void *b)
+{
+    const dfs_index_entry_t *ea = a, *eb = b;
+
+    if(ea->hash != eb->hash)
+    {
+        return ea->hash < eb->hash ? -1 : 1;
+    }
+
+    return ea->dirent < eb->dirent ? -1 : ea->dirent > eb->dirent;
+}
+
+/* Append the path index to the filesystem, return its offset */
+uint32_t add_index(void)
+{
+    /* Sort by hash: since buckets are selected by the top bits of the hash,
+     * this also makes each bucket a contiguous range of entries */
+    qsort(index_entries, index_count, sizeof(dfs_index_entry_t), index_cmp);
+
+    uint32_t num_buckets = index_count;
+    uint32_t paths_offset = sizeof(dfs_index_header_t) + (num_buckets + 1) * 4 + index_count * sizeof(dfs_index_entry_t);
+    uint32_t size = paths_offset;
+    for(uint32_t i = 0; i < index_count; i++)
+    {
+        size += strlen(index_paths[i]) + 1;
+    }
+    uint32_t blob = new_blob(size);
+
+    dfs_index_header_t *header = sector_to_memory(blob);
+    header->magic = SWAPLONG(DFS_INDEX_MAGIC);
+    header->num_buckets = SWAPLONG(num_buckets);
+    header->num_entries = SWAPLONG(index_count);
+    header->reserved = 0;
+
+    uint32_t *buckets = sector_to_memory(blob + sizeof(dfs_index_header_t));
+    uint32_t cur = 0;
+    for(uint32_t b = 0; b <= num_buckets; b++)
+    {
+        /* First entry whose bucket is >= b (same formula used at runtime) */
+        while(cur < index_count && ((uint64_t)index_entries[cur].hash * num_buckets) >> 32 < b)
+        {
+            cur++;
+        }
+
+        buckets[b] = SWAPLONG(cur);
+    }
+
+    dfs_index_entry_t *entries = sector_to_memory(blob + sizeof(dfs_index_header_t) + (num_buckets + 1) * 4);
+    char *paths = sector_to_memory(blob + paths_offset);
+    for(uint32_t i = 0; i < index_count; i++)
+    {
+        const char *path = index_paths[index_entries[i].path];
+
+        entries[i].hash = SWAPLONG(index_entries[i].hash);
+        entries[i].dirent = SWAPLONG(index_entries[i].dirent);
+        entries[i].path = SWAPLONG(paths_offset);
+
+        strcpy(paths, path);
+        paths += strlen(path) + 1;
+        paths_offset += strlen(path) + 1;
+    }
+
+    return blob;
 }
 
 uint32_t add_file(const char * const file, uint32_t *size)
@@ -123,7 +223,7 @@ uint32_t add_file(const char * const file, uint32_t *size)
     return blob;
 }
 
-uint32_t add_directory(const char * const path)
+uint32_t add_directory(const char * const path, const char * const dfs_path)
 {
     directory_entry_t *tmp_entry;
     uint32_t first_entry = 0;
@@ -150,11 +250,15 @@ uint32_t add_directory(const char * const path)
             else
             {
                 char *file = malloc(strlen(path) + strlen(dp->d_name) + 2);
+                char *dfs_file = malloc(strlen(dfs_path) + MAX_FILENAME_LEN + 2);
                 struct stat stats;
 
-                if(!file)
+                if(!file || !dfs_file)
                 {
                     /* Out of memory */
+                    free(file);
+                    free(dfs_file);
+                    closedir(dirp);
                     return 0;
                 }
 
@@ -183,11 +287,17 @@ uint32_t add_directory(const char * const path)
                     strncpy(tmp_entry->path, dp->d_name, MAX_FILENAME_LEN);
                     tmp_entry->path[MAX_FILENAME_LEN] = 0;
 
+                    /* Index the file by its path as stored in the image */
+                    sprintf(dfs_file, "%s%s", dfs_path, tmp_entry->path);
+                    index_add(dfs_file, new_entry);
+
                     uint32_t new_file = add_file(file, &file_size);
 
                     if(!new_file)
                     {
                         free(file);
+                        free(dfs_file);
+                        closedir(dirp);
                         return 0;
                     }
 
@@ -217,12 +327,15 @@ uint32_t add_directory(const char * const path)
                     strncpy(tmp_entry->path, dp->d_name, MAX_FILENAME_LEN);
                     tmp_entry->path[MAX_FILENAME_LEN] = 0;
 
-                    uint32_t new_directory = add_directory(file);
+                    sprintf(dfs_file, "%s%s/", dfs_path, tmp_entry->path);
+
+                    uint32_t new_directory = add_directory(file, dfs_file);
 
                     if(!new_directory)
                     {
                         fprintf(stderr, "Skipping empty directory: %s\n", file);
                         free(file);
+                        free(dfs_file);
                         continue;
                     }
 
@@ -241,6 +354,7 @@ uint32_t add_directory(const char * const path)
                 }
 
                 free(file);
+                free(dfs_file);
 
                 if(!first_entry)
                 {
@@ -259,12 +373,32 @@ uint32_t add_directory(const char * const path)
 
 int main(int argc, char *argv[])
 {
-    if(argc != 3)
+    bool with_index = true;
+    int i = 1;
+
+    for(; i < argc && argv[i][0] == '-'; i++)
+    {
+        if(!strcmp(argv[i], "--no-index"))
+        {
+            with_index = false;
+        }
+        else
+        {
+            fprintf(stderr, "invalid flag: %s\n", argv[i]);
+            print_help(argv[0]);
+            return -1;
+        }
+    }
+
+    if(argc - i != 2)
     {
         print_help(argv[0]);
         return -1;
     }
 
+    const char *outfn = argv[i];
+    const char *indir = argv[i+1];
+
     /* Add in identifier */
     directory_entry_t *id = sector_to_memory(new_sector());
 
@@ -279,23 +413,34 @@ int main(int argc, char *argv[])
     id->next_entry = SWAPLONG(ROOT_NEXT_ENTRY);
     strcpy(id->path, ROOT_PATH);
 
-    if(!add_directory(argv[2]))
+    if(!add_directory(indir, ""))
     {
         /* Error adding directory */
-        fprintf(stderr, "Error creating filesystem: directory is empty or does not exist: %s\n", argv[2]);
+        fprintf(stderr, "Error creating filesystem: directory is empty or does not exist: %s\n", indir);
 
         kill_fs();
 
         return -1;
     }
 
+    if(with_index)
+    {
+        /* The index offset goes into the (otherwise unused) file pointer of
+         * the root sector. Notice that the root sector must be fetched again
+         * as the image might have been reallocated. */
+        uint32_t index = add_index();
+
+        id = sector_to_memory(0);
+        id->file_pointer = SWAPLONG(index);
+    }
+
     /* Write out filesystem */
-    FILE *fp = fopen(argv[1], "wb");
+    FILE *fp = fopen(outfn, "wb");
 
     if(!fp)
     {
         /* Error writing file out */
-        fprintf(stderr, "Error opening '%s' for writing.\n", argv[1]);
+        fprintf(stderr, "Error opening '%s' for writing.\n", outfn);
 
         kill_fs();
 
@@ -490,6 +490,7 @@ void exq_map_image_dither(exq_data *pExq, int width, int height,
 						  unsigned char *pIn, unsigned char *pOut, int ordered)
 {
 	int x, y, i, j, d;
+	unsigned int seed = 1;
 	exq_color p, scale, tmp;
 	exq_histogram *pHist;
 	const exq_float dither_matrix[4] = { -0.375, 0.125, 0.375, -0.125 };
@@ -503,7 +504,12 @@ void exq_map_image_dither(exq_data *pExq, int width, int height,
 			if(ordered)
 				d = (x & 1) + (y & 1) * 2;
 			else
-				d = rand() & 3;
+			{
+				// Simple LCG seeded per call, rather than rand(): it is
+				// thread-safe and makes the output deterministic.
+				seed = seed * 1103515245 + 12345;
+				d = (seed >> 16) & 3;
+			}
 			pHist = exq_find_histogram(pExq, pIn);
 			p.r = *pIn++ / 255.0f * SCALE_R;
 			p.g = *pIn++ / 255.0f * SCALE_G;
@@ -696,7 +702,8 @@ exq_float exq_sort_by_a(const exq_histogram *pHist)
 	return pHist->color.a;
 }
 
-exq_color exq_sort_dir;
+// Thread-local, as mksprite quantizes multiple images in parallel.
+__thread exq_color exq_sort_dir;
 
 exq_float exq_sort_by_dir(const exq_histogram *pHist)
 {
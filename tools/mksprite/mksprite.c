@@ -6,9 +6,12 @@
 #include <string.h>
 #include <assert.h>
 #include <sys/stat.h>
+#include <dirent.h>
 #include "../common/binout.c"
 #include "../common/binout.h"
 #include "../common/polyfill.h"
+#include "../common/assetcache.h"
+#include "../common/parallel.h"
 #include "exoquant.h"
 
 #define LODEPNG_NO_COMPILE_ANCILLARY_CHUNKS    // No need to parse PNG extra fields
@@ -142,7 +145,7 @@ void print_supported_dithers(void) {
 
 void print_args( char * name )
 {
-    fprintf(stderr, "Usage: %s [flags] <input files...>\n", name);
+    fprintf(stderr, "Usage: %s [flags] <input files or directories...>\n", name);
     fprintf(stderr, "\n");
     fprintf(stderr, "Command-line flags:\n");
     fprintf(stderr, "   -v/--verbose          Verbose output\n");
@@ -151,6 +154,9 @@ void print_args( char * name )
     fprintf(stderr, "   -D/--dither <dither>  Dithering algorithm (default: NONE)\n");
     fprintf(stderr, "   -c/--compress <level> Compress output files (default: %d)\n", DEFAULT_COMPRESSION);
     fprintf(stderr, "   -d/--debug            Dump computed images (eg: mipmaps) as PNG files in output directory\n");
+    fprintf(stderr, "   -j/--jobs <N>         Number of files to convert in parallel (default: number of CPUs)\n");
+    fprintf(stderr, "   --cache <dir>         Cache converted sprites in the specified directory, and\n");
+    fprintf(stderr, "                         skip conversion of files that did not change\n");
     fprintf(stderr, "\nSampling flags:\n");
     fprintf(stderr, "   --texparms <x,s,r,m>          Sampling parameters:\n");
     fprintf(stderr, "                                 x=translation, s=scale, r=repetitions, m=mirror\n");
@@ -163,6 +169,8 @@ void print_args( char * name )
     fprintf(stderr, "                                         <factor> is the blend factor in range 0..1 (default: 0.5)\n");
     fprintf(stderr, "   --detail-texparms <x,x,s,s,r,r,m,m>   Sampling parameters for the detail texture\n");
     fprintf(stderr, "\n");
+    fprintf(stderr, "Directories are processed recursively (only PNG files), recreating their structure in the output directory.\n");
+    fprintf(stderr, "\n");
     print_supported_formats();
     print_supported_mipmap();
     print_supported_dithers();
@@ -1359,11 +1367,142 @@ bool cli_parse_texparms(const char *opt, texparms_t *parms)
 }
 
 
+typedef struct {
+    char *infn;             // Input file
+    char *outfn;            // Output file
+} job_t;
+
+typedef struct {
+    job_t *jobs;            // List of files to convert
+    int njobs;              // Number of files to convert
+    const parms_t *pm;      // Conversion parameters
+    int compression;        // Compression level
+    const char *cachedir;   // Cache directory (or NULL)
+    bool error;             // At least one file failed
+} mksprite_t;
+
+static bool isdir(const char *path)
+{
+    struct stat st;
+    return stat(path, &st) == 0 && (st.st_mode & S_IFDIR) != 0;
+}
+
+static void add_job(mksprite_t *mk, const char *infn, const char *outdir)
+{
+    const char *basename = strrchr(infn, '/');
+    if (!basename) basename = infn; else basename += 1;
+    char* basename_noext = strdup(basename);
+    char* ext = strrchr(basename_noext, '.');
+    if (ext) *ext = '\0';
+
+    mk->jobs = realloc(mk->jobs, (mk->njobs+1) * sizeof(job_t));
+    job_t *job = &mk->jobs[mk->njobs++];
+    job->infn = strdup(infn);
+    asprintf(&job->outfn, "%s/%s.sprite", outdir, basename_noext);
+    free(basename_noext);
+}
+
+// Add all PNG files within a directory (recursively) to the list of jobs,
+// creating the matching output directories.
+static void add_dir(mksprite_t *mk, const char *indir, const char *outdir)
+{
+    if (!isdir(outdir)) {
+        #ifndef __MINGW32__
+        mkdir(outdir, 0777);
+        #else
+        mkdir(outdir);
+        #endif
+    }
+
+    DIR *d = opendir(indir);
+    if (!d) {
+        fprintf(stderr, "error opening directory: %s\n", indir);
+        mk->error = true;
+        return;
+    }
+    struct dirent *de;
+    while ((de = readdir(d))) {
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+            continue;
+        char *insub;
+        asprintf(&insub, "%s/%s", indir, de->d_name);
+        if (isdir(insub)) {
+            char *outsub;
+            asprintf(&outsub, "%s/%s", outdir, de->d_name);
+            add_dir(mk, insub, outsub);
+            free(outsub);
+        } else {
+            const char *ext = strrchr(de->d_name, '.');
+            if (ext && !strcasecmp(ext, ".png"))
+                add_job(mk, insub, outdir);
+        }
+        free(insub);
+    }
+    closedir(d);
+}
+
+// Calculate the cache key of a conversion. Returns false if any of
+// the input files cannot be read.
+static bool cache_key(mksprite_t *mk, job_t *job, uint64_t *key)
+{
+    // Hash the parameters without pointers, that are hashed by content.
+    parms_t pm = *mk->pm;
+    pm.detail.infn = NULL;
+
+    *key = assetcache_hash_str(ASSETCACHE_KEY_INIT, "mksprite " __DATE__ " " __TIME__);
+    *key = assetcache_hash(*key, &pm, sizeof(pm));
+    *key = assetcache_hash(*key, &mk->compression, sizeof(mk->compression));
+    // The output format might be detected from the input path (eg:
+    // "foo.ci8.png"), so files with the same contents can convert differently.
+    *key = assetcache_hash_str(*key, job->infn);
+    if (mk->pm->detail.infn && !assetcache_hash_file(key, mk->pm->detail.infn))
+        return false;
+    return assetcache_hash_file(key, job->infn);
+}
+
+static void convert_job(int idx, void *ctx)
+{
+    mksprite_t *mk = ctx;
+    job_t *job = &mk->jobs[idx];
+    uint64_t key = 0;
+
+    // Debug images are not cached, so always convert in that case
+    bool use_cache = mk->cachedir && !flag_debug && cache_key(mk, job, &key);
+    if (use_cache && assetcache_fetch(mk->cachedir, key, job->outfn)) {
+        if (flag_verbose)
+            fprintf(stderr, "Cached: %s -> %s\n", job->infn, job->outfn);
+        return;
+    }
+
+    if (convert(job->infn, job->outfn, mk->pm) != 0) {
+        mk->error = true;
+        return;
+    }
+
+    if (mk->compression) {
+        struct stat st_decomp = {0}, st_comp = {0};
+        stat(job->outfn, &st_decomp);
+        asset_compress(job->outfn, job->outfn, mk->compression, 0);
+        stat(job->outfn, &st_comp);
+        if (flag_verbose)
+            fprintf(stderr, "compressed: %s (%d -> %d, ratio %.1f%%)\n", job->outfn,
+            (int)st_decomp.st_size, (int)st_comp.st_size, 100.0 * (float)st_comp.st_size / (float)(st_decomp.st_size == 0 ? 1 :st_decomp.st_size));
+    }
+
+    if (use_cache)
+        assetcache_store(mk->cachedir, key, job->outfn);
+}
+
 int main(int argc, char *argv[])
 {
     char *infn = NULL, *outdir = ".", *outfn = NULL;
-    parms_t pm = {0}; int compression = -1;
+    parms_t pm; int compression = -1;
     bool at_least_one_file = false;
+    mksprite_t mk = {0};
+    int nthreads = parallel_default_threads();
+
+    // Clear also the padding, as the parameters are hashed for the cache
+    memset(&pm, 0, sizeof(pm));
 
     if (argc < 2) {
         print_args(argv[0]);
@@ -1496,6 +1635,34 @@ int main(int argc, char *argv[])
                 }
             }
 
+            /* ---------------- JOBS console argument ------------------- */
+            /* -j/--jobs <N>         Number of files to convert in parallel             */
+            else if (!strcmp(argv[i], "-j") || !strcmp(argv[i], "--jobs")) {
+                if (++i == argc) {
+                    fprintf(stderr, "missing argument for %s\n", argv[i-1]);
+                    return 1;
+                }
+                char extra;
+                if (sscanf(argv[i], "%d%c", &nthreads, &extra) != 1 || nthreads < 1) {
+                    fprintf(stderr, "invalid argument for %s: %s\n", argv[i-1], argv[i]);
+                    return 1;
+                }
+            }
+
+            /* ---------------- CACHE console argument ------------------- */
+            /* --cache <dir>         Cache converted sprites             */
+            else if (!strcmp(argv[i], "--cache")) {
+                if (++i == argc) {
+                    fprintf(stderr, "missing argument for %s\n", argv[i-1]);
+                    return 1;
+                }
+                mk.cachedir = argv[i];
+                if (!assetcache_init(mk.cachedir)) {
+                    fprintf(stderr, "cannot create cache directory: %s\n", mk.cachedir);
+                    return 1;
+                }
+            }
+
             /* ---------------- TEXTURE PARAMETERS console argument ------------------- */
             /* --texparms <x,s,r,m>          Sampling parameters             */
             /* --texparms <x,x,s,s,r,r,m,m>  Sampling parameters (different for S/T)             */
@@ -1580,32 +1747,29 @@ int main(int argc, char *argv[])
 
         at_least_one_file = true;
         infn = argv[i];
-        char *basename = strrchr(infn, '/');
-        if (!basename) basename = infn; else basename += 1;
-        char* basename_noext = strdup(basename);
-        char* ext = strrchr(basename_noext, '.');
-        if (ext) *ext = '\0';
-
-        asprintf(&outfn, "%s/%s.sprite", outdir, basename_noext);
-
-        if (convert(infn, outfn, &pm) != 0) {
-            error = true;
+        if (isdir(infn)) {
+            char *basename = strrchr(infn, '/');
+            if (!basename) basename = infn; else basename += 1;
+            asprintf(&outfn, "%s/%s", outdir, basename);
+            add_dir(&mk, infn, outfn);
+            free(outfn);
         } else {
-            if (compression == -1)
-                compression = DEFAULT_COMPRESSION;
-            if (compression) {
-                struct stat st_decomp = {0}, st_comp = {0};
-                stat(outfn, &st_decomp);
-                asset_compress(outfn, outfn, compression, 0);
-                stat(outfn, &st_comp);
-                if (flag_verbose)
-                    fprintf(stderr, "compressed: %s (%d -> %d, ratio %.1f%%)\n", outfn,
-                    (int)st_decomp.st_size, (int)st_comp.st_size, 100.0 * (float)st_comp.st_size / (float)(st_decomp.st_size == 0 ? 1 :st_decomp.st_size));
-            }
+            add_job(&mk, infn, outdir);
         }
+    }
+
+    // Convert all files
+    mk.pm = &pm;
+    mk.compression = compression == -1 ? DEFAULT_COMPRESSION : compression;
+    parallel_run(mk.njobs, nthreads, convert_job, &mk);
+    if (mk.error)
+        error = true;
 
-        free(outfn);
+    for (int i = 0; i < mk.njobs; i++) {
+        free(mk.jobs[i].infn);
+        free(mk.jobs[i].outfn);
     }
+    free(mk.jobs);
 
     if (!at_least_one_file) {
         infn = "(stdin)";
@@ -0,0 +1,472 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+// Reuse the libdragon RDP disassembler and validator. They are guarded
+// by #ifdef N64, so the host build only has the parts that work on a
+// plain buffer of commands.
+#include "../../src/rdpq/rdpq_debug.c"
+
+// Approximate cost model of the RDP, in RDP clock cycles (62.5 MHz).
+// These are ballpark figures, meant to compare display lists with each
+// other and to catch regressions, not to predict exact hardware timings.
+#define RDP_CLOCK               62500000.0
+#define CMD_FETCH_CYCLES        1       // Fetch and decode of each 64-bit command word
+#define TRI_SETUP_CYCLES        20      // Edge walker setup of a triangle
+#define TRI_SHADE_CYCLES        8       // Additional setup for shade coefficients
+#define TRI_TEX_CYCLES          8       // Additional setup for texture coefficients
+#define TRI_ZBUF_CYCLES         4       // Additional setup for Z coefficients
+#define RECT_SETUP_CYCLES       8       // Setup of a rectangle
+#define SPAN_CYCLES             4       // Per scanline overhead of the span rasterizer
+#define MEM_BYTES_PER_CYCLE     4.0     // Average RDRAM bandwidth available to the RDP for pixels
+#define FILL_BYTES_PER_CYCLE    8.0     // Fill and copy modes write 64 bits per cycle
+#define LOAD_SETUP_CYCLES       12      // Setup of a LOAD_* command
+#define LOAD_BYTES_PER_CYCLE    8.0     // TMEM loads transfer 64 bits per cycle
+#define SYNC_PIPE_CYCLES        30      // Pipeline drain
+#define SYNC_LOAD_CYCLES        30      // Wait for pending TMEM loads
+#define SYNC_TILE_CYCLES        30      // Wait for pending tile descriptor usage
+#define SYNC_FULL_CYCLES        100     // Full pipeline and memory flush
+
+bool flag_verbose = false;
+bool flag_csv = false;
+bool flag_draws = false;
+bool flag_validate = true;
+double flag_budget = 0;
+
+// Cost categories
+enum { CAT_STATE, CAT_SYNC, CAT_LOAD, CAT_DRAW, CAT_COUNT };
+static const char *cat_names[CAT_COUNT] = { "state", "sync", "load", "draw" };
+
+typedef struct {
+    double cycles[CAT_COUNT];   // Cycles spent in each category
+    uint64_t pixels;            // Pixels drawn
+    int draws;                  // Number of draw commands
+} totals_t;
+
+static struct {
+    int cycle_type;             // Cycle type from SET_OTHER_MODES (0=1cyc, 1=2cyc, 2=copy, 3=fill)
+    bool z_cmp, z_upd;          // Z buffer compare and update
+    bool image_read;            // Blender reads the framebuffer
+    int col_bytes;              // Bytes per pixel of the color image
+    int tex_size;               // Pixel size of the texture image (0=4bpp .. 3=32bpp)
+    double setup;               // Cycles spent since the last draw command
+} st;
+
+void print_args(char * name)
+{
+    fprintf(stderr, "%s -- Libdragon RDP command stream simulator\n\n", name);
+    fprintf(stderr, "This tool reads a dump of RDP commands, validates it with the rdpq validator and\n");
+    fprintf(stderr, "runs an approximate cost model of each command (fill rate for each cycle mode,\n");
+    fprintf(stderr, "TMEM loads, syncs), reporting the estimated RDP time of each frame.\n\n");
+    fprintf(stderr, "Usage: %s [flags] <dump files...>\n", name);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Command-line flags:\n");
+    fprintf(stderr, "   -v/--verbose            Disassemble each command\n");
+    fprintf(stderr, "   -d/--draws              Print the cost of each draw command\n");
+    fprintf(stderr, "   -b/--budget <us>        Fail if any frame takes longer than the budget (in microseconds)\n");
+    fprintf(stderr, "   --no-validate           Do not validate the commands\n");
+    fprintf(stderr, "   --csv                   Print the cost of each draw command in CSV format\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Input files can be captures made by rdpq_debug_capture_frame, or raw dumps\n");
+    fprintf(stderr, "of 64-bit big-endian RDP command words. Each SYNC_FULL terminates a frame.\n");
+    fprintf(stderr, "Exit code is non-zero if validation errors are found or the budget is exceeded.\n");
+    fprintf(stderr, "\n");
+}
+
+static double cycles_to_us(double cycles)
+{
+    return cycles * 1000000.0 / RDP_CLOCK;
+}
+
+static const char *draw_name(uint8_t cmd)
+{
+    switch (cmd) {
+    case 0x08: return "TRI";
+    case 0x09: return "TRI_Z";
+    case 0x0A: return "TRI_TEX";
+    case 0x0B: return "TRI_TEX_Z";
+    case 0x0C: return "TRI_SHADE";
+    case 0x0D: return "TRI_SHADE_Z";
+    case 0x0E: return "TRI_SHADE_TEX";
+    case 0x0F: return "TRI_SHADE_TEX_Z";
+    case 0x24: return "TEX_RECT";
+    case 0x25: return "TEX_RECT_FLIP";
+    case 0x36: return "FILL_RECT";
+    default:   return "???";
+    }
+}
+
+// Cost of drawing a span of the specified width in pixels
+static double span_cycles(double width, bool zbuf)
+{
+    if (width <= 0) return SPAN_CYCLES;
+
+    if (st.cycle_type >= 2) {
+        // Fill and copy modes are only limited by the memory interface
+        return SPAN_CYCLES + ceil(width * st.col_bytes / FILL_BYTES_PER_CYCLE);
+    }
+
+    double pipe = st.cycle_type == 1 ? 2.0 : 1.0;
+    double bytes = st.col_bytes;
+    if (st.image_read) bytes += st.col_bytes;
+    if (zbuf && st.z_cmp) bytes += 2;
+    if (zbuf && st.z_upd) bytes += 2;
+    double mem = bytes / MEM_BYTES_PER_CYCLE;
+    return SPAN_CYCLES + width * (pipe > mem ? pipe : mem);
+}
+
+// Walk the edges of a triangle one scanline at a time
+static double tri_cycles(uint64_t *buf, uint64_t *pixels)
+{
+    uint8_t cmd = CMD(buf[0]);
+    double yl = SBITS(buf[0], 32, 45) / 4.0;
+    double ym = SBITS(buf[0], 16, 29) / 4.0;
+    double yh = SBITS(buf[0],  0, 13) / 4.0;
+    double xl = (int32_t)BITS(buf[1], 32, 63) / 65536.0, dxl = (int32_t)BITS(buf[1], 0, 31) / 65536.0;
+    double xh = (int32_t)BITS(buf[2], 32, 63) / 65536.0, dxh = (int32_t)BITS(buf[2], 0, 31) / 65536.0;
+    double xm = (int32_t)BITS(buf[3], 32, 63) / 65536.0, dxm = (int32_t)BITS(buf[3], 0, 31) / 65536.0;
+    bool zbuf = cmd & 1;
+
+    double cycles = TRI_SETUP_CYCLES;
+    if (cmd & 4) cycles += TRI_SHADE_CYCLES;
+    if (cmd & 2) cycles += TRI_TEX_CYCLES;
+    if (zbuf)    cycles += TRI_ZBUF_CYCLES;
+
+    for (double y = floor(yh); y < yl; y += 1.0) {
+        if (y + 1.0 <= yh) continue;
+        double major = xh + dxh * (y - yh);
+        double minor = y < ym ? xm + dxm * (y - yh) : xl + dxl * (y - ym);
+        double width = fabs(major - minor);
+        *pixels += (uint64_t)width;
+        cycles += span_cycles(width, zbuf);
+    }
+    return cycles;
+}
+
+static double rect_cycles(uint64_t *buf, uint64_t *pixels)
+{
+    double x0 = BITS(buf[0], 12, 23) / 4.0, y0 = BITS(buf[0],  0, 11) / 4.0;
+    double x1 = BITS(buf[0], 44, 55) / 4.0, y1 = BITS(buf[0], 32, 43) / 4.0;
+    // In fill and copy modes, the bottom-right coordinates are inclusive
+    if (st.cycle_type >= 2) { x1 += 1; y1 += 1; }
+    double w = floor(x1) - floor(x0), h = floor(y1) - floor(y0);
+    if (w <= 0 || h <= 0) return RECT_SETUP_CYCLES;
+
+    *pixels += (uint64_t)(w * h);
+    bool zbuf = CMD(buf[0]) != 0x36 || st.cycle_type < 2;
+    return RECT_SETUP_CYCLES + h * span_cycles(w, zbuf);
+}
+
+static double load_cycles(uint64_t *buf)
+{
+    int bpp = 4 << st.tex_size;
+    switch (CMD(buf[0])) {
+    case 0x33: { // LOAD_BLOCK
+        int texels = BITS(buf[0], 12, 23) - BITS(buf[0], 44, 55) + 1;
+        return LOAD_SETUP_CYCLES + ceil(texels * bpp / 8 / LOAD_BYTES_PER_CYCLE);
+    }
+    case 0x34: { // LOAD_TILE
+        int w = (BITS(buf[0], 12, 23) >> 2) - (BITS(buf[0], 44, 55) >> 2) + 1;
+        int h = (BITS(buf[0],  0, 11) >> 2) - (BITS(buf[0], 32, 43) >> 2) + 1;
+        if (w <= 0 || h <= 0) return LOAD_SETUP_CYCLES;
+        return LOAD_SETUP_CYCLES + h * (SPAN_CYCLES + ceil(w * bpp / 8 / LOAD_BYTES_PER_CYCLE));
+    }
+    case 0x30: { // LOAD_TLUT: one palette entry per cycle
+        int n = (BITS(buf[0], 12, 23) >> 2) - (BITS(buf[0], 44, 55) >> 2) + 1;
+        return LOAD_SETUP_CYCLES + (n > 0 ? n : 0);
+    }
+    }
+    return 0;
+}
+
+static void print_draw(int idx, uint64_t *buf, uint64_t pixels, double setup, double draw)
+{
+    static const char *cycle_names[4] = { "1cyc", "2cyc", "copy", "fill" };
+    uint8_t cmd = CMD(buf[0]);
+    if (flag_csv) {
+        printf("%d,%s,%s,%llu,%.0f,%.0f\n", idx, draw_name(cmd), cycle_names[st.cycle_type],
+            (unsigned long long)pixels, setup, draw);
+    } else {
+        printf("  %6d  %-16s %-5s %9llu %9.0f %9.0f %9.2f\n", idx, draw_name(cmd), cycle_names[st.cycle_type],
+            (unsigned long long)pixels, setup, draw, cycles_to_us(setup + draw));
+    }
+}
+
+static void print_totals(const char *title, totals_t *t)
+{
+    double total = 0;
+    for (int i = 0; i < CAT_COUNT; i++) total += t->cycles[i];
+    printf("%s: %.0f cycles (%.2f us), %d draws, %llu pixels\n", title,
+        total, cycles_to_us(total), t->draws, (unsigned long long)t->pixels);
+    for (int i = 0; i < CAT_COUNT; i++)
+        printf("    %-6s %10.0f cycles %9.2f us %5.1f%%\n", cat_names[i],
+            t->cycles[i], cycles_to_us(t->cycles[i]), total ? t->cycles[i] * 100.0 / total : 0);
+}
+
+static double totals_us(totals_t *t)
+{
+    double total = 0;
+    for (int i = 0; i < CAT_COUNT; i++) total += t->cycles[i];
+    return cycles_to_us(total);
+}
+
+static uint32_t read_be32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint64_t read_be64(const uint8_t *p)
+{
+    return ((uint64_t)read_be32(p) << 32) | read_be32(p+4);
+}
+
+// Extract the commands from a capture made by rdpq_debug_capture_frame
+static int parse_capture(const char *fn, const uint8_t *raw, long size, uint64_t *buf)
+{
+    uint32_t flags = read_be32(raw + 8);
+    if (read_be32(raw + 4) != RDPQ_CAPTURE_VERSION) {
+        fprintf(stderr, "error: %s: unsupported capture version %u\n", fn, read_be32(raw + 4));
+        return -1;
+    }
+    if (flags & RDPQ_CAPTURE_FLAG_TRUNCATED)
+        fprintf(stderr, "warning: %s: capture is truncated\n", fn);
+    if (flags & RDPQ_CAPTURE_FLAG_MEM_MISSING)
+        fprintf(stderr, "warning: %s: capture is missing some memory blocks\n", fn);
+
+    int nwords = 0, nmem = 0;
+    long membytes = 0;
+    for (long pos = 16; pos + 8 <= size; ) {
+        uint32_t type = read_be32(raw + pos);
+        uint32_t len = read_be32(raw + pos + 4);
+        pos += 8;
+        if (pos + len > size) {
+            fprintf(stderr, "warning: %s: truncated chunk at offset %ld\n", fn, pos - 8);
+            break;
+        }
+        switch (type) {
+        case RDPQ_CAPTURE_CHUNK_CMDS:
+            for (uint32_t i = 0; i + 8 <= len; i += 8)
+                buf[nwords++] = read_be64(raw + pos + i);
+            break;
+        case RDPQ_CAPTURE_CHUNK_MEM:
+            nmem++;
+            membytes += read_be32(raw + pos + 4);
+            break;
+        default:
+            fprintf(stderr, "warning: %s: unknown chunk type %u\n", fn, type);
+            break;
+        }
+        pos += len;
+    }
+    if (!flag_csv)
+        printf("%s: capture with %d command words, %d memory blocks (%ld bytes)\n", fn, nwords, nmem, membytes);
+    return nwords;
+}
+
+// Load a dump, converting it to host endianness. Both raw dumps and
+// captures are supported.
+static uint64_t *load_dump(const char *fn, int *nwords)
+{
+    FILE *f = fopen(fn, "rb");
+    if (!f) {
+        fprintf(stderr, "error: cannot open file: %s\n", fn);
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    uint8_t *raw = malloc(size + 8);
+    if (fread(raw, 1, size, f) != size) {
+        fprintf(stderr, "error: cannot read file: %s\n", fn);
+        fclose(f);
+        free(raw);
+        return NULL;
+    }
+    fclose(f);
+
+    uint64_t *buf = malloc(size + 8);
+    if (size >= 16 && read_be32(raw) == RDPQ_CAPTURE_MAGIC) {
+        *nwords = parse_capture(fn, raw, size, buf);
+        if (*nwords < 0) {
+            free(raw);
+            free(buf);
+            return NULL;
+        }
+    } else {
+        if (size % 8)
+            fprintf(stderr, "warning: %s: size is not a multiple of 8, ignoring the last %ld bytes\n", fn, size % 8);
+        *nwords = size / 8;
+        for (int i = 0; i < *nwords; i++)
+            buf[i] = read_be64(raw + i*8);
+    }
+    free(raw);
+    return buf;
+}
+
+// Simulate a dump. Returns false if it failed validation or exceeded the budget.
+static bool simulate(const char *fn)
+{
+    int nwords;
+    uint64_t *buf = load_dump(fn, &nwords);
+    if (!buf) return false;
+
+    memset(&st, 0, sizeof(st));
+    st.col_bytes = 2;
+    totals_t frame = {0}, all = {0};
+    int nframes = 0, errs = 0, warns = 0, draw_idx = 0;
+    bool ok = true;
+
+    if (flag_csv) printf("draw,command,mode,pixels,setup_cycles,draw_cycles\n");
+    else printf("%s:\n", fn);
+    if (flag_draws && !flag_csv)
+        printf("  %6s  %-16s %-5s %9s %9s %9s %9s\n", "draw", "command", "mode", "pixels", "setup", "cycles", "us");
+
+    for (int i = 0; i < nwords; ) {
+        uint64_t *cmdbuf = &buf[i];
+        int sz = rdpq_debug_disasm_size(cmdbuf);
+        if (i + sz > nwords) {
+            fprintf(stderr, "warning: %s: truncated command at word %d\n", fn, i);
+            break;
+        }
+        i += sz;
+
+        if (flag_verbose) rdpq_debug_disasm(cmdbuf, stdout);
+        if (flag_validate) {
+            int e = 0, w = 0;
+            rdpq_validate(cmdbuf, 0, &e, &w);
+            errs += e; warns += w;
+        }
+
+        uint8_t cmd = CMD(cmdbuf[0]);
+        int cat = CAT_STATE;
+        double cycles = sz * CMD_FETCH_CYCLES;
+        uint64_t pixels = 0;
+
+        switch (cmd) {
+        case 0x08 ... 0x0F:
+            cat = CAT_DRAW;
+            cycles += tri_cycles(cmdbuf, &pixels);
+            break;
+        case 0x24: case 0x25: case 0x36:
+            cat = CAT_DRAW;
+            cycles += rect_cycles(cmdbuf, &pixels);
+            break;
+        case 0x30: case 0x33: case 0x34:
+            cat = CAT_LOAD;
+            cycles += load_cycles(cmdbuf);
+            break;
+        case 0x26: cat = CAT_SYNC; cycles += SYNC_LOAD_CYCLES; break;
+        case 0x27: cat = CAT_SYNC; cycles += SYNC_PIPE_CYCLES; break;
+        case 0x28: cat = CAT_SYNC; cycles += SYNC_TILE_CYCLES; break;
+        case 0x29: cat = CAT_SYNC; cycles += SYNC_FULL_CYCLES; break;
+        case 0x2F: // SET_OTHER_MODES
+            st.cycle_type = BITS(cmdbuf[0], 52, 53);
+            st.image_read = BIT(cmdbuf[0], 6);
+            st.z_cmp = BIT(cmdbuf[0], 4);
+            st.z_upd = BIT(cmdbuf[0], 5);
+            break;
+        case 0x3F: // SET_COLOR_IMAGE
+            st.col_bytes = (4 << BITS(cmdbuf[0], 51, 52)) / 8;
+            if (st.col_bytes == 0) st.col_bytes = 1;
+            break;
+        case 0x3D: // SET_TEXTURE_IMAGE
+            st.tex_size = BITS(cmdbuf[0], 51, 52);
+            break;
+        }
+
+        frame.cycles[cat] += cycles;
+        if (cat == CAT_DRAW) {
+            if (flag_draws || flag_csv)
+                print_draw(draw_idx, cmdbuf, pixels, st.setup, cycles);
+            frame.pixels += pixels;
+            frame.draws++;
+            draw_idx++;
+            st.setup = 0;
+        } else {
+            st.setup += cycles;
+        }
+
+        if (cmd == 0x29 || i == nwords) {
+            // End of frame. Skip the empty tail after the last SYNC_FULL.
+            if (cmd != 0x29 && frame.draws == 0) break;
+            char title[64];
+            snprintf(title, sizeof(title), "  frame %d", nframes);
+            if (!flag_csv) print_totals(title, &frame);
+            if (flag_budget && totals_us(&frame) > flag_budget) {
+                fprintf(stderr, "%s: frame %d exceeds the budget: %.2f us > %.2f us\n",
+                    fn, nframes, totals_us(&frame), flag_budget);
+                ok = false;
+            }
+            for (int c = 0; c < CAT_COUNT; c++) all.cycles[c] += frame.cycles[c];
+            all.pixels += frame.pixels;
+            all.draws += frame.draws;
+            memset(&frame, 0, sizeof(frame));
+            nframes++;
+        }
+    }
+
+    if (!flag_csv) {
+        if (nframes > 1) print_totals("  total", &all);
+        if (flag_validate)
+            printf("  validation: %d errors, %d warnings\n", errs, warns);
+    }
+    if (errs) ok = false;
+    free(buf);
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        print_args(argv[0]);
+        return 1;
+    }
+
+    bool ok = true;
+    int nfiles = 0;
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] == '-') {
+            if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
+                print_args(argv[0]);
+                return 0;
+            } else if (!strcmp(argv[i], "-v") || !strcmp(argv[i], "--verbose")) {
+                flag_verbose = true;
+                __rdpq_debug_log_flags |= RDPQ_LOG_FLAG_SHOWTRIS;
+            } else if (!strcmp(argv[i], "-d") || !strcmp(argv[i], "--draws")) {
+                flag_draws = true;
+            } else if (!strcmp(argv[i], "--csv")) {
+                flag_csv = true;
+            } else if (!strcmp(argv[i], "--no-validate")) {
+                flag_validate = false;
+            } else if (!strcmp(argv[i], "-b") || !strcmp(argv[i], "--budget")) {
+                if (++i == argc) {
+                    fprintf(stderr, "missing argument for %s\n", argv[i-1]);
+                    return 1;
+                }
+                char extra;
+                if (sscanf(argv[i], "%lf%c", &flag_budget, &extra) != 1 || flag_budget <= 0) {
+                    fprintf(stderr, "invalid budget: %s\n", argv[i]);
+                    return 1;
+                }
+            } else {
+                fprintf(stderr, "invalid flag: %s\n", argv[i]);
+                return 1;
+            }
+            continue;
+        }
+
+        ok = simulate(argv[i]) && ok;
+        nfiles++;
+    }
+
+    if (!nfiles) {
+        fprintf(stderr, "no input files\n");
+        return 1;
+    }
+    return ok ? 0 : 1;
+}